@@ -0,0 +1,83 @@
+#pragma once
+
+#ifndef BYTE_IO_H_INCLUDED
+#define BYTE_IO_H_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+
+// Little endian fields
+// -------------------------------------------------------------------------------------------
+// A file reads the same on any host: little endian ones copy the bytes as they are, others assemble them one by one
+// (the byte loops are not reliably merged into single loads and stores, the flight recorder writes these on every substep)
+// The put functions return the position after the field, the get functions advance p past it
+#if defined(_WIN32) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+	#define BYTE_IO_LITTLE_ENDIAN 1
+#else
+	#define BYTE_IO_LITTLE_ENDIAN 0
+#endif
+
+namespace byte_io {
+	inline unsigned char* putU32(unsigned char* p, std::uint32_t v) {
+#if BYTE_IO_LITTLE_ENDIAN
+		std::memcpy(p, &v, sizeof(v));
+#else
+		for (int i = 0; i < 4; i++) {
+			p[i] = static_cast<unsigned char>(v >> (8 * i));
+		}
+#endif
+		return p + 4;
+	}
+
+	inline unsigned char* putU64(unsigned char* p, std::uint64_t v) {
+#if BYTE_IO_LITTLE_ENDIAN
+		std::memcpy(p, &v, sizeof(v));
+#else
+		for (int i = 0; i < 8; i++) {
+			p[i] = static_cast<unsigned char>(v >> (8 * i));
+		}
+#endif
+		return p + 8;
+	}
+
+	inline unsigned char* putF64(unsigned char* p, double v) {
+		std::uint64_t bits;
+		std::memcpy(&bits, &v, sizeof(bits));
+		return putU64(p, bits);
+	}
+
+	inline std::uint32_t getU32(const unsigned char*& p) {
+		std::uint32_t v = 0;
+#if BYTE_IO_LITTLE_ENDIAN
+		std::memcpy(&v, p, sizeof(v));
+#else
+		for (int i = 0; i < 4; i++) {
+			v |= static_cast<std::uint32_t>(p[i]) << (8 * i);
+		}
+#endif
+		p += 4;
+		return v;
+	}
+
+	inline std::uint64_t getU64(const unsigned char*& p) {
+		std::uint64_t v = 0;
+#if BYTE_IO_LITTLE_ENDIAN
+		std::memcpy(&v, p, sizeof(v));
+#else
+		for (int i = 0; i < 8; i++) {
+			v |= static_cast<std::uint64_t>(p[i]) << (8 * i);
+		}
+#endif
+		p += 8;
+		return v;
+	}
+
+	inline double getF64(const unsigned char*& p) {
+		const std::uint64_t bits = getU64(p);
+		double v;
+		std::memcpy(&v, &bits, sizeof(v));
+		return v;
+	}
+}
+
+#endif
@@ -1,6 +1,5 @@
 #ifndef CAMERA_CLASS_H
 #define CAMERA_CLASS_H
-#define M_PI        3.14159265358979323846264338327950288   /* pi */
 
 #include <glm/glm.hpp>
 #include <imgui/imgui.h>
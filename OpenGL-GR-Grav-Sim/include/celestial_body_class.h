@@ -1,10 +1,9 @@
 #ifndef celestial_body_class_H
 #define celestial_body_class_H
-#define M_PI        3.14159265358979323846264338327950288   /* pi */
 
 #include <glm/glm.hpp>
-#include <iostream>
-#include <iomanip>
+#include "constants.h"
+#include "logger.h"
 #include <cmath>
 
 using dvec3 = glm::dvec3;
@@ -18,7 +17,7 @@ private:
 
     double calcSphereRadius(double M) {
         if (M > 3.003e-6) {
-            return (50 * std::cbrt((3 * (M - 3.003 * 10e-6)) / (4 * M_PI * 9247304)) + 0.05);
+            return (50 * std::cbrt((3 * (M - 3.003 * 10e-6)) / (4 * PI * 9247304)) + 0.05);
         }
         else {
             return 0.05;
@@ -51,10 +50,10 @@ public:
 
     // Debug
     void print() const {
-        std::cout << std::setprecision(20) << "pos = " << pos.x << " " << pos.y << " " << pos.z << std::endl;
-        std::cout << std::setprecision(20) << "vel = " << vel.x << " " << vel.y << " " << vel.z << std::endl;
-        std::cout << std::setprecision(20) << "mass = " << mass << std::endl;
-        std::cout << std::setprecision(20) << "radius = " << radius << std::endl;
+        logger::debug(log_category::general, "pos = {} {} {}", pos.x, pos.y, pos.z);
+        logger::debug(log_category::general, "vel = {} {} {}", vel.x, vel.y, vel.z);
+        logger::debug(log_category::general, "mass = {}", mass);
+        logger::debug(log_category::general, "radius = {}", radius);
     }
 };
 
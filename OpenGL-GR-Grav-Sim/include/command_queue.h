@@ -0,0 +1,174 @@
+#pragma once
+
+#ifndef COMMAND_QUEUE_H_INCLUDED
+#define COMMAND_QUEUE_H_INCLUDED
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+// Bounded multi producer / single consumer queue
+// -------------------------------------------------------------------------------------------
+// Every cell carries a sequence number telling producers and the consumer whose turn it is, so pushing is a single CAS on the tail and popping needs no atomic read-modify-write at all
+template <typename T, size_t Capacity>
+class mpsc_queue {
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "mpsc_queue capacity must be a power of two");
+
+public:
+	mpsc_queue() {
+		for (size_t i = 0; i < Capacity; i++) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	bool try_push(const T& value) { // Any thread, false if the queue is full
+		size_t pos = tail.load(std::memory_order_relaxed);
+		for (;;) {
+			cell& c = cells[pos & mask];
+			const size_t seq = c.sequence.load(std::memory_order_acquire);
+			const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+
+			if (diff == 0) { // cell is free for this position, claim it
+				if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					c.value = value;
+					c.sequence.store(pos + 1, std::memory_order_release); // hands the cell to the consumer
+					return true;
+				}
+			}
+			else if (diff < 0) { // the consumer has not freed this cell yet
+				return false;
+			}
+			else { // another producer claimed it first
+				pos = tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool try_pop(T& out) { // Consumer thread only, false if the queue is empty
+		cell& c = cells[head & mask];
+		if (c.sequence.load(std::memory_order_acquire) != head + 1) {
+			return false;
+		}
+		out = c.value;
+		c.sequence.store(head + Capacity, std::memory_order_release); // free for the producer one lap later
+		head++;
+		return true;
+	}
+
+	bool empty() const { // Consumer thread only
+		return cells[head & mask].sequence.load(std::memory_order_acquire) != head + 1;
+	}
+
+private:
+	static constexpr size_t mask = Capacity - 1;
+
+	struct cell {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	cell cells[Capacity];
+
+	alignas(64) std::atomic<size_t> tail{ 0 }; // producers
+	alignas(64) size_t head = 0; // consumer
+};
+
+// Simulation Commands
+// -------------------------------------------------------------------------------------------
+enum class command_type {
+	SetState, // replaces the whole state
+	SetMass, // replaces the mass of one body
+	Undo,
+	Redo,
+	SaveScenario, // stores the current edit in the scenario store under a name
+	SaveSnapshot, // writes a restart snapshot of the current state
+	LoadSnapshot, // replaces the state and integrator settings with a restart snapshot
+	Pause,
+	SetSpeed
+};
+
+constexpr size_t command_name_size = 64; // SaveScenario's name and tags, with their terminators, longer ones are cut short
+constexpr size_t command_tags_size = 128;
+
+struct sim_command { // An edit from the GUI, applied by the physics thread between two steps, plain data so queueing it never allocates
+	command_type type = command_type::Pause;
+	std::uint64_t ticket = 0; // order it was sent in, set by command_queue::push
+
+	dmat43 y{ 0.0 }; // SetState
+	double m1 = 0.0, m2 = 0.0; // SetState
+	int body = 1; // SetMass, 1 or 2
+	double mass = 0.0; // SetMass
+	char name[command_name_size] = {}; // SaveScenario
+	char tags[command_tags_size] = {};
+	double speed = 1.0; // SetSpeed
+	bool flag = false; // SetState: checkpoint the current state first, Undo: revert to the current edit rather than stepping back, Pause: paused or not
+
+	static sim_command set_state(const dmat43& y, double m1, double m2, bool checkpoint) {
+		sim_command cmd; cmd.type = command_type::SetState; cmd.y = y; cmd.m1 = m1; cmd.m2 = m2; cmd.flag = checkpoint; return cmd;
+	}
+	static sim_command set_mass(int body, double mass) {
+		sim_command cmd; cmd.type = command_type::SetMass; cmd.body = body; cmd.mass = mass; return cmd;
+	}
+	static sim_command undo(bool revert) {
+		sim_command cmd; cmd.type = command_type::Undo; cmd.flag = revert; return cmd;
+	}
+	static sim_command redo() {
+		sim_command cmd; cmd.type = command_type::Redo; return cmd;
+	}
+	static sim_command save_scenario(const char* name, const char* tags) {
+		sim_command cmd; cmd.type = command_type::SaveScenario; copyText(cmd.name, name); copyText(cmd.tags, tags); return cmd;
+	}
+	static sim_command save_snapshot() {
+		sim_command cmd; cmd.type = command_type::SaveSnapshot; return cmd;
+	}
+	static sim_command load_snapshot() {
+		sim_command cmd; cmd.type = command_type::LoadSnapshot; return cmd;
+	}
+	static sim_command set_pause(bool paused) {
+		sim_command cmd; cmd.type = command_type::Pause; cmd.flag = paused; return cmd;
+	}
+	static sim_command set_speed(double speed) {
+		sim_command cmd; cmd.type = command_type::SetSpeed; cmd.speed = speed; return cmd;
+	}
+
+private:
+	template <size_t N>
+	static void copyText(char (&out)[N], const char* text) {
+		const size_t length = text ? strnlen(text, N - 1) : 0;
+		std::memcpy(out, text ? text : "", length);
+		out[length] = '\0';
+	}
+};
+
+class command_queue {
+public:
+	// Any thread, returns the ticket given to the command, or 0 if the queue is full and the command was dropped (counted by dropped)
+	// The queue only fills up if the physics thread is stuck in a very long step, and a sender (the GUI) must never stall on that
+	std::uint64_t push(sim_command cmd) {
+		cmd.ticket = next_ticket.fetch_add(1, std::memory_order_relaxed) + 1;
+		if (!queue.try_push(cmd)) {
+			dropped_commands.fetch_add(1, std::memory_order_relaxed);
+			return 0;
+		}
+		return cmd.ticket;
+	}
+
+	bool pop(sim_command& out) { return queue.try_pop(out); } // Physics thread only
+
+	bool empty() const { return queue.empty(); } // Physics thread only
+
+	std::uint64_t dropped() const { return dropped_commands.load(std::memory_order_relaxed); }
+
+private:
+	mpsc_queue<sim_command, 256> queue;
+	std::atomic<std::uint64_t> next_ticket{ 0 };
+	std::atomic<std::uint64_t> dropped_commands{ 0 };
+};
+
+#endif
@@ -0,0 +1,17 @@
+#pragma once
+
+#ifndef CONSTANTS_H_INCLUDED
+#define CONSTANTS_H_INCLUDED
+
+// Mathematical Constants
+// -----------------------------------------------------------------------------------------
+// Defined here rather than through M_PI, which is not standard C++ and needs _USE_MATH_DEFINES (or a redefinition) on MSVC
+constexpr double PI = 3.14159265358979323846;
+constexpr float PI_F = static_cast<float>(PI); // for the float geometry in the renderer
+
+// Physical Constants
+// -----------------------------------------------------------------------------------------
+constexpr double G = 4.0 * PI * PI; // Newtonian Gravitational Constant in AU^3 / (Msun * yr^2)
+constexpr double c = 63241.0771; // Speed of light in AU / yr
+
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+#ifndef CRC32_H_INCLUDED
+#define CRC32_H_INCLUDED
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+// CRC-32 (IEEE, reflected 0xEDB88320), the same checksum as zlib and PNG so files can be checked with standard tools
+// -------------------------------------------------------------------------------------------
+// Slicing by 8: table[k][b] is the CRC of byte b followed by k zero bytes, so eight bytes take eight independent lookups instead of a chain of eight
+namespace crc32_detail {
+	using tables = std::array<std::array<std::uint32_t, 256>, 8>;
+
+	constexpr tables makeTables() {
+		tables t{};
+		for (std::uint32_t i = 0; i < 256; i++) {
+			std::uint32_t c = i;
+			for (int k = 0; k < 8; k++) {
+				c = (c & 1u) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+			}
+			t[0][i] = c;
+		}
+		for (std::uint32_t i = 0; i < 256; i++) {
+			for (int k = 1; k < 8; k++) {
+				t[k][i] = t[0][t[k - 1][i] & 0xFFu] ^ (t[k - 1][i] >> 8);
+			}
+		}
+		return t;
+	}
+
+	inline constexpr tables table = makeTables(); // built at compile time
+}
+
+// crc is the running value, so a buffer can be checksummed in pieces: crc32(b, nb, crc32(a, na))
+inline std::uint32_t crc32(const void* data, size_t size, std::uint32_t crc = 0) {
+	using crc32_detail::table;
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	crc = ~crc;
+	for (; size >= 8; size -= 8, p += 8) {
+		const std::uint32_t lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<std::uint32_t>(p[3]) << 24));
+		crc = table[7][lo & 0xFFu] ^ table[6][(lo >> 8) & 0xFFu] ^ table[5][(lo >> 16) & 0xFFu] ^ table[4][lo >> 24]
+			^ table[3][p[4]] ^ table[2][p[5]] ^ table[1][p[6]] ^ table[0][p[7]];
+	}
+	for (; size > 0; size--, p++) {
+		crc = table[0][(crc ^ *p) & 0xFFu] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+#endif
@@ -0,0 +1,231 @@
+#pragma once
+
+#ifndef EDIT_HISTORY_H_INCLUDED
+#define EDIT_HISTORY_H_INCLUDED
+
+#include <glm/glm.hpp>
+
+#include "logger.h"
+
+#include <initializer_list>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+struct state { // Snapshot of the program that the user can return to
+	dmat43 vectors;
+	double m1;
+	double m2;
+
+public:
+	// Constructors
+	state(dmat43 con_y, double con_mass1, double con_mass2) // dmat43, double, double
+		: vectors(con_y), m1(con_mass1), m2(con_mass2) { }
+	state(dvec3 con_pos1, dvec3 con_vel1, dvec3 con_pos2, dvec3 con_vel2, double con_mass1, double con_mass2) // dvec3, dvec3, dvec3, dvec3, double, double
+		: m1(con_mass1), m2(con_mass2) {
+		vectors[0] = con_pos1;
+		vectors[1] = con_vel1;
+		vectors[2] = con_pos2;
+		vectors[3] = con_vel2;
+	}
+
+	void print() const {
+		// Mass printing
+		logger::debug(log_category::history, "m1 = {} m2 = {}", m1, m2);
+		// Matrix printing
+		for (int i = 0; i <= 3; i++) {
+			logger::debug(log_category::history, "y[{}] = {} {} {}", i, vectors[i][0], vectors[i][1], vectors[i][2]);
+		}
+	}
+};
+
+struct Node {
+	state value; // Snapshot of the program that this node represents
+
+	struct Node* next; // Pointer indicating to the next node in the dustack // If there is no next node it is set to nullptr
+
+	Node(state val, struct Node* ptr) // Constructor
+		: value(val), next(ptr) {}
+};
+
+struct dustack { // A dual stack mimicks the operations of flipping between two stacks with one stack evaporating as soon as new data is added to the other
+private:
+	Node* front = nullptr; // points to the top of the fallback list
+	Node* middle = nullptr; // points to the currently accessed data
+	Node* back = nullptr; // points to the top node of the constant list
+	int sizeNum = 0; // current size of the entire strucuture
+
+public:
+	dustack() = default;
+	dustack(const dustack&) = delete;
+	dustack& operator=(const dustack&) = delete;
+	~dustack() { // Frees both lists, so every simulation only ever holds its own 20 states
+		for (Node* list : { front, middle, back }) {
+			while (list) {
+				Node* next = list->next;
+				delete list;
+				list = next;
+			}
+		}
+	}
+
+	int size() const { return sizeNum; }
+
+	void push(state val, bool output = false) {
+		// Creating the newNode
+		Node* newNode = new Node(val, nullptr);
+
+		if (sizeNum == 0) { // the simplest scenario // the list is empty/being pushed to for the first time
+			middle = newNode;
+			sizeNum = 1;
+			if (output) {
+				logger::debug(log_category::history, "[1] {}", newNode);
+			}
+			return;
+		}
+
+		middle->next = back; // Place the previous state at the top of the constant list
+		back = middle; // Move the back pointer to the new top of the constant list
+
+		if (front) { // if there is a fallback list, it deletes each fallback node and removes the size of the fallback list from the sizeNum
+			Node* cull = front;
+			front = nullptr; // Sets the front pointer to null
+			while (cull) {
+				Node* next = cull->next;
+				delete cull;
+				sizeNum--;
+				cull = next;
+			}
+		}
+
+		middle = newNode; // Adds the new node
+
+		if (output) {
+			logger::debug(log_category::history, "[{}] {}", sizeNum + 1, newNode);
+		}
+		sizeNum++; // Increases the size
+
+		if (sizeNum > 20) { // In case of error removes each extra node over the maximum
+			Node* run = back;
+			for (int i = 0; i < 18; i++) { // runs to the end of the list
+				run = run->next;
+			}
+			Node* cull = run->next;
+			run->next = nullptr;
+			while (sizeNum > 20) { // deletes any overflow nodes
+				Node* next = cull->next;
+				delete cull;
+				sizeNum--;
+				cull = next;
+			}
+		}
+	}
+
+	bool undo() {
+		if (back) {
+			// Place middle node into fallback list
+			middle->next = front;
+			front = middle;
+
+			// Move top of constant stack into middle
+			middle = back;
+			back = back->next;
+			middle->next = nullptr;
+			return true;
+		}
+		else {
+			return false;
+		}
+	}
+
+	bool redo() {
+		if (front) {
+			// Move middle node into constant list
+			middle->next = back;
+			back = middle;
+
+			// Recall top of fallback list into the middle
+			middle = front;
+			front = front->next;
+			middle->next = nullptr;
+			return true;
+		}
+		else {
+			return false;
+		}
+	}
+
+	state read() const { return middle->value; }
+
+	void debug(bool flag) {
+		if (flag) {
+			// Middle
+			logger::debug(log_category::history, "[MIDDLE] printed {}", middle);
+			// Back
+			logger::debug(log_category::history, "[BACK] printed {}", back);
+			// Front
+			logger::debug(log_category::history, "[FRONT] printed {}", front);
+
+			if (sizeNum != 1) {
+				// Constant
+				if (back) {
+					logger::debug(log_category::history, "[CONSTANT]");
+					Node* next = back;
+					while (next) {
+						logger::debug(log_category::history, "[CONSTANT STATE] printed {}", next);
+
+						next = next->next;
+					}
+
+				}
+
+				// Fallback
+				if (front) {
+					logger::debug(log_category::history, "[FALLBACK]");
+					Node* next = front;
+					while (next) {
+						logger::debug(log_category::history, "[FALLBACK STATE] printed {}", next);
+
+						next = next->next;
+					}
+				}
+			}
+		}
+		else {
+			// Middle
+			state crt = middle->value;
+			logger::debug(log_category::history, "[MIDDLE]");
+			crt.print();
+
+			if (sizeNum != 1) {
+				// Constant
+				if (back) {
+					logger::debug(log_category::history, "[CONSTANT]");
+					Node* next = back;
+					while (next) {
+						state debug = next->value;
+
+						debug.print();
+
+						next = next->next;
+					}
+				}
+
+				// Fallback
+				if (front) {
+					logger::debug(log_category::history, "[FALLBACK]");
+					Node* next = front;
+					while (next) {
+						state debug = next->value;
+
+						debug.print();
+
+						next = next->next;
+					}
+				}
+			}
+		}
+	}
+};
+
+#endif
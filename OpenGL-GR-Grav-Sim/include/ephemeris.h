@@ -0,0 +1,125 @@
+#pragma once
+
+#ifndef EPHEMERIS_H_INCLUDED
+#define EPHEMERIS_H_INCLUDED
+
+#include <glm/glm.hpp>
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+// Chebyshev ephemerides
+// -------------------------------------------------------------------------------------------
+// Both bodies' positions as piecewise Chebyshev series, the way the JPL ephemerides store the planets
+// Segments adapt to the orbit (short through pericentre, long elsewhere) and each one holds its series within the stated error
+// Velocities are the series' derivatives, so they are continuous with the positions and cost nothing extra to store
+//
+//   header    96 bytes: magic "PNEPHEM\n", u32 version, u32 coefficients per component, u32 segments, u32 buckets,
+//             f64 start, f64 end, f64 bucket width, f64 tolerance, f64 largest error of the fit, f64 m1, f64 m2,
+//             f64 1.0 (byte order check), u32 CRC-32 of everything after the header, 4 padding
+//   segments  f64 centre, f64 half width per segment
+//   coeffs    per segment, coefficient k of all six components (x1 y1 z1 x2 y2 z2) then k + 1 (version 1 files padded each k to eight)
+//   buckets   u32 first segment of each bucket, padded to 8 bytes
+//
+// Everything is 8 byte aligned and little endian, so the file is used straight from the mapping
+// The buckets split the span evenly, half the shortest segment wide, so a lookup is an index computation and at most a step forward
+// (past four buckets a segment or 2^20 in all they are wider and the lookup bisects the few segments one covers)
+
+constexpr std::uint32_t ephemeris_version = 2;
+constexpr int ephemeris_components = 6; // both positions, stored without padding, the evaluation loops have this fixed length
+
+struct ephemeris_options {
+	double tolerance = 1e-8; // largest position error allowed (AU), against the integrator's dense output
+	int coefficients = 40; // per component and segment (degree 39), a longer series spans more of the orbit for fewer bytes per year
+	double min_span = 1e-5; // shortest segment (yr), a segment that cannot meet the tolerance this short is kept anyway and counted
+	double max_span = 10.0; // longest segment (yr)
+};
+
+// Builder
+// -------------------------------------------------------------------------------------------
+// Fed the integrator's states in time order, fits segments as soon as the states cover them, so only the states of the open segment are kept
+// Between two states the positions are the quintic Hermite through the positions, velocities and accelerations the integrator gives at both
+// (the cubic RK45_integration::interpolate is only C1 and would leave kinks for the series to chase)
+class ephemeris_builder {
+public:
+	explicit ephemeris_builder(const ephemeris_options& options = ephemeris_options{});
+
+	void add(double t, const dmat43& y, const dmat43& dydt, double m1, double m2); // increasing t, a repeated time is ignored
+	void finish(); // Fits what is left, call once after the last add
+
+	bool write(const std::string& path) const; // false (logged) on failure
+
+	size_t segments() const { return spans.size() / 2; }
+	size_t fileSize() const;
+	double maxError() const { return max_error; } // largest position error of any accepted segment (AU)
+	size_t forced() const { return forced_segments; } // segments kept at min_span without meeting the tolerance
+
+private:
+	struct knot {
+		double t;
+		dmat43 y;
+		dmat43 dydt;
+	};
+
+	ephemeris_options options;
+	std::vector<knot> knots; // states from the start of the open segment on
+	double seg_start = 0.0; // start of the open segment
+	double span = 0.0; // next segment length to try, set from the orbital period by the first state
+	bool limited = false; // a fit has failed, so spans are about as long as the series can take and only grow gently
+	double m1 = 0.0, m2 = 0.0;
+	double max_error = 0.0;
+	size_t forced_segments = 0;
+	bool finished = false;
+
+	std::vector<double> spans; // centre and half width of every segment
+	std::vector<double> coeffs; // coefficients * components per segment
+	std::vector<double> trial; // coefficients of the segment being tried
+
+	void fitReady(bool final);
+	bool tryFit(double t0, double t1, bool force);
+	void dense(double t, double out[6]) const; // both positions at t from the knots
+};
+
+// Reader
+// -------------------------------------------------------------------------------------------
+class ephemeris {
+public:
+	bool open(const std::string& path); // false (logged) if it is not a valid ephemeris
+	void close();
+
+	double start() const { return t_start; }
+	double end() const { return t_end; }
+	size_t segments() const { return segment_count; }
+	double tolerance() const { return tol; }
+	double mass1() const { return m1; }
+	double mass2() const { return m2; }
+
+	// Both positions (and velocities) at t, false if t is outside the ephemeris (the nearest end is evaluated) or not finite (nothing is written)
+	bool position(double t, dvec3& pos1, dvec3& pos2) const;
+	bool state(double t, dvec3& pos1, dvec3& vel1, dvec3& pos2, dvec3& vel2) const;
+
+private:
+	mapped_file file;
+	const double* spans = nullptr;
+	const double* coeffs = nullptr;
+	const std::uint32_t* buckets = nullptr;
+	size_t segment_count = 0;
+	size_t bucket_count = 0;
+	int ncoeff = 0;
+	int stride = ephemeris_components; // doubles per coefficient in the file, 8 in version 1
+	double t_start = 0.0, t_end = 0.0;
+	double bucket_width = 1.0, inv_bucket_width = 1.0;
+	double tol = 0.0;
+	double m1 = 0.0, m2 = 0.0;
+
+	size_t find(double t) const;
+	void evaluate(double t, double pos[ephemeris_components], double* vel) const; // vel null for positions only
+};
+
+#endif
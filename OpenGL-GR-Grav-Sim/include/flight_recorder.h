@@ -0,0 +1,123 @@
+#pragma once
+
+#ifndef FLIGHT_RECORDER_H_INCLUDED
+#define FLIGHT_RECORDER_H_INCLUDED
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using dmat43 = glm::mat<4, 3, double>;
+
+// Flight recorder
+// -------------------------------------------------------------------------------------------
+// The last substeps of the integrator (accepted and rejected) in a fixed size ring, kept in a shared file mapping
+// Recording a step is a few stores into the mapped pages, the OS writes them back on its own, and they outlive the process however it ends
+//
+//   header   64 bytes: magic "PNFLIGHT", u32 version, u32 record size, u64 capacity, u64 records written (ever),
+//            u32 status, i32 signal, f64 wall time of the last record (s since open), 16 reserved
+//   records  capacity * 152 bytes: f64 physics time, f64 h, f64 error norm, f64 wall time, u32 flags, 4 padding,
+//            f64 m1, f64 m2, the 12 state values (x1 y1 z1 vx1 vy1 vz1 x2 .. vz2)
+//
+// Record n is at slot n % capacity, so the ring holds records max(0, written - capacity) .. written - 1 in order
+// On an integrator crash, a fatal signal or SIGUSR1 the ring is copied to <path>.dump, the next run would otherwise overwrite it
+// A ring left "running" by a process that could not catch its end (killed, power loss) is moved to <path>.dump by the next open
+
+constexpr std::uint32_t flight_version = 1;
+constexpr size_t flight_header_size = 64;
+constexpr size_t flight_record_size = 152;
+
+enum class flight_status : std::uint32_t {
+	running = 0,
+	closed = 1, // closed normally
+	integrator_crash = 2, // the integrator gave up after too many rejections
+	signal = 3, // a fatal signal, the header holds its number
+	requested = 4 // dumped on request (SIGUSR1), the run carried on
+};
+
+enum flight_flags : std::uint32_t {
+	flight_accepted = 1u << 0,
+	flight_crashed = 1u << 1, // the rejection that made the integrator give up
+	flight_kepler = 1u << 2 // an analytic Kepler step, no error estimate
+};
+
+struct flight_record {
+	double t = 0.0; // physics time at the end of the step (its start if rejected)
+	double h = 0.0;
+	double err_norm = 0.0;
+	double wall = 0.0; // seconds since the recorder was opened, read every 16 records
+	std::uint32_t flags = 0;
+	double m1 = 0.0, m2 = 0.0;
+	dmat43 y{ 0.0 };
+};
+
+class flight_recorder {
+public:
+	explicit flight_recorder(size_t capacity = 65536); // about 10 MB, the last minutes of a typical run
+	~flight_recorder(); // closes the recorder if it is still open
+
+	flight_recorder(const flight_recorder&) = delete;
+	flight_recorder& operator=(const flight_recorder&) = delete;
+
+	// Creates (or replaces) the ring at path and adds it to the recorders the signal handlers dump, false (logged) on failure
+	bool open(const std::string& path);
+	void close(); // Marks the ring closed and unmaps it, the file is kept
+
+	bool isOpen() const { return base != nullptr; }
+	const std::string& path() const { return ring_path; }
+	std::uint64_t written() const { return count; }
+
+	// Owning (physics) thread only
+	void record(double t, double h, double err_norm, std::uint32_t flags, const dmat43& y, double m1, double m2);
+
+	// Copies the ring to <path>.dump and marks why, false if the copy could not be written
+	// Only raw system calls, so the signal handlers use it too
+	bool dump(flight_status why, int signal = 0);
+
+	// Dumps every open recorder (signal safe), false if none is open or a dump failed
+	static bool dumpActive(flight_status why, int signal = 0);
+
+	// Fatal signals (and SIGUSR1 where it exists) dump the open recorders, fatal ones then carry on to the default action
+	// A program with a SIGUSR1 handler of its own installs it afterwards and calls dumpActive from it
+	static void installSignalHandlers();
+
+private:
+	size_t capacity;
+	unsigned char* base = nullptr; // the mapping, header then records
+	size_t length = 0;
+	std::uint64_t count = 0;
+	size_t slot = 0; // count % capacity
+	double wall = 0.0; // wall time stamped on records, refreshed every few
+	std::string ring_path, dump_path;
+	std::chrono::steady_clock::time_point opened;
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#endif
+
+	void setStatus(flight_status status, int signal);
+	bool map(); // maps ring_path, sized for capacity records
+	void unmap();
+};
+
+// Reading
+// -------------------------------------------------------------------------------------------
+struct flight_info {
+	std::uint64_t capacity = 0;
+	std::uint64_t written = 0;
+	flight_status status = flight_status::running;
+	int signal = 0;
+};
+
+// The records of a ring or a dump, oldest first, false (logged) if it is not a flight recording
+bool readFlightRecording(const std::string& path, std::vector<flight_record>& out, flight_info* info = nullptr);
+
+// Writes a ring or dump as CSV, oldest record first
+bool flightRecordingToCsv(const std::string& path, std::ostream& out);
+
+#endif
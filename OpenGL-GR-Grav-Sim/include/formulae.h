@@ -6,12 +6,22 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include "celestial_body_class.h"
+#include "constants.h"
 
 using dvec3 = glm::dvec3;
 
 dvec3 PN_acceleration(dvec3 pos1, dvec3 pos2, dvec3 v1, dvec3 v2, double m1, double m2);
 
+dvec3 PN_correction(dvec3 pos1, dvec3 pos2, dvec3 v1, dvec3 v2, double m1, double m2); // Only the post-Newtonian part of PN_acceleration
+
+dvec3 newtonian_acceleration(dvec3 pos1, dvec3 pos2, double m1, double m2); // Only the Newtonian part of PN_acceleration, what the Newtonian preset integrates
+
 void resolve_rel_accel(dvec3& a_rel, dvec3& a1, dvec3& a2, double m1, double m2);
 
+dvec3 newtonian_jerk(dvec3 pos1, dvec3 pos2, dvec3 v1, dvec3 v2, double m1, double m2); // Time derivative of the Newtonian relative acceleration, resolved like it with resolve_rel_accel
+
+double orbital_energy(dvec3 pos1, dvec3 pos2, dvec3 v1, dvec3 v2, double m1, double m2); // Newtonian total energy of the pair
+
+dvec3 orbital_angular_momentum(dvec3 pos1, dvec3 pos2, dvec3 v1, dvec3 v2, double m1, double m2); // Total angular momentum of the pair about the origin
+
 #endif
\ No newline at end of file
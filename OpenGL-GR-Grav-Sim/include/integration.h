@@ -5,11 +5,13 @@
 
 #include <iostream>
 #include <iomanip>
+#include <limits>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include "celestial_body_class.h"
+#include "rk45_engine.h"
+#include "flight_recorder.h"
 
 using dvec3 = glm::dvec3;
 using dmat43 = glm::mat<4, 3, double>;
@@ -19,11 +21,6 @@ struct mathState {
 	double m1, m2, physics_time;
 };
 
-struct substep_values {
-	dmat43 state_y;
-	double err_norm;
-};
-
 struct integrate_result {
 	dmat43 state_y;
 	int count;
@@ -31,9 +28,11 @@ struct integrate_result {
 	int rejects;
 	double avg_h;
 	bool crash_f;
+	double covered; // simulated time the step actually advanced
+	dmat43 dydt; // derivatives at state_y (velocities and accelerations of both bodies), zero after a crash
 
-	integrate_result(dmat43 state, int count, int accepts, int rejects, double avg_h, bool crash) :
-		state_y(state), count(count), accepts(accepts), rejects(rejects), avg_h(avg_h), crash_f(crash) {
+	integrate_result(dmat43 state, int count, int accepts, int rejects, double avg_h, bool crash, double covered = 0.0, dmat43 dydt = dmat43{ 0.0 }) :
+		state_y(state), count(count), accepts(accepts), rejects(rejects), avg_h(avg_h), crash_f(crash), covered(covered), dydt(dydt) {
 	}
 };
 
@@ -41,24 +40,57 @@ class RK45_integration {
 public:
 	RK45_integration(double atol, double rtol, double initial_dt);
 
-	integrate_result step(mathState backbuf, double physics_dt);
+	// Advances backbuf by physics_dt, or by less if max_substeps runs out first (result.covered says how far it got)
+	// A Kepler step always covers physics_dt, result.count is then its work in substeps
+	integrate_result step(mathState backbuf, double physics_dt, int max_substeps = std::numeric_limits<int>::max());
 
 	bool getDebug();
 
 	void setDebug(bool update);
-private:
-	double atol;
-	double rtol;
-	double timestep;
-	bool debug = false;
 
-	dmat43 derivatives(dmat43& y, double m1, double m2);
+	bool getNewtonian();
+
+	void setNewtonian(bool update);
+
+	double getAtol();
+
+	double getRtol();
+
+	void setTolerances(double atol, double rtol);
 
-	integrate_result RK45_integrate(dmat43 y, double total_dt, double tol, double m1, double m2);
+	double getTimestep(); // Current adaptive substep, saved with a checkpoint so a resumed run carries on exactly
 
-	substep_values RK45_substep(dmat43 y, double& h, double m1, double m2);
+	void setTimestep(double h);
 
-	double calc_err_norm(const dmat43& y, const dmat43& y4, const dmat43& y5, const double atol, const double rtol);
+	// Dense output of the steps the integrator takes from now on, for following the binary between the ends of a step
+	void setDenseOutput(bool on);
+
+	// The state at t into the last step call (0 <= t <= result.covered): the RK45 continuous extension of the substep holding t,
+	// or the Kepler orbit itself when the step took the Kepler path. False if dense output is off or the last call took no step
+	bool denseState(double t, dmat43& out) const;
+
+	// dydt is derivatives(s.y, s.m1, s.m2), saved with a restart, so the first step from s does not evaluate it again
+	void seedDerivative(const mathState& s, const dmat43& dydt);
+
+	// Every substep (accepted or rejected) is recorded to recorder, null to stop, and an integration crash dumps it
+	// The recorder must outlive the integrator or be detached first, it is written from whichever thread calls step
+	void setRecorder(flight_recorder* recorder);
+
+	static dmat43 derivatives(const dmat43& y, double m1, double m2);
+
+	static dmat43 newtonianDerivatives(const dmat43& y, double m1, double m2); // without the PN terms, what the Newtonian preset integrates when the Kepler propagation fails
+
+	static dmat43 interpolate(const dmat43& y0, const dmat43& dydt0, const dmat43& y1, const dmat43& dydt1, double h, double theta);
+private:
+	dormand_prince<dmat43> engine; // Adaptive stepper, owns the tolerances, the current timestep and the stage workspace
+	bool debug = false;
+	bool newtonian = false; // Forces the analytic Kepler propagation (Newtonian preset), or the Newtonian equations where it fails
+	bool last_newtonian = false; // equations the engine's carried over first stage was evaluated with
+	flight_recorder* recorder = nullptr; // not owned
+	double last_m1 = 0.0, last_m2 = 0.0; // masses the engine's carried over first stage was evaluated with
+	bool dense_on = false;
+	bool kepler_step = false; // the last step call took the Kepler path, its dense output is the propagation from kepler_start
+	mathState kepler_start{};
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,23 @@
+#pragma once
+
+#ifndef KEPLER_H_INCLUDED
+#define KEPLER_H_INCLUDED
+
+#include <glm/glm.hpp>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+// Upper bound of the post-Newtonian corrections relative to the Newtonian acceleration over the whole orbit described by the state (evaluated at pericentre)
+double PN_strength_bound(const dmat43& y, double m1, double m2);
+
+// Bound below which the PN terms are dropped and the orbit is propagated as an exact Kepler orbit, a precession of ~1e-11 rad per orbit at most
+// Fixed rather than tied to the tolerances, so loosening the accuracy (a tuner trial, a preview) never changes the physics being integrated
+constexpr double pn_negligible = 1e-12;
+
+// Advances the two-body state exactly along its Newtonian (Keplerian) orbit by dt using universal variables
+// Returns false if the propagation did not converge, in which case y is left untouched
+// evaluations (if not null) receives how often the Kepler equation was evaluated, the work the propagation took
+bool kepler_propagate(dmat43& y, double m1, double m2, double dt, int* evaluations = nullptr);
+
+#endif
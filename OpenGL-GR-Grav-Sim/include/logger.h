@@ -0,0 +1,167 @@
+#pragma once
+
+#ifndef LOGGER_H_INCLUDED
+#define LOGGER_H_INCLUDED
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <ostream>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+enum class log_level : std::uint8_t {
+	trace,
+	debug,
+	info,
+	warn,
+	error,
+	off
+};
+
+enum class log_category : std::uint8_t {
+	general,
+	physics, // the simulation and its physics thread
+	integrator, // the RK45 engine and tolerance tuning
+	history, // the undo / redo stack
+	render, // shaders, textures and the window
+	io, // files read and written
+	count
+};
+
+constexpr std::uint32_t log_all_categories = (1u << static_cast<int>(log_category::count)) - 1;
+
+struct logger_options {
+	log_level level = log_level::info; // records below this are dropped where they are made
+	std::uint32_t categories = log_all_categories; // bit (1 << category) enables a category
+	bool console = true; // formatted lines to stdout, warnings and errors to stderr
+	std::string text_path; // formatted lines to this file, empty for none
+	std::string binary_path; // raw records to this file (formatted later by logger::convertBinary), empty for none
+};
+
+// Log Record
+// -------------------------------------------------------------------------------------------
+// Everything a call site hands over is copied into one fixed size record, nothing is formatted or allocated on the calling thread
+// The format is kept as a pointer, so it must be a string literal (or otherwise live as long as the program)
+struct log_arg {
+	enum kind_t : std::uint8_t { sint, uint, real, pointer, text, boolean } kind;
+	std::uint8_t length; // text only, bytes in the record's text area
+	std::uint16_t offset; // text only
+	union {
+		std::int64_t i;
+		std::uint64_t u;
+		double d;
+		const void* p;
+	};
+};
+
+struct log_record {
+	static constexpr int max_args = 8;
+	static constexpr size_t text_capacity = 96; // shared by the text arguments, longer ones are cut short
+
+	std::uint64_t time_ns; // steady clock
+	const char* format;
+	std::uint32_t thread; // logger's id of the thread that made it
+	log_level level;
+	log_category category;
+	std::uint8_t argc;
+	std::uint8_t text_used;
+	log_arg args[max_args];
+	char text[text_capacity];
+};
+
+// Asynchronous logger
+// -------------------------------------------------------------------------------------------
+// Each thread writes into its own lock free ring (made the first time it logs), and a drain on the I/O lane (thread_pool.h) merges the rings in time order, formats the records and writes them out
+// A disabled level or category costs one relaxed load at the call site, an enabled one the copy of its arguments into the ring
+// A full ring drops the record rather than blocking (warnings and errors wait briefly for the writer first), the count of dropped records is reported in the log
+//
+// Formats use {} for each argument, in order: logger::info(log_category::physics, "step {} took {} ms", n, ms)
+namespace logger {
+	namespace detail {
+		extern std::atomic<int> min_level;
+		extern std::atomic<std::uint32_t> category_mask;
+
+		void submit(log_record& record); // stamps and queues the record on the calling thread's ring
+
+		inline void capture(log_record&, log_arg& a, bool v) { a.kind = log_arg::boolean; a.u = v ? 1 : 0; }
+		inline void capture(log_record&, log_arg& a, double v) { a.kind = log_arg::real; a.d = v; }
+		inline void capture(log_record&, log_arg& a, float v) { a.kind = log_arg::real; a.d = v; }
+		inline void capture(log_record&, log_arg& a, const void* v) { a.kind = log_arg::pointer; a.p = v; }
+
+		inline void capture(log_record& r, log_arg& a, std::string_view v) {
+			const size_t room = log_record::text_capacity - r.text_used;
+			const size_t n = (v.size() < room) ? v.size() : room;
+			for (size_t i = 0; i < n; i++) {
+				r.text[r.text_used + i] = v[i];
+			}
+			a.kind = log_arg::text;
+			a.offset = r.text_used;
+			a.length = static_cast<std::uint8_t>(n);
+			r.text_used = static_cast<std::uint8_t>(r.text_used + n);
+		}
+		inline void capture(log_record& r, log_arg& a, const char* v) { capture(r, a, std::string_view(v ? v : "(null)")); }
+		inline void capture(log_record& r, log_arg& a, const std::string& v) { capture(r, a, std::string_view(v)); }
+
+		template <typename T>
+		void capture(log_record&, log_arg& a, const T& v) {
+			if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+				a.kind = log_arg::sint;
+				a.i = static_cast<std::int64_t>(v);
+			}
+			else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+				a.kind = log_arg::uint;
+				a.u = static_cast<std::uint64_t>(v);
+			}
+			else if constexpr (std::is_pointer_v<T>) {
+				a.kind = log_arg::pointer;
+				a.p = static_cast<const void*>(v);
+			}
+			else {
+				static_assert(std::is_arithmetic_v<T>, "logger arguments are numbers, pointers, bools and strings");
+			}
+		}
+	}
+
+	void configure(const logger_options& options); // Any thread, sinks are reopened and the filters replaced
+	void setLevel(log_level level);
+	void setCategories(std::uint32_t mask);
+
+	inline bool enabled(log_level level, log_category category) {
+		return static_cast<int>(level) >= detail::min_level.load(std::memory_order_relaxed)
+			&& (detail::category_mask.load(std::memory_order_relaxed) & (1u << static_cast<int>(category))) != 0;
+	}
+
+	void nameThread(const char* name); // Names the calling thread in the log, up to 15 characters
+
+	void flush(); // Returns once everything logged before the call has been written
+	void shutdown(); // Flushes and stops the writer, later records are written straight to stderr
+	std::uint64_t dropped(); // Records lost to full rings so far
+
+	bool convertBinary(const std::string& binary_path, std::ostream& out); // Formats a binary log as the text sink would have
+
+	template <typename... Args>
+	void write(log_level level, log_category category, const char* format, const Args&... args) {
+		static_assert(sizeof...(Args) <= log_record::max_args, "too many logger arguments");
+		if (!enabled(level, category)) {
+			return;
+		}
+		log_record r;
+		r.format = format;
+		r.level = level;
+		r.category = category;
+		r.argc = 0;
+		r.text_used = 0;
+		(detail::capture(r, r.args[r.argc++], args), ...);
+		detail::submit(r);
+	}
+
+	template <typename... Args> void trace(log_category c, const char* format, const Args&... args) { write(log_level::trace, c, format, args...); }
+	template <typename... Args> void debug(log_category c, const char* format, const Args&... args) { write(log_level::debug, c, format, args...); }
+	template <typename... Args> void info(log_category c, const char* format, const Args&... args) { write(log_level::info, c, format, args...); }
+	template <typename... Args> void warn(log_category c, const char* format, const Args&... args) { write(log_level::warn, c, format, args...); }
+	template <typename... Args> void error(log_category c, const char* format, const Args&... args) { write(log_level::error, c, format, args...); }
+}
+
+#endif
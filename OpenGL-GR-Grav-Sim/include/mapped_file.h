@@ -0,0 +1,41 @@
+#pragma once
+
+#ifndef MAPPED_FILE_H_INCLUDED
+#define MAPPED_FILE_H_INCLUDED
+
+#include <string>
+#include <cstddef>
+
+// Read only memory mapping of a whole file
+// -------------------------------------------------------------------------------------------
+// The pages are read in by the OS on first touch, so opening is one system call whatever the size and nothing is copied into the heap
+// The mapping (and every pointer into it) lives until close or destruction
+class mapped_file {
+public:
+	mapped_file() = default;
+	explicit mapped_file(const std::string& path) { open(path); }
+	~mapped_file() { close(); }
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+	mapped_file(mapped_file&& other) noexcept;
+	mapped_file& operator=(mapped_file&& other) noexcept;
+
+	bool open(const std::string& path); // false if the file cannot be opened or mapped, an empty file opens with no data
+	void close();
+
+	bool isOpen() const { return is_open; }
+	const unsigned char* data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	const unsigned char* bytes = nullptr;
+	size_t length = 0;
+	bool is_open = false;
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#endif
+};
+
+#endif
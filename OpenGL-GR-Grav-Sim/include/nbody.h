@@ -0,0 +1,111 @@
+#pragma once
+
+#ifndef NBODY_H_INCLUDED
+#define NBODY_H_INCLUDED
+
+#include <glm/glm.hpp>
+#include "rk45_engine.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+
+using dvec3 = glm::dvec3;
+
+struct body_soa { // Structure of arrays body storage, each component is contiguous so the force loops stream through memory
+	std::vector<double> x, y, z;
+	std::vector<double> vx, vy, vz;
+	std::vector<double> ax, ay, az;
+	std::vector<double> m;
+
+	size_t size() const { return m.size(); }
+
+	void resize(size_t n) {
+		x.resize(n); y.resize(n); z.resize(n);
+		vx.resize(n); vy.resize(n); vz.resize(n);
+		ax.resize(n); ay.resize(n); az.resize(n);
+		m.resize(n);
+	}
+
+	void push_back(const dvec3& pos, const dvec3& vel, double mass) {
+		x.push_back(pos.x); y.push_back(pos.y); z.push_back(pos.z);
+		vx.push_back(vel.x); vy.push_back(vel.y); vz.push_back(vel.z);
+		ax.push_back(0.0); ay.push_back(0.0); az.push_back(0.0);
+		m.push_back(mass);
+	}
+
+	dvec3 getPos(size_t i) const { return dvec3{ x[i], y[i], z[i] }; }
+	dvec3 getVel(size_t i) const { return dvec3{ vx[i], vy[i], vz[i] }; }
+	dvec3 getAccel(size_t i) const { return dvec3{ ax[i], ay[i], az[i] }; }
+};
+
+struct force_stats { // Per evaluation report of how each pair was treated
+	size_t pn_pairs = 0; // close pairs above the PN threshold, given the full PN_acceleration
+	size_t near_pairs = 0; // in the neighbour list (within the skin) but below the threshold this evaluation, Newtonian
+	size_t far_pairs = 0; // every other pair, Newtonian
+	bool list_rebuilt = false; // whether the neighbour list was refreshed this evaluation
+};
+
+class hybrid_force {
+public:
+	// pn_threshold: Gm/(rc^2) above which a pair receives the PN terms
+	// skin: factor the PN separation is widened by when building the neighbour list, so pairs closing in between refreshes are already listed
+	// max_separation: pairs further apart than this are always Newtonian, regardless of their mass
+	// refresh_interval: number of evaluations between neighbour list rebuilds (an RK45 substep is 6 evaluations)
+	hybrid_force(double pn_threshold, double skin, double max_separation, int refresh_interval);
+
+	force_stats evaluate(body_soa& bodies); // Fills ax, ay, az of every body
+
+	force_stats getStats() const { return stats; }
+
+	void invalidate() { steps_since_refresh = refresh_interval; } // Forces a rebuild on the next evaluation (bodies added, removed or edited)
+
+private:
+	double pn_threshold;
+	double skin;
+	double max_separation;
+	int refresh_interval;
+	int steps_since_refresh;
+
+	std::vector<std::uint32_t> pair_i, pair_j; // Neighbour list of close pairs
+	force_stats stats;
+
+	void rebuildNeighbours(const body_soa& bodies);
+
+	void newtonianAccelerations(body_soa& bodies);
+};
+
+// N body integration
+// -------------------------------------------------------------------------------------------
+// Steps a body_soa with the same Dormand-Prince engine as the two body integrator, over the bodies packed into one state
+// (x, y, z, vx, vy, vz blocks of n doubles), every stage's accelerations coming from the hybrid force
+class nbody_integrator {
+public:
+	nbody_integrator(double atol, double rtol, double initial_dt, const hybrid_force& force);
+
+	// Advances bodies by dt, or by less if max_substeps runs out first (result.covered), their accelerations are left at the new state
+	// Logs the step's substeps and pair counts at trace level, and at info level when the number of PN pairs changes
+	engine_result step(body_soa& bodies, double dt, int max_substeps = std::numeric_limits<int>::max());
+
+	const force_stats& lastForce() const { return last_force; } // pair counts of the last force evaluation
+	std::uint64_t evaluations() const { return force_evaluations; }
+	std::uint64_t rebuilds() const { return list_rebuilds; } // neighbour list rebuilds so far
+
+	double getTimestep() const { return engine.getTimestep(); }
+	void setTimestep(double h) { engine.setTimestep(h); }
+
+private:
+	dormand_prince<std::vector<double>> engine;
+	hybrid_force force;
+	std::vector<double> packed; // the bodies as the engine's state, kept so a step never allocates once it has seen n bodies
+	body_soa stage; // one stage's positions and velocities unpacked for the force
+	force_stats last_force;
+	std::uint64_t force_evaluations = 0;
+	std::uint64_t list_rebuilds = 0;
+	size_t logged_pn_pairs = static_cast<size_t>(-1); // PN pairs of the last info line, none yet
+
+	void derivatives(const std::vector<double>& s, std::vector<double>& dydt);
+};
+
+#endif
@@ -1,7 +1,6 @@
 #pragma once
 
-#define M_PI        3.14159265358979323846264338327950288   /* pi */
-
+#include "constants.h"
 #include "shaders_c.h"
 #include <vector>
 #include <cmath>
@@ -291,8 +290,8 @@ namespace objects {
             // =======================
             for (int i = 0; i <= sections; i++)
             {
-                float a0 = 2.0f * M_PI * i / sections;
-                float a1 = 2.0f * M_PI * (i + 1) / sections;
+                float a0 = 2.0f * PI_F * i / sections;
+                float a1 = 2.0f * PI_F * (i + 1) / sections;
 
                 glm::vec3 p0(0.025 * cosf(a0), 0.0f, 0.025 * sinf(a0));
                 glm::vec3 p1(0.025 * cosf(a1), 0.0f, 0.025 * sinf(a1));
@@ -315,7 +314,7 @@ namespace objects {
 
             for (int i = 0; i <= sections; i++)
             {
-                float a = 2.0f * M_PI * i / sections;
+                float a = 2.0f * PI_F * i / sections;
                 m_vertices.emplace_back(
                     0.025 * cosf(a),
                     0.0f,
@@ -329,8 +328,8 @@ namespace objects {
             neck_offset = head_baseVertexCount + head_sideVertexCount;
 
             for (int i = 0; i <= sections; i++) {
-                float a0 = 2.0f * M_PI * i / sections;
-                float a1 = 2.0f * M_PI * (i + 1) / sections;
+                float a0 = 2.0f * PI_F * i / sections;
+                float a1 = 2.0f * PI_F * (i + 1) / sections;
 
                 glm::vec3 p0(0.0125 * cosf(a0), neck_baseHeight, 0.0125 * sinf(a0));
                 glm::vec3 p1(0.0125 * cosf(a1), neck_baseHeight, 0.0125 * sinf(a1));
@@ -436,11 +435,11 @@ namespace objects {
             m_vertices.clear();
             m_indices.clear();
 
-            float sectorStep = 2.0f * M_PI / sectorCount;
-            float stackStep = M_PI / stackCount;
+            float sectorStep = 2.0f * PI_F / sectorCount;
+            float stackStep = PI_F / stackCount;
 
             for (int i = 0; i <= stackCount; ++i) {
-                float phi = M_PI / 2.0f - i * stackStep;
+                float phi = PI_F / 2.0f - i * stackStep;
                 float xy = cosf(phi);
                 float z = sinf(phi);
 
@@ -506,5 +505,151 @@ namespace objects {
             glBindVertexArray(0);
         }
     };
+
+    class point_cloud {
+    public:
+        point_cloud(
+            glm::vec3 color,
+            float size
+        )
+            : colour(color),
+            point_size(size)
+        {
+            setupBuffers();
+        }
+        ~point_cloud()
+        {
+            glDeleteVertexArrays(1, &p_VAO);
+            glDeleteBuffers(1, &p_VBO);
+        }
+
+        void update(const std::vector<float>& positions) { // Packed xyz positions
+            glBindBuffer(GL_ARRAY_BUFFER, p_VBO);
+
+            if (positions.size() > capacity) { // Only reallocates when the cloud outgrows the buffer
+                capacity = positions.size();
+                glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(float), nullptr, GL_STREAM_DRAW);
+            }
+            if (!positions.empty()) {
+                glBufferSubData(GL_ARRAY_BUFFER, 0, positions.size() * sizeof(float), positions.data());
+            }
+
+            count = static_cast<GLsizei>(positions.size() / 3);
+        }
+
+        void draw(Shader* shader) {
+            if (count == 0) {
+                return;
+            }
+
+            shader->use();
+            shader->setVec3("colour", colour);
+            shader->setMat4("model", glm::mat4{ 1.0f }); // positions are already in world space
+
+            glPointSize(point_size);
+
+            glBindVertexArray(p_VAO);
+            glDrawArrays(GL_POINTS, 0, count);
+            glBindVertexArray(0);
+        }
+
+    private:
+        GLuint p_VAO{}, p_VBO{};
+
+        glm::vec3 colour;
+        float point_size;
+
+        size_t capacity{ 0 };
+        GLsizei count{ 0 };
+
+        void setupBuffers() {
+            glGenVertexArrays(1, &p_VAO);
+            glGenBuffers(1, &p_VBO);
+
+            glBindVertexArray(p_VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, p_VBO);
+
+            // position
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+            glEnableVertexAttribArray(0);
+
+            glBindVertexArray(0);
+        }
+    };
+
+    class polyline {
+    public:
+        polyline(
+            glm::vec3 color,
+            float width
+        )
+            : colour(color),
+            line_width(width)
+        {
+            setupBuffers();
+        }
+        ~polyline()
+        {
+            glDeleteVertexArrays(1, &l_VAO);
+            glDeleteBuffers(1, &l_VBO);
+        }
+
+        void update(const std::vector<float>& positions) { // Packed xyz positions, joined in order
+            glBindBuffer(GL_ARRAY_BUFFER, l_VBO);
+
+            if (positions.size() > capacity) { // Only reallocates when the line outgrows the buffer
+                capacity = positions.size();
+                glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(float), nullptr, GL_STREAM_DRAW);
+            }
+            if (!positions.empty()) {
+                glBufferSubData(GL_ARRAY_BUFFER, 0, positions.size() * sizeof(float), positions.data());
+            }
+
+            count = static_cast<GLsizei>(positions.size() / 3);
+        }
+
+        void clear() { count = 0; }
+
+        void setColour(const glm::vec3& color) { colour = color; }
+
+        void draw(Shader* shader) {
+            if (count < 2) {
+                return;
+            }
+
+            shader->use();
+            shader->setVec3("colour", colour);
+            shader->setMat4("model", glm::mat4{ 1.0f }); // positions are already in world space
+
+            glLineWidth(line_width);
+
+            glBindVertexArray(l_VAO);
+            glDrawArrays(GL_LINE_STRIP, 0, count);
+            glBindVertexArray(0);
+        }
+
+    private:
+        GLuint l_VAO{}, l_VBO{};
+
+        glm::vec3 colour;
+        float line_width;
+
+        size_t capacity{ 0 };
+        GLsizei count{ 0 };
+
+        void setupBuffers() {
+            glGenVertexArrays(1, &l_VAO);
+            glGenBuffers(1, &l_VBO);
+
+            glBindVertexArray(l_VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, l_VBO);
+
+            // position
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+            glEnableVertexAttribArray(0);
+
+            glBindVertexArray(0);
+        }
+    };
 }
 
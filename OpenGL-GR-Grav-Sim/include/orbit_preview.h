@@ -0,0 +1,59 @@
+#pragma once
+
+#ifndef ORBIT_PREVIEW_H_INCLUDED
+#define ORBIT_PREVIEW_H_INCLUDED
+
+#include <glm/glm.hpp>
+#include "thread_pool.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+struct preview_path { // Predicted trajectory of an edited state
+	std::uint64_t key = 0; // the edit it belongs to
+	std::vector<float> path1, path2; // packed xyz positions of each body along the prediction
+	double span = 0.0; // simulated time covered
+	bool crashed = false; // the integrator gave up before the end of the span, the edit would crash the simulation
+};
+
+// Integrates an edited state forward on the thread pool while the user is still typing, so the editor can draw where the bodies are about to go
+// A new request supersedes the previous one (which stops at its next sample), and finished paths are cached per edit so stepping back through values is free
+class orbit_preview {
+public:
+	orbit_preview(int samples = 256, double tolerance = 1e-6, size_t cache_size = 32);
+	~orbit_preview(); // Waits for the running prediction to notice it has been cancelled
+
+	void request(const dmat43& y, double m1, double m2, bool newtonian); // Render thread, non blocking
+
+	bool poll(preview_path& out); // Render thread, true once the path of the latest request is ready (only once per request)
+
+	void clear(); // Forgets the cache, and the current request
+
+private:
+	int samples;
+	double tolerance;
+	size_t cache_size;
+
+	task_group jobs;
+	std::atomic<std::uint64_t> latest{ 0 }; // key of the latest request, a running job whose key no longer matches stops
+	std::uint64_t delivered = 0; // key last handed out by poll (render thread)
+
+	std::mutex mtx;
+	std::vector<preview_path> cache; // most recent last
+	preview_path ready; // finished path of the latest request
+	bool has_ready = false;
+
+	static std::uint64_t editKey(const dmat43& y, double m1, double m2, bool newtonian);
+
+	void predict(std::uint64_t key, dmat43 y, double m1, double m2, bool newtonian); // pool thread
+
+	static double horizon(const dmat43& y, double m1, double m2);
+};
+
+#endif
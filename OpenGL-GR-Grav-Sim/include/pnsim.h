@@ -0,0 +1,87 @@
+#ifndef PNSIM_H_INCLUDED
+#define PNSIM_H_INCLUDED
+
+/*
+ * PNsim C interface
+ * -------------------------------------------------------------------------------------------
+ * The two body post-Newtonian integrator behind a plain C ABI, for embedding without the window
+ * Units: AU, years and solar masses
+ *
+ * A state is 12 doubles: position 1, velocity 1, position 2, velocity 2 (x, y, z each)
+ * Only pnsim_create allocates, stepping and reading never touch the heap and only write to the caller's buffers
+ * A handle is not thread safe, use one per thread (any number can run side by side)
+ * Nothing throws across the interface, failures are returned as a pnsim_status
+ *
+ * Linking: the static library needs nothing defined, the shared one needs PNSIM_SHARED defined by its users
+ */
+
+#include <stdint.h>
+
+#if defined(PNSIM_SHARED)
+	#if defined(_WIN32)
+		#if defined(PNSIM_BUILDING)
+			#define PNSIM_API __declspec(dllexport)
+		#else
+			#define PNSIM_API __declspec(dllimport)
+		#endif
+	#else
+		#define PNSIM_API __attribute__((visibility("default")))
+	#endif
+#else
+	#define PNSIM_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PNSIM_ABI_VERSION 1u /* raised whenever a signature or struct layout below changes */
+#define PNSIM_STATE_SIZE 12
+
+typedef struct pnsim_sim pnsim_sim; /* opaque */
+
+typedef enum pnsim_status {
+	PNSIM_OK = 0,
+	PNSIM_ERR_NULL = -1, /* a required pointer was null */
+	PNSIM_ERR_ARGUMENT = -2, /* a value out of range (negative mass, non-finite state, ...) */
+	PNSIM_ERR_CRASHED = -3, /* the integrator gave up, the state is the last one it reached, set a new state to carry on */
+	PNSIM_ERR_INTERNAL = -4
+} pnsim_status;
+
+typedef struct pnsim_step_stats {
+	int64_t substeps; /* adaptive substeps taken */
+	int64_t rejects; /* substeps retried with a smaller step */
+	double covered; /* simulated years advanced */
+} pnsim_step_stats;
+
+PNSIM_API uint32_t pnsim_abi_version(void); /* PNSIM_ABI_VERSION of the library actually loaded */
+PNSIM_API const char* pnsim_status_string(int status);
+
+/* Lifetime */
+PNSIM_API pnsim_sim* pnsim_create(double atol, double rtol, double initial_dt); /* null if out of memory or the tolerances are not positive */
+PNSIM_API void pnsim_destroy(pnsim_sim* sim); /* null is ignored */
+
+/* Settings */
+PNSIM_API int pnsim_set_tolerances(pnsim_sim* sim, double atol, double rtol);
+PNSIM_API int pnsim_set_newtonian(pnsim_sim* sim, int newtonian); /* non zero steps along the exact Kepler orbit, ignoring the PN terms */
+PNSIM_API void pnsim_set_log_level(int level); /* 0 trace .. 4 error, 5 off, process wide (info by default) */
+
+/* State */
+PNSIM_API int pnsim_set_state(pnsim_sim* sim, const double state[PNSIM_STATE_SIZE], double m1, double m2, double time);
+PNSIM_API int pnsim_get_state(const pnsim_sim* sim, double state_out[PNSIM_STATE_SIZE], double* m1_out, double* m2_out, double* time_out); /* any output but state_out may be null */
+PNSIM_API int pnsim_get_derivatives(const pnsim_sim* sim, double dydt_out[PNSIM_STATE_SIZE]); /* velocities and accelerations at the current state */
+PNSIM_API int pnsim_get_invariants(const pnsim_sim* sim, double* energy_out, double angular_momentum_out[3]); /* Newtonian, either may be null */
+
+/*
+ * Stepping
+ * Advances by steps intervals of dt years
+ * trajectory_out (steps * PNSIM_STATE_SIZE doubles) and times_out (steps doubles) receive the state after each interval, either may be null
+ * stats_out (may be null) receives the totals, on a crash they cover the intervals completed before it
+ */
+PNSIM_API int pnsim_step(pnsim_sim* sim, double dt, int64_t steps, double* trajectory_out, double* times_out, pnsim_step_stats* stats_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
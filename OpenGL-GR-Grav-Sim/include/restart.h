@@ -0,0 +1,64 @@
+#pragma once
+
+#ifndef RESTART_H_INCLUDED
+#define RESTART_H_INCLUDED
+
+#include <glm/glm.hpp>
+#include "integration.h"
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+// Restart snapshots
+// -------------------------------------------------------------------------------------------
+// Everything needed to carry a simulation on exactly where it stopped, in a small checksummed binary file
+//
+//   header   32 bytes: magic "PNSNAP\x1a\n", u32 version, u32 header size, u32 payload size, u32 CRC-32 of the payload, 8 reserved
+//   payload  the fields below in order, doubles and integers little endian
+//
+// A newer version only ever appends to the payload, so a reader takes any file whose version it knows and skips what follows the fields it reads
+// Writing is one buffered write to <path>.tmp renamed over <path>, reading maps the file, so a checkpoint every few seconds costs next to nothing
+
+constexpr std::uint32_t restart_version = 1;
+
+struct restart_state {
+	mathState s{ dmat43{ 0.0 }, 0.0, 0.0, 0.0 }; // state, masses and physics time
+	dmat43 dydt{ 0.0 }; // derivatives at s, the integrator's last (first same as last) stage
+	bool dydt_valid = false; // false if dydt was never evaluated (the state was just edited)
+
+	// Integrator
+	double atol = 1e-8;
+	double rtol = 1e-10;
+	double timestep = 0.05; // current adaptive substep, restoring it avoids the warm up of a cold start
+	bool newtonian = false;
+	bool auto_tune = false;
+	double drift_target = 1e-8;
+
+	// History
+	std::uint64_t steps = 0; // steps (or samples) taken so far
+	double energy0 = 0.0, momentum0 = 0.0; // reference values drift is measured against
+
+	// Seeds
+	std::uint32_t tracer_seed = 0; // seed of the tracer disk, reseeded around the restored binary
+	std::uint64_t tracer_count = 0; // 0 if there was none
+};
+
+// Sizes of the v1 layout, for anything that embeds a snapshot in a larger file
+constexpr size_t restart_header_size = 32;
+constexpr size_t restart_payload_size = 33 * sizeof(double) + 2 * sizeof(std::uint64_t) + 2 * sizeof(std::uint32_t);
+constexpr size_t restart_file_size = restart_header_size + restart_payload_size;
+
+// Encodes into out (restart_file_size bytes), no allocation
+void encodeRestart(const restart_state& rs, unsigned char* out);
+
+// Decodes a whole snapshot from memory, false (logged) if it is truncated, from an unknown version or fails its checksum
+bool decodeRestart(const unsigned char* data, size_t size, restart_state& rs, const char* name = "snapshot");
+
+bool writeRestart(const std::string& path, const restart_state& rs); // to path.tmp, then renamed over path, false (logged) on failure
+bool readRestart(const std::string& path, restart_state& rs);
+
+#endif
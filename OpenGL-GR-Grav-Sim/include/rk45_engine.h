@@ -0,0 +1,381 @@
+#pragma once
+
+#ifndef RK45_ENGINE_H_INCLUDED
+#define RK45_ENGINE_H_INCLUDED
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "logger.h"
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <utility>
+#include <limits>
+
+using dmat43 = glm::mat<4, 3, double>;
+
+// State Traits
+// -------------------------------------------------------------------------------------------
+// The stepper treats a state as a flat array of doubles, anything providing these three operations can be integrated:
+//   size(s)            number of doubles in the state
+//   data(s)            pointer to the first of them (contiguous)
+//   resize_like(d, s)  gives d the same shape as s (the only place the stepper may allocate)
+// and an extent, the size if it is known at compile time (0 otherwise) so the fixed size loops are fully unrolled
+template <typename State>
+struct state_traits;
+
+template <>
+struct state_traits<dmat43> { // Fixed two body state, 4 columns of 3 doubles stored contiguously
+	static constexpr size_t extent = 12;
+	static size_t size(const dmat43&) { return 12; }
+	static double* data(dmat43& s) { return glm::value_ptr(s); }
+	static const double* data(const dmat43& s) { return glm::value_ptr(s); }
+	static void resize_like(dmat43&, const dmat43&) {}
+};
+
+template <>
+struct state_traits<std::vector<double>> { // Dynamic state, used for N body SoA and ensemble states
+	static constexpr size_t extent = 0;
+	static size_t size(const std::vector<double>& s) { return s.size(); }
+	static double* data(std::vector<double>& s) { return s.data(); }
+	static const double* data(const std::vector<double>& s) { return s.data(); }
+	static void resize_like(std::vector<double>& d, const std::vector<double>& s) { d.resize(s.size()); } // no-op once the workspace has the right size
+};
+
+// Dormand-Prince coefficients
+// -------------------------------------------------------------------------------------------
+namespace dp_coeffs {
+	// State Step Constants
+	constexpr double a21 = 0.2;
+	constexpr double a31 = 3.0 / 40.0, a32 = 9.0 / 40.0;
+	constexpr double a41 = 44.0 / 45.0, a42 = -56.0 / 15.0, a43 = 32.0 / 9.0;
+	constexpr double a51 = 19372.0 / 6561.0, a52 = -25360.0 / 2187.0, a53 = 64448.0 / 6561.0, a54 = -212.0 / 729.0;
+	constexpr double a61 = 9017.0 / 3168.0, a62 = -355.0 / 33.0, a63 = 46732.0 / 5247.0, a64 = 49.0 / 176.0, a65 = -5103.0 / 18656.0;
+
+	// Order Constants
+	constexpr double b1 = 35.0 / 384.0, b3 = 500.0 / 1113.0, b4 = 125.0 / 192.0, b5 = -2187.0 / 6784.0, b6 = 11.0 / 84.0;
+	constexpr double b1s = 5179.0 / 57600.0, b3s = 7571.0 / 16695.0, b4s = 393.0 / 640.0, b5s = -92097.0 / 339200.0, b6s = 187.0 / 2100.0, b7s = 1.0 / 40.0;
+
+	// Dense Output Constants (Hairer's continuous extension, fourth order within the step)
+	constexpr double d1 = -12715105075.0 / 11282082432.0, d3 = 87487479700.0 / 32700410799.0, d4 = -10690763975.0 / 1880347072.0;
+	constexpr double d5 = 701980252875.0 / 199316789632.0, d6 = -1453857185.0 / 822651844.0, d7 = 69997945.0 / 29380423.0;
+}
+
+// Fused multi-AXPY
+// -------------------------------------------------------------------------------------------
+struct axpy_term { // One a_ij * k_j term of a stage combination
+	double a;
+	const double* k;
+};
+
+template <typename... Terms>
+inline double axpy_sum(size_t i, const Terms&... terms) { return (... + (terms.a * terms.k[i])); }
+
+// Fixed size states, the elements are expanded as well so there is no loop left at all
+template <size_t... I, typename... Terms>
+inline void fused_axpy_fixed(std::index_sequence<I...>, double* out, const double* y, double h, const Terms&... terms) {
+	((out[I] = y[I] + h * axpy_sum(I, terms...)), ...);
+}
+
+// out = y + h * (a_1 * k_1 + ... + a_N * k_N) in a single pass, the terms are expanded at compile time so every element is one unrolled expression
+template <size_t Extent, typename... Terms>
+inline void fused_axpy(double* out, const double* y, double h, size_t n, const Terms&... terms) {
+	if constexpr (Extent > 0) {
+		fused_axpy_fixed(std::make_index_sequence<Extent>{}, out, y, h, terms...);
+	}
+	else {
+		for (size_t i = 0; i < n; i++) {
+			out[i] = y[i] + h * axpy_sum(i, terms...);
+		}
+	}
+}
+
+// Step observer
+// -------------------------------------------------------------------------------------------
+// Called after every attempted substep with the state it left (the new state if accepted, the unchanged one if rejected)
+// The default observer is empty and inlined away, so an integration that does not watch its steps pays nothing for the hook
+struct step_event {
+	double t; // time into this integrate call at the end of the step (its start if rejected)
+	double h;
+	double err_norm;
+	bool accepted;
+	bool crashed; // the last rejection, the state is zeroed after the observer returns
+};
+
+struct no_step_observer {
+	template <typename State>
+	void operator()(const step_event&, const State&) const {}
+};
+
+struct engine_result {
+	int count;
+	int accepts;
+	int rejects;
+	double avg_h;
+	bool crash_f;
+	double covered; // time actually integrated, less than asked for if the step limit was reached
+};
+
+// Adaptive Dormand-Prince stepper over any state with state_traits
+// The system is any callable f(const State& y, State& dydt) writing the derivatives into dydt
+// Every stage buffer lives in the engine, so after the first step (which sizes them) the step loop never touches the heap
+// The fifth order solution is propagated, so the last stage is the derivative at the new state and becomes the first stage of the next step (first same as last)
+// With dense output on, every accepted step also keeps the coefficients of its continuous extension (one more pass over the stages, no
+// more evaluations), so the state anywhere inside the last call can be read back afterwards
+// The first stage carries over between integrate calls too, as long as the call starts from the state the last one left; a caller
+// whose system changed (an edited mass) calls invalidate, one that already has f(y) from elsewhere (a restart) hands it over with seed
+template <typename State>
+class dormand_prince {
+public:
+	dormand_prince(double atol, double rtol, double initial_dt)
+		: atol(atol), rtol(rtol), timestep(initial_dt) {}
+
+	// max_steps bounds the substeps of this call, so a caller with a time budget can integrate a long interval in slices
+	// observe(const step_event&, const State&) sees every substep, accepted or not
+	template <typename System, typename Observer = no_step_observer>
+	engine_result integrate(State& y, double total_dt, System&& f, double tol = 1.0, int max_steps = std::numeric_limits<int>::max(), Observer&& observe = Observer{}) {
+		using traits = state_traits<State>;
+		if (k1_valid && (traits::size(k1_at) != traits::size(y) || !std::equal(traits::data(k1_at), traits::data(k1_at) + traits::size(k1_at), traits::data(y)))) {
+			k1_valid = false; // a different state than the last call left, k1 is not its derivative
+		}
+		reserve(y);
+
+		const double safety = 0.9;
+		const double minAdapt = 0.1, maxAdapt = 5.0;
+
+		double intg_t = 0.0;
+
+		int accepts = 0, rejects = 0, count = 0;
+		double tot_h = 0.0;
+
+		double h = timestep;
+
+		bool no_crash = true;
+
+		dense_count = 0;
+		dense_cursor = 0;
+
+		while (intg_t < total_dt && no_crash && count < max_steps) {
+			if (intg_t + h > total_dt) {
+				h = total_dt - intg_t;
+			}
+
+			double err_norm = substep(y, h, f);
+			const bool accepted = err_norm < tol;
+
+			if (accepted) {
+				if (dense_on) {
+					storeDense(y, intg_t, h);
+				}
+				intg_t += h;
+				tot_h += h;
+				const double* hi = state_traits<State>::data(y_hi);
+				std::copy(hi, hi + state_traits<State>::size(y_hi), state_traits<State>::data(y)); // accepted, copied so the caller's buffer stays its own
+				std::swap(k1, k7); // f(y_hi), the first stage of the next step
+				accepts++;
+			}
+			else {
+				rejects++; // y and k1 are unchanged, the retry reuses k1
+			}
+
+			observe(step_event{ intg_t, h, err_norm, accepted, !accepted && rejects >= 50 }, static_cast<const State&>(y)); // before a crash zeroes the state
+
+			if (!accepted && rejects >= 50) {
+				no_crash = false;
+				k1_valid = false;
+				logger::warn(log_category::integrator, "[CRASH] {} rejected steps at t = {} (h = {})", rejects, intg_t, h);
+				std::fill(state_traits<State>::data(y), state_traits<State>::data(y) + state_traits<State>::size(y), 0.0);
+			}
+
+			double adapt = safety * std::pow(1.0 / (err_norm + 1e-16), 0.2);
+			adapt = std::min(std::max(adapt, minAdapt), maxAdapt);
+
+			h *= adapt;
+
+			count++;
+		}
+
+		timestep = h;
+		if (k1_valid) {
+			k1_at = y;
+		}
+
+		return engine_result{ count, accepts, rejects, (accepts > 0) ? (tot_h / accepts) : 0.0, !no_crash, intg_t };
+	}
+
+	double getAtol() const { return atol; }
+	double getRtol() const { return rtol; }
+	double getTimestep() const { return timestep; }
+
+	// Derivatives at the state the last integrate call left, free from the final stage, false if it never evaluated one or crashed
+	bool hasDerivative() const { return k1_valid; }
+	const State& getDerivative() const { return k1; }
+
+	void invalidate() { k1_valid = false; } // The system changed, the next call evaluates its first stage afresh
+
+	void setDenseOutput(bool on) { dense_on = on; } // Takes effect from the next call
+	bool hasDenseOutput() const { return dense_on && dense_count > 0; }
+
+	// The state at t into the last integrate call (0 <= t <= its covered time) from the continuous extension of the step holding t
+	// The callers read forward through the steps, so the search starts from the step the last lookup found, and only a t before it
+	// is binary searched for
+	void denseState(double t, State& out) const {
+		using traits = state_traits<State>;
+		size_t s = dense_cursor;
+		if (s >= dense_count || (s > 0 && t <= dense[s].t0)) {
+			s = static_cast<size_t>(std::upper_bound(dense.begin(), dense.begin() + dense_count, t, [](double v, const dense_step& d) { return v <= d.t0; }) - dense.begin());
+			s = (s > 0) ? s - 1 : 0;
+		}
+		while (s + 1 < dense_count && t > dense[s + 1].t0) {
+			s++;
+		}
+		dense_cursor = s;
+		const dense_step& d = dense[s];
+		const double theta = std::min(std::max((t - d.t0) / d.h, 0.0), 1.0);
+		const double theta1 = 1.0 - theta;
+		traits::resize_like(out, d.r1);
+		const size_t n = traits::size(d.r1);
+		const double* r1 = traits::data(d.r1); const double* r2 = traits::data(d.r2); const double* r3 = traits::data(d.r3);
+		const double* r4 = traits::data(d.r4); const double* r5 = traits::data(d.r5);
+		double* po = traits::data(out);
+		for (size_t i = 0; i < n; i++) {
+			po[i] = r1[i] + theta * (r2[i] + theta1 * (r3[i] + theta * (r4[i] + theta1 * r5[i])));
+		}
+	}
+
+	// dydt is f(y), the next call starting from y uses it as its first stage instead of evaluating it
+	void seed(const State& y, const State& dydt) {
+		reserve(y);
+		k1 = dydt;
+		k1_at = y;
+		k1_valid = true;
+	}
+
+	void setTolerances(double a, double r) { atol = a; rtol = r; }
+	void setTimestep(double h) { timestep = h; }
+
+private:
+	double atol;
+	double rtol;
+	double timestep;
+
+	// Preallocated stage workspace
+	State k1, k2, k3, k4, k5, k6, k7;
+	State staged_y, y_hi, y_lo; // fifth order solution (propagated) and embedded fourth order one (error estimate only)
+	State k1_at; // the state k1 is the derivative of, where the last call ended
+	bool k1_valid = false; // k1 already holds f(k1_at), carried over from the last accepted step or call
+
+	struct dense_step {
+		double t0, h; // start into the call and length
+		State r1, r2, r3, r4, r5; // y(theta) = r1 + theta (r2 + (1 - theta) (r3 + theta (r4 + (1 - theta) r5)))
+	};
+	std::vector<dense_step> dense; // kept between calls, so once it has grown to a call's steps it never allocates again
+	size_t dense_count = 0; // steps of the last call
+	mutable size_t dense_cursor = 0; // step the last denseState found, the owning thread's alone like the rest of the engine
+	bool dense_on = false;
+
+	// Continuous extension of the step just accepted from y to y_hi, before k7 becomes the next k1
+	void storeDense(const State& y, double t0, double h) {
+		using traits = state_traits<State>;
+		using namespace dp_coeffs;
+		if (dense_count == dense.size()) {
+			dense.emplace_back();
+		}
+		dense_step& d = dense[dense_count++];
+		d.t0 = t0;
+		d.h = h;
+		traits::resize_like(d.r1, y); traits::resize_like(d.r2, y); traits::resize_like(d.r3, y);
+		traits::resize_like(d.r4, y); traits::resize_like(d.r5, y);
+
+		const size_t n = traits::size(y);
+		const double* py = traits::data(y); const double* p_hi = traits::data(y_hi);
+		const double* pk1 = traits::data(k1); const double* pk3 = traits::data(k3); const double* pk4 = traits::data(k4);
+		const double* pk5 = traits::data(k5); const double* pk6 = traits::data(k6); const double* pk7 = traits::data(k7);
+		double* r1 = traits::data(d.r1); double* r2 = traits::data(d.r2); double* r3 = traits::data(d.r3);
+		double* r4 = traits::data(d.r4); double* r5 = traits::data(d.r5);
+		for (size_t i = 0; i < n; i++) {
+			const double dy = p_hi[i] - py[i];
+			const double bsp = h * pk1[i] - dy;
+			r1[i] = py[i];
+			r2[i] = dy;
+			r3[i] = bsp;
+			r4[i] = dy - h * pk7[i] - bsp;
+			r5[i] = h * (d1 * pk1[i] + d3 * pk3[i] + d4 * pk4[i] + d5 * pk5[i] + d6 * pk6[i] + d7 * pk7[i]);
+		}
+	}
+
+	void reserve(const State& like) {
+		using traits = state_traits<State>;
+		traits::resize_like(k1, like); traits::resize_like(k2, like); traits::resize_like(k3, like);
+		traits::resize_like(k4, like); traits::resize_like(k5, like); traits::resize_like(k6, like);
+		traits::resize_like(k7, like); traits::resize_like(k1_at, like);
+		traits::resize_like(staged_y, like); traits::resize_like(y_hi, like); traits::resize_like(y_lo, like);
+	}
+
+	// One Dormand-Prince step of size h from y, leaves the proposed state in y_hi and f(y_hi) in k7, and returns the error norm
+	template <typename System>
+	double substep(const State& y, double h, System& f) {
+		using traits = state_traits<State>;
+		using namespace dp_coeffs;
+
+		const size_t n = (traits::extent > 0) ? traits::extent : traits::size(y);
+		const double* py = traits::data(y);
+		const double* pk1 = traits::data(k1); const double* pk2 = traits::data(k2); const double* pk3 = traits::data(k3);
+		const double* pk4 = traits::data(k4); const double* pk5 = traits::data(k5); const double* pk6 = traits::data(k6);
+		const double* pk7 = traits::data(k7);
+		double* ps = traits::data(staged_y);
+
+		// Stage 1
+		if (!k1_valid) {
+			f(y, k1);
+			k1_valid = true;
+		}
+
+		// Stage 2
+		fused_axpy<traits::extent>(ps, py, h, n, axpy_term{ a21, pk1 });
+		f(staged_y, k2);
+
+		// Stage 3
+		fused_axpy<traits::extent>(ps, py, h, n, axpy_term{ a31, pk1 }, axpy_term{ a32, pk2 });
+		f(staged_y, k3);
+
+		// Stage 4
+		fused_axpy<traits::extent>(ps, py, h, n, axpy_term{ a41, pk1 }, axpy_term{ a42, pk2 }, axpy_term{ a43, pk3 });
+		f(staged_y, k4);
+
+		// Stage 5
+		fused_axpy<traits::extent>(ps, py, h, n, axpy_term{ a51, pk1 }, axpy_term{ a52, pk2 }, axpy_term{ a53, pk3 }, axpy_term{ a54, pk4 });
+		f(staged_y, k5);
+
+		// Stage 6
+		fused_axpy<traits::extent>(ps, py, h, n, axpy_term{ a61, pk1 }, axpy_term{ a62, pk2 }, axpy_term{ a63, pk3 }, axpy_term{ a64, pk4 }, axpy_term{ a65, pk5 });
+		f(staged_y, k6);
+
+		// Fifth order solution
+		double* p_hi = traits::data(y_hi);
+		fused_axpy<traits::extent>(p_hi, py, h, n, axpy_term{ b1, pk1 }, axpy_term{ b3, pk3 }, axpy_term{ b4, pk4 }, axpy_term{ b5, pk5 }, axpy_term{ b6, pk6 });
+
+		// Stage 7
+		f(y_hi, k7); // y_hi is the coincidental staged_y for stage 7
+
+		// Embedded fourth order solution and error norm in the same pass
+		// sqrt(1/N * sum((y_lo_ij - y_hi_ij)/(atol + rtol * max(y_ij, y_hi_ij))))
+		double* p_lo = traits::data(y_lo);
+		const double a_tol = atol, r_tol = rtol; // locals, the stores into y_lo could otherwise alias the members and force a reload every element
+		double sum = 0.0;
+		for (size_t i = 0; i < n; i++) {
+			const double lo_i = py[i] + h * (b1s * pk1[i] + b3s * pk3[i] + b4s * pk4[i] + b5s * pk5[i] + b6s * pk6[i] + b7s * pk7[i]);
+			p_lo[i] = lo_i;
+
+			const double scale = a_tol + r_tol * std::max(std::abs(py[i]), std::abs(p_hi[i]));
+			const double diff = (lo_i - p_hi[i]) / scale;
+			sum += diff * diff;
+		}
+
+		return std::sqrt(sum / n);
+	}
+};
+
+#endif
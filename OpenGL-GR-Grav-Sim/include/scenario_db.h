@@ -0,0 +1,121 @@
+#pragma once
+
+#ifndef SCENARIO_DB_H_INCLUDED
+#define SCENARIO_DB_H_INCLUDED
+
+#include <glm/glm.hpp>
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <cstddef>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using dmat43 = glm::mat<4, 3, double>;
+
+// Scenario store
+// -------------------------------------------------------------------------------------------
+// Named initial conditions kept across runs, an append only data file and a sorted index next to it (<path>.idx), both memory mapped
+// Opening maps the two files and checks the index (its checksum and the string ranges of every entry, linear in the entries but no
+// record is parsed), then reads the journal back
+//
+//   data     32 byte header: magic "PNSCEN\x1a\n", u32 version, 20 reserved
+//            then records: u32 "SCEN", u32 body bytes, u32 CRC-32 of the body, u32 flags (1: removed),
+//            body f64 x12 state, f64 m1, f64 m2, u32 name, tags and description lengths, 4 padding, the three strings, padded to 8 bytes
+//   index    48 byte header: magic "PNSCIDX\n", u32 version, u32 entries, u32 tag entries, u32 CRC-32 of everything after the header,
+//            u64 data bytes it covers, 16 reserved
+//            entries sorted by name: u64 record offset, u32 name, u32 name length, u32 tags, u32 tags length (offsets into the strings)
+//            tag entries sorted by tag then entry: u32 tag, u32 tag length, u32 entry
+//            strings
+//
+// Saving a name again appends a new record and the index points at the newest, removing appends a removed record
+// A change only appends its records: the records past the end the index covers are its journal, held in memory over the index
+// (and read back on open, the only part of the data file read through), and once the journal has grown to a sixteenth of the index
+// the two are compacted into a new index. A record cut short by a crash is dropped when the index is rebuilt from every record
+//
+// An entry is referred to by its id, the offset of its record in the data file, which never moves or changes once written, so an id
+// stays valid through any later change. Saving the name again gives the entry a new id, the old one still reads the version it was
+
+constexpr std::uint32_t scenario_version = 1;
+
+using scenario_id = std::uint64_t;
+
+struct scenario {
+	std::string name;
+	std::string tags; // comma separated, stored lower case and trimmed
+	std::string description;
+	dmat43 y{ 0.0 };
+	double m1 = 0.0, m2 = 0.0;
+};
+
+// Thread safe, any number of readers alongside one writer (the physics thread saves, the GUI browses)
+class scenario_db {
+public:
+	bool open(const std::string& path); // Opens or creates the store at path, false (logged) if it cannot be used
+	void close();
+
+	bool isOpen() const { return data.isOpen(); }
+	size_t size() const; // entries, not counting replaced or removed ones
+
+	std::string name(scenario_id id) const;
+	std::string tags(scenario_id id) const;
+	bool load(scenario_id id, scenario& out) const; // false (logged) if there is no intact record at id
+	bool load(const std::string& name, scenario& out) const; // O(log n) by name, false if there is none
+
+	bool contains(const std::string& name) const;
+	std::vector<scenario_id> withTag(const std::string& tag) const; // O(log n + matches), in name order
+	std::vector<scenario_id> search(const std::string& text) const; // entries with text in their name or tags (ignoring case), in name order
+
+	// Writing: appends the records, the index is only replaced when the journal is compacted
+	bool put(const scenario& s) { return put(std::vector<scenario>{ s }); }
+	bool put(const std::vector<scenario>& batch); // false (logged) on failure, names already stored are replaced
+	bool remove(const std::string& name); // false if there is no such entry
+	bool compactionFailed() const; // the last compaction could not write the index, the change itself is stored
+
+private:
+	struct entry { // an index entry while the index is rebuilt, or a journal entry
+		std::uint64_t offset;
+		std::string name;
+		std::string tags;
+		bool removed = false;
+	};
+
+	mutable std::shared_mutex mtx;
+	std::string data_path, index_path;
+	mapped_file data, index;
+
+	// Views into the index mapping
+	const unsigned char* entries = nullptr;
+	const unsigned char* tag_entries = nullptr;
+	const char* strings = nullptr;
+	size_t entry_count = 0, tag_count = 0, strings_size = 0;
+
+	// Records appended since the index was written, the newest of each name
+	std::vector<entry> journal;
+	std::unordered_map<std::string, size_t> journal_at; // by name
+	size_t journal_records = 0; // records past the index, replaced ones included
+	size_t live_count = 0; // entries of the index and the journal together
+	bool compact_failed = false; // tried again on the next change
+
+	bool mapIndex(); // false if the index is missing or damaged, or its journal is cut short
+	bool rebuildIndex(); // from the data records
+	bool writeIndex(std::vector<entry>& list, size_t sorted = 0); // sorts list (its first sorted entries already are by name), writes and maps the index
+	bool compact(); // the index and the journal into a new index
+	void note(entry e); // applies a record just appended (or read back) to the journal
+	bool append(const std::vector<unsigned char>& records);
+
+	std::string nameAt(size_t entry) const;
+	std::string tagsAt(size_t entry) const;
+	std::uint64_t offsetAt(size_t entry) const;
+	size_t lowerBound(const std::string& name) const;
+	bool current(const std::string& name, std::uint64_t& offset) const; // the offset of a live entry's record
+	std::vector<size_t> shadowed() const; // index entries the journal replaces or removes, ascending
+	std::vector<scenario_id> merge(const std::vector<size_t>& hits, std::vector<const entry*>& journal_hits) const; // both in name order
+	bool decode(std::uint64_t offset, scenario& out, bool* removed = nullptr) const;
+};
+
+std::string normaliseTags(const std::string& tags); // lower case, trimmed, no empty or repeated tags
+
+#endif
@@ -0,0 +1,64 @@
+#pragma once
+
+#ifndef SCHEDULER_H_INCLUDED
+#define SCHEDULER_H_INCLUDED
+
+#include <cstdint>
+
+struct scheduler_stats { // Running report of how well the scheduler is keeping time
+	std::uint64_t ticks = 0; // wake ups
+	std::uint64_t steps = 0; // steps handed out
+	std::uint64_t overruns = 0; // wake ups that found more than one step due (the previous work ran long)
+	std::uint64_t dropped = 0; // steps skipped because they were over the catch-up budget
+	double max_late = 0.0; // worst lateness of a wake up past its deadline, in seconds
+	double mean_late = 0.0; // average lateness of a wake up, in seconds
+	double drift = 0.0; // wall time given up to dropped steps, in seconds
+};
+
+enum class clock_mode {
+	realtime, // monotonic wall clock, sleeps for real
+	virtual_clock // time only moves when the scheduler sleeps or advance() is called, every run is identical
+};
+
+// Fixed rate scheduler for the physics thread
+// Deadlines are laid on a fixed grid from the anchor (never accumulated from the previous wake up), so rounding never drifts the rate
+// Work that falls behind is caught up by up to max_catchup steps per wake up, anything further behind is dropped rather than spiralling
+class fixed_step_scheduler {
+public:
+	fixed_step_scheduler(double rate_hz, int max_catchup, clock_mode mode = clock_mode::realtime);
+
+	int begin(); // Number of steps due now (0 to max_catchup), call once per wake up
+
+	void sleepUntilNext(); // Sleeps to the next deadline, returns immediately if it has already passed
+
+	void reset(); // Re-anchors the grid on now, after a pause so the paused time is not caught up
+
+	void advance(double seconds); // Moves the virtual clock forward (virtual mode only)
+
+	void setRate(double rate_hz); // Takes effect from the next deadline
+	double getRate() const { return 1e9 / static_cast<double>(period_ns); }
+	double getDt() const { return static_cast<double>(period_ns) * 1e-9; } // Seconds of wall time per step
+	double lastDeadline() const { return static_cast<double>(next_deadline_ns - period_ns) * 1e-9; } // Grid time of the last step handed out by begin, on the scheduler's clock
+
+	void setMaxCatchup(int steps) { max_catchup = (steps > 0) ? steps : 1; }
+
+	double now() const; // Seconds on the scheduler's clock
+
+	scheduler_stats getStats() const { return stats; }
+
+private:
+	clock_mode mode;
+	int max_catchup;
+	std::int64_t period_ns;
+	std::int64_t next_deadline_ns = 0;
+	std::int64_t virtual_ns = 0;
+	double late_sum = 0.0;
+
+	scheduler_stats stats;
+
+	std::int64_t clockNs() const;
+
+	void sleepUntil(std::int64_t deadline_ns);
+};
+
+#endif
@@ -8,7 +8,9 @@
 #include <string>
 #include <fstream>
 #include <sstream>
-#include <iostream>
+#include <string_view>
+#include <algorithm>
+#include "logger.h"
 
 class Shader {
 private:
@@ -17,7 +19,7 @@ private:
         std::stringstream buffer;
 
         if (!file.is_open()) {
-            std::cerr << "[ShaderProgram] Failed to open file: " << path << std::endl;
+            logger::error(log_category::io, "[ShaderProgram] Failed to open file: {}", path);
             return "";
         }
 
@@ -26,6 +28,19 @@ private:
         return buffer.str();
     }
 
+    static void logInfoLog(const char* format, const char* log) { // One record per line of a GL info log, long lines in pieces a record can hold
+        std::string_view rest(log);
+        while (!rest.empty()) {
+            const size_t end = rest.find('\n');
+            std::string_view line = rest.substr(0, end);
+            rest = (end == std::string_view::npos) ? std::string_view() : rest.substr(end + 1);
+            do {
+                logger::error(log_category::render, format, line.substr(0, log_record::text_capacity));
+                line.remove_prefix(std::min(line.size(), log_record::text_capacity));
+            } while (!line.empty());
+        }
+    }
+
     GLuint compileStage(GLenum type, const std::string& source) {
         GLuint shader = glCreateShader(type);
         const char* src = source.c_str();
@@ -39,7 +54,7 @@ private:
         if (!success) {
             char log[1024];
             glGetShaderInfoLog(shader, 1024, nullptr, log);
-            std::cerr << "[ShaderProgram] Compilation error:\n" << log << std::endl;
+            logInfoLog("[ShaderProgram] Compilation error: {}", log);
         }
 
         return shader;
@@ -57,7 +72,7 @@ private:
         if (!success) {
             char log[1024];
             glGetProgramInfoLog(ID, 1024, nullptr, log);
-            std::cerr << "[ShaderProgram] Linking error:\n" << log << std::endl;
+            logInfoLog("[ShaderProgram] Linking error: {}", log);
         }
 
         glDeleteShader(vertex);
@@ -0,0 +1,189 @@
+#pragma once
+
+#ifndef SIMULATION_H_INCLUDED
+#define SIMULATION_H_INCLUDED
+
+#include <glm/glm.hpp>
+#include "integration.h"
+#include "tracers.h"
+#include "tuning.h"
+#include "triple_buffer.h"
+#include "spsc_queue.h"
+#include "command_queue.h"
+#include "scheduler.h"
+#include "edit_history.h"
+#include "restart.h"
+#include "flight_recorder.h"
+#include "scenario_db.h"
+#include "vtk_export.h"
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+struct sim_snapshot { // Immutable frame of the simulation as published by the physics thread
+	dmat43 y{ 0.0 };
+	dmat43 dydt{ 0.0 }; // velocities and accelerations of both bodies, from the integrator's final stage
+	double m1 = 0.0;
+	double m2 = 0.0;
+	dvec3 jerk1{ 0.0 }, jerk2{ 0.0 }; // jerk of each body from the Newtonian term only, off from the true jerk by about the PN strength (dydt holds the PN accelerations)
+	double energy = 0.0; // Newtonian orbital energy
+	double physics_time = 0.0; // simulated time of the frame
+	std::uint64_t sequence = 0; // number of physics steps taken when it was published
+	std::uint64_t ticket = 0; // last GUI command applied before it was published
+	std::chrono::steady_clock::time_point published; // wall clock time it was published at
+	std::vector<float> tracer_xyz; // packed tracer positions, empty while the tracers are hidden
+	scheduler_stats timing; // physics scheduler report at the time it was published
+	double achieved_warp = 1.0; // simulated time per wall time over the last tick
+	bool lagging = false; // the last tick ran out of its compute budget before reaching the requested time warp
+};
+
+struct timed_state { // State queued ahead of the display clock for the render thread to interpolate between
+	dmat43 y;
+	dmat43 dydt; // derivatives at y, the Hermite interpolation needs them at both ends
+	double physics_time; // simulated time of the state
+	double display_time; // steady clock seconds the state is meant to be on screen at
+	bool discontinuity = false; // an edit, load or resume, the render thread jumps here rather than interpolating from the previous state
+};
+
+// One self contained simulation: its state, edit history, integrator, tuner, tracers and the physics thread stepping them
+// Nothing in here is global or touches the window, so any number of them can run side by side in one process (a parameter sweep, a split view)
+// Each instance costs one physics thread plus its own buffers, the force loops share thread_pool::shared()
+//
+// Threads: the physics thread owns the state and history, every other thread talks to it through commands (send) and the settings below,
+// and exactly one reader thread takes frames with acquireFrame / frame and interpolation states with popLookahead
+class Simulation {
+public:
+	Simulation(const state& initial, double atol = 1e-8, double rtol = 1e-10, double initial_dt = 0.05);
+
+	static constexpr double tracer_warp_limit = 64.0; // above this warp the tracers take as many substeps a tick as at it, longer and less accurate ones
+	~Simulation(); // Stops the physics thread if it is still running
+
+	Simulation(const Simulation&) = delete;
+	Simulation& operator=(const Simulation&) = delete;
+
+	void start(double warp = 1.0); // Starts the physics thread, paused or not as the simulation currently is
+	void stop(); // Stops and joins the physics thread, the state is kept so it can be started again
+	bool isRunning() const { return physics.joinable(); }
+
+	// Any thread
+	// -------------------------------------------------------------------------------------
+	std::uint64_t send(const sim_command& cmd); // Queues a command and wakes the physics thread if it is paused, returns its ticket (0 if it was dropped)
+
+	bool isPaused() const { return pause; }
+	bool checkCrash() const { return crash_flag; }
+	void clearCrash() { crash_flag = false; }
+
+	void setNewtonian(const bool flag) { newtonian = flag; } // Picked up at the start of the next step
+	bool getNewtonian() const { return newtonian; }
+
+	void setTracersEnabled(const bool flag) { tracers_enabled = flag; }
+	bool getTracersEnabled() const { return tracers_enabled; }
+	void requestTracers(const int count) { tracer_request = count; } // > 0 seeds that many tracers, < 0 clears them
+
+	void setAutoTune(const bool flag) { auto_tune = flag; }
+	bool getAutoTune() const { return auto_tune; }
+	void setDriftTarget(const double drift) { drift_target = drift; }
+	double getDriftTarget() const { return drift_target; }
+	tolerance_choice getTunedChoice() const;
+
+	void setPhysicsRate(const double rate) { physics_rate = rate; }
+	double getPhysicsRate() const { return physics_rate; }
+	void setFrameBudget(const double ms) { frame_budget_ms = ms; }
+	double getFrameBudget() const { return frame_budget_ms; }
+
+	void setSnapshotPath(const std::string& path) { snapshot_path = path; } // While stopped, the file SaveSnapshot and LoadSnapshot use
+	const std::string& getSnapshotPath() const { return snapshot_path; }
+	void setFlightPath(const std::string& path) { flight_path = path; } // While stopped, the flight recorder ring of the next start, empty for none
+	const std::string& getFlightPath() const { return flight_path; }
+	void setScenarioStore(scenario_db* store) { scenarios = store; } // While stopped, where SaveScenario saves to (not owned, may be shared)
+	void setExportPath(const std::string& prefix, int every = 10) { export_prefix = prefix; export_every = every; } // While stopped, a ParaView series of every nth step from the next start, empty for none
+	const std::string& getExportPath() const { return export_prefix; }
+
+	// Reader thread
+	// -------------------------------------------------------------------------------------
+	bool acquireFrame() { return published.acquire(); } // Moves to the latest published frame, false if there has not been a new one
+	const sim_snapshot& frame() const { return published.front(); } // Valid until the next acquireFrame
+
+	bool popLookahead(timed_state& out) { return lookahead.try_pop(out); }
+
+	// Physics thread, or any thread while it is stopped
+	// -------------------------------------------------------------------------------------
+	mathState readBackBuffer() const { return backBuffer; }
+	state readState() const { return editStack.read(); }
+
+	void debugBackBuffer() const;
+	void debugEditLog(bool flag) { editStack.debug(flag); }
+
+private:
+	mathState backBuffer; // The state the physics thread steps
+	dmat43 backDydt{ 0.0 }; // Derivatives at the back buffer state, carried over from the last step
+	bool dydt_valid = false; // false after an edit, until they are evaluated once
+	dustack editStack; // Custom data structure for undoing and redoing edits
+
+	RK45_integration integrator;
+	double fixed_atol, fixed_rtol; // Tolerances restored when tuning is switched off (physics thread)
+	tolerance_tuner tuner;
+	tolerance_choice tuned_choice; // Settings the tuner is currently using (guarded by mtx)
+	tracer_system tracers;
+
+	triple_buffer<sim_snapshot> published; // Frames handed from the physics thread to the reader without either side locking
+	spsc_queue<timed_state, 64> lookahead; // States stamped slightly ahead of the display clock, so the reader always has one on each side of the time it draws
+	command_queue commands; // Edits waiting for the physics thread
+
+	std::uint64_t sequence = 0; // Steps published so far (physics thread)
+	std::uint64_t applied_ticket = 0; // Last command applied to the Backbuffer (physics thread)
+	double sim_speed = 1.0; // Time warp, simulated years per second of wall time (physics thread)
+	std::string snapshot_path; // pnsim.snap, pnsim-<n>.snap for the nth simulation of the process
+	std::string flight_path; // pnsim.flight, numbered the same way, so side by side simulations never share a ring
+	flight_recorder recorder; // The physics thread's last substeps, open while it runs
+	scenario_db* scenarios = nullptr;
+	std::string export_prefix;
+	int export_every = 10;
+	std::unique_ptr<vtk_writer> exporter; // Open while the physics thread runs, if there is an export path
+
+	std::atomic<bool> pause = false;
+	std::atomic<bool> stopping = false;
+	std::atomic<bool> crash_flag = false; // Raised by the physics thread, cleared by whoever handles the crash
+	std::atomic<bool> newtonian = false; // Steps the bodies along their exact Kepler orbit
+	std::atomic<bool> tracers_enabled = false;
+	std::atomic<int> tracer_request = 0;
+	std::atomic<bool> auto_tune = false; // Lets the tolerance tuner pick the integrator settings instead of the fixed ones
+	std::atomic<double> drift_target = 1e-8; // Relative drift in energy and angular momentum allowed per orbit while tuning
+	std::atomic<double> physics_rate = 30.0; // Physics steps per second of wall time
+	std::atomic<double> frame_budget_ms = 8.0; // CPU time the physics thread may spend integrating per frame it publishes
+
+	mutable std::mutex mtx;
+	std::condition_variable P_cv;
+	std::thread physics;
+
+	void run(); // The physics thread
+
+	bool drainCommands(); // Applies every queued command in order, returns true if the state changed
+
+	void edit(const state& edit_state);
+	void applyEdits(const state& edit_state);
+	void setMass(int body, double mass);
+	void undoState(bool running_flag);
+	void redoState();
+
+	void seedTracers(size_t count, std::uint32_t seed); // Circumbinary disk around the current Backbuffer
+	bool saveSnapshot();
+	bool loadSnapshot();
+	bool saveScenario(const std::string& name, const std::string& tags);
+
+	const dmat43& backDerivatives(); // backDydt, evaluated only if an edit has invalidated it
+
+	void publishBackBuffer(const fixed_step_scheduler& scheduler, double achieved_warp, bool lagging);
+	void queueState(double display_time, bool discontinuity);
+};
+
+#endif
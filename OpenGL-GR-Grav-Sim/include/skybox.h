@@ -9,7 +9,8 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#include <iostream>
+#include "logger.h"
+
 #include <vector>
 #include <string>
 #include <random>
@@ -45,7 +46,7 @@ public:
 
         lightPos = randomVectorWithMagnitude(30.0f, 1000.0f);
 
-        std::cout << "Loaded skybox #" << index << std::endl;
+        logger::info(log_category::render, "Loaded skybox #{}", index);
     }
 
     void draw(Shader& skyboxShader) {
@@ -165,7 +166,7 @@ private:
 
     std::vector<fs::path> buildFaces(int index)
     {
-        std::cout << fs::current_path() << std::endl;
+        logger::debug(log_category::io, "Skybox faces relative to {}", fs::current_path().string());
 
         fs::path base = fs::path("assets") / "textures" / "skyboxes" / std::to_string(index);
 
@@ -210,8 +211,7 @@ private:
             }
             else
             {
-                std::cerr << "Failed to load cubemap face: "
-                    << faces[i] << std::endl;
+                logger::error(log_category::io, "Failed to load cubemap face: {}", faces[i].string());
             }
             stbi_image_free(data);
         }
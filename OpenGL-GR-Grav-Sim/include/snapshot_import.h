@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef SNAPSHOT_IMPORT_H_INCLUDED
+#define SNAPSHOT_IMPORT_H_INCLUDED
+
+#include "nbody.h"
+
+#include <cstddef>
+#include <string>
+
+// N-body snapshot import
+// -------------------------------------------------------------------------------------------
+// Particle sets from other codes, read straight out of a memory mapping into body_soa on the shared thread pool
+//
+//   gadget1   Gadget-2 SnapFormat 1: Fortran records (u32 length before and after) HEAD, POS, VEL, ID, MASS, gas blocks ignored
+//   gadget2   Gadget-2 SnapFormat 2: the same blocks, each after an 8 byte record holding its 4 character name and size
+//             Either byte order, single or double precision, every particle type in type order, split snapshots (<path>.0, <path>.1 ..)
+//             Converted from Gadget's kpc/h, km/s and 1e10 Msun/h to AU, AU/yr and solar masses with the header's HubbleParam
+//             Velocities are taken as stored, a cosmological snapshot's need sqrt(a) through velocity_scale
+//   csv       one body per line, x y z vx vy vz m separated by commas, spaces or tabs, # starts a comment
+//             A first line of names (x, y, z, vx, vy, vz, m or mass, any order, other columns skipped) picks the columns
+//   table     headerless binary records of x y z vx vy vz m, f64 (or f32 with table_f32), native byte order
+//
+// CSV and table values are in AU, AU/yr and solar masses unless scaled
+
+enum class snapshot_format {
+	automatic, // from the extension (.csv .txt, .bin .dat) or the first record marker
+	gadget1,
+	gadget2,
+	csv,
+	table
+};
+
+struct import_options {
+	snapshot_format format = snapshot_format::automatic;
+	bool table_f32 = false; // table records are f32
+	double length_scale = 1.0; // applied after any unit conversion
+	double velocity_scale = 1.0;
+	double mass_scale = 1.0;
+};
+
+struct import_report {
+	snapshot_format format = snapshot_format::automatic;
+	size_t bodies = 0;
+	size_t files = 0; // parts of a split Gadget snapshot
+	double time = 0.0; // the snapshot's time (Gadget header), 0 for tables
+	double seconds = 0.0; // wall time of the import
+};
+
+// Replaces out with the bodies in path, false (logged) if it cannot be read, out is left empty then
+bool importSnapshot(const std::string& path, body_soa& out, const import_options& options = import_options{}, import_report* report = nullptr);
+
+const char* formatName(snapshot_format format);
+
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+
+#ifndef SPSC_QUEUE_H_INCLUDED
+#define SPSC_QUEUE_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded single producer / single consumer ring
+// -------------------------------------------------------------------------------------------
+// Each side owns one index and only reads the other's, so pushing and popping are a load and a store with no read-modify-write
+// A full ring refuses the push instead of waiting, the producer decides what to do with the value
+template <typename T, size_t Capacity>
+class spsc_queue {
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "spsc_queue capacity must be a power of two");
+
+public:
+	bool try_push(const T& value) { // Producer thread only, false if the ring is full
+		const size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head_cache == Capacity) {
+			head_cache = head.load(std::memory_order_acquire); // only refreshed when the ring looks full, so the consumer's line is rarely pulled over
+			if (t - head_cache == Capacity) {
+				return false;
+			}
+		}
+		slots[t & mask] = value;
+		tail.store(t + 1, std::memory_order_release); // hands the slot to the consumer
+		return true;
+	}
+
+	bool try_pop(T& out) { // Consumer thread only, false if the ring is empty
+		const size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail_cache) {
+			tail_cache = tail.load(std::memory_order_acquire);
+			if (h == tail_cache) {
+				return false;
+			}
+		}
+		out = slots[h & mask];
+		head.store(h + 1, std::memory_order_release); // frees the slot for the producer
+		return true;
+	}
+
+	bool empty() const { // Consumer thread only
+		return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+	}
+
+private:
+	static constexpr size_t mask = Capacity - 1;
+
+	T slots[Capacity];
+
+	alignas(64) std::atomic<size_t> tail{ 0 }; // written by the producer
+	size_t head_cache = 0; // producer's last look at head
+	alignas(64) std::atomic<size_t> head{ 0 }; // written by the consumer
+	size_t tail_cache = 0; // consumer's last look at tail
+};
+
+#endif
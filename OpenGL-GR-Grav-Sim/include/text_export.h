@@ -0,0 +1,110 @@
+#pragma once
+
+#ifndef TEXT_EXPORT_H_INCLUDED
+#define TEXT_EXPORT_H_INCLUDED
+
+#include "spsc_queue.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Text export
+// -------------------------------------------------------------------------------------------
+// Doubles as the shortest text that reads back to the same value (std::to_chars), so a CSV round trips exactly through strtod
+// or any other correctly rounded parser. Integral values print without a fraction, nan and inf as nan, inf and -inf
+
+namespace text_export {
+	constexpr size_t max_number = 24; // the longest shortest form, -2.2250738585072014e-308
+
+	char* appendNumber(char* out, double value); // out needs max_number bytes, returns the end
+	char* appendRow(char* out, const double* values, size_t count); // comma separated and a newline, out needs rowBytes(count)
+
+	constexpr size_t rowBytes(size_t count) { return count * (max_number + 1) + 1; }
+}
+
+// CSV writer
+// -------------------------------------------------------------------------------------------
+// Rows of doubles to a CSV file, formatted and written off the producer's thread
+//
+// The producer copies each row into a block from a fixed pool and hands full blocks to the writer, a drain on the I/O lane (thread_pool.h), which formats a
+// whole block into one reusable buffer (slices of rows in parallel on the shared thread pool) and writes it with a single
+// unbuffered fwrite. A push only waits when the disk has fallen the whole pool behind (counted by stalls), rows are never dropped
+
+struct csv_options {
+	size_t block_rows = 8192; // rows handed to the writer at once
+	size_t blocks = 4; // blocks in flight, 2 to 16
+};
+
+class csv_writer {
+public:
+	explicit csv_writer(const csv_options& options = csv_options{});
+	~csv_writer(); // closes the file if it is still open
+
+	csv_writer(const csv_writer&) = delete;
+	csv_writer& operator=(const csv_writer&) = delete;
+
+	// Starts writing path, false (logged) if it cannot be opened
+	// header names the columns ("t,x,y"), every row has one value per name. Append carries on an existing file, whose header
+	// is then not written again
+	bool open(const std::string& path, const std::string& header, bool append = false);
+	bool close(); // Writes the rows still queued, false if any write failed
+
+	bool isOpen() const { return writer != nullptr; }
+	size_t columns() const { return column_count; }
+
+	// Producer thread only
+	void push(const double* row); // one value per column
+	bool flush(); // Waits until every row pushed is in the file, false if any write failed
+
+	std::uint64_t rows() const { return rows_written.load(std::memory_order_relaxed); }
+	std::uint64_t bytes() const { return bytes_written.load(std::memory_order_relaxed); }
+	std::uint64_t stalls() const { return push_stalls.load(std::memory_order_relaxed); }
+
+private:
+	struct block {
+		size_t rows = 0;
+		std::vector<double> values; // block_rows * columns, row major
+	};
+
+	static constexpr size_t max_blocks = 16;
+
+	csv_options options;
+	std::vector<block> pool;
+	std::unique_ptr<spsc_queue<std::uint32_t, max_blocks>> free_blocks; // writer to producer
+	std::unique_ptr<spsc_queue<std::uint32_t, max_blocks>> ready_blocks; // producer to writer
+	size_t column_count = 0;
+
+	// Producer only
+	block* current = nullptr;
+	std::uint32_t current_index = 0;
+	std::uint64_t rows_pushed = 0;
+
+	std::string path;
+	std::FILE* file = nullptr;
+	std::vector<char> text; // writer, one formatted block
+	std::vector<size_t> slice_ends; // writer, where each slice's text ends before the slices are closed up
+	std::atomic<bool> failed{ false };
+
+	std::unique_ptr<io_drain> writer; // open while the file is
+
+	std::mutex done_mtx; // a block returned to the pool, for a producer waiting on one or on flush
+	std::condition_variable done_cv;
+	std::atomic<std::uint64_t> rows_done{ 0 }; // rows the writer is finished with, written or not
+
+	std::atomic<std::uint64_t> rows_written{ 0 };
+	std::atomic<std::uint64_t> bytes_written{ 0 };
+	std::atomic<std::uint64_t> push_stalls{ 0 };
+
+	void handOver(); // passes the current block to the writer
+	void run(); // One pass of the writer, every block handed over
+	void writeBlock(const block& b);
+};
+
+#endif
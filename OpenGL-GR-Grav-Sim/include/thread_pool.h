@@ -0,0 +1,230 @@
+#pragma once
+
+#ifndef THREAD_POOL_H_INCLUDED
+#define THREAD_POOL_H_INCLUDED
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <exception>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+class thread_pool;
+
+struct pool_options {
+	unsigned int workers = 0; // worker threads, 0 for one less than the hardware threads (the thread waiting on the work helps run it)
+	bool pin_threads = false; // pins worker i to logical CPU i + 1, leaving CPU 0 to the main and physics threads
+	int spin_limit = 2048; // failed steal rounds before an idle worker goes to sleep, higher keeps latency down for bursty work at the cost of idle CPU
+};
+
+// A set of tasks that can be waited on and cancelled together
+// -------------------------------------------------------------------------------------------
+class task_group {
+public:
+	explicit task_group(thread_pool& pool) : pool(pool) {}
+	~task_group(); // Waits for anything still running, an exception nobody waited for is dropped
+
+	task_group(const task_group&) = delete;
+	task_group& operator=(const task_group&) = delete;
+
+	template <typename Fn>
+	void run(Fn&& fn);
+
+	// Runs this group's queued tasks on the calling thread, then sleeps until the ones running elsewhere have finished and rethrows the first exception one of them threw
+	// Tasks of other groups are left alone, a waiter must not pick up somebody else's long job
+	void wait();
+
+	void cancel() { cancelled.store(true, std::memory_order_relaxed); } // Tasks not started yet are skipped, running ones can poll isCancelled
+	bool isCancelled() const { return cancelled.load(std::memory_order_relaxed); }
+
+private:
+	friend class thread_pool;
+
+	thread_pool& pool;
+	std::atomic<size_t> pending{ 0 };
+	std::atomic<bool> cancelled{ false };
+	std::mutex done_mtx; // the last task to finish notifies under it, so the group cannot be destroyed while it does
+	std::condition_variable done_cv;
+	std::mutex error_mtx;
+	std::exception_ptr error;
+
+	void finish(std::exception_ptr failure);
+};
+
+// Work stealing thread pool
+// -------------------------------------------------------------------------------------------
+// Every worker keeps its own deque: it pushes and pops its own tasks at the back (newest first, still warm in cache) while idle workers steal from the front (oldest first, usually the largest pieces of work)
+// Tasks submitted from outside the pool go into a shared injection queue
+// Long running loops (the physics and render threads) stay on their own threads, the pool is for work that finishes
+class thread_pool {
+public:
+	explicit thread_pool(const pool_options& options = pool_options{});
+	~thread_pool();
+
+	thread_pool(const thread_pool&) = delete;
+	thread_pool& operator=(const thread_pool&) = delete;
+
+	// The process wide pool, created on first use with the options last passed to configure
+	static thread_pool& shared();
+	static bool configure(const pool_options& options); // false if the shared pool is already running
+
+	void submit(std::function<void()> fn, task_group* group = nullptr); // Any thread, fire and forget unless a group is given
+
+	bool runOne(const task_group* group = nullptr); // Runs one queued task (of group, if given) on the calling thread if there is any, used by waiters so they help instead of blocking
+
+	unsigned int concurrency() const { return static_cast<unsigned int>(workers.size()) + 1; } // workers plus the waiting thread
+
+	// Calls fn(begin, end) over chunks of [first, last) of at least grain items, on the pool and the calling thread, returns once all are done
+	// A cancelled group stops chunks that have not started yet
+	template <typename Fn>
+	void parallel_for(size_t first, size_t last, size_t grain, Fn&& fn, task_group* cancel = nullptr);
+
+	// Maps every chunk to a partial result with map(begin, end) and folds the partials with reduce in chunk order, so the result does not depend on which thread ran what
+	template <typename T, typename Map, typename Reduce>
+	T parallel_reduce(size_t first, size_t last, size_t grain, T identity, Map&& map, Reduce&& reduce);
+
+private:
+	struct task {
+		std::function<void()> fn;
+		task_group* group = nullptr;
+	};
+
+	struct alignas(64) worker_queue {
+		std::mutex mtx;
+		std::deque<task> tasks;
+	};
+
+	pool_options options;
+	std::vector<std::unique_ptr<worker_queue>> queues;
+	std::vector<std::thread> workers;
+
+	std::mutex inject_mtx;
+	std::deque<task> injected;
+
+	std::atomic<size_t> queued{ 0 }; // tasks sitting in any queue
+	std::atomic<unsigned int> sleeping{ 0 };
+	std::atomic<bool> stopping{ false };
+	std::mutex sleep_mtx;
+	std::condition_variable sleep_cv;
+
+	void workerLoop(unsigned int index);
+
+	bool findTask(int index, task& out, const task_group* group = nullptr); // own deque, then the injection queue, then the other workers (only group's tasks, if given)
+
+	void execute(task& t);
+
+	void wake();
+
+	size_t chunkCount(size_t items, size_t grain) const;
+
+	static void pinThread(std::thread& thread, unsigned int cpu);
+};
+
+// I/O lane
+// -------------------------------------------------------------------------------------------
+// The file writers drain on one thread of their own beside the pool: a drain spends most of its time blocked in a write, and a worker stuck
+// there would hold up every parallel_for waiting on it. The lane runs one drain at a time, so each writer's file is only touched by one thread
+// The thread is started by the first drain made and never stopped, writers owned by statics still close while the process exits
+class io_drain {
+public:
+	// fn takes everything its producer has queued so far. With a period the lane also runs it that long after its last run, for producers
+	// that only schedule once a batch has built up
+	explicit io_drain(std::function<void()> fn, std::chrono::milliseconds period = std::chrono::milliseconds{ 0 });
+	~io_drain(); // Stops it
+
+	io_drain(const io_drain&) = delete;
+	io_drain& operator=(const io_drain&) = delete;
+
+	void schedule(); // Any thread, never waits. Asks for a run soon, free while one is already asked for
+	void wait(); // Returns once a run started after the call has finished, runs it directly if called from the lane itself
+	void stop(); // Waits for a run in progress, no more start after it and wait returns straight away
+
+private:
+	friend class io_lane;
+
+	std::function<void()> fn;
+	std::chrono::milliseconds period;
+	std::atomic<bool> requested{ false };
+	// Guarded by the lane's mutex
+	std::chrono::steady_clock::time_point due;
+	std::uint64_t started = 0, finished = 0;
+	bool stopped = false;
+};
+
+// Template Definitions
+// -------------------------------------------------------------------------------------------
+template <typename Fn>
+void task_group::run(Fn&& fn) {
+	pending.fetch_add(1, std::memory_order_relaxed);
+	pool.submit(std::function<void()>(std::forward<Fn>(fn)), this);
+}
+
+template <typename Fn>
+void thread_pool::parallel_for(size_t first, size_t last, size_t grain, Fn&& fn, task_group* cancel) {
+	if (last <= first) {
+		return;
+	}
+	const size_t n = last - first;
+	const size_t chunks = chunkCount(n, grain);
+	if (chunks == 1) {
+		fn(first, last); // too small to be worth a task
+		return;
+	}
+	const size_t chunk = (n + chunks - 1) / chunks;
+
+	task_group group(*this);
+	for (size_t c_i = 1; c_i < chunks; c_i++) {
+		const size_t begin = first + c_i * chunk;
+		const size_t end = std::min(last, begin + chunk);
+		if (begin >= end) {
+			break;
+		}
+		group.run([&fn, cancel, begin, end] {
+			if (!cancel || !cancel->isCancelled()) {
+				fn(begin, end);
+			}
+		});
+	}
+
+	if (!cancel || !cancel->isCancelled()) {
+		fn(first, std::min(last, first + chunk)); // the calling thread takes the first chunk
+	}
+	group.wait();
+}
+
+template <typename T, typename Map, typename Reduce>
+T thread_pool::parallel_reduce(size_t first, size_t last, size_t grain, T identity, Map&& map, Reduce&& reduce) {
+	if (last <= first) {
+		return identity;
+	}
+	const size_t n = last - first;
+	const size_t chunks = chunkCount(n, grain);
+	const size_t chunk = (n + chunks - 1) / chunks;
+
+	std::vector<T> partials(chunks, identity);
+	parallel_for(0, chunks, 1, [&](size_t begin, size_t end) {
+		for (size_t c_i = begin; c_i < end; c_i++) {
+			const size_t b = first + c_i * chunk;
+			const size_t e = std::min(last, b + chunk);
+			if (b < e) {
+				partials[c_i] = map(b, e);
+			}
+		}
+	});
+
+	T result = identity;
+	for (const T& partial : partials) {
+		result = reduce(result, partial);
+	}
+	return result;
+}
+
+#endif
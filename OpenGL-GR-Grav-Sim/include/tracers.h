@@ -0,0 +1,59 @@
+#pragma once
+
+#ifndef TRACERS_H_INCLUDED
+#define TRACERS_H_INCLUDED
+
+#include <glm/glm.hpp>
+#include "integration.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+// Massless test particles moving in the field of the binary (the restricted problem)
+// The binary is never influenced by them, so they are advanced after each binary step along the integrator's dense output of it
+class tracer_system {
+public:
+	tracer_system(double max_dt, double softening, unsigned int threads = 0);
+
+	// Scatters count particles on circular orbits around the binary's centre of mass, between r_inner and r_outer, in the binary's orbital plane
+	void seedDisk(size_t count, double r_inner, double r_outer, const dmat43& binary, double m1, double m2, std::uint32_t seed);
+
+	void clear();
+
+	// Advances every particle over the binary step y0 -> y1 of length dt that binary has just taken, along its dense output
+	// (a cubic Hermite through the ends if dense output was off for the step)
+	// max_substeps bounds the cost of a long step (0 for no bound), its substeps are then longer than max_dt and less accurate
+	void advance(const RK45_integration& binary, const dmat43& y0, const dmat43& y1, double m1, double m2, double dt, int max_substeps = 0);
+
+	// Copies the particle positions into a packed float xyz buffer for rendering
+	void copyPositions(std::vector<float>& out) const;
+
+	size_t size() const { return x.size(); }
+	double getMaxDt() const { return max_dt; }
+	std::uint32_t getSeed() const { return seed; }
+
+private:
+	double max_dt; // largest substep the particles are integrated with
+	double softening; // Plummer softening length, keeps particles passing through a body finite
+	unsigned int threads; // most chunks a step is split into, 0 for the shared pool's concurrency
+	std::uint32_t seed = 0;
+
+	// Structure of arrays particle storage
+	std::vector<double> x, y, z;
+	std::vector<double> vx, vy, vz;
+
+	std::vector<dvec3> p1, p2; // binary positions at each substep boundary of the step being advanced, kept so a step never allocates
+
+	void kick(size_t begin, size_t end, const dvec3& p1, const dvec3& p2, double gm1, double gm2, double dt);
+
+	void drift(size_t begin, size_t end, double dt);
+
+	template <typename Fn>
+	void parallelChunks(Fn&& fn);
+};
+
+#endif
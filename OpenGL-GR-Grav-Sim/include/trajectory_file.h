@@ -0,0 +1,163 @@
+#pragma once
+
+#ifndef TRAJECTORY_FILE_H_INCLUDED
+#define TRAJECTORY_FILE_H_INCLUDED
+
+#include <glm/glm.hpp>
+#include "spsc_queue.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+// Trajectory files
+// -------------------------------------------------------------------------------------------
+// Columnar, compressed trajectories for long runs, a few bits per value where raw doubles would take 64
+//
+//   header   32 bytes: magic "PNTRAJ\x1a\n", u32 version, u32 columns, u32 rows per chunk, 12 reserved
+//   chunks   each a 40 byte chunk header (u32 "CHNK", u32 rows, u32 payload bytes, u32 CRC-32 of the payload, f64 first time, f64 last time,
+//            u64 first row) followed by the columns' byte offsets into the payload (u32 each) and the payload
+//   index    u64 offset, u64 first row, u32 rows, u32 chunk bytes, f64 first time, f64 last time per chunk
+//   trailer  u64 index offset, u32 chunk count, u32 "TIDX"
+//
+// Every column of a chunk is its own Gorilla stream: the first value raw, then each value XORed with the one before it
+// (one bit if unchanged, otherwise the meaningful bits between its leading and trailing zeros, reusing the previous window when it fits)
+// Consecutive states of a smooth orbit share sign, exponent and the top of the mantissa, so most of those bits are zero
+// A file cut short by a crash has no index, the reader rebuilds it by walking the chunk headers and keeps every complete chunk
+
+constexpr std::uint32_t trajectory_version = 1;
+constexpr int trajectory_columns = 15; // t, the 12 state values (x1 y1 z1 vx1 vy1 vz1 x2 .. vz2), m1, m2
+
+struct trajectory_sample {
+	double t = 0.0;
+	dmat43 y{ 0.0 };
+	double m1 = 0.0, m2 = 0.0;
+};
+
+struct trajectory_chunk_info {
+	std::uint64_t offset = 0; // of the chunk header in the file
+	std::uint64_t first_row = 0;
+	std::uint32_t rows = 0;
+	std::uint32_t bytes = 0; // chunk header, column offsets and payload
+	double t_first = 0.0, t_last = 0.0;
+};
+
+// Writer
+// -------------------------------------------------------------------------------------------
+// push is called by the physics thread and only ever copies the sample into a ring, a drain on the I/O lane (thread_pool.h) compresses and writes the chunks
+// A full ring drops the sample rather than wait (counted by dropped), which only happens if the disk cannot keep up for a whole ring,
+// unless the writer was made to wait: then the push waits for the writer to make room (counted by stalls) and nothing is ever dropped
+class trajectory_writer {
+public:
+	// wait: for batch runs that would rather slow down than lose samples
+	explicit trajectory_writer(std::uint32_t chunk_rows = 4096, bool wait = false);
+	~trajectory_writer(); // closes the file if it is still open
+
+	trajectory_writer(const trajectory_writer&) = delete;
+	trajectory_writer& operator=(const trajectory_writer&) = delete;
+
+	// Starts writing path, false (logged) if the file cannot be created
+	// append carries on an existing file after its last complete chunk (a resumed run), otherwise it is truncated
+	bool open(const std::string& path, bool append = false);
+	bool close(); // Writes what is left, the index and the trailer, false if any write failed
+
+	bool isOpen() const { return writer != nullptr; }
+
+	// Producer thread only
+	bool push(const trajectory_sample& sample);
+	bool push(double t, const dmat43& y, double m1, double m2) { return push(trajectory_sample{ t, y, m1, m2 }); }
+
+	std::uint64_t written() const { return rows_written.load(std::memory_order_relaxed); } // rows in chunks already on disk
+	std::uint64_t dropped() const { return rows_dropped.load(std::memory_order_relaxed); }
+	std::uint64_t stalls() const { return push_stalls.load(std::memory_order_relaxed); } // pushes that waited for room
+	std::uint64_t bytes() const { return bytes_written.load(std::memory_order_relaxed); }
+
+private:
+	static constexpr size_t ring_capacity = 4096;
+	static constexpr unsigned int wake_interval = ring_capacity / 4; // a fast producer schedules the writer this often instead of waiting for its period
+
+	std::uint32_t chunk_rows;
+	bool wait;
+	std::unique_ptr<spsc_queue<trajectory_sample, ring_capacity>> ring; // about half a megabyte, kept off the stack of whoever owns the writer
+	unsigned int since_wake = 0; // producer only
+
+	std::FILE* file = nullptr;
+	bool failed = false; // a write failed (writer, read after the close)
+
+	std::unique_ptr<io_drain> writer; // open while the file is
+
+	std::mutex done_mtx; // room made in the ring, for a producer waiting on it
+	std::condition_variable done_cv;
+
+	std::atomic<std::uint64_t> rows_written{ 0 };
+	std::atomic<std::uint64_t> rows_dropped{ 0 };
+	std::atomic<std::uint64_t> push_stalls{ 0 };
+	std::atomic<std::uint64_t> bytes_written{ 0 };
+
+	// Writer
+	std::vector<double> columns[trajectory_columns]; // rows of the chunk being filled, column major
+	std::vector<unsigned char> payload; // reused for every chunk, so once it has grown the writer never allocates
+	std::vector<trajectory_chunk_info> index;
+	std::uint64_t offset = 0;
+	std::uint64_t rows_total = 0;
+
+	void drain(); // One pass of the writer, the samples in the ring into chunks
+	void finish(); // The last chunk, the index and the trailer
+	void notifyRoom(); // wakes a producer waiting for room in the ring
+	void append(const trajectory_sample& sample);
+	void flushChunk();
+	void writeBytes(const void* data, size_t size);
+};
+
+// Reader
+// -------------------------------------------------------------------------------------------
+// Maps the file and decodes chunks on demand, seeking by time is a binary search of the index and one chunk decode
+class trajectory_reader {
+public:
+	bool open(const std::string& path); // false (logged) if it is not a trajectory file, a missing index is rebuilt
+	void close();
+
+	std::uint64_t rows() const { return total_rows; }
+	size_t chunks() const { return index.size(); }
+	const std::vector<trajectory_chunk_info>& chunkIndex() const { return index; }
+	bool recovered() const { return rebuilt; } // the index was rebuilt, the file was not closed properly
+	std::uint64_t dataEnd() const; // byte just past the last complete chunk
+
+	size_t findChunk(double t) const; // Chunk holding time t, the first or last one if t is outside the file
+	bool readChunk(size_t chunk, std::vector<trajectory_sample>& out) const; // Replaces out with the chunk's rows, false (logged) if it is corrupt
+	bool readColumn(size_t chunk, int column, std::vector<double>& out) const; // One column of a chunk, without decoding the others
+	bool sampleAt(double t, trajectory_sample& out) const; // The last row at or before t (the first row if t is before it)
+
+private:
+	mapped_file file;
+	std::vector<trajectory_chunk_info> index;
+	std::uint64_t total_rows = 0;
+	std::uint32_t columns = 0;
+	bool rebuilt = false;
+
+	struct chunk_view {
+		const unsigned char* payload = nullptr;
+		std::uint32_t size = 0;
+		std::uint32_t rows = 0;
+		std::uint32_t offsets[trajectory_columns + 1] = {}; // where each column starts, the last one is the payload size
+	};
+
+	bool rebuildIndex();
+	bool view(size_t chunk, chunk_view& out) const; // false (logged) if the chunk is damaged
+};
+
+// Writes a trajectory file as CSV, the same columns as the headless runner's states file
+bool trajectoryToCsv(const std::string& path, std::ostream& out);
+
+#endif
@@ -0,0 +1,52 @@
+#pragma once
+
+#ifndef TRIPLE_BUFFER_H_INCLUDED
+#define TRIPLE_BUFFER_H_INCLUDED
+
+#include <atomic>
+
+// Lock free single producer / single consumer triple buffer
+// The writer fills its back slot and publishes it by swapping it with the middle slot, the reader swaps its front slot with the middle slot whenever a fresher one is waiting
+// Neither side ever waits for the other: the writer may publish any number of frames the reader never sees, and the reader keeps the last complete frame until a newer one exists
+template <typename T>
+class triple_buffer {
+public:
+	triple_buffer() = default;
+	explicit triple_buffer(const T& initial) {
+		slots[0] = slots[1] = slots[2] = initial;
+	}
+
+	// Writer side
+	// -------------------------------------------------------------------------------------
+	T& back() { return slots[back_i]; } // The slot only the writer touches, fill it and then publish it
+
+	void publish() {
+		unsigned int previous = middle.exchange(back_i | fresh_bit, std::memory_order_acq_rel); // release makes the slot's contents visible to the reader's acquire
+		back_i = previous & index_mask; // the old middle (never the reader's front) becomes the next back slot
+	}
+
+	// Reader side
+	// -------------------------------------------------------------------------------------
+	bool acquire() { // Moves to the latest published slot, false if there has not been one since the last acquire
+		if (!(middle.load(std::memory_order_relaxed) & fresh_bit)) {
+			return false;
+		}
+		unsigned int previous = middle.exchange(front_i, std::memory_order_acq_rel);
+		front_i = previous & index_mask;
+		return true;
+	}
+
+	const T& front() const { return slots[front_i]; } // The latest complete slot, valid until the next acquire
+
+private:
+	static constexpr unsigned int index_mask = 0x3;
+	static constexpr unsigned int fresh_bit = 0x4; // set while the middle slot holds a frame the reader has not taken yet
+
+	T slots[3];
+
+	alignas(64) std::atomic<unsigned int> middle{ 1 }; // shared index, kept on its own cache line so the two sides do not false share their private indices with it
+	alignas(64) unsigned int back_i = 0; // writer only
+	alignas(64) unsigned int front_i = 2; // reader only
+};
+
+#endif
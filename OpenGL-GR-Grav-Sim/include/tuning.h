@@ -0,0 +1,106 @@
+#pragma once
+
+#ifndef TUNING_H_INCLUDED
+#define TUNING_H_INCLUDED
+
+#include <glm/glm.hpp>
+#include "integration.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+
+using dmat43 = glm::mat<4, 3, double>;
+
+struct tolerance_choice { // Integrator settings picked for a scenario
+	double atol = 1e-8;
+	double rtol = 1e-10;
+	bool kepler = false; // the analytic Kepler propagation alone meets the target
+	double drift = 0.0; // measured relative drift per orbit of these settings
+	bool calibrated = false; // false if the calibration could not finish within its budget
+};
+
+// Picks the loosest integrator settings whose relative drift in energy and angular momentum per orbit stays under a target
+// The drift is measured against a tightly integrated reference over (up to) one orbit, so the physical decay from the 2.5PN term is not mistaken for error
+// Choices are cached per scenario and verified again every few orbits, as an inspiralling orbit slowly becomes harder to integrate
+// Calibrations and verifications run on the shared thread pool on a copy of the state, one at a time, so the physics thread never waits on one
+class tolerance_tuner {
+public:
+	// target_drift: allowed relative drift per orbit
+	// recheck_orbits: orbits between verifications of the current choice
+	// step_budget: most RK45 substeps a single calibration run may take before it is abandoned
+	tolerance_tuner(double target_drift, double recheck_orbits = 10.0, int step_budget = 200000);
+	~tolerance_tuner(); // Abandons a calibration still running
+
+	tolerance_tuner(const tolerance_tuner&) = delete;
+	tolerance_tuner& operator=(const tolerance_tuner&) = delete;
+
+	// Called before every physics step, never blocks: what needs measuring is handed to the pool and applied by the first update after it finishes
+	// Until then the integrator keeps the settings it has. Returns true if the integrator's settings were changed
+	bool update(const mathState& s, double physics_dt, RK45_integration& integrator);
+
+	// Runs the whole ladder of candidates on s, loosest first
+	tolerance_choice calibrate(const mathState& s, double physics_dt) const;
+
+	void setTarget(double drift); // Also forgets every cached choice, they were made for the old target
+
+	double getTarget() const { return target_drift; }
+
+	tolerance_choice getChoice() const { return choice; }
+
+	void reset(); // Forgets the cached choices and recalibrates on the next update
+
+	void cancel(); // Abandons a calibration or verification still running and waits for it to stop, its result is never applied
+
+	bool busy() const { return job_running; }
+
+private:
+	struct job_result { // What a calibration or verification hands back to update
+		std::uint64_t key = 0;
+		tolerance_choice choice;
+		bool verification = false;
+		bool changed = false; // the settings have to change, false for a verification the current choice passed
+		bool measured = false; // false if a verification could not afford its reference run, nothing is known then
+		double check_interval = 0.0;
+	};
+
+	double target_drift;
+	double recheck_orbits;
+	int step_budget;
+
+	std::unordered_map<std::uint64_t, tolerance_choice> cache; // Scenario key -> choice
+	std::uint64_t current_key = 0;
+	bool has_choice = false;
+	tolerance_choice choice;
+	double since_check = 0.0; // simulated time since the choice was last verified
+	double check_interval = 0.0; // simulated time between verifications
+
+	std::unique_ptr<task_group> job; // The calibration or verification on the shared pool, made on first use so the pool is configured by then
+	bool job_running = false; // update's thread
+	std::atomic<bool> job_done{ false }; // raised by the task once job_out is written
+	job_result job_out;
+
+	void launch(const mathState& s, double physics_dt, std::uint64_t key, bool verification);
+
+	bool apply(RK45_integration& integrator); // Takes in a finished job's result, true if the integrator's settings were changed
+
+	job_result verify(const mathState& s, double physics_dt, const tolerance_choice& current) const; // The periodic check of the current choice
+
+	bool abandoned() const { return job && job->isCancelled(); }
+
+	static std::uint64_t scenarioKey(const mathState& s, double physics_dt);
+
+	static double orbitalPeriod(const mathState& s); // 0 for an unbound orbit
+
+	// Integrates s over the calibration window with the given settings, false if it crashed or ran over the budget
+	bool run(const mathState& s, int steps, double physics_dt, const tolerance_choice& settings, dmat43& out) const;
+
+	// Relative drift per orbit of the candidate run against the reference run
+	double measure(const mathState& s, int steps, double physics_dt, const tolerance_choice& settings, const dmat43& reference) const;
+
+	int windowSteps(const mathState& s, double physics_dt) const;
+};
+
+#endif
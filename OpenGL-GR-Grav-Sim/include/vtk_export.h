@@ -0,0 +1,111 @@
+#pragma once
+
+#ifndef VTK_EXPORT_H_INCLUDED
+#define VTK_EXPORT_H_INCLUDED
+
+#include <glm/glm.hpp>
+#include "spsc_queue.h"
+#include "nbody.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using dmat43 = glm::mat<4, 3, double>;
+
+// VTK / ParaView export
+// -------------------------------------------------------------------------------------------
+// A time series ParaView opens directly: <prefix>.pvd lists the frames, each frame is <prefix>_000000.vtp
+//
+//   .vtp   XML PolyData, one vertex per body: points, PointData velocity, acceleration and mass, FieldData TimeValue and the
+//          diagnostics named at open (ASCII, one value each), the arrays as appended raw binary in the host's byte order
+//          (u64 byte count before each, header_type UInt64)
+//   .pvd   a Collection of DataSet timestep / file entries, rewritten past the last entry after every frame so it is complete
+//          while the run is still going
+//
+// The producer fills a frame from a fixed pool and hands its number to the writer, a drain on the I/O lane (thread_pool.h), the frames' buffers keep their capacity
+// so once every frame has been used at the largest body count a push neither allocates nor waits
+// With no free frame the push is dropped (counted by dropped), the disk has fallen a whole pool behind, unless the options say to wait
+
+struct vtk_options {
+	int every = 1; // pushes between exported frames
+	size_t frames = 8; // frames in flight, 2 to 32
+	bool wait = false; // a push waits for a free frame instead of dropping, for batch runs that would rather slow down than lose frames
+};
+
+class vtk_writer {
+public:
+	explicit vtk_writer(const vtk_options& options = vtk_options{});
+	~vtk_writer(); // closes the series if it is still open
+
+	vtk_writer(const vtk_writer&) = delete;
+	vtk_writer& operator=(const vtk_writer&) = delete;
+
+	// Starts writing <prefix>.pvd, false (logged) if it cannot be created
+	// fields names the diagnostics every push carries, append carries on the frames of an existing series (a resumed run)
+	bool open(const std::string& prefix, const std::vector<std::string>& fields, bool append = false);
+	bool close(); // Writes the frames still queued, false if any write failed
+
+	bool isOpen() const { return writer != nullptr; }
+
+	// Producer thread only, false if the push was not one to export or was dropped
+	// fields holds one value per field named at open, nullptr for zeros
+	bool push(double t, const dmat43& y, const dmat43& dydt, double m1, double m2, const double* fields = nullptr); // the two body state
+	bool push(double t, const body_soa& bodies, const double* fields = nullptr);
+
+	std::uint64_t written() const { return frames_written.load(std::memory_order_relaxed); }
+	std::uint64_t dropped() const { return frames_dropped.load(std::memory_order_relaxed); }
+	std::uint64_t bytes() const { return bytes_written.load(std::memory_order_relaxed); }
+
+private:
+	struct frame {
+		double t = 0.0;
+		size_t n = 0; // bodies
+		std::vector<double> points, velocity, acceleration; // xyz interleaved
+		std::vector<double> mass;
+		std::vector<double> fields;
+	};
+
+	static constexpr size_t max_frames = 32;
+
+	vtk_options options;
+	std::vector<frame> pool;
+	std::unique_ptr<spsc_queue<std::uint32_t, max_frames>> free_frames; // writer to producer
+	std::unique_ptr<spsc_queue<std::uint32_t, max_frames>> ready_frames; // producer to writer
+	std::uint64_t since_export = 0; // producer only
+	size_t ready_since_wake = 0; // producer only
+
+	std::string prefix, pvd_path, base_name; // base_name: the prefix without its directory, as the .pvd refers to the frames
+	std::vector<std::string> field_names;
+	std::FILE* pvd = nullptr;
+	std::uint64_t next_index = 0; // number of the next .vtp (writer)
+	bool failed = false; // a write failed (writer, read after the close)
+
+	std::unique_ptr<io_drain> writer; // open while the series is
+
+	std::mutex done_mtx; // a frame returned to the pool, for a producer waiting on one
+	std::condition_variable done_cv;
+
+	std::atomic<std::uint64_t> frames_written{ 0 };
+	std::atomic<std::uint64_t> frames_dropped{ 0 };
+	std::atomic<std::uint64_t> bytes_written{ 0 };
+
+	// Writer, reused for every frame
+	std::string xml;
+	std::vector<std::int64_t> vertex_ids; // 0 .. n, the connectivity is the first n and the offsets the last n
+
+	frame* claim(double t, size_t n, const double* fields, std::uint32_t& index); // nullptr if this push is skipped or dropped
+	void commit(std::uint32_t index);
+
+	void run(); // One pass of the writer, every ready frame
+	void writeFrame(const frame& f);
+	bool appendToSeries(double t, const std::string& file_name);
+};
+
+#endif
@@ -0,0 +1,439 @@
+#include <glm/glm.hpp>
+#include "ephemeris.h"
+#include "constants.h"
+#include "byte_io.h"
+#include "crc32.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+using namespace byte_io;
+
+static const unsigned char ephemeris_magic[8] = { 'P', 'N', 'E', 'P', 'H', 'E', 'M', '\n' };
+static const size_t header_size = 96;
+
+static size_t bucketsPadded(size_t buckets) { // u32 each, padded to 8 bytes
+	return (buckets * 4 + 7) & ~size_t{ 7 };
+}
+
+static const size_t max_buckets = size_t{ 1 } << 20; // 4 MB of table, past this the lookup bisects the segments a bucket spans
+
+// Buckets half as wide as the shortest segment over the whole time span, but at most four per segment, so a short last segment or
+// pericentre passage cannot make the table larger than the coefficients. A lookup lands within a segment or two, or bisects the few a bucket covers
+static size_t bucketCount(const std::vector<double>& spans) {
+	const size_t count = spans.size() / 2;
+	double shortest = spans[1];
+	for (size_t s = 1; s < count; s++) {
+		shortest = std::min(shortest, spans[2 * s + 1]);
+	}
+	const double total = (spans[2 * (count - 1)] + spans[2 * (count - 1) + 1]) - (spans[0] - spans[1]);
+	const size_t buckets = static_cast<size_t>(std::ceil(total / (2.0 * shortest))) + 1;
+	return std::min({ std::max<size_t>(buckets, 1), 4 * count + 1, max_buckets });
+}
+
+// Chebyshev series of all components at x in [-1, 1], and their derivatives in x if dpos is not null
+// T_k and T_k' come from their recurrences, the sums stay in locals since the compiler has to assume the output aliases the coefficients
+// and the component loops have a fixed length, so they compile to whole vector operations. stride is the doubles per coefficient in the file
+static void chebyshev(const double* c, int n, int stride, double x, double pos[ephemeris_components]) {
+	double sum[ephemeris_components];
+	for (int j = 0; j < ephemeris_components; j++) {
+		sum[j] = c[j];
+	}
+	double t_prev = 1.0, t_cur = x; // T_0, T_1
+	for (int k = 1; k < n; k++) {
+		const double* ck = c + k * stride;
+		for (int j = 0; j < ephemeris_components; j++) {
+			sum[j] += ck[j] * t_cur;
+		}
+		const double t_next = 2.0 * x * t_cur - t_prev;
+		t_prev = t_cur;
+		t_cur = t_next;
+	}
+	for (int j = 0; j < ephemeris_components; j++) {
+		pos[j] = sum[j];
+	}
+}
+
+static void chebyshev(const double* c, int n, int stride, double x, double pos[ephemeris_components], double dpos[ephemeris_components]) {
+	double sum[ephemeris_components], dsum[ephemeris_components];
+	for (int j = 0; j < ephemeris_components; j++) {
+		sum[j] = c[j];
+		dsum[j] = 0.0;
+	}
+	double t_prev = 1.0, t_cur = x; // T_0, T_1
+	double d_prev = 0.0, d_cur = 1.0; // T_0', T_1'
+	for (int k = 1; k < n; k++) {
+		const double* ck = c + k * stride;
+		for (int j = 0; j < ephemeris_components; j++) {
+			sum[j] += ck[j] * t_cur;
+			dsum[j] += ck[j] * d_cur;
+		}
+		const double t_next = 2.0 * x * t_cur - t_prev;
+		const double d_next = 2.0 * t_cur + 2.0 * x * d_cur - d_prev;
+		t_prev = t_cur;
+		t_cur = t_next;
+		d_prev = d_cur;
+		d_cur = d_next;
+	}
+	for (int j = 0; j < ephemeris_components; j++) {
+		pos[j] = sum[j];
+		dpos[j] = dsum[j];
+	}
+}
+
+// First span to try: one whole bound orbit, about what a series of a few dozen coefficients can take, a hundredth of a year otherwise
+static double initialSpan(const dmat43& y, double m1, double m2) {
+	const dvec3 sep = y[0] - y[2];
+	const dvec3 v = y[1] - y[3];
+	const double mu = G * (m1 + m2);
+	const double energy = 0.5 * glm::dot(v, v) - mu / glm::length(sep);
+	if (!(energy < 0.0) || !(mu > 0.0)) {
+		return 1e-2;
+	}
+	const double a = -mu / (2.0 * energy);
+	return 2.0 * PI * std::sqrt(a * a * a / mu);
+}
+
+// Builder
+// -------------------------------------------------------------------------------------------
+ephemeris_builder::ephemeris_builder(const ephemeris_options& options)
+	: options(options) {
+	this->options.coefficients = std::max(options.coefficients, 2);
+	trial.resize(static_cast<size_t>(this->options.coefficients) * ephemeris_components);
+}
+
+void ephemeris_builder::add(double t, const dmat43& y, const dmat43& dydt, double mass1, double mass2) {
+	if (finished || (!knots.empty() && t <= knots.back().t)) {
+		return;
+	}
+	if (knots.empty() && spans.empty()) {
+		seg_start = t;
+		m1 = mass1;
+		m2 = mass2;
+		span = std::min(options.max_span, std::max(options.min_span, initialSpan(y, m1, m2)));
+	}
+	knots.push_back(knot{ t, y, dydt });
+	fitReady(false);
+}
+
+void ephemeris_builder::finish() {
+	if (finished) {
+		return;
+	}
+	fitReady(true);
+	finished = true;
+	knots.clear();
+}
+
+void ephemeris_builder::fitReady(bool final) {
+	while (knots.size() >= 2) {
+		const double available = knots.back().t;
+		double t1 = seg_start + span;
+		if (t1 > available) {
+			if (!final) {
+				return; // wait for the states to cover the segment
+			}
+			t1 = available;
+		}
+		if (t1 <= seg_start) {
+			return;
+		}
+
+		const bool force = (t1 - seg_start) <= options.min_span;
+		if (tryFit(seg_start, t1, force)) {
+			seg_start = t1;
+			span = std::min(span * (limited ? 1.25 : 2.0), options.max_span); // doubles until the first failure, then creeps up to the limit
+			// Keeps the last state at or before the new start, the next segment interpolates from it
+			size_t first = 0;
+			while (first + 1 < knots.size() && knots[first + 1].t <= seg_start) {
+				first++;
+			}
+			knots.erase(knots.begin(), knots.begin() + first);
+			if (final && seg_start >= available) {
+				return;
+			}
+		}
+		else {
+			limited = true;
+			span = std::max(0.75 * (t1 - seg_start), options.min_span);
+		}
+	}
+}
+
+bool ephemeris_builder::tryFit(double t0, double t1, bool force) {
+	const int n = options.coefficients;
+	const double mid = 0.5 * (t0 + t1), half = 0.5 * (t1 - t0);
+
+	// Coefficients from the values at the Chebyshev nodes (a discrete cosine transform)
+	std::fill(trial.begin(), trial.end(), 0.0);
+	double f[ephemeris_components];
+	for (int i = 0; i < n; i++) {
+		const double angle = PI * (i + 0.5) / n;
+		dense(mid + half * std::cos(angle), f);
+		for (int k = 0; k < n; k++) {
+			const double w = std::cos(k * angle) * (2.0 / n);
+			for (int j = 0; j < ephemeris_components; j++) {
+				trial[static_cast<size_t>(k) * ephemeris_components + j] += w * f[j];
+			}
+		}
+	}
+	for (int j = 0; j < ephemeris_components; j++) {
+		trial[j] *= 0.5;
+	}
+
+	// Error between the nodes, where a series that does not converge is worst, and at both ends
+	const int checks = 2 * n + 1;
+	double error = 0.0;
+	double p[ephemeris_components];
+	for (int m = 0; m < checks; m++) {
+		const double x = -1.0 + 2.0 * m / (checks - 1);
+		chebyshev(trial.data(), n, ephemeris_components, x, p);
+		dense(mid + half * x, f);
+		const double e1 = std::sqrt((p[0] - f[0]) * (p[0] - f[0]) + (p[1] - f[1]) * (p[1] - f[1]) + (p[2] - f[2]) * (p[2] - f[2]));
+		const double e2 = std::sqrt((p[3] - f[3]) * (p[3] - f[3]) + (p[4] - f[4]) * (p[4] - f[4]) + (p[5] - f[5]) * (p[5] - f[5]));
+		error = std::max(error, std::max(e1, e2));
+	}
+
+	if (error > options.tolerance && !force) {
+		return false;
+	}
+	if (error > options.tolerance) {
+		forced_segments++;
+	}
+	max_error = std::max(max_error, error);
+	spans.push_back(mid);
+	spans.push_back(half);
+	coeffs.insert(coeffs.end(), trial.begin(), trial.end());
+	return true;
+}
+
+void ephemeris_builder::dense(double t, double out[6]) const {
+	// Interval of the knots holding t
+	size_t hi = std::upper_bound(knots.begin(), knots.end(), t, [](double value, const knot& k) { return value < k.t; }) - knots.begin();
+	hi = std::min(std::max<size_t>(hi, 1), knots.size() - 1);
+	const knot& a = knots[hi - 1];
+	const knot& b = knots[hi];
+	const double h = b.t - a.t;
+	const double s = (t - a.t) / h;
+
+	// Quintic Hermite basis, matching position, velocity and acceleration at both states
+	const double s2 = s * s, s3 = s2 * s, s4 = s3 * s, s5 = s4 * s;
+	const double hp0 = 1.0 - 10.0 * s3 + 15.0 * s4 - 6.0 * s5;
+	const double hv0 = h * (s - 6.0 * s3 + 8.0 * s4 - 3.0 * s5);
+	const double ha0 = h * h * 0.5 * (s2 - 3.0 * s3 + 3.0 * s4 - s5);
+	const double hp1 = 10.0 * s3 - 15.0 * s4 + 6.0 * s5;
+	const double hv1 = h * (-4.0 * s3 + 7.0 * s4 - 3.0 * s5);
+	const double ha1 = h * h * 0.5 * (s3 - 2.0 * s4 + s5);
+
+	for (int body = 0; body < 2; body++) {
+		const int col = 2 * body; // position column, the velocity follows it, dydt holds velocity and acceleration in the same places
+		const dvec3 p = hp0 * a.y[col] + hv0 * a.y[col + 1] + ha0 * a.dydt[col + 1] + hp1 * b.y[col] + hv1 * b.y[col + 1] + ha1 * b.dydt[col + 1];
+		out[3 * body] = p.x;
+		out[3 * body + 1] = p.y;
+		out[3 * body + 2] = p.z;
+	}
+}
+
+size_t ephemeris_builder::fileSize() const {
+	if (spans.empty()) {
+		return 0;
+	}
+	return header_size + spans.size() * sizeof(double) + coeffs.size() * sizeof(double) + bucketsPadded(bucketCount(spans));
+}
+
+bool ephemeris_builder::write(const std::string& path) const {
+	const size_t count = segments();
+	if (count == 0) {
+		logger::error(log_category::io, "No ephemeris to write to {}, it needs at least two states", path);
+		return false;
+	}
+	const double t_start = spans[0] - spans[1];
+	const double t_end = spans[2 * (count - 1)] + spans[2 * (count - 1) + 1];
+
+	const size_t buckets = bucketCount(spans);
+	const double width = (buckets > 1) ? (t_end - t_start) / (buckets - 1) : 1.0;
+
+	std::vector<unsigned char> out(fileSize(), 0);
+	unsigned char* p = out.data() + header_size;
+	for (double v : spans) {
+		p = putF64(p, v);
+	}
+	for (double v : coeffs) {
+		p = putF64(p, v);
+	}
+	size_t segment = 0;
+	for (size_t b = 0; b < buckets; b++) {
+		const double tb = t_start + b * width;
+		while (segment + 1 < count && tb > spans[2 * segment] + spans[2 * segment + 1]) {
+			segment++;
+		}
+		p = putU32(p, static_cast<std::uint32_t>(segment));
+	}
+
+	p = out.data();
+	std::memcpy(p, ephemeris_magic, sizeof(ephemeris_magic));
+	p += sizeof(ephemeris_magic);
+	p = putU32(p, ephemeris_version);
+	p = putU32(p, static_cast<std::uint32_t>(options.coefficients));
+	p = putU32(p, static_cast<std::uint32_t>(count));
+	p = putU32(p, static_cast<std::uint32_t>(buckets));
+	p = putF64(p, t_start);
+	p = putF64(p, t_end);
+	p = putF64(p, width);
+	p = putF64(p, options.tolerance);
+	p = putF64(p, max_error);
+	p = putF64(p, m1);
+	p = putF64(p, m2);
+	p = putF64(p, 1.0);
+	putU32(p, crc32(out.data() + header_size, out.size() - header_size));
+
+	const std::string tmp = path + ".tmp";
+	FILE* f = std::fopen(tmp.c_str(), "wb");
+	if (!f) {
+		logger::error(log_category::io, "Could not create {}", tmp);
+		return false;
+	}
+	const bool written = std::fwrite(out.data(), 1, out.size(), f) == out.size();
+	if (std::fclose(f) != 0 || !written) {
+		logger::error(log_category::io, "Could not write {}", tmp);
+		return false;
+	}
+	std::error_code ec;
+	fs::rename(tmp, path, ec);
+	if (ec) {
+		logger::error(log_category::io, "Could not replace {}: {}", path, ec.message());
+		return false;
+	}
+	return true;
+}
+
+// Reader
+// -------------------------------------------------------------------------------------------
+bool ephemeris::open(const std::string& path) {
+	close();
+	if (!file.open(path)) {
+		logger::error(log_category::io, "Could not open {}", path);
+		return false;
+	}
+	const unsigned char* data = file.data();
+	const size_t size = file.size();
+	if (size < header_size || std::memcmp(data, ephemeris_magic, sizeof(ephemeris_magic)) != 0) {
+		logger::error(log_category::io, "{}: not an ephemeris", path);
+		close();
+		return false;
+	}
+
+	const unsigned char* p = data + sizeof(ephemeris_magic);
+	const std::uint32_t version = getU32(p);
+	ncoeff = static_cast<int>(getU32(p));
+	segment_count = getU32(p);
+	bucket_count = getU32(p);
+	t_start = getF64(p);
+	t_end = getF64(p);
+	bucket_width = getF64(p);
+	tol = getF64(p);
+	getF64(p); // largest error, informative
+	m1 = getF64(p);
+	m2 = getF64(p);
+	const double one = getF64(p);
+	const std::uint32_t crc = getU32(p);
+
+	stride = (version == 1) ? 8 : ephemeris_components; // version 1 padded every coefficient to eight lanes
+	const size_t expected = header_size + segment_count * 2 * sizeof(double) + segment_count * ncoeff * stride * sizeof(double) + bucketsPadded(bucket_count);
+	double native_one;
+	std::memcpy(&native_one, data + 80, sizeof(native_one)); // the check value read as this host stores doubles
+
+	if (version == 0 || version > ephemeris_version || ncoeff < 2 || segment_count == 0 || bucket_count == 0 || size != expected) {
+		logger::error(log_category::io, "{}: unsupported or truncated ephemeris", path);
+		close();
+		return false;
+	}
+	if (one != 1.0 || native_one != 1.0) {
+		logger::error(log_category::io, "{}: the ephemeris is read straight from memory, which needs a little endian host", path);
+		close();
+		return false;
+	}
+	if (crc32(data + header_size, size - header_size) != crc) {
+		logger::error(log_category::io, "{}: ephemeris checksum mismatch", path);
+		close();
+		return false;
+	}
+
+	spans = reinterpret_cast<const double*>(data + header_size); // mappings are page aligned, and every offset is a multiple of 8
+	coeffs = spans + 2 * segment_count;
+	buckets = reinterpret_cast<const std::uint32_t*>(coeffs + segment_count * ncoeff * stride);
+	inv_bucket_width = (bucket_width > 0.0) ? 1.0 / bucket_width : 0.0;
+	return true;
+}
+
+void ephemeris::close() {
+	file.close();
+	spans = coeffs = nullptr;
+	buckets = nullptr;
+	segment_count = bucket_count = 0;
+}
+
+// t must be finite. The segment holding t lies between the first segments of its bucket and the next bucket
+size_t ephemeris::find(double t) const {
+	double b = (t - t_start) * inv_bucket_width;
+	b = std::min(std::max(b, 0.0), static_cast<double>(bucket_count - 1));
+	const size_t bucket = static_cast<size_t>(b);
+	size_t lo = buckets[bucket];
+	size_t hi = (bucket + 1 < bucket_count) ? std::min<size_t>(buckets[bucket + 1], segment_count - 1) : segment_count - 1;
+	while (lo < hi) { // the first segment ending at or after t, one step for a table sized to the shortest segment
+		const size_t mid = lo + (hi - lo) / 2;
+		if (t > spans[2 * mid] + spans[2 * mid + 1]) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+void ephemeris::evaluate(double t, double pos[ephemeris_components], double* vel) const {
+	const size_t s = find(t);
+	const double centre = spans[2 * s], half = spans[2 * s + 1];
+	const double x = std::min(std::max((t - centre) / half, -1.0), 1.0);
+	const double* c = coeffs + s * ncoeff * stride;
+	if (!vel) {
+		chebyshev(c, ncoeff, stride, x, pos);
+	}
+	else {
+		chebyshev(c, ncoeff, stride, x, pos, vel);
+		const double scale = 1.0 / half; // d/dt = d/dx / half width
+		for (int j = 0; j < ephemeris_components; j++) {
+			vel[j] *= scale;
+		}
+	}
+}
+
+bool ephemeris::position(double t, dvec3& pos1, dvec3& pos2) const {
+	if (!coeffs || !std::isfinite(t)) { // a NaN would index the buckets with an undefined conversion
+		return false;
+	}
+	double p[ephemeris_components];
+	evaluate(t, p, nullptr);
+	pos1 = dvec3{ p[0], p[1], p[2] };
+	pos2 = dvec3{ p[3], p[4], p[5] };
+	return t >= t_start && t <= t_end;
+}
+
+bool ephemeris::state(double t, dvec3& pos1, dvec3& vel1, dvec3& pos2, dvec3& vel2) const {
+	if (!coeffs || !std::isfinite(t)) {
+		return false;
+	}
+	double p[ephemeris_components], v[ephemeris_components];
+	evaluate(t, p, v);
+	pos1 = dvec3{ p[0], p[1], p[2] };
+	pos2 = dvec3{ p[3], p[4], p[5] };
+	vel1 = dvec3{ v[0], v[1], v[2] };
+	vel2 = dvec3{ v[3], v[4], v[5] };
+	return t >= t_start && t <= t_end;
+}
@@ -0,0 +1,387 @@
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "flight_recorder.h"
+#include "byte_io.h"
+#include "mapped_file.h"
+#include "logger.h"
+#include "text_export.h"
+
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#ifdef _WIN32
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+using namespace byte_io;
+
+static const unsigned char flight_magic[8] = { 'P', 'N', 'F', 'L', 'I', 'G', 'H', 'T' };
+
+// Header fields the recorder updates in place
+static const size_t written_offset = 24;
+static const size_t status_offset = 32;
+static const size_t signal_offset = 36;
+static const size_t wall_offset = 40;
+
+// The open recorders the signal handlers dump, a fixed table so a handler only ever walks plain atomics
+static const size_t max_live_recorders = 16;
+static std::atomic<flight_recorder*> live_recorders[max_live_recorders] = {};
+static_assert(std::atomic<flight_recorder*>::is_always_lock_free, "the live recorders are read from signal handlers");
+
+flight_recorder::flight_recorder(size_t capacity) : capacity(std::max<size_t>(capacity, 1)) {}
+
+flight_recorder::~flight_recorder() {
+	close();
+}
+
+// Mapping
+// -------------------------------------------------------------------------------------------
+#ifdef _WIN32
+
+bool flight_recorder::map() {
+	HANDLE file = CreateFileA(ring_path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	file_handle = file;
+	const std::uint64_t size = length;
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size & 0xffffffffu), nullptr); // extends the file to the size
+	if (!mapping) {
+		unmap();
+		return false;
+	}
+	mapping_handle = mapping;
+	base = static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, length));
+	if (!base) {
+		unmap();
+		return false;
+	}
+	return true;
+}
+
+void flight_recorder::unmap() {
+	if (base) {
+		FlushViewOfFile(base, 0);
+		UnmapViewOfFile(base);
+	}
+	if (mapping_handle) {
+		CloseHandle(static_cast<HANDLE>(mapping_handle));
+	}
+	if (file_handle) {
+		CloseHandle(static_cast<HANDLE>(file_handle));
+	}
+	base = nullptr;
+	file_handle = mapping_handle = nullptr;
+}
+
+static bool writeWhole(const char* path, const unsigned char* data, size_t size) {
+	HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	bool ok = true;
+	while (ok && size > 0) {
+		const DWORD part = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+		DWORD done = 0;
+		ok = WriteFile(file, data, part, &done, nullptr) && done > 0;
+		data += done;
+		size -= done;
+	}
+	return CloseHandle(file) && ok;
+}
+
+#else
+
+bool flight_recorder::map() {
+	const int fd = ::open(ring_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	if (::ftruncate(fd, static_cast<off_t>(length)) != 0) {
+		::close(fd);
+		return false;
+	}
+	void* p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd); // the mapping keeps its own reference to the file
+	if (p == MAP_FAILED) {
+		return false;
+	}
+	base = static_cast<unsigned char*>(p);
+	return true;
+}
+
+void flight_recorder::unmap() {
+	if (base) {
+		::munmap(base, length);
+	}
+	base = nullptr;
+}
+
+static bool writeWhole(const char* path, const unsigned char* data, size_t size) { // open, write and close are all async signal safe
+	const int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		return false;
+	}
+	bool ok = true;
+	while (ok && size > 0) {
+		const ssize_t done = ::write(fd, data, size);
+		ok = done > 0;
+		if (ok) {
+			data += done;
+			size -= static_cast<size_t>(done);
+		}
+	}
+	return ::close(fd) == 0 && ok;
+}
+
+#endif
+
+// Recorder
+// -------------------------------------------------------------------------------------------
+bool flight_recorder::open(const std::string& path) {
+	close();
+
+	// A ring its process never got to close or dump is the only record of how that run ended, so it is kept as the dump
+	{
+		mapped_file old;
+		if (old.open(path) && old.size() >= flight_header_size && std::memcmp(old.data(), flight_magic, sizeof(flight_magic)) == 0) {
+			const unsigned char* p = old.data() + status_offset;
+			const bool unclean = static_cast<flight_status>(getU32(p)) == flight_status::running;
+			old.close();
+			if (unclean) {
+				std::error_code ec;
+				fs::rename(path, path + ".dump", ec);
+				if (!ec) {
+					logger::warn(log_category::io, "{} was left open by a run that did not exit cleanly, kept as {}.dump", path, path);
+				}
+			}
+		}
+	}
+
+	ring_path = path;
+	dump_path = path + ".dump";
+	length = flight_header_size + capacity * flight_record_size;
+	if (!map()) {
+		logger::error(log_category::io, "Could not map a {} byte flight recorder at {}", length, path);
+		length = 0;
+		return false;
+	}
+
+	std::memset(base, 0, flight_header_size);
+	unsigned char* h = base;
+	std::memcpy(h, flight_magic, sizeof(flight_magic));
+	h += sizeof(flight_magic);
+	h = putU32(h, flight_version);
+	h = putU32(h, static_cast<std::uint32_t>(flight_record_size));
+	putU64(h, capacity);
+
+	count = 0;
+	slot = 0;
+	wall = 0.0;
+	opened = std::chrono::steady_clock::now();
+
+	bool listed = false;
+	for (std::atomic<flight_recorder*>& live : live_recorders) {
+		flight_recorder* empty = nullptr;
+		if (live.compare_exchange_strong(empty, this, std::memory_order_acq_rel)) {
+			listed = true;
+			break;
+		}
+	}
+	if (!listed) { // still records, and still dumps on an integrator crash
+		logger::warn(log_category::io, "More than {} flight recorders are open, {} is not dumped on a signal", max_live_recorders, path);
+	}
+	return true;
+}
+
+void flight_recorder::close() {
+	if (!base) {
+		return;
+	}
+	for (std::atomic<flight_recorder*>& live : live_recorders) {
+		flight_recorder* self = this;
+		live.compare_exchange_strong(self, nullptr, std::memory_order_acq_rel);
+	}
+	setStatus(flight_status::closed, 0);
+	unmap();
+	length = 0;
+}
+
+void flight_recorder::setStatus(flight_status status, int signal) {
+	putU32(base + status_offset, static_cast<std::uint32_t>(status));
+	putU32(base + signal_offset, static_cast<std::uint32_t>(signal));
+}
+
+void flight_recorder::record(double t, double h, double err_norm, std::uint32_t flags, const dmat43& y, double m1, double m2) {
+	if (!base) {
+		return;
+	}
+	if ((count & 15) == 0) { // the clock costs more than the rest of the record, every 16th substep is still microseconds apart
+		wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - opened).count();
+	}
+
+	unsigned char buffer[flight_record_size]; // assembled here and copied in whole, the stores into the mapping are then a few wide moves
+	unsigned char* p = buffer;
+	p = putF64(p, t);
+	p = putF64(p, h);
+	p = putF64(p, err_norm);
+	p = putF64(p, wall);
+	p = putU32(p, flags);
+	p = putU32(p, 0);
+	p = putF64(p, m1);
+	p = putF64(p, m2);
+	const double* values = glm::value_ptr(y);
+	for (int i = 0; i < 12; i++) {
+		p = putF64(p, values[i]);
+	}
+	std::memcpy(base + flight_header_size + slot * flight_record_size, buffer, flight_record_size);
+	if (++slot == capacity) {
+		slot = 0;
+	}
+
+	// The count goes after the record, so a dump taken from a signal between the two only misses the newest record
+	count++;
+	std::atomic_signal_fence(std::memory_order_release);
+	putU64(base + written_offset, count);
+	putF64(base + wall_offset, wall);
+}
+
+bool flight_recorder::dump(flight_status why, int signal) {
+	if (!base) {
+		return false;
+	}
+	setStatus(why, signal);
+	const bool ok = writeWhole(dump_path.c_str(), base, length);
+	if (why != flight_status::signal) {
+		setStatus(flight_status::running, 0); // the run carries on (an integrator crash can be reset), only the dump says why it was taken
+	}
+	return ok;
+}
+
+bool flight_recorder::dumpActive(flight_status why, int signal) {
+	bool any = false, ok = true;
+	for (std::atomic<flight_recorder*>& live : live_recorders) {
+		flight_recorder* recorder = live.load(std::memory_order_acquire);
+		if (recorder) {
+			any = true;
+			ok = recorder->dump(why, signal) && ok;
+		}
+	}
+	return any && ok;
+}
+
+// Signals
+// -------------------------------------------------------------------------------------------
+static void onFatalSignal(int signal) {
+	flight_recorder::dumpActive(flight_status::signal, signal);
+	std::signal(signal, SIG_DFL); // then the default action (core dump, abort dialog) as if nothing had been installed
+	std::raise(signal);
+}
+
+#ifdef SIGUSR1
+static void onDumpSignal(int) {
+	flight_recorder::dumpActive(flight_status::requested);
+}
+#endif
+
+void flight_recorder::installSignalHandlers() {
+	for (int signal : { SIGSEGV, SIGFPE, SIGILL, SIGABRT }) {
+		std::signal(signal, onFatalSignal);
+	}
+#ifdef SIGBUS
+	std::signal(SIGBUS, onFatalSignal);
+#endif
+#ifdef SIGUSR1
+	std::signal(SIGUSR1, onDumpSignal);
+#endif
+}
+
+// Reading
+// -------------------------------------------------------------------------------------------
+bool readFlightRecording(const std::string& path, std::vector<flight_record>& out, flight_info* info) {
+	out.clear();
+	mapped_file file;
+	if (!file.open(path)) {
+		logger::error(log_category::io, "Could not open {}", path);
+		return false;
+	}
+	if (file.size() < flight_header_size || std::memcmp(file.data(), flight_magic, sizeof(flight_magic)) != 0) {
+		logger::error(log_category::io, "{}: not a flight recording", path);
+		return false;
+	}
+
+	const unsigned char* h = file.data() + sizeof(flight_magic);
+	const std::uint32_t version = getU32(h);
+	const std::uint32_t record_size = getU32(h);
+	const std::uint64_t capacity = getU64(h);
+	const std::uint64_t written = getU64(h);
+	const flight_status status = static_cast<flight_status>(getU32(h));
+	const int signal = static_cast<int>(getU32(h));
+
+	if (version == 0 || version > flight_version) {
+		logger::error(log_category::io, "{}: flight recording version {} (this build reads up to {})", path, version, flight_version);
+		return false;
+	}
+	if (record_size < flight_record_size || capacity == 0 || (file.size() - flight_header_size) / record_size < capacity) {
+		logger::error(log_category::io, "{}: truncated flight recording ({} bytes)", path, file.size());
+		return false;
+	}
+	if (info) {
+		*info = flight_info{ capacity, written, status, signal };
+	}
+
+	const std::uint64_t held = std::min(written, capacity);
+	out.resize(static_cast<size_t>(held));
+	for (std::uint64_t i = 0; i < held; i++) {
+		const std::uint64_t n = written - held + i;
+		const unsigned char* p = file.data() + flight_header_size + (n % capacity) * record_size;
+		flight_record& r = out[static_cast<size_t>(i)];
+		r.t = getF64(p);
+		r.h = getF64(p);
+		r.err_norm = getF64(p);
+		r.wall = getF64(p);
+		r.flags = getU32(p);
+		p += 4;
+		r.m1 = getF64(p);
+		r.m2 = getF64(p);
+		double* values = glm::value_ptr(r.y);
+		for (int k = 0; k < 12; k++) {
+			values[k] = getF64(p);
+		}
+	}
+	return true;
+}
+
+bool flightRecordingToCsv(const std::string& path, std::ostream& out) {
+	std::vector<flight_record> records;
+	if (!readFlightRecording(path, records)) {
+		return false;
+	}
+	out << "t,h,err_norm,wall,accepted,crashed,kepler,m1,m2,x1,y1,z1,vx1,vy1,vz1,x2,y2,z2,vx2,vy2,vz2\n";
+
+	std::vector<char> text(records.size() * text_export::rowBytes(21)); // the whole recording goes out in one write
+	char* end = text.data();
+	for (const flight_record& r : records) {
+		double row[21] = { r.t, r.h, r.err_norm, r.wall, (r.flags & flight_accepted) ? 1.0 : 0.0, (r.flags & flight_crashed) ? 1.0 : 0.0,
+			(r.flags & flight_kepler) ? 1.0 : 0.0, r.m1, r.m2 };
+		std::copy_n(glm::value_ptr(r.y), 12, row + 9);
+		end = text_export::appendRow(end, row, 21);
+	}
+	out.write(text.data(), end - text.data());
+	return static_cast<bool>(out);
+}
@@ -1,4 +1,3 @@
-#define M_PI        3.14159265358979323846264338327950288   /* pi */
 #define GLM_ENABLE_EXPERIMENTAL
 
 #include <iostream>
@@ -12,14 +11,10 @@
 
 using dvec3 = glm::dvec3;
 
-// Mathematical Constants
-// -----------------------------------------------------------------------------------------
-constexpr double G = 4.0 * M_PI * M_PI; // Newtonian Gravitational Constant in AU^3 / (Msun * yr^2)
-constexpr double c = 63241.0771; // Speed of light in AU / yr
-
 // Function
 // -----------------------------------------------------------------------------------------
-dvec3 PN_acceleration(dvec3 pos1, dvec3 pos2, dvec3 v1, dvec3 v2, double m1, double m2) {
+// Evaluates the bracketed PN correction (1/c^2)(A_1PN) + (1/c^4)(A_2PN) + (1/c^5)(A_25PN), along with the unit vector and the Newtonian scale Gm/r^2 it multiplies
+static dvec3 PN_bracket(dvec3 pos1, dvec3 pos2, dvec3 v1, dvec3 v2, double m1, double m2, dvec3& n_hat_out, double& scale_out) {
 	// Terms
 	// -------------------------------------------------------------------------------------
 	// Mass Terms
@@ -79,17 +74,68 @@ dvec3 PN_acceleration(dvec3 pos1, dvec3 pos2, dvec3 v1, dvec3 v2, double m1, dou
 	const double c4 = (1 / (c * c * c * c));
 	const double c5 = (1 / (c * c * c * c * c));
 
+	n_hat_out = n_hat;
+	scale_out = mu / (r * r);
+
+	return (c2 * A_1PN) + (c4 * A_2PN) + (c5 * A_25PN);
+}
+
+dvec3 PN_acceleration(dvec3 pos1, dvec3 pos2, dvec3 v1, dvec3 v2, double m1, double m2) {
+	dvec3 n_hat;
+	double scale;
+	dvec3 corrections = PN_bracket(pos1, pos2, v1, v2, m1, m2, n_hat, scale);
+
 	// dv_bold/dt ~ a
 	// Gm/r^2(-n_hat + (1/c^2)(A_1PN) + (1/c^4)(A_2PN))
-	dvec3 a = (mu / (r * r)) * (-n_hat + (c2 * A_1PN) + (c4 * A_2PN) + (c5 * A_25PN));
+	dvec3 a = scale * (-n_hat + corrections);
 	//std::cout << std::setprecision(20) << "a = " << a_cons.x << " " << a_cons.y << " " << a_cons.z << std::endl;
 
 	return a;
 }
 
+dvec3 PN_correction(dvec3 pos1, dvec3 pos2, dvec3 v1, dvec3 v2, double m1, double m2) {
+	dvec3 n_hat;
+	double scale;
+	dvec3 corrections = PN_bracket(pos1, pos2, v1, v2, m1, m2, n_hat, scale);
+
+	// Gm/r^2((1/c^2)(A_1PN) + (1/c^4)(A_2PN) + (1/c^5)(A_25PN)), the relative acceleration without its Newtonian part
+	return scale * corrections;
+}
+
+dvec3 newtonian_acceleration(dvec3 pos1, dvec3 pos2, double m1, double m2) {
+	// -Gm r/r^3
+	dvec3 sep = pos1 - pos2;
+	const double r = glm::length(sep);
+	return -(G * (m1 + m2) / (r * r * r)) * sep;
+}
+
 void resolve_rel_accel(dvec3& a_rel, dvec3& a1, dvec3& a2, double m1, double m2) {
 	// Because I've only included up to the 2.5PN term currently the individual accelerations can be seperated from the relative acceleration using the mass ratio of the two objects
 	double m = m1 + m2;
 	a1 = (m2 / m) * a_rel;
 	a2 = -((m1 / m) * a_rel);
 }
+
+dvec3 newtonian_jerk(dvec3 pos1, dvec3 pos2, dvec3 v1, dvec3 v2, double m1, double m2) {
+	// d/dt(-Gm r/r^3) = -Gm (v/r^3 - 3 (r.v) r/r^5)
+	dvec3 sep = pos1 - pos2;
+	dvec3 v_bold = v1 - v2;
+	const double r = glm::length(sep);
+	const double inv_r3 = 1.0 / (r * r * r);
+	const double r_dot_v = glm::dot(sep, v_bold);
+
+	return -(G * (m1 + m2)) * ((v_bold * inv_r3) - ((3.0 * r_dot_v * inv_r3 / (r * r)) * sep));
+}
+
+double orbital_energy(dvec3 pos1, dvec3 pos2, dvec3 v1, dvec3 v2, double m1, double m2) {
+	// 1/2 m1 v1^2 + 1/2 m2 v2^2 - G m1 m2 / r
+	const double kinetic = 0.5 * (m1 * glm::dot(v1, v1) + m2 * glm::dot(v2, v2));
+	const double potential = -(G * m1 * m2) / glm::length(pos1 - pos2);
+
+	return kinetic + potential;
+}
+
+dvec3 orbital_angular_momentum(dvec3 pos1, dvec3 pos2, dvec3 v1, dvec3 v2, double m1, double m2) {
+	// m1 (r1 x v1) + m2 (r2 x v2)
+	return (m1 * glm::cross(pos1, v1)) + (m2 * glm::cross(pos2, v2));
+}
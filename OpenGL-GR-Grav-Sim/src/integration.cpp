@@ -5,47 +5,141 @@
 #include <glm/gtc/type_ptr.hpp>
 #include "formulae.h"
 #include "integration.h"
+#include "kepler.h"
+#include "logger.h"
 
-#include <iostream>
-#include <iomanip>
+#include <algorithm>
 #include <cmath>
 
 using dvec3 = glm::tvec3<double>;
 using dmat43 = glm::mat<4, 3, double>;
 
-// DormandPrince coefficients
-// -------------------------------------------------------------------------------------------
-// State Step Constants
-static const double a21_const = 0.2;
-static const double a31_const = 3.0 / 40.0, a32_const = 9.0 / 40.0;
-static const double a41_const = 44.0 / 45.0, a42_const = -56.0 / 15.0, a43_const = 32.0 / 9.0;
-static const double a51_const = 19372.0 / 6561.0, a52_const = -25360.0 / 2187.0, a53_const = 64448.0 / 6561.0, a54_const = -212.0 / 729.0;
-static const double a61_const = 9017.0 / 3168.0, a62_const = -355.0 / 33.0, a63_const = 46732.0 / 5247.0, a64_const = 49.0 / 176.0, a65_const = -5103.0 / 18656.0;
-
-// Order Constants
-static const double b1_const = 35.0 / 384.0, b3_const = 500.0 / 1113.0, b4_const = 125.0 / 192.0, b5_const = -2187.0 / 6784.0, b6_const = 11.0 / 84.0;
-static const double b1s_const = 5179.0 / 57600.0, b3s_const = 7571.0 / 16695.0, b4s_const = 393.0 / 640.0, b5s_const = -92097.0 / 339200.0, b6s_const = 187.0 / 2100.0, b7s_const = 1.0 / 40.0;
-
-
 //Constructor
 RK45_integration::RK45_integration(double atol, double rtol, double initial_dt)
-	: atol(atol), rtol(rtol), timestep(initial_dt) {}
+	: engine(atol, rtol, initial_dt) {}
 
-integrate_result RK45_integration::step(mathState backbuf, double physics_dt) {
+integrate_result RK45_integration::step(mathState backbuf, double physics_dt, int max_substeps) {
 	const double tol = 1.0;
+
+	// Newtonian fast path
+	// When every PN term is negligible (or the Newtonian preset is selected) the orbit is a Kepler orbit, which has a closed form solution
+	// Any interval is one propagation, so max_substeps never limits it. Its count is the propagation's work in substeps, one RK45
+	// substep being six derivative evaluations against one evaluation of the Kepler equation each, so substep budgets still hold
+	if (newtonian || PN_strength_bound(backbuf.y, backbuf.m1, backbuf.m2) < pn_negligible) {
+		dmat43 y = backbuf.y;
+		int evaluations = 0;
+		if (kepler_propagate(y, backbuf.m1, backbuf.m2, physics_dt, &evaluations)) {
+			kepler_step = true;
+			kepler_start = backbuf;
+			backbuf.physics_time += physics_dt;
+			if (recorder) {
+				recorder->record(backbuf.physics_time, physics_dt, 0.0, flight_accepted | flight_kepler, y, backbuf.m1, backbuf.m2);
+			}
+			const dmat43 dydt = newtonian ? newtonianDerivatives(y, backbuf.m1, backbuf.m2) : derivatives(y, backbuf.m1, backbuf.m2);
+			engine.seed(y, dydt); // so an RK45 step carrying on from here starts with its first stage
+			last_m1 = backbuf.m1;
+			last_m2 = backbuf.m2;
+			last_newtonian = newtonian;
+			const int count = std::max(1, (evaluations + 5) / 6);
+			return integrate_result(y, count, 1, 0, physics_dt, false, physics_dt, dydt); // any interval costs the same, so large time warps are free here
+		}
+		logger::debug(log_category::integrator, "Kepler propagation did not converge at t = {}, integrating numerically", backbuf.physics_time);
+	} // Falls through to the numerical integration of the same equations, the Newtonian ones if the preset is selected
 	
-	integrate_result result = RK45_integrate(backbuf.y, physics_dt, tol, backbuf.m1, backbuf.m2);
+	const double m1 = backbuf.m1, m2 = backbuf.m2;
+	dmat43 y = backbuf.y;
+	const bool pn = !newtonian;
+	kepler_step = false;
+	if (m1 != last_m1 || m2 != last_m2 || newtonian != last_newtonian) { // the engine notices a changed state itself, the masses and equations are hidden in the system
+		engine.invalidate();
+		last_m1 = m1;
+		last_m2 = m2;
+		last_newtonian = newtonian;
+	}
 
-	backbuf.physics_time += physics_dt;
+	auto system = [m1, m2, pn](const dmat43& state, dmat43& dydt) { dydt = pn ? derivatives(state, m1, m2) : newtonianDerivatives(state, m1, m2); };
+
+	engine_result stats;
+	if (recorder) {
+		const double t0 = backbuf.physics_time;
+		flight_recorder* rec = recorder;
+		stats = engine.integrate(y, physics_dt, system, tol, max_substeps, [rec, t0, m1, m2](const step_event& e, const dmat43& state) {
+			rec->record(t0 + e.t, e.h, e.err_norm, (e.accepted ? flight_accepted : 0u) | (e.crashed ? flight_crashed : 0u), state, m1, m2);
+		});
+		if (stats.crash_f) { // the steps that led up to it, before the next run's recorder overwrites them
+			if (recorder->dump(flight_status::integrator_crash)) {
+				logger::warn(log_category::integrator, "The steps before the crash are in {}.dump", recorder->path());
+			}
+			else {
+				logger::error(log_category::io, "Could not write {}.dump", recorder->path());
+			}
+		}
+	}
+	else {
+		stats = engine.integrate(y, physics_dt, system, tol, max_substeps); // nothing watches the steps, the hook compiles away
+	}
 
-	return result;
+	backbuf.physics_time += stats.covered;
+
+	dmat43 dydt{ 0.0 };
+	if (engine.hasDerivative()) {
+		dydt = engine.getDerivative(); // the final stage of the last accepted step
+	}
+	else if (!stats.crash_f) {
+		dydt = pn ? derivatives(y, m1, m2) : newtonianDerivatives(y, m1, m2); // no step was taken
+	}
+
+	return integrate_result(y, stats.count, stats.accepts, stats.rejects, stats.avg_h, stats.crash_f, stats.covered, dydt);
 }
 
 bool RK45_integration::getDebug() { return RK45_integration::debug; } // Used for debugging
 
 void RK45_integration::setDebug(bool update) { RK45_integration::debug = update; } // Used to turn into debugging mode (Currently unsetup)
 
-dmat43 RK45_integration::derivatives(dmat43& state, double m1, double m2) {
+bool RK45_integration::getNewtonian() { return RK45_integration::newtonian; } // Returns whether the Newtonian preset is selected
+
+void RK45_integration::setNewtonian(bool update) { RK45_integration::newtonian = update; } // Forces every step through the Kepler propagator, ignoring the PN terms
+
+double RK45_integration::getAtol() { return engine.getAtol(); }
+
+double RK45_integration::getRtol() { return engine.getRtol(); }
+
+void RK45_integration::setTolerances(double atol, double rtol) { engine.setTolerances(atol, rtol); } // Takes effect from the next step, the current timestep is kept and adapts on its own
+
+double RK45_integration::getTimestep() { return engine.getTimestep(); }
+
+void RK45_integration::setTimestep(double h) { engine.setTimestep(h); }
+
+void RK45_integration::setDenseOutput(bool on) {
+	dense_on = on;
+	engine.setDenseOutput(on);
+}
+
+bool RK45_integration::denseState(double t, dmat43& out) const {
+	if (!dense_on) {
+		return false;
+	}
+	if (kepler_step) {
+		out = kepler_start.y;
+		return kepler_propagate(out, kepler_start.m1, kepler_start.m2, t); // exact, and a Kepler solve is far cheaper than what asks for it
+	}
+	if (!engine.hasDenseOutput()) {
+		return false;
+	}
+	engine.denseState(t, out);
+	return true;
+}
+
+void RK45_integration::seedDerivative(const mathState& s, const dmat43& dydt) {
+	engine.seed(s.y, dydt);
+	last_m1 = s.m1;
+	last_m2 = s.m2;
+	last_newtonian = newtonian;
+}
+
+void RK45_integration::setRecorder(flight_recorder* update) { recorder = update; }
+
+dmat43 RK45_integration::derivatives(const dmat43& state, double m1, double m2) {
 	// Propertries Unpacking
 	dvec3 pos1 = state[0]; 
 	dvec3 v1 = state[1];
@@ -66,120 +160,31 @@ dmat43 RK45_integration::derivatives(dmat43& state, double m1, double m2) {
 	return dydt;
 }
 
-// sqrt(1/N * sum((y5_ij - y4_ij)/(atol + rtol * max(y_ij, y4_ij))))
-double RK45_integration::calc_err_norm(const dmat43& y, const dmat43& y4, const dmat43& y5, const double atol, const double rtol) {
-	// Formulae Variables
-	double sum = 0.0; // sum(diff^2)
-	int count = 0; // 1 / N
-
-	for (int i = 0; i < 4; i++) {
-		for (int j = 0; j < 3; j++) {
-			double scale = atol + rtol * std::max(std::abs(y[i][j]), std::abs(y4[i][j])); // atol + rtol * max(y_ij, y4_ij)
-			double diff = (y5[i][j] - y4[i][j]) / scale; // (y5_ij - y4_ij) / scale
-			sum += diff * diff;
-			count++;
-		}
-	}
-
-	return std::sqrt(sum / count);
-}
-
-substep_values RK45_integration::RK45_substep(dmat43 y, double& h, double m1, double m2) {
-	// RK45 Stages
-	// -------------------------------------------------------------------------------------
-	dmat43 k1, k2, k3, k4, k5, k6, k7, staged_y;
-	// Stage 1
-	k1 = derivatives(y, m1, m2);
-
-	// Stage 2
-	staged_y = y + h * (a21_const * k1);
-	k2 = derivatives(staged_y, m1, m2);
-
-	// Stage 3
-	staged_y = y + h * ((a31_const * k1) + (a32_const * k2));
-	k3 = derivatives(staged_y, m1, m2);
-
-	// Stage 4
-	staged_y = y + h * ((a41_const * k1) + (a42_const * k2) + (a43_const * k3));
-	k4 = derivatives(staged_y, m1, m2);
-
-	// Stage 5
-	staged_y = y + h * ((a51_const * k1) + (a52_const * k2) + (a53_const * k3) + (a54_const * k4));
-	k5 = derivatives(staged_y, m1, m2);
-
-	// Stage 6
-	staged_y = y + h * ((a61_const * k1) + (a62_const * k2) + (a63_const * k3) + (a64_const * k4) + (a65_const * k5));
-	k6 = derivatives(staged_y, m1, m2);
-
-	// Fourth order solution
-	dmat43 y4 = y + h * (b1_const * k1 + b3_const * k3 + b4_const * k4 + b5_const * k5 + b6_const * k6);
-
-	// Stage 7
-	k7 = derivatives(y4, m1, m2); // y4 is the coincidental staged_y for stage 7
-
-	// Fifth order solution
-	dmat43 y5 = y + h * (b1s_const * k1 + b3s_const * k3 + b4s_const * k4 + b5s_const * k5 + b6s_const * k6 + b7s_const * k7);
-
-	// Error checking
-	double err_norm = calc_err_norm(y, y4, y5, RK45_integration::atol, RK45_integration::rtol);
+dmat43 RK45_integration::newtonianDerivatives(const dmat43& state, double m1, double m2) {
+	dvec3 a_rel = newtonian_acceleration(state[0], state[2], m1, m2);
+	dvec3 a1, a2;
+	resolve_rel_accel(a_rel, a1, a2, m1, m2);
 
-	substep_values result{
-		y5, err_norm
-	};
+	dmat43 dydt;
+	dydt[0] = state[1];
+	dydt[1] = a1;
+	dydt[2] = state[3];
+	dydt[3] = a2;
 
-	return result;
+	return dydt;
 }
 
-integrate_result RK45_integration::RK45_integrate(dmat43 y, double total_dt, double tol, double m1, double m2) {
-	const double safety = 0.9;
-	const double minAdapt = 0.1, maxAdapt = 5.0;
-
-	double intg_t = 0.0;
-	double overhang = 0.0;
-
-	dmat43 state = y;
+// Cubic Hermite interpolation of the state at t0 + theta * h (0 <= theta <= 1) from the states and derivatives at both ends of a step
+// Third order accurate in the positions and velocities without any further derivative evaluations
+dmat43 RK45_integration::interpolate(const dmat43& y0, const dmat43& dydt0, const dmat43& y1, const dmat43& dydt1, double h, double theta) {
+	const double t2 = theta * theta;
+	const double t3 = t2 * theta;
 
-	int accepts = 0, rejects = 0, count = 0;
-	double tot_h = 0.0;
+	// Hermite basis functions
+	const double h00 = 2.0 * t3 - 3.0 * t2 + 1.0;
+	const double h10 = t3 - 2.0 * t2 + theta;
+	const double h01 = -2.0 * t3 + 3.0 * t2;
+	const double h11 = t3 - t2;
 
-	int since_last_accept = 0;
-
-	double h = RK45_integration::timestep;
-
-	bool no_crash = true;
-
-	while (intg_t < total_dt && no_crash) {
-		if (intg_t + h > total_dt) {
-			h = total_dt - intg_t;
-		}
-
-		substep_values RK45_values = RK45_substep(state, h, m1, m2);
-
-		if (RK45_values.err_norm < tol) {
-			intg_t += h;
-			state = RK45_values.state_y;
-			accepts++;
-			since_last_accept = 0;
-		}
-		else {
-			rejects++;
-			since_last_accept++;
-			if (rejects >= 50) { no_crash = false;  std::cout << "[CRASH]" << std::endl; state = dmat43{ 0.0 }; }
-		}
-
-		double adapt = safety * std::pow(1.0 / (RK45_values.err_norm + 1e-16), 0.2);
-		adapt = std::min(std::max(adapt, minAdapt), maxAdapt);
-
-		h *= adapt;
-
-		count++;
-	}
-
-	RK45_integration::timestep = h;
-
-	integrate_result result{
-		state, count, accepts, rejects, (tot_h / count), !no_crash
-	};
-
-	return result;
-}
\ No newline at end of file
+	return (h00 * y0) + ((h10 * h) * dydt0) + (h01 * y1) + ((h11 * h) * dydt1);
+}
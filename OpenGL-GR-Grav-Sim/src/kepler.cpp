@@ -0,0 +1,212 @@
+#include <glm/glm.hpp>
+#include "formulae.h"
+#include "kepler.h"
+
+#include <cmath>
+#include <limits>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+// Stumpff Functions
+// -----------------------------------------------------------------------------------------
+// C(z) = (1 - cos(sqrt(z))) / z, S(z) = (sqrt(z) - sin(sqrt(z))) / sqrt(z)^3 (with their hyperbolic counterparts for z < 0)
+// Near z = 0 both lose every significant digit to cancellation so the leading terms of their series are used instead
+static double stumpff_C(double z) {
+	if (z > 1e-6) {
+		return (1.0 - std::cos(std::sqrt(z))) / z;
+	}
+	if (z < -1e-6) {
+		return (std::cosh(std::sqrt(-z)) - 1.0) / (-z);
+	}
+	return 0.5 - z / 24.0 + (z * z) / 720.0;
+}
+
+static double stumpff_S(double z) {
+	if (z > 1e-6) {
+		double sz = std::sqrt(z);
+		return (sz - std::sin(sz)) / (sz * sz * sz);
+	}
+	if (z < -1e-6) {
+		double sz = std::sqrt(-z);
+		return (std::sinh(sz) - sz) / (sz * sz * sz);
+	}
+	return (1.0 / 6.0) - z / 120.0 + (z * z) / 5040.0;
+}
+
+// Functions
+// -----------------------------------------------------------------------------------------
+double PN_strength_bound(const dmat43& y, double m1, double m2) {
+	const double m = m1 + m2;
+	const double mu = G * m;
+	const double n_smr = (m1 * m2) / (m * m); // symmetric mass ratio
+
+	dvec3 sep = y[0] - y[2]; // relative position
+	dvec3 v_bold = y[1] - y[3]; // relative velocity
+	const double r = glm::length(sep);
+	const double v_2 = glm::dot(v_bold, v_bold);
+
+	// Pericentre of the osculating orbit, this is where both Gm/r and v^2 (and therefore every PN term) peak
+	const double h = glm::length(glm::cross(sep, v_bold)); // specific angular momentum
+	dvec3 e_vec = ((v_2 - mu / r) * sep - glm::dot(sep, v_bold) * v_bold) / mu; // eccentricity vector
+	const double e = glm::length(e_vec);
+	const double r_p = (h * h / mu) / (1.0 + e);
+
+	if (!(r_p > 0.0)) { // radial infall, the bodies will collide so the corrections are unbounded
+		return std::numeric_limits<double>::infinity();
+	}
+
+	const double v_p = h / r_p;
+
+	// Dimensionless PN parameters at pericentre
+	const double e_r = mu / (r_p * c * c); // Gm/(rc^2)
+	const double e_v = (v_p * v_p) / (c * c); // v^2/c^2
+	const double s_v = std::sqrt(e_v); // v/c
+
+	// Each coefficient of PN_acceleration taken in absolute value, with |r_dot| <= |v|
+	const double b_1PN = (4.0 + 2.0 * n_smr) * e_r
+		+ ((1.0 + 3.0 * n_smr) + (1.5 * n_smr) + std::abs(4.0 - 2.0 * n_smr)) * e_v;
+
+	const double b_2PN = (0.75 * (12.0 + 29.0 * n_smr)) * e_r * e_r
+		+ (n_smr * std::abs(3.0 - 4.0 * n_smr) * 2.5
+			+ (15.0 / 8.0) * n_smr * std::abs(1.0 - 3.0 * n_smr)
+			+ n_smr * (15.0 + 4.0 * n_smr)
+			+ 1.5 * n_smr * (3.0 + 2.0 * n_smr)) * e_v * e_v
+		+ (0.5 * n_smr * std::abs(13.0 - 4.0 * n_smr)
+			+ (2.0 + 25.0 * n_smr + 2.0 * n_smr * n_smr)
+			+ 0.5 * (4.0 + 41.0 * n_smr + 8.0 * n_smr * n_smr)) * e_r * e_v;
+
+	const double b_25PN = (8.0 / 15.0) * n_smr * e_r * ((12.0 * e_v) + (26.0 * e_r)) * s_v;
+
+	return b_1PN + b_2PN + b_25PN;
+}
+
+bool kepler_propagate(dmat43& y, double m1, double m2, double dt, int* evaluations) {
+	const double m = m1 + m2;
+	const double mu = G * m;
+	const double sqrt_mu = std::sqrt(mu);
+
+	// Centre of mass and relative coordinates
+	// -------------------------------------------------------------------------------------
+	dvec3 com_pos = (m1 * y[0] + m2 * y[2]) / m;
+	dvec3 com_vel = (m1 * y[1] + m2 * y[3]) / m;
+
+	dvec3 r0_vec = y[0] - y[2];
+	dvec3 v0_vec = y[1] - y[3];
+
+	const double r0 = glm::length(r0_vec);
+	const double v0_2 = glm::dot(v0_vec, v0_vec);
+	const double rv0 = glm::dot(r0_vec, v0_vec) / sqrt_mu; // r0 * vr0 / sqrt(mu)
+
+	if (!(r0 > 0.0)) {
+		return false;
+	}
+
+	const double alpha = 2.0 / r0 - v0_2 / mu; // reciprocal semi-major axis (> 0 ellipse, = 0 parabola, < 0 hyperbola)
+
+	// Bound orbits are periodic, only the remainder of dt past whole periods needs propagating
+	double t = dt;
+	if (alpha > 0.0) {
+		const double period = 2.0 * PI / (sqrt_mu * alpha * std::sqrt(alpha));
+		t = std::fmod(dt, period);
+	}
+
+	// Universal Kepler equation solved for chi
+	// F(chi) = rv0 chi^2 C(z) + (1 - alpha r0) chi^3 S(z) + r0 chi - sqrt(mu) t, with z = alpha chi^2
+	// dF/dchi is the separation r > 0, so F is monotonic and the root can be bracketed and Newton safeguarded with bisection
+	// -------------------------------------------------------------------------------------
+	int calls = 0;
+	auto kepler_F = [&](double x, double& dF) {
+		calls++;
+		const double z = alpha * x * x;
+		const double C = stumpff_C(z), S = stumpff_S(z);
+		const double F = rv0 * x * x * C + (1.0 - alpha * r0) * x * x * x * S + r0 * x - sqrt_mu * t;
+		dF = rv0 * x * (1.0 - z * S) + (1.0 - alpha * r0) * x * x * C + r0;
+		if (!std::isfinite(F)) { // cosh overflow on far hyperbolic guesses, the sign still follows chi
+			dF = std::numeric_limits<double>::infinity();
+			return std::copysign(std::numeric_limits<double>::infinity(), x);
+		}
+		return F;
+	};
+
+	double chi = (alpha > 0.0) ? sqrt_mu * alpha * t : sqrt_mu * t / r0; // initial guess
+	double dF;
+	double F = kepler_F(chi, dF);
+
+	// Bracketing
+	double lo = chi, hi = chi;
+	double width = std::max(std::abs(chi), 1e-8);
+	for (int i = 0; i < 128 && F != 0.0; i++) {
+		if (F < 0.0) {
+			lo = hi;
+			hi += width;
+			F = kepler_F(hi, dF);
+			if (F >= 0.0) { break; }
+		}
+		else {
+			hi = lo;
+			lo -= width;
+			F = kepler_F(lo, dF);
+			if (F <= 0.0) { break; }
+		}
+		width *= 2.0;
+	}
+
+	// Safeguarded Newton iteration
+	bool converged = false;
+	chi = 0.5 * (lo + hi);
+	for (int i = 0; i < 128; i++) {
+		F = kepler_F(chi, dF);
+		if (F == 0.0) { converged = true; break; }
+		if (F < 0.0) { lo = chi; }
+		else { hi = chi; }
+
+		double next = chi - F / dF;
+		if (!(next > lo && next < hi)) { // Newton left the bracket, bisect instead
+			next = 0.5 * (lo + hi);
+		}
+
+		const double step = next - chi;
+		chi = next;
+
+		if (std::abs(step) <= 1e-15 * std::max(1.0, std::abs(chi)) || (hi - lo) <= 1e-15 * std::max(1.0, std::abs(chi))) {
+			converged = true;
+			break;
+		}
+	}
+
+	if (evaluations) {
+		*evaluations = calls;
+	}
+	if (!converged || !std::isfinite(chi)) {
+		return false;
+	}
+
+	const double z = alpha * chi * chi;
+	const double C = stumpff_C(z), S = stumpff_S(z);
+
+	// Lagrange coefficients
+	// -------------------------------------------------------------------------------------
+	const double chi_2 = chi * chi;
+	const double f = 1.0 - (chi_2 / r0) * C;
+	const double g = t - (chi_2 * chi / sqrt_mu) * S;
+
+	dvec3 r_vec = f * r0_vec + g * v0_vec;
+	const double r = glm::length(r_vec);
+
+	const double f_dot = (sqrt_mu / (r * r0)) * (z * chi * S - chi);
+	const double g_dot = 1.0 - (chi_2 / r) * C;
+
+	dvec3 v_vec = f_dot * r0_vec + g_dot * v0_vec;
+
+	// Unpacking back into the individual bodies, the centre of mass drifts uniformly
+	// -------------------------------------------------------------------------------------
+	com_pos += com_vel * dt;
+
+	y[0] = com_pos + (m2 / m) * r_vec;
+	y[1] = com_vel + (m2 / m) * v_vec;
+	y[2] = com_pos - (m1 / m) * r_vec;
+	y[3] = com_vel - (m1 / m) * v_vec;
+
+	return true;
+}
@@ -0,0 +1,526 @@
+#include "logger.h"
+#include "spsc_queue.h"
+#include "text_export.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+
+namespace logger::detail {
+	std::atomic<int> min_level{ static_cast<int>(log_level::info) };
+	std::atomic<std::uint32_t> category_mask{ log_all_categories };
+}
+
+// Logger Constants
+// -------------------------------------------------------------------------------------------
+static const size_t ring_capacity = 512; // records per thread, about 128 KB
+static const unsigned int wake_interval = ring_capacity / 4; // a thread logging heavily schedules the writer every this many records instead of waiting for its period
+static const int urgent_retries = 1000; // attempts a warning or error makes at a full ring before it is dropped
+static const std::chrono::milliseconds writer_period{ 10 }; // the writer drains this often when nobody schedules it
+
+static const char binary_magic[6] = { 'G', 'R', 'L', 'O', 'G', '\0' };
+static const std::uint16_t binary_version = 1;
+
+static const char* level_names[] = { "TRACE", "DEBUG", "INFO ", "WARN ", "ERROR" };
+static const char* category_names[] = { "general", "physics", "integrator", "history", "render", "io" };
+
+// Thread Ring
+// -------------------------------------------------------------------------------------------
+struct thread_ring {
+	spsc_queue<log_record, ring_capacity> records; // the owning thread produces, the writer consumes
+	std::atomic<std::uint64_t> dropped{ 0 };
+	std::atomic<bool> retired{ false }; // its thread has exited, the writer frees it once it is empty
+	std::uint32_t id = 0;
+	unsigned int since_wake = 0; // owning thread only
+};
+
+struct ring_handle { // thread_local owner, marks the ring retired when its thread exits
+	std::shared_ptr<thread_ring> ring;
+	~ring_handle() {
+		if (ring) {
+			ring->retired.store(true, std::memory_order_release);
+		}
+	}
+};
+
+static thread_local ring_handle local_ring;
+static thread_local char local_name[16] = ""; // name given before the thread's first record, its ring is only made once it logs
+
+// Formatting
+// -------------------------------------------------------------------------------------------
+static void appendArg(std::string& line, const log_record& r, const log_arg& a) {
+	char buf[32];
+	int n = 0;
+	switch (a.kind) {
+	case log_arg::sint: n = std::snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(a.i)); break;
+	case log_arg::uint: n = std::snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(a.u)); break;
+	case log_arg::real: n = static_cast<int>(text_export::appendNumber(buf, a.d) - buf); break; // shortest text that round trips
+	case log_arg::pointer: n = std::snprintf(buf, sizeof(buf), "%p", a.p); break;
+	case log_arg::boolean: line += a.u ? "true" : "false"; return;
+	case log_arg::text: line.append(r.text + a.offset, a.length); return;
+	}
+	line.append(buf, static_cast<size_t>(std::max(n, 0)));
+}
+
+static void formatRecord(std::string& line, const log_record& r, const char* format, const std::string& thread_name, double seconds) {
+	char head[96];
+	const int level = std::min<int>(static_cast<int>(r.level), 4);
+	const int category = std::min<int>(static_cast<int>(r.category), static_cast<int>(log_category::count) - 1);
+	const int n = std::snprintf(head, sizeof(head), "[%12.6f] [%s] [%s] [%s] ", seconds, level_names[level], category_names[category], thread_name.c_str());
+	line.append(head, static_cast<size_t>(std::max(n, 0)));
+
+	// {} takes the next argument, {{ and }} are literal braces
+	int next = 0;
+	for (const char* c = format; *c; c++) {
+		if (c[0] == '{' && c[1] == '}') {
+			if (next < r.argc) {
+				appendArg(line, r, r.args[next++]);
+			}
+			else {
+				line += "{}";
+			}
+			c++;
+		}
+		else if ((c[0] == '{' && c[1] == '{') || (c[0] == '}' && c[1] == '}')) {
+			line += *c;
+			c++;
+		}
+		else {
+			line += *c;
+		}
+	}
+	line += '\n';
+}
+
+// Writer
+// -------------------------------------------------------------------------------------------
+class log_writer {
+public:
+	log_writer() : epoch(std::chrono::steady_clock::now()) {}
+
+	std::uint64_t sinceEpoch() const {
+		return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+	}
+
+	std::shared_ptr<thread_ring> registerThread(const char* name) {
+		auto ring = std::make_shared<thread_ring>();
+		std::lock_guard<std::mutex> lock(registry_mtx);
+		ring->id = static_cast<std::uint32_t>(thread_names.size());
+		thread_names.push_back(name[0] ? std::string(name) : "t" + std::to_string(ring->id));
+		rings.push_back(ring);
+		if (!started.load() && !stopped) {
+			writer = std::make_unique<io_drain>([this] { drain(); }, writer_period);
+			started.store(true);
+		}
+		return ring;
+	}
+
+	void nameThread(std::uint32_t id, const char* name) {
+		std::lock_guard<std::mutex> lock(registry_mtx);
+		thread_names[id] = name;
+	}
+
+	bool isRunning() const { return !stopping.load(std::memory_order_acquire); }
+
+	void wake() {
+		writer->schedule(); // the calling thread has registered, so the writer exists
+	}
+
+	void flush() {
+		if (!isRunning() || !started.load()) {
+			return; // nothing has been queued yet
+		}
+		writer->wait();
+	}
+
+	void shutdown() {
+		if (stopping.exchange(true, std::memory_order_acq_rel)) { // records made from here on go straight to stderr
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(registry_mtx);
+			stopped = true; // no writer is made after this
+		}
+		if (started.load()) {
+			writer->stop(); // waits for a pass in progress, the lane starts no other
+		}
+		drain(); // this thread is the only consumer now
+	}
+
+	void configure(const logger_options& new_options) {
+		logger::detail::min_level.store(static_cast<int>(new_options.level), std::memory_order_relaxed);
+		logger::detail::category_mask.store(new_options.categories, std::memory_order_relaxed);
+
+		std::lock_guard<std::mutex> lock(sink_mtx);
+		options = new_options;
+		text_file.close();
+		binary_file.close();
+		if (!options.text_path.empty()) {
+			text_file.open(options.text_path, std::ios::out | std::ios::trunc);
+		}
+		if (!options.binary_path.empty()) {
+			binary_file.open(options.binary_path, std::ios::out | std::ios::trunc | std::ios::binary);
+			binary_file.write(binary_magic, sizeof(binary_magic));
+			put(binary_file, binary_version);
+			format_ids.clear(); // a new file defines its formats and threads again
+			named_threads.clear();
+		}
+	}
+
+	void writeDirect(const log_record& r) { // after shutdown, formatted on the calling thread
+		std::string line;
+		formatRecord(line, r, r.format, "late", r.time_ns * 1e-9);
+		std::lock_guard<std::mutex> lock(sink_mtx);
+		std::fwrite(line.data(), 1, line.size(), stderr);
+		if (text_file.is_open()) {
+			text_file << line << std::flush;
+		}
+	}
+
+	std::uint64_t droppedTotal() {
+		std::lock_guard<std::mutex> lock(registry_mtx);
+		return retired_dropped + liveDropped();
+	}
+
+private:
+	std::chrono::steady_clock::time_point epoch;
+
+	// Rings, guarded by registry_mtx (the writer only holds it to take a copy of the list)
+	std::mutex registry_mtx;
+	std::vector<std::shared_ptr<thread_ring>> rings;
+	std::vector<std::string> thread_names; // by ring id
+	std::uint64_t retired_dropped = 0; // dropped by rings already freed
+	bool stopped = false;
+
+	// Sinks, guarded by sink_mtx
+	std::mutex sink_mtx;
+	logger_options options;
+	std::ofstream text_file, binary_file;
+	std::unordered_map<const char*, std::uint32_t> format_ids; // formats already defined in the binary file
+	std::vector<bool> named_threads; // threads already named in the binary file
+
+	// Writer, a drain on the I/O lane
+	std::unique_ptr<io_drain> writer; // made by the first thread to log, never released (stopped at shutdown) as any thread may still schedule it
+	std::atomic<bool> started{ false };
+	std::atomic<bool> stopping{ false };
+	std::uint64_t reported_dropped = 0; // writer only
+
+	std::vector<log_record> batch; // writer only, reused between passes
+	std::vector<std::shared_ptr<thread_ring>> ring_copy;
+	std::vector<std::string> name_copy;
+	std::string out_line, err_line;
+
+	std::uint64_t liveDropped() const {
+		std::uint64_t total = 0;
+		for (const auto& ring : rings) {
+			total += ring->dropped.load(std::memory_order_relaxed);
+		}
+		return total;
+	}
+
+	void drain() {
+		std::uint64_t dropped_now;
+		{
+			std::lock_guard<std::mutex> lock(registry_mtx);
+			// Retired rings are freed once empty, the retired flag is read first so nothing pushed before it was set is missed
+			for (size_t i = 0; i < rings.size();) {
+				if (rings[i]->retired.load(std::memory_order_acquire) && rings[i]->records.empty()) {
+					retired_dropped += rings[i]->dropped.load(std::memory_order_relaxed);
+					rings.erase(rings.begin() + i);
+				}
+				else {
+					i++;
+				}
+			}
+			ring_copy = rings;
+			name_copy = thread_names;
+			dropped_now = retired_dropped + liveDropped();
+		}
+
+		batch.clear();
+		log_record r;
+		for (const auto& ring : ring_copy) {
+			while (ring->records.try_pop(r)) {
+				batch.push_back(r);
+			}
+		}
+		std::stable_sort(batch.begin(), batch.end(), [](const log_record& a, const log_record& b) { return a.time_ns < b.time_ns; }); // threads interleaved as they happened
+
+		std::lock_guard<std::mutex> lock(sink_mtx);
+		out_line.clear();
+		err_line.clear();
+		for (const log_record& rec : batch) {
+			emit(rec);
+		}
+		if (dropped_now > reported_dropped) {
+			log_record note{};
+			note.time_ns = sinceEpoch();
+			note.format = "{} log records dropped, the rings were full";
+			note.level = log_level::warn;
+			note.category = log_category::general;
+			note.argc = 1;
+			note.args[0].kind = log_arg::uint;
+			note.args[0].u = dropped_now - reported_dropped;
+			note.thread = UINT32_MAX;
+			emit(note);
+			reported_dropped = dropped_now;
+		}
+
+		if (options.console) {
+			std::fwrite(out_line.data(), 1, out_line.size(), stdout);
+			std::fflush(stdout);
+			std::fwrite(err_line.data(), 1, err_line.size(), stderr);
+		}
+		if (text_file.is_open()) {
+			text_file.flush();
+		}
+		if (binary_file.is_open()) {
+			binary_file.flush();
+		}
+	}
+
+	void emit(const log_record& r) { // sink_mtx held
+		const std::string& name = (r.thread < name_copy.size()) ? name_copy[r.thread] : log_name;
+
+		if (options.console || text_file.is_open()) {
+			std::string& line = (r.level >= log_level::warn) ? err_line : out_line;
+			const size_t start = line.size();
+			formatRecord(line, r, r.format, name, r.time_ns * 1e-9);
+			if (text_file.is_open()) {
+				text_file.write(line.data() + start, static_cast<std::streamsize>(line.size() - start));
+			}
+			if (!options.console) {
+				line.resize(start);
+			}
+		}
+		if (binary_file.is_open()) {
+			writeBinary(r, name);
+		}
+	}
+
+	// Binary sink
+	// ---------------------------------------------------------------------------------------
+	// 'F' id len bytes : defines a format, 'T' id len bytes : names a thread
+	// 'R' time thread level category format argc (kind payload)... : one record, payload is 8 bytes or a length byte and text
+	// Integers are written in the byte order of the machine that logged them
+	template <typename T>
+	static void put(std::ofstream& f, const T& v) { f.write(reinterpret_cast<const char*>(&v), sizeof(T)); }
+
+	void writeBinary(const log_record& r, const std::string& name) {
+		auto it = format_ids.find(r.format);
+		if (it == format_ids.end()) {
+			const std::uint32_t id = static_cast<std::uint32_t>(format_ids.size());
+			it = format_ids.emplace(r.format, id).first;
+			const std::uint16_t len = static_cast<std::uint16_t>(std::min<size_t>(std::strlen(r.format), UINT16_MAX));
+			binary_file.put('F');
+			put(binary_file, id);
+			put(binary_file, len);
+			binary_file.write(r.format, len);
+		}
+		if (r.thread != UINT32_MAX) {
+			if (named_threads.size() <= r.thread) {
+				named_threads.resize(r.thread + 1, false);
+			}
+			if (!named_threads[r.thread]) {
+				named_threads[r.thread] = true;
+				const std::uint8_t len = static_cast<std::uint8_t>(std::min<size_t>(name.size(), 255));
+				binary_file.put('T');
+				put(binary_file, r.thread);
+				put(binary_file, len);
+				binary_file.write(name.data(), len);
+			}
+		}
+
+		binary_file.put('R');
+		put(binary_file, r.time_ns);
+		put(binary_file, r.thread);
+		put(binary_file, static_cast<std::uint8_t>(r.level));
+		put(binary_file, static_cast<std::uint8_t>(r.category));
+		put(binary_file, it->second);
+		put(binary_file, r.argc);
+		for (int i = 0; i < r.argc; i++) {
+			const log_arg& a = r.args[i];
+			put(binary_file, static_cast<std::uint8_t>(a.kind));
+			if (a.kind == log_arg::text) {
+				put(binary_file, a.length);
+				binary_file.write(r.text + a.offset, a.length);
+			}
+			else {
+				put(binary_file, a.u);
+			}
+		}
+	}
+
+	static const std::string log_name;
+};
+
+const std::string log_writer::log_name = "log";
+
+static log_writer& core() {
+	static log_writer* writer = new log_writer; // never destroyed, threads may still log while the process exits
+	return *writer;
+}
+
+struct shutdown_guard { // drains the rings when the process exits normally
+	~shutdown_guard() { logger::shutdown(); }
+};
+static shutdown_guard guard;
+
+// Logger
+// -------------------------------------------------------------------------------------------
+void logger::detail::submit(log_record& record) {
+	log_writer& w = core();
+	record.time_ns = w.sinceEpoch();
+
+	if (!w.isRunning()) {
+		w.writeDirect(record);
+		return;
+	}
+
+	if (!local_ring.ring) {
+		local_ring.ring = w.registerThread(local_name);
+	}
+	thread_ring& ring = *local_ring.ring;
+	record.thread = ring.id;
+
+	if (ring.records.try_push(record)) {
+		if (++ring.since_wake >= wake_interval) {
+			ring.since_wake = 0;
+			w.wake();
+		}
+		return;
+	}
+	if (record.level >= log_level::warn) {
+		for (int i = 0; i < urgent_retries; i++) {
+			w.wake();
+			std::this_thread::yield();
+			if (ring.records.try_push(record)) {
+				return;
+			}
+		}
+	}
+	ring.dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void logger::configure(const logger_options& options) {
+	core().configure(options);
+}
+
+void logger::setLevel(log_level level) {
+	detail::min_level.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+void logger::setCategories(std::uint32_t mask) {
+	detail::category_mask.store(mask, std::memory_order_relaxed);
+}
+
+void logger::nameThread(const char* name) {
+	const size_t n = strnlen(name, sizeof(local_name) - 1);
+	std::memcpy(local_name, name, n);
+	local_name[n] = '\0';
+	if (local_ring.ring) {
+		core().nameThread(local_ring.ring->id, local_name);
+	}
+}
+
+void logger::flush() {
+	core().flush();
+}
+
+void logger::shutdown() {
+	core().shutdown();
+}
+
+std::uint64_t logger::dropped() {
+	return core().droppedTotal();
+}
+
+bool logger::convertBinary(const std::string& binary_path, std::ostream& out) {
+	std::ifstream in(binary_path, std::ios::binary);
+	char magic[sizeof(binary_magic)];
+	std::uint16_t version = 0;
+	in.read(magic, sizeof(magic));
+	in.read(reinterpret_cast<char*>(&version), sizeof(version));
+	if (!in || std::memcmp(magic, binary_magic, sizeof(magic)) != 0 || version != binary_version) {
+		return false;
+	}
+
+	auto get = [&in](auto& v) { in.read(reinterpret_cast<char*>(&v), sizeof(v)); return static_cast<bool>(in); };
+
+	std::vector<std::string> formats;
+	std::unordered_map<std::uint32_t, std::string> names;
+	std::string line;
+	int tag;
+	while ((tag = in.get()) != EOF) {
+		if (tag == 'F') {
+			std::uint32_t id;
+			std::uint16_t len;
+			if (!get(id) || !get(len)) {
+				return false;
+			}
+			if (formats.size() <= id) {
+				formats.resize(id + 1);
+			}
+			formats[id].resize(len);
+			in.read(formats[id].data(), len);
+		}
+		else if (tag == 'T') {
+			std::uint32_t id;
+			std::uint8_t len;
+			if (!get(id) || !get(len)) {
+				return false;
+			}
+			std::string name(len, '\0');
+			in.read(name.data(), len);
+			names[id] = name;
+		}
+		else if (tag == 'R') {
+			log_record r{};
+			std::uint8_t level, category;
+			std::uint32_t format_id;
+			if (!get(r.time_ns) || !get(r.thread) || !get(level) || !get(category) || !get(format_id) || !get(r.argc)) {
+				return false;
+			}
+			r.level = static_cast<log_level>(level);
+			r.category = static_cast<log_category>(category);
+			if (r.argc > log_record::max_args || format_id >= formats.size()) {
+				return false;
+			}
+			for (int i = 0; i < r.argc; i++) {
+				log_arg& a = r.args[i];
+				std::uint8_t kind;
+				if (!get(kind)) {
+					return false;
+				}
+				a.kind = static_cast<log_arg::kind_t>(kind);
+				if (a.kind == log_arg::text) {
+					if (!get(a.length) || r.text_used + a.length > log_record::text_capacity) {
+						return false;
+					}
+					a.offset = r.text_used;
+					in.read(r.text + r.text_used, a.length);
+					r.text_used = static_cast<std::uint8_t>(r.text_used + a.length);
+				}
+				else if (!get(a.u)) {
+					return false;
+				}
+			}
+			auto name = names.find(r.thread);
+			line.clear();
+			formatRecord(line, r, formats[format_id].c_str(), (name != names.end()) ? name->second : std::string("log"), r.time_ns * 1e-9);
+			out << line;
+		}
+		else {
+			return false;
+		}
+	}
+	return true;
+}
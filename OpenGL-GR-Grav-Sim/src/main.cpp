@@ -1,9 +1,12 @@
-#define M_PI        3.14159265358979323846264338327950288   /* pi */
 #define GLM_ENABALE_EXPERIMENTAL
 #define STB_IMAGE_IMPLEMENTATION
 
 #include "formulae.h"
 #include "integration.h"
+#include "thread_pool.h"
+#include "logger.h"
+#include "simulation.h"
+#include "orbit_preview.h"
 #include "shaders_c.h"
 #include "celestial_body_class.h"
 #include "camera_class.h"
@@ -33,6 +36,8 @@
 #include <atomic>
 #include <chrono>
 #include <thread>
+#include <random>
+#include <algorithm>
 
 int SCR_WIDTH = 800;
 int SCR_HEIGHT = 600;
@@ -51,6 +56,8 @@ constexpr glm::vec3 X_AXIS(AXIS_LEN, 0.0f, 0.0f);
 constexpr glm::vec3 Y_AXIS(0.0f, AXIS_LEN, 0.0f);
 constexpr glm::vec3 Z_AXIS(0.0f, 0.0f, AXIS_LEN);
 
+constexpr double max_interp_fraction = 0.125; // queued states further apart than this share of the orbital period are held, not interpolated
+
 cameras::camera cam(-90.0f, 0.0f, 800.0f / 2.0f, 600.0f / 2.0f, 45.0f);
 
 using dvec3 = glm::dvec3;
@@ -58,219 +65,6 @@ using dmat43 = glm::mat<4, 3, double>;
 
 namespace fs = std::filesystem;
 
-std::atomic<bool> pause = false;
-std::atomic<bool> halted = false;
-
-std::mutex mtx;
-std::condition_variable P_cv;
-//std::condition_variable H_cv;
-
-struct state { // Snapshot of the program that the user can return to
-	dmat43 vectors;
-	double m1;
-	double m2;
-
-public:
-	// Constructors
-	state(dmat43 con_y, double con_mass1, double con_mass2) // dmat43, double, double
-		: vectors(con_y), m1(con_mass1), m2(con_mass2) { }
-	state(dvec3 con_pos1, dvec3 con_vel1, dvec3 con_pos2, dvec3 con_vel2, double con_mass1, double con_mass2) // dvec3, dvec3, dvec3, dvec3, double, double
-		: m1(con_mass1), m2(con_mass2) {
-		vectors[0] = con_pos1;
-		vectors[1] = con_vel1;
-		vectors[2] = con_pos2;
-		vectors[3] = con_vel2;
-	}
-
-	void print() const {
-		// Mass printing
-		std::cout << "m1 = " << m1 << std::endl;
-		std::cout << "m2 = " << m2 << std::endl;
-		// Matrix printing
-		for (int i = 0; i <= 3; i++) {
-			for (int j = 0; j <= 2; j++) {
-				std::cout << vectors[i][j] << std::endl;
-			}
-		}
-	}
-};
-
-struct Node {
-	state value; // Snapshot of the program that this node represents
-
-	struct Node* next; // Pointer indicating to the next node in the dustack // If there is no next node it is set to nullptr
-
-	Node(state val, struct Node* ptr) // Constructor
-		: value(val), next(ptr) {}
-};
-
-struct dustack { // A dual stack mimicks the operations of flipping between two stacks with one stack evaporating as soon as new data is added to the other
-private:
-	Node* front = nullptr; // points to the top of the fallback list
-	Node* middle = nullptr; // points to the currently accessed data
-	Node* back = nullptr; // points to the top node of the constant list
-	int sizeNum = 0; // current size of the entire strucuture
-
-public:
-	int size() const { return sizeNum; }
-
-	void push(state val, bool output = false) {
-		// Creating the newNode
-		Node* newNode = new Node(val, nullptr);
-
-		if (sizeNum == 0) { // the simplest scenario // the list is empty/being pushed to for the first time
-			middle = newNode;
-			sizeNum = 1;
-			if (output) {
-				std::cout << "[1] " << newNode << std::endl;
-			}
-			return;
-		}
-
-		middle->next = back; // Place the previous state at the top of the constant list
-		back = middle; // Move the back pointer to the new top of the constant list
-
-		if (front) { // if there is a fallback list, it deletes each fallback node and removes the size of the fallback list from the sizeNum
-			Node* cull = front;
-			front = nullptr; // Sets the front pointer to null
-			while (cull) {
-				Node* next = cull->next;
-				delete cull;
-				sizeNum--;
-				cull = next;
-			}
-		}
-
-		middle = newNode; // Adds the new node
-
-		if (output) {
-			std::cout << "[" << sizeNum + 1 << "] " << newNode << std::endl;
-		}
-		sizeNum++; // Increases the size
-
-		if (sizeNum > 20) { // In case of error removes each extra node over the maximum
-			Node* run = back;
-			for (int i = 0; i < 18; i++) { // runs to the end of the list
-				run = run->next;
-			}
-			Node* cull = run->next;
-			run->next = nullptr;
-			while (sizeNum > 20) { // deletes any overflow nodes
-				Node* next = cull->next;
-				delete cull;
-				sizeNum--;
-				cull = next;
-			}
-		}
-	}
-
-	bool undo() {
-		if (back) {
-			// Place middle node into fallback list
-			middle->next = front;
-			front = middle;
-
-			// Move top of constant stack into middle
-			middle = back;
-			back = back->next;
-			middle->next = nullptr;
-			return true;
-		}
-		else {
-			return false;
-		}
-	}
-
-	bool redo() {
-		if (front) {
-			// Move middle node into constant list
-			middle->next = back;
-			back = middle;
-
-			// Recall top of fallback list into the middle
-			middle = front;
-			front = front->next;
-			middle->next = nullptr;
-			return true;
-		}
-		else {
-			return false;
-		}
-	}
-
-	state read() const { return middle->value; }
-
-	void debug(bool flag) {
-		if (flag) {
-			// Middle
-			std::cout << "[MIDDLE] printed " << middle << std::endl;
-			// Back
-			std::cout << "[BACK] printed" << back << std::endl;
-			// Front
-			std::cout << "[FRONT] printed" << front << std::endl;
-
-			if (sizeNum != 1) {
-				// Constant
-				if (back) {
-					std::cout << "[CONSTANT]" << std::endl;
-					Node* next = back;
-					while (next) {
-						std::cout << "[CONSTANT STATE] printed " << next << std::endl;
-
-						next = next->next;
-					}
-
-				}
-
-				// Fallback
-				if (front) {
-					std::cout << "[FALLBACK]" << std::endl;
-					Node* next = front;
-					while (next) {
-						std::cout << "[FALLBACK STATE] printed " << next << std::endl;
-
-						next = next->next;
-					}
-				}
-			}
-		}
-		else {
-			// Middle
-			state crt = middle->value;
-			std::cout << "[MIDDLE]" << std::endl;
-			crt.print();
-
-			if (sizeNum != 1) {
-				// Constant
-				if (back) {
-					std::cout << "[CONSTANT]" << std::endl;
-					Node* next = back;
-					while (next) {
-						state debug = next->value;
-
-						debug.print();
-
-						next = next->next;
-					}
-				}
-
-				// Fallback
-				if (front) {
-					std::cout << "[FALLBACK]" << std::endl;
-					Node* next = front;
-					while (next) {
-						state debug = next->value;
-
-						debug.print();
-
-						next = next->next;
-					}
-				}
-			}
-		}
-	}
-};
-
 struct clsState {
 	celestial_body* b1;
 	celestial_body* b2;
@@ -322,129 +116,131 @@ void ImGui_Input_Vector_Fields(infields intp_type, render_object& edit_obj);
 
 class buffer_box {
 private:
-	mathState backBuffer; // The back buffer. Used for the background mathematics and the buffer used by the physics thread
-	clsState frontBuffer; // The front buffer. Used for displaying the position of the bodies and the buffer used by the rendering function within the main thread
+	Simulation& sim; // The simulation shown, its physics thread owns the back buffer (state) and the edit history
+	clsState frontBuffer; // The front buffer. Used for displaying the position of the bodies and the buffer used by the rendering function within the main thread (only ever touched by that thread)
+	timed_state lerp_prev, lerp_next; // Bracketing states taken off the simulation's lookahead queue
+	dvec3 accl1{ 0.0 }, accl2{ 0.0 }; // Accelerations of the Frontbuffer bodies, as published by the physics thread
+	bool has_prev = false, has_next = false;
 	glm::vec2 mousePos; // The mouse buffer. Stores the location of the most recent mouse input
-	dustack editStack; // Custom data structure for undoing and redoing edits
-	float sim_speed = 1.0f;
-	bool crash_flag;
 	int GUI_ID; // The GUI ID. Informs the rendering what gui (in context of the bodies) to display at a given moment
 
-	void bufferSet(celestial_body& body1, celestial_body& body2) {
-		// Constructor Function
+public:
+	buffer_box(Simulation& sim, celestial_body& body1, celestial_body& body2) : sim(sim) {
 		frontBuffer.b1 = &body1;
 		frontBuffer.b2 = &body2;
-		backBuffer.y[0] = body1.getPos();
-		backBuffer.y[1] = body1.getVel();
-		backBuffer.y[2] = body2.getPos();
-		backBuffer.y[3] = body2.getVel();
-		backBuffer.m1 = body1.getMass();
-		backBuffer.m2 = body2.getMass();
-		backBuffer.physics_time = 0.0;
 	}
 
-	void edit(dvec3 pos1_edit, dvec3 vel1_edit, dvec3 pos2_edit, dvec3 vel2_edit, double m1_edit, double m2_edit) { // Changes the values within each buffer.
-		// Pack Matrix
-		dmat43 dim_edits = { pos1_edit, vel1_edit, pos2_edit, vel2_edit };
-
-		//Back Buffer Edits
-		backBuffer.y = dim_edits; // Apply dimensional edits to the backbuffer
-		backBuffer.m1 = m1_edit; // Apply the mass edits of b1 to the backbuffer
-		backBuffer.m2 = m2_edit; // Apply the mass edits of b2 to the backbuffer
+	bool changeBuffers(std::uint64_t awaited_ticket = 0) {
+		// Copies the latest published frame into the Frontbuffer, returns false if nothing new was published since the last call
+		// Frames published before the command awaited_ticket was applied are skipped, so an edit shown in the front buffer is never overwritten by an older step
+		if (!sim.acquireFrame()) {
+			return false;
+		}
+		const sim_snapshot& frame = sim.frame();
+		if (frame.ticket < awaited_ticket) {
+			return false;
+		}
+		celestial_body& b1 = *frontBuffer.b1;
+		celestial_body& b2 = *frontBuffer.b2;
 
-		//Front Buffer Edits
-		celestial_body& b1 = *frontBuffer.b1; // Dereference b1
-		celestial_body& b2 = *frontBuffer.b2; // Dereference b2
+		if (b1.getMass() != frame.m1) { b1.setMass(frame.m1); } // the radius is only recalculated when the mass actually changed
+		if (b2.getMass() != frame.m2) { b2.setMass(frame.m2); }
 
-		b1.setMass(m1_edit);
-		b2.setMass(m2_edit);
+		b1.setPos(frame.y[0]);
+		b1.setVel(frame.y[1]);
+		b2.setPos(frame.y[2]);
+		b2.setVel(frame.y[3]);
+		accl1 = frame.dydt[1];
+		accl2 = frame.dydt[3];
+		return true;
+	}
 
-		b1.setPos(pos1_edit);
-		b1.setVel(vel1_edit);
+	bool interpolateFrontBuffer(double now) {
+		// Moves the Frontbuffer bodies to their position at the display time now, Hermite interpolated between the two queued states around it
+		// Returns false if there is nothing queued yet, the Frontbuffer then keeps the latest published frame
+		timed_state s;
+		while ((!has_next || lerp_next.display_time <= now) && sim.popLookahead(s)) {
+			if (s.discontinuity || !has_prev) {
+				lerp_prev = s;
+				has_prev = true;
+				has_next = false;
+				continue;
+			}
+			if (has_next) {
+				lerp_prev = lerp_next;
+			}
+			lerp_next = s;
+			has_next = true;
+		}
+		if (!has_prev) {
+			return false;
+		}
 
-		b2.setPos(pos2_edit);
-		b2.setVel(vel2_edit);
+		dmat43 y, dydt;
+		if (!has_next || now >= lerp_next.display_time) {
+			y = has_next ? lerp_next.y : lerp_prev.y; // the physics thread has fallen behind the display, hold rather than extrapolate
+			dydt = has_next ? lerp_next.dydt : lerp_prev.dydt;
+		}
+		else if (now <= lerp_prev.display_time || !interpolable(lerp_prev, lerp_next)) {
+			y = lerp_prev.y; // a high time warp, the cubic would cut across the orbit, so each state is shown until the next one is due
+			dydt = lerp_prev.dydt;
+		}
+		else {
+			const double theta = (now - lerp_prev.display_time) / (lerp_next.display_time - lerp_prev.display_time);
+			y = RK45_integration::interpolate(lerp_prev.y, lerp_prev.dydt, lerp_next.y, lerp_next.dydt, lerp_next.physics_time - lerp_prev.physics_time, theta);
+			dydt = lerp_prev.dydt + theta * (lerp_next.dydt - lerp_prev.dydt); // only drawn as arrows, linear is close enough
+		}
+		accl1 = dydt[1];
+		accl2 = dydt[3];
+
+		frontBuffer.b1->setPos(y[0]);
+		frontBuffer.b1->setVel(y[1]);
+		frontBuffer.b2->setPos(y[2]);
+		frontBuffer.b2->setVel(y[3]);
+		return true;
 	}
 
-public:
-	buffer_box(celestial_body& body1, celestial_body& body2) {
-		bufferSet(body1, body2);
+	// Whether the cubic through two queued states follows the orbit, false once they are a large share of the period apart
+	// The period is the local one, 2 pi sqrt(r / |a|) from the relative acceleration, so it needs no masses and shortens through pericentre
+	static bool interpolable(const timed_state& a, const timed_state& b) {
+		const double r = glm::length(a.y[2] - a.y[0]);
+		const double accel = glm::length(a.dydt[3] - a.dydt[1]);
+		if (!(r > 0.0) || !(accel > 0.0)) {
+			return true;
+		}
+		const double period = 2.0 * PI * std::sqrt(r / accel);
+		return b.physics_time - a.physics_time <= max_interp_fraction * period;
 	}
 
-	void changeBuffers() {
-		// Copies Backbuffer into Frontbuffer
-		dmat43 y = backBuffer.y;
+	void previewEdits(dvec3 pos1_edit, dvec3 vel1_edit, dvec3 pos2_edit, dvec3 vel2_edit, double m1_edit, double m2_edit) { // Shows an edit in the Frontbuffer straight away, while the command carrying it waits for the physics thread
 		celestial_body& b1 = *frontBuffer.b1;
 		celestial_body& b2 = *frontBuffer.b2;
 
-		b1.setPos(y[0]);
-		b1.setVel(y[1]);
-		b2.setPos(y[2]);
-		b2.setVel(y[3]);
-	}
-
-	mathState readBackBuffer() const { return backBuffer; } // returns the back buffer
-	clsState readFrontBuffer() const { return frontBuffer; } // returns the back buffer
-	float getSimSpeed() const { return sim_speed; }
-	bool checkCrash() const { return crash_flag; }
-	void setSimSpeed(const float speed) { sim_speed = speed; }
-	void setCrash(const bool flag) { crash_flag = flag; crash::OnSimulationCrash();}
-
-	void physicsStateUpdate(const dmat43 state) {
-		backBuffer.y = state;
-	} // Updates the backbuffer with a new state and new time
-
-	void applyEdits(dvec3 pos1_edit, dvec3 vel1_edit, dvec3 pos2_edit, dvec3 vel2_edit, double m1_edit, double m2_edit) { // Update the back buffer and front buffer with a completely new state / simulation
-		edit(pos1_edit, vel1_edit, pos2_edit, vel2_edit, m1_edit, m2_edit);
+		b1.setMass(m1_edit);
+		b2.setMass(m2_edit);
 
-		state val(pos1_edit, vel1_edit, pos2_edit, vel2_edit, m1_edit, m2_edit);
+		b1.setPos(pos1_edit);
+		b1.setVel(vel1_edit);
 
-		editStack.push(val);
+		b2.setPos(pos2_edit);
+		b2.setVel(vel2_edit);
 	}
-	void applyEdits(state &edit_state) { // Update the back buffer and front buffer with a completely new state / simulation (state parameter)
-		edit(edit_state.vectors[0], edit_state.vectors[1], edit_state.vectors[2], edit_state.vectors[3], edit_state.m1, edit_state.m2);
 
-		editStack.push(edit_state);
-	}
+	const sim_snapshot& readSnapshot() const { return sim.frame(); } // Latest frame taken by changeBuffers
 
-	void undoState(bool running_flag = false) {
-		if (!running_flag) {
-			editStack.undo();
+	clsState readFrontBuffer() const { return frontBuffer; } // returns the front buffer
+	dvec3 readAccl1() const { return accl1; } // Acceleration of body 1 in the front buffer
+	dvec3 readAccl2() const { return accl2; } // Acceleration of body 2 in the front buffer
+	bool checkCrash() const { // Picks a crash blurb the first time the physics thread's crash is seen
+		if (sim.checkCrash()) {
+			crash::OnSimulationCrash();
+			return true;
 		}
-		state new_val = editStack.read();
-		dmat43 vectors = new_val.vectors;
-		edit(vectors[0], vectors[1], vectors[2], vectors[3], new_val.m1, new_val.m2);
-	}
-
-	void redoState() {
-		editStack.redo();
-		state new_val = editStack.read();
-		dmat43 vectors = new_val.vectors;
-		edit(vectors[0], vectors[1], vectors[2], vectors[3], new_val.m1, new_val.m2);
+		return false;
 	}
-
-	state readState() { return editStack.read(); }
+	void clearCrash() { sim.clearCrash(); }
 
 	// Debug Functions
-	void debugBackBuffer() const {
-		dmat43 y = backBuffer.y;
-
-		for (int i = 0; i < 4; i = i + 2) {
-			std::cout << "bckbuf pos = ";
-			for (int j = 0; j < 3; j++) {
-				std::cout << std::setprecision(20) << y[i][j] << ", ";
-			}
-			std::cout << "\n";
-			std::cout << "bckbuf vel = ";
-			for (int j = 0; j < 3; j++) {
-				std::cout << std::setprecision(20) << y[i + 1][j] << ", ";
-			}
-			std::cout << "\n";
-		}
-		std::cout << std::setprecision(20) << "bckbuf m1 = " << backBuffer.m1 << "\n";
-		std::cout << std::setprecision(20) << "bckbuf m2 = " << backBuffer.m2 << "\n";
-	}
-
 	void debugFrontBuffer() const {
 		celestial_body& b1 = *frontBuffer.b1;
 		celestial_body& b2 = *frontBuffer.b2;
@@ -453,19 +249,10 @@ public:
 		b2.print();
 	}
 
-	void debugEditLog(bool flag) {
-		editStack.debug(flag);
-	}
-
 	glm::vec2 getMousePos() const { return mousePos; }
 	void setMousePos(const glm::vec2 position) { mousePos = position; }
 };
 
-// Nil State
-dvec3 empty_vector{ 0.0,0.0,0.0 };
-double empty_double = 0.0;
-state nil(empty_vector, empty_vector, empty_vector, empty_vector, empty_double, empty_double);
-
 // Initial State
 // Body 1 Characteristics
 dvec3 pos1{ 0.0, 0.0, 0.0 };
@@ -474,86 +261,21 @@ double m1 = 1;
 
 // Body 2 Characteristics
 dvec3 pos2{ 1.0, 0.0, 0.0 };
-dvec3 v2{ 0.0, 2.0 * M_PI, 0.0 };
+dvec3 v2{ 0.0, 2.0 * PI, 0.0 };
 double m2 = 3.003e-6;
 
 // Creates the celestial body objects
 celestial_body body1(pos1, v1, m1);
 celestial_body body2(pos2, v2, m2);
 
-buffer_box bufbx = buffer_box(body1, body2);
-
 state earth_sun(pos1, v1, pos2, v2, m1, m2);
 
-state presets[5] = { state(pos1, v1, pos2, v2, m1, m2), nil, nil, nil, nil };
-
-void physics_thread(GLFWwindow* window, RK45_integration& integrator, double sim_speed) {
-	double ct, lt = 0.0, accum_t = 0.0;
-	double physics_dt = 0.033;
-	dmat43 mat{ dvec3{ 0.0 }, dvec3{ 0.0 }, dvec3{ 0.0 }, dvec3{ 0.0 } };
-	integrate_result result(mat, 0, 0, 0, 0.0, false); 
-	bool wait_f = false;
-
-	int count = 0, accepts = 0, rejects = 0;
-
-	while (!glfwWindowShouldClose(window)) {
-		//halted = true; // Momentarily updates the halted variable so it may be caught if the ImGUI pause function has started
-		//H_cv.notify_one(); // Notifies the rendering function IF IT IS WAITING, if it's not waitng nothing happens and this just goes onto the next step
-
-		double lock_time_start = glfwGetTime();
-
-		{
-			std::unique_lock<std::mutex> lock(mtx);
-			P_cv.wait(lock, [] { return !pause; });
-		}; // Mutex unqiue_lock checks if the physics thread has been set to pause
-
-		double lock_time_end = glfwGetTime();
-		double lock_duration = lock_time_end - lock_time_start;
-
-		//halted = false; // After checking that it doesn't need to halted it then sets the halted variable to false
-
-		mathState BackBuffer = bufbx.readBackBuffer(); // Reads the current backbuffer
-		
-		ct = glfwGetTime();
-		double delta = ct - lt - lock_duration; // change in time since last
-		lt = ct;
-		accum_t += delta;
-
-		while (accum_t >= physics_dt) {
-			wait_f = true;
-			accum_t -= physics_dt;
-			result = integrator.step(BackBuffer, physics_dt); // Steps through the physics given the current state within the backbuffer
-
-			bufbx.physicsStateUpdate(result.state_y);
-
-			{
-				std::lock_guard<std::mutex> lock(mtx);
-				if (result.crash_f) {
-					bufbx.setCrash(true);
-					pause = true;
-					accum_t = 0.0;
-				}
-				else {
-					bufbx.changeBuffers();
-				}
-			}
-			P_cv.notify_one();
-		}
-
-		count += result.count;
-		accepts += result.accepts;
-		rejects += result.rejects;
+Simulation sim(earth_sun, 1e-8, 1e-10, 0.05); // The simulation this window shows
+scenario_db scenarios; // Named initial conditions, browsed from the Presets menu and saved to by the physics thread
 
-		//std::cout << "accept ratio = " << accepts / count << std::endl;
-		//std::cout << "reject ratio = " << rejects / count << std::endl;
+buffer_box bufbx = buffer_box(sim, body1, body2);
 
-		if (wait_f) {
-			std::this_thread::sleep_for(std::chrono::milliseconds(33));
-			wait_f = false;
-
-		}
-	}
-}
+std::uint64_t awaited_ticket = 0; // Last command sent that changes the state, frames older than it are not shown (render thread)
 
 void render(GLFWwindow* window, int FPS, glm::vec4 background, bool show, const char* glsl_version) {
 	// GLFW Set
@@ -604,7 +326,7 @@ void render(GLFWwindow* window, int FPS, glm::vec4 background, bool show, const
 	// Initialises GLAD
 	if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
 	{
-		std::cout << "Failed to initialise GLAD" << std::endl;
+		logger::error(log_category::render, "Failed to initialise GLAD");
 	}
 
 	// Main View Shader
@@ -633,6 +355,16 @@ void render(GLFWwindow* window, int FPS, glm::vec4 background, bool show, const
 	bool checkpt_f = false;
 
 	bool exp_menu = false;
+	bool newtonian_preset = sim.getNewtonian();
+
+	// Scenario store
+	char scenario_search[64] = "";
+	std::vector<scenario_id> scenario_hits; // entries matching the search, looked up again only when it changes or the menu opens (ids stay valid through saves)
+	bool save_scenario = false;
+	char scenario_name[command_name_size] = "";
+	char scenario_tags[command_tags_size] = "";
+	double warp = 1.0; // Time warp shown on the slider, the physics thread is sent every change
+	const double warp_min = 1e-3, warp_max = 1e9;
 
 	glm::mat4 view;	// view matrix, representative of the current position of the where the point of view originates and in what direction
 	glm::mat4 projection; // projection matrix, responsible for dictating what is in view / what can be seen
@@ -705,6 +437,20 @@ void render(GLFWwindow* window, int FPS, glm::vec4 background, bool show, const
 		32
 	);
 
+	// Tracer Particles
+	objects::point_cloud tracerCloud(
+		glm::vec3{ 0.6f, 0.8f, 1.0f },
+		2.0f
+	);
+
+	// Ghost Orbits, the predicted path of an edit
+	const glm::vec3 ghost_colour{ 0.7f, 0.7f, 0.7f };
+	const glm::vec3 ghost_crash_colour{ 1.0f, 0.3f, 0.3f }; // the prediction crashed, resuming would too
+	objects::polyline ghost1(ghost_colour, 1.0f);
+	objects::polyline ghost2(ghost_colour, 1.0f);
+	orbit_preview preview;
+	bool ghost_shown = false;
+
 	// Sphere Bodies
 	objects::sphere sphere1(
 		32, 
@@ -728,13 +474,17 @@ void render(GLFWwindow* window, int FPS, glm::vec4 background, bool show, const
 		}
 
 		// Front Buffer Snapshot
+		bool new_frame = bufbx.changeBuffers(awaited_ticket); // takes the latest frame the physics thread published, if there is one
+		if (!sim.isPaused() && bufbx.readSnapshot().ticket >= awaited_ticket) { // an edit waiting on the physics thread keeps its preview
+			bufbx.interpolateFrontBuffer(std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count()); // smooth motion at the display rate, the published frame is already a step ahead
+		}
 		clsState snapshot = bufbx.readFrontBuffer(); // grabs the pointers for the celestial body class objects
 
 		float currentFrame = glfwGetTime();
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
 
-		if (!pause) {
+		if (!sim.isPaused()) {
 			edit_f = false;
 			checkpt_f = false;
 		}
@@ -757,12 +507,9 @@ void render(GLFWwindow* window, int FPS, glm::vec4 background, bool show, const
 			body2_edit.mass = body2.mass;
 		}
 
-		// Relative acceleration of the current state
-		dvec3 a_rel = PN_acceleration(body1.pos, body2.pos, body1.vel, body2.vel, body1.mass, body2.mass);
-		dvec3 a1, a2;
-		resolve_rel_accel(a_rel, a1, a2, body1.mass, body2.mass); // Seperates the individual accelerations of each body given the mass ratio
-		body1.accl = a1;
-		body2.accl = a2;
+		// Accelerations come with the frame, the physics thread already has them from its last stage
+		body1.accl = bufbx.readAccl1();
+		body2.accl = bufbx.readAccl2();
 
 		//std::cout << "[A1] x = " << body1.accl.x << " y = " << body1.accl.y << " z = " << body1.accl.z << std::endl;
 		//std::cout << "[A2] x = " << body2.accl.x << " y = " << body2.accl.y << " z = " << body2.accl.z << std::endl;
@@ -789,26 +536,58 @@ void render(GLFWwindow* window, int FPS, glm::vec4 background, bool show, const
 		{
 			ImGui::Text("%s", crash::crashQuote, 75.0f);
 			ImGui::Text("");
+			if (!sim.getFlightPath().empty()) {
+				ImGui::TextDisabled("The steps leading up to it are in %s.dump", sim.getFlightPath().c_str());
+			}
 
 			if (ImGui::Button("Abort")) {
-				pause = false;
-				P_cv.notify_one();
 				ImGui::CloseCurrentPopup();
 
 				glfwSetWindowShouldClose(window, true);
 			}
 			ImGui::SameLine();
 			if (ImGui::Button("Reset")) {
-				bufbx.setCrash(false);
+				bufbx.clearCrash();
 				crash::has_crashed = false;
 				crash::crashQuote = nullptr;
-				bufbx.undoState(true);
+				awaited_ticket = sim.send(sim_command::undo(true));
 				ImGui::CloseCurrentPopup();
 			}
 
 			ImGui::EndPopup();
 		}
 
+		// Save Scenario GUI
+		if (save_scenario) {
+			ImGui::OpenPopup("Save Scenario");
+			save_scenario = false;
+		}
+		if (ImGui::BeginPopupModal("Save Scenario", nullptr, ImGuiWindowFlags_AlwaysAutoResize)) {
+			ImGui::PushFont(defaultFont);
+			if (ImGui::IsWindowAppearing()) {
+				ImGui::SetKeyboardFocusHere();
+			}
+			ImGui::InputText("Name", scenario_name, sizeof(scenario_name));
+			ImGui::InputTextWithHint("Tags", "comma separated", scenario_tags, sizeof(scenario_tags));
+			const bool named = scenario_name[0] != '\0';
+			if (named && scenarios.contains(scenario_name)) {
+				ImGui::TextDisabled("Replaces the stored %s", scenario_name);
+			}
+
+			ImGui::BeginDisabled(!named);
+			if (ImGui::Button("Save")) {
+				sim.send(sim_command::save_scenario(scenario_name, scenario_tags));
+				ImGui::CloseCurrentPopup();
+			}
+			ImGui::EndDisabled();
+			ImGui::SameLine();
+			if (ImGui::Button("Cancel")) {
+				ImGui::CloseCurrentPopup();
+			}
+			ImGui::PopFont();
+			ImGui::EndPopup();
+		}
+
 		// Editor GUI
 		if (show) {
 			ImGui::Begin("Editor");
@@ -823,14 +602,21 @@ void render(GLFWwindow* window, int FPS, glm::vec4 background, bool show, const
 			ImGui_Input_Vector_Fields(vel, body2_edit);
 			ImGui_Input_Vector_Fields(mass, body2_edit);
 			if (body1_edit != body1 || body2_edit != body2) {
-				pause = true;
-				P_cv.notify_one();
-				if (!checkpt_f) {
-					bufbx.applyEdits(body1.pos, body1.vel, body2.pos, body2.vel, body1.mass, body2.mass);
+				bool mass_only = body1_edit.pos == body1.pos && body1_edit.vel == body1.vel && body2_edit.pos == body2.pos && body2_edit.vel == body2.vel;
+				if (mass_only && checkpt_f && body1_edit.mass != body1.mass) {
+					awaited_ticket = sim.send(sim_command::set_mass(1, body1_edit.mass));
+				}
+				if (mass_only && checkpt_f && body2_edit.mass != body2.mass) {
+					awaited_ticket = sim.send(sim_command::set_mass(2, body2_edit.mass));
+				}
+				if (!mass_only || !checkpt_f) {
+					dmat43 edited{ body1_edit.pos, body1_edit.vel, body2_edit.pos, body2_edit.vel };
+					awaited_ticket = sim.send(sim_command::set_state(edited, body1_edit.mass, body2_edit.mass, !checkpt_f)); // the first edit also checkpoints where the simulation was
 					checkpt_f = true;
 				}
 
-				bufbx.applyEdits(body1_edit.pos, body1_edit.vel, body2_edit.pos, body2_edit.vel, body1_edit.mass, body2_edit.mass);
+				bufbx.previewEdits(body1_edit.pos, body1_edit.vel, body2_edit.pos, body2_edit.vel, body1_edit.mass, body2_edit.mass);
+				preview.request(dmat43{ body1_edit.pos, body1_edit.vel, body2_edit.pos, body2_edit.vel }, body1_edit.mass, body2_edit.mass, sim.getNewtonian()); // supersedes the prediction of the previous keystroke
 			}
 
 			ImGui::PopFont();
@@ -877,6 +663,31 @@ void render(GLFWwindow* window, int FPS, glm::vec4 background, bool show, const
 		a_arrow_1.draw(&flatShader);
 		a_arrow_2.draw(&flatShader); 
 
+		// Tracers
+		if (new_frame) { // an empty frame (tracers cleared) empties the cloud too
+			tracerCloud.update(bufbx.readSnapshot().tracer_xyz); // straight from the frame, the physics thread cannot touch it until the next acquire
+		}
+		if (sim.getTracersEnabled()) {
+			tracerCloud.draw(&flatShader);
+		}
+
+		// Ghost Orbits
+		preview_path ghost;
+		if (preview.poll(ghost)) {
+			ghost1.update(ghost.path1);
+			ghost2.update(ghost.path2);
+			ghost1.setColour(ghost.crashed ? ghost_crash_colour : ghost_colour);
+			ghost2.setColour(ghost.crashed ? ghost_crash_colour : ghost_colour);
+			ghost_shown = true;
+		}
+		if (!sim.isPaused() || !checkpt_f) {
+			ghost_shown = false; // only shown while an edit is pending, resuming plays the real thing
+		}
+		if (ghost_shown) {
+			ghost1.draw(&flatShader);
+			ghost2.draw(&flatShader);
+		}
+
 		// Bottom Right Helpmarker
 		fs::path helpIconPath = fs::path("assets") / ("textures") / ("icons") / ("Helpmarker.png");
 		GLuint helpIcon = LoadTextureFromFile(helpIconPath.string().c_str());
@@ -886,30 +697,13 @@ void render(GLFWwindow* window, int FPS, glm::vec4 background, bool show, const
 		if (ImGui::BeginMainMenuBar()) {
 			if (ImGui::BeginMenu("Edit")) {
 				if (ImGui::MenuItem("Undo", "Ctrl+Z")) {
-					if (!pause) {
-						// if program is currently running
-						pause = true;
-						P_cv.notify_one();
-						bufbx.undoState(true); // revert instead of undo
-					}
-					else {
-						bufbx.undoState();
-					}
+					awaited_ticket = sim.send(sim_command::undo(!sim.isPaused())); // if program is currently running it reverts instead of undoing
 				}
 				if (ImGui::MenuItem("Redo", "Ctrl+Y")) {
-					pause = true;
-					P_cv.notify_one();
-					bufbx.redoState();
+					awaited_ticket = sim.send(sim_command::redo());
 				}
 				if (ImGui::MenuItem("Pause", "Ctrl+P")) {
-					if (pause) {
-						pause = false;
-						P_cv.notify_one();
-					}
-					else {
-						pause = true;
-						P_cv.notify_one();
-					}
+					sim.send(sim_command::set_pause(!sim.isPaused()));
 				}
 				ImGui::EndMenu();
 			}
@@ -929,56 +723,126 @@ void render(GLFWwindow* window, int FPS, glm::vec4 background, bool show, const
 					}
 					ImGui::EndMenu();
 				}
-				ImGui::MenuItem("Explanation", NULL, &exp_menu);
-				ImGui::EndMenu();
-			}
-			if (ImGui::BeginMenu("Presets")) {
-				if (ImGui::BeginMenu("Save")) {
-					if (ImGui::MenuItem("Preset 1")) {
-						presets[0] = bufbx.readState();
+				if (ImGui::BeginMenu("Tracers")) {
+					bool show_tracers = sim.getTracersEnabled();
+					if (ImGui::MenuItem("Show Tracers", NULL, &show_tracers)) {
+						sim.setTracersEnabled(show_tracers);
 					}
-					if (ImGui::MenuItem("Preset 2")) {
-						presets[1] = bufbx.readState();
+					if (ImGui::MenuItem("Seed 1,000")) {
+						sim.requestTracers(1000);
+						sim.setTracersEnabled(true);
 					}
-					if (ImGui::MenuItem("Preset 3")) {
-						presets[2] = bufbx.readState();
+					if (ImGui::MenuItem("Seed 10,000")) {
+						sim.requestTracers(10000);
+						sim.setTracersEnabled(true);
 					}
-					if (ImGui::MenuItem("Preset 4")) {
-						presets[3] = bufbx.readState();
+					if (ImGui::MenuItem("Seed 50,000")) {
+						sim.requestTracers(50000);
+						sim.setTracersEnabled(true);
 					}
-					if (ImGui::MenuItem("Preset 5")) {
-						presets[4] = bufbx.readState();
+					if (ImGui::MenuItem("Clear")) {
+						sim.requestTracers(-1);
 					}
+					ImGui::TextDisabled("Coarser steps above %.0fx warp", Simulation::tracer_warp_limit);
 					ImGui::EndMenu();
 				}
-				if (ImGui::BeginMenu("Load")) {
-					if (ImGui::MenuItem("Preset 1")) {
-						pause = true;
-						P_cv.notify_one();
-						bufbx.applyEdits(presets[0]);
+				ImGui::MenuItem("Explanation", NULL, &exp_menu);
+				ImGui::EndMenu();
+			}
+			if (ImGui::BeginMenu("Presets")) {
+				if (ImGui::MenuItem("Save As...", NULL, false, scenarios.isOpen())) {
+					save_scenario = true; // opened outside the menu bar, a popup opened in here would close with the menu
+				}
+				if (ImGui::BeginMenu("Browse", scenarios.isOpen())) {
+					ImGui::PushFont(defaultFont);
+					const bool appearing = ImGui::IsWindowAppearing();
+					if (appearing) {
+						ImGui::SetKeyboardFocusHere();
 					}
-					if (ImGui::MenuItem("Preset 2")) {
-						pause = true;
-						P_cv.notify_one();
-						bufbx.applyEdits(presets[1]);
+					if (ImGui::InputTextWithHint("##search", "Search names and tags", scenario_search, sizeof(scenario_search)) || appearing) {
+						scenario_hits = scenarios.search(scenario_search);
 					}
-					if (ImGui::MenuItem("Preset 3")) {
-						pause = true;
-						P_cv.notify_one();
-						bufbx.applyEdits(presets[2]);
+					ImGui::TextDisabled("%zu of %zu", scenario_hits.size(), scenarios.size());
+
+					// Only the rows in view are read from the store, however many match
+					ImGui::BeginChild("##scenarios", ImVec2(360.0f, 300.0f));
+					ImGuiListClipper clipper;
+					clipper.Begin(static_cast<int>(scenario_hits.size()));
+					while (clipper.Step()) {
+						for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+							const scenario_id entry = scenario_hits[row];
+							ImGui::PushID(row);
+							if (ImGui::MenuItem(scenarios.name(entry).c_str(), scenarios.tags(entry).c_str())) {
+								scenario s;
+								if (scenarios.load(entry, s)) {
+									awaited_ticket = sim.send(sim_command::set_state(s.y, s.m1, s.m2, false));
+								}
+							}
+							ImGui::PopID();
+						}
 					}
-					if (ImGui::MenuItem("Preset 4")) {
-						pause = true;
-						P_cv.notify_one();
-						bufbx.applyEdits(presets[3]);
+					ImGui::EndChild();
+					ImGui::PopFont();
+					ImGui::EndMenu();
+				}
+				ImGui::Separator();
+				if (ImGui::MenuItem("Save Snapshot")) {
+					sim.send(sim_command::save_snapshot());
+				}
+				if (ImGui::MenuItem("Load Snapshot")) {
+					awaited_ticket = sim.send(sim_command::load_snapshot());
+				}
+				ImGui::Separator();
+				if (ImGui::MenuItem("Newtonian Limit", NULL, &newtonian_preset)) {
+					sim.setNewtonian(newtonian_preset); // Integrator picks the change up at the start of its next step
+				}
+				ImGui::EndMenu();
+			}
+			if (ImGui::BeginMenu("Integrator")) {
+				bool tune = sim.getAutoTune();
+				if (ImGui::MenuItem("Auto Tune Tolerances", NULL, &tune)) {
+					sim.setAutoTune(tune);
+				}
+				double target = sim.getDriftTarget();
+				ImGui::PushFont(defaultFont);
+				if (ImGui::InputDouble("Drift / Orbit", &target, 0.0, 0.0, "%.1e", ImGuiInputTextFlags_EnterReturnsTrue)) {
+					sim.setDriftTarget(std::clamp(target, 1e-14, 1e-1)); // tighter than the reference run cannot be measured
+				}
+				if (sim.getAutoTune()) {
+					tolerance_choice shown = sim.getTunedChoice();
+					if (shown.kepler) {
+						ImGui::Text("Kepler propagation");
 					}
-					if (ImGui::MenuItem("Preset 5")) {
-						pause = true;
-						P_cv.notify_one();
-						bufbx.applyEdits(presets[4]);
+					else {
+						ImGui::Text("atol %.0e  rtol %.0e", shown.atol, shown.rtol);
 					}
-					ImGui::EndMenu();
+					ImGui::Text("measured drift %.2e / orbit", shown.drift);
+				}
+				ImGui::Separator();
+				float rate = static_cast<float>(sim.getPhysicsRate());
+				if (ImGui::SliderFloat("Physics Rate", &rate, 10.0f, 240.0f, "%.0f Hz")) {
+					sim.setPhysicsRate(rate);
 				}
+				ImGui::Separator();
+				if (ImGui::SliderScalar("Time Warp", ImGuiDataType_Double, &warp, &warp_min, &warp_max, "%.3gx", ImGuiSliderFlags_Logarithmic)) {
+					sim.send(sim_command::set_speed(warp));
+				}
+				double budget = sim.getFrameBudget();
+				if (ImGui::InputDouble("Budget / Frame", &budget, 0.0, 0.0, "%.1f ms", ImGuiInputTextFlags_EnterReturnsTrue)) {
+					sim.setFrameBudget(std::clamp(budget, 0.5, 1000.0));
+				}
+				const sim_snapshot& shown_frame = bufbx.readSnapshot();
+				if (shown_frame.lagging) {
+					ImGui::TextColored(ImVec4(1.0f, 0.6f, 0.2f, 1.0f), "can't keep up, achieved %.3gx", shown_frame.achieved_warp);
+				}
+				else {
+					ImGui::Text("achieved %.3gx", shown_frame.achieved_warp);
+				}
+				ImGui::Text("energy %.6e", shown_frame.energy);
+				const scheduler_stats& timing = shown_frame.timing;
+				ImGui::Text("late %.2f ms avg  %.2f ms max", timing.mean_late * 1e3, timing.max_late * 1e3);
+				ImGui::Text("overruns %llu  dropped steps %llu", static_cast<unsigned long long>(timing.overruns), static_cast<unsigned long long>(timing.dropped));
+				ImGui::PopFont();
 				ImGui::EndMenu();
 			}
 			ImGui::EndMainMenuBar();
@@ -1073,6 +937,15 @@ void render(GLFWwindow* window, int FPS, glm::vec4 background, bool show, const
 
 int main(int, char**)
 {
+	logger_options log;
+	log.level = log_level::info; // debug adds the edit history and back buffer dumps, cheap enough to leave on
+	log.console = true;
+	log.text_path = ""; // e.g. "pnsim.log"
+	log.binary_path = ""; // e.g. "pnsim.bin", read back with logger::convertBinary
+	logger::configure(log);
+	logger::nameThread("render");
+	flight_recorder::installSignalHandlers(); // a crash or SIGUSR1 keeps the physics threads' last steps in <flight path>.dump
+
 	// Intialising GLFW
 	if (!glfwInit())
 	{
@@ -1089,7 +962,7 @@ int main(int, char**)
 	GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "PNsim: Gravity Simulator 1.0", NULL, NULL);
 	if (!window)
 	{
-		std::cout << "Failed to create window" << std::endl;
+		logger::error(log_category::render, "Failed to create window");
 		glfwTerminate();
 		return -1;
 	}
@@ -1101,23 +974,40 @@ int main(int, char**)
 	glfwSetMouseButtonCallback(window, mouse_button_callback);
 	glfwSetKeyCallback(window, key_callback);
 
-	RK45_integration integrator(1e-8, 1e-10, 0.05);
+	pool_options pool;
+	pool.workers = 0; // one per hardware thread besides this one
+	pool.pin_threads = false; // the physics and render threads are not pinned, so neither are the workers
+	thread_pool::configure(pool); // before anything touches the shared pool
 
 	bool show = true;
 	glm::vec4 background(0.5f, 0.5f, 0.5f, 1.0f); // 0.5, 0.5, 0.5
 
 	int FPS = 60;
 
-	integrator.setDebug(false);
-
-	bufbx.applyEdits(pos1, v1, pos2, v2, m1, m2);
+	sim.setExportPath(""); // e.g. "paraview/pnsim", a .pvd series of every 10th physics step for ParaView
+
+	// Scenario store, a first run starts it off with the default system
+	if (scenarios.open("pnsim.scenarios")) {
+		if (scenarios.size() == 0) {
+			scenario s;
+			s.name = "Earth-Sun";
+			s.tags = "solar system, newtonian";
+			s.description = "The Earth on a circular 1 AU orbit around the Sun";
+			s.y = earth_sun.vectors;
+			s.m1 = earth_sun.m1;
+			s.m2 = earth_sun.m2;
+			scenarios.put(s);
+		}
+		sim.setScenarioStore(&scenarios);
+	}
 
 	// Threading
-	std::thread p(physics_thread, window, std::ref(integrator), 1.0f);
+	sim.start(1.0);
 
 	render(window, FPS, background, show, glsl_version);
 
-	p.join();
+	sim.stop();
+	logger::shutdown(); // writes out whatever the threads logged last
 
 	// As soon as the window is set to close, the while loop is passed and then Imgui and glfw is terminated
 	ImGui_ImplOpenGL3_Shutdown();
@@ -1129,7 +1019,7 @@ int main(int, char**)
 
 // Function definitions ~ kept below the main loop for formatting
 static void glfw_error_callback(int error, const char* description) {
-	fprintf(stderr, "GLFW ERROR %d: %s\n", error, description); // formatted print ~ using the format of a C error document it prints GLFW ERROR then its error number and then the description
+	logger::error(log_category::render, "GLFW ERROR {}: {}", error, description); // prints GLFW ERROR then its error number and then the description
 }
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
@@ -1179,32 +1069,19 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 void key_callback(GLFWwindow* window, int button, int scancode, int action, int mods) {
 	if (button == GLFW_KEY_P && action == GLFW_PRESS && mods == GLFW_MOD_CONTROL) {
 		if (!bufbx.checkCrash()) {
-			pause = !pause;
-			P_cv.notify_one();
+			sim.send(sim_command::set_pause(!sim.isPaused()));
 		}
 	}
 	if (button == GLFW_KEY_R && action == GLFW_PRESS && mods == GLFW_MOD_CONTROL) {
 		cam.resetCommand();
 	}
 	if (button == GLFW_KEY_Z && action == GLFW_PRESS && mods == GLFW_MOD_CONTROL) {
-		if (!pause) {
-			pause = true;
-			P_cv.notify_one();
-			bufbx.undoState(true);
-		}
-		else {
-			bufbx.undoState();
-		}
+		awaited_ticket = sim.send(sim_command::undo(!sim.isPaused())); // reverts instead of undoing while running
 	}
 	if (button == GLFW_KEY_Y && action == GLFW_PRESS && mods == GLFW_MOD_CONTROL) {
-		pause = true;
-		P_cv.notify_one();
-		bufbx.redoState();
+		awaited_ticket = sim.send(sim_command::redo());
 	}
 	if (button == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
-		pause = false;
-		P_cv.notify_one();
-
 		glfwSetWindowShouldClose(window, true);
 	}
 }
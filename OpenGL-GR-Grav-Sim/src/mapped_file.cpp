@@ -0,0 +1,125 @@
+#include "mapped_file.h"
+
+#include <utility>
+
+#ifdef _WIN32
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+mapped_file::mapped_file(mapped_file&& other) noexcept {
+	*this = std::move(other);
+}
+
+mapped_file& mapped_file::operator=(mapped_file&& other) noexcept {
+	if (this != &other) {
+		close();
+		bytes = std::exchange(other.bytes, nullptr);
+		length = std::exchange(other.length, 0);
+		is_open = std::exchange(other.is_open, false);
+#ifdef _WIN32
+		file_handle = std::exchange(other.file_handle, nullptr);
+		mapping_handle = std::exchange(other.mapping_handle, nullptr);
+#endif
+	}
+	return *this;
+}
+
+#ifdef _WIN32
+
+bool mapped_file::open(const std::string& path) {
+	close();
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return false;
+	}
+	file_handle = file;
+	is_open = true;
+	if (size.QuadPart == 0) { // a zero length file cannot be mapped, it is just empty
+		return true;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		close();
+		return false;
+	}
+	mapping_handle = mapping;
+	bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!bytes) {
+		close();
+		return false;
+	}
+	length = static_cast<size_t>(size.QuadPart);
+	return true;
+}
+
+void mapped_file::close() {
+	if (bytes) {
+		UnmapViewOfFile(bytes);
+	}
+	if (mapping_handle) {
+		CloseHandle(static_cast<HANDLE>(mapping_handle));
+	}
+	if (file_handle) {
+		CloseHandle(static_cast<HANDLE>(file_handle));
+	}
+	bytes = nullptr;
+	length = 0;
+	is_open = false;
+	file_handle = mapping_handle = nullptr;
+}
+
+#else
+
+bool mapped_file::open(const std::string& path) {
+	close();
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (::fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+	is_open = true;
+	if (st.st_size > 0) { // a zero length file cannot be mapped, it is just empty
+		void* p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			::close(fd);
+			is_open = false;
+			return false;
+		}
+		bytes = static_cast<const unsigned char*>(p);
+		length = static_cast<size_t>(st.st_size);
+	}
+	::close(fd); // the mapping keeps its own reference to the file
+	return true;
+}
+
+void mapped_file::close() {
+	if (bytes) {
+		::munmap(const_cast<unsigned char*>(bytes), length);
+	}
+	bytes = nullptr;
+	length = 0;
+	is_open = false;
+}
+
+#endif
@@ -0,0 +1,196 @@
+#include <glm/glm.hpp>
+#include "formulae.h"
+#include "nbody.h"
+#include "logger.h"
+#include "thread_pool.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+using dvec3 = glm::dvec3;
+
+//Constructor
+hybrid_force::hybrid_force(double pn_threshold, double skin, double max_separation, int refresh_interval)
+	: pn_threshold(pn_threshold), skin(std::max(skin, 1.0)), max_separation(max_separation),
+	refresh_interval(std::max(refresh_interval, 1)), steps_since_refresh(std::max(refresh_interval, 1)) {}
+
+force_stats hybrid_force::evaluate(body_soa& bodies) {
+	const size_t n = bodies.size();
+
+	stats.list_rebuilt = false;
+	if (steps_since_refresh >= refresh_interval) {
+		rebuildNeighbours(bodies);
+		steps_since_refresh = 0;
+		stats.list_rebuilt = true;
+	}
+	steps_since_refresh++;
+
+	// Newtonian part of every pair
+	newtonianAccelerations(bodies);
+
+	// PN corrections of the listed pairs that are above the threshold now (the skin lists some that are not yet), the Newtonian part is already included above
+	const double r_scale = G / (c * c * pn_threshold);
+	size_t pn = 0;
+	for (size_t k = 0; k < pair_i.size(); k++) {
+		const std::uint32_t i = pair_i[k], j = pair_j[k];
+		const double dx = bodies.x[j] - bodies.x[i];
+		const double dy = bodies.y[j] - bodies.y[i];
+		const double dz = bodies.z[j] - bodies.z[i];
+		const double r_pn = r_scale * (bodies.m[i] + bodies.m[j]);
+		if (dx * dx + dy * dy + dz * dz > r_pn * r_pn) {
+			continue;
+		}
+		pn++;
+
+		dvec3 a_rel = PN_correction(bodies.getPos(i), bodies.getPos(j), bodies.getVel(i), bodies.getVel(j), bodies.m[i], bodies.m[j]);
+		dvec3 a1, a2;
+		resolve_rel_accel(a_rel, a1, a2, bodies.m[i], bodies.m[j]); // Seperates the individual accelerations of each body given the mass ratio
+
+		bodies.ax[i] += a1.x; bodies.ay[i] += a1.y; bodies.az[i] += a1.z;
+		bodies.ax[j] += a2.x; bodies.ay[j] += a2.y; bodies.az[j] += a2.z;
+	}
+
+	const size_t total_pairs = (n * (n - (n > 0 ? 1 : 0))) / 2;
+	stats.pn_pairs = pn;
+	stats.near_pairs = pair_i.size() - pn;
+	stats.far_pairs = total_pairs - pair_i.size();
+
+	return stats;
+}
+
+void hybrid_force::rebuildNeighbours(const body_soa& bodies) {
+	const size_t n = bodies.size();
+
+	pair_i.clear();
+	pair_j.clear();
+
+	// Gm/(rc^2) >= pn_threshold  <=>  r <= Gm/(c^2 pn_threshold), compared squared so the scan needs no square roots
+	const double r_scale = G / (c * c * pn_threshold);
+	const double max_sep2 = max_separation * max_separation;
+
+	for (size_t i = 0; i < n; i++) {
+		for (size_t j = i + 1; j < n; j++) {
+			const double dx = bodies.x[j] - bodies.x[i];
+			const double dy = bodies.y[j] - bodies.y[i];
+			const double dz = bodies.z[j] - bodies.z[i];
+			const double r2 = dx * dx + dy * dy + dz * dz;
+
+			const double r_pn = skin * r_scale * (bodies.m[i] + bodies.m[j]);
+
+			if (r2 <= r_pn * r_pn && r2 <= max_sep2) {
+				pair_i.push_back(static_cast<std::uint32_t>(i));
+				pair_j.push_back(static_cast<std::uint32_t>(j));
+			}
+		}
+	}
+}
+
+void hybrid_force::newtonianAccelerations(body_soa& bodies) {
+	const size_t n = bodies.size();
+
+	const double* x = bodies.x.data();
+	const double* y = bodies.y.data();
+	const double* z = bodies.z.data();
+	const double* m = bodies.m.data();
+
+	double* ax = bodies.ax.data();
+	double* ay = bodies.ay.data();
+	double* az = bodies.az.data();
+
+	// Direct summation, every i is independent (so the rows are split over the pool) and the inner loop has no branches so it vectorises
+	const size_t min_rows = std::max<size_t>(1, 65536 / std::max<size_t>(n, 1)); // ~64k pair interactions per chunk, fewer is not worth a task
+	thread_pool::shared().parallel_for(0, n, min_rows, [=](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const double xi = x[i], yi = y[i], zi = z[i];
+			double axi = 0.0, ayi = 0.0, azi = 0.0;
+
+			for (size_t j = 0; j < n; j++) {
+				const double dx = x[j] - xi;
+				const double dy = y[j] - yi;
+				const double dz = z[j] - zi;
+				const double r2 = dx * dx + dy * dy + dz * dz;
+				const double inv_r = (r2 > 0.0) ? 1.0 / std::sqrt(r2) : 0.0; // the body itself contributes nothing
+				const double s = G * m[j] * inv_r * inv_r * inv_r;
+
+				axi += s * dx;
+				ayi += s * dy;
+				azi += s * dz;
+			}
+
+			ax[i] = axi;
+			ay[i] = ayi;
+			az[i] = azi;
+		}
+	});
+}
+
+// N body integration
+// -------------------------------------------------------------------------------------------
+//Constructor
+nbody_integrator::nbody_integrator(double atol, double rtol, double initial_dt, const hybrid_force& force)
+	: engine(atol, rtol, initial_dt), force(force) {}
+
+engine_result nbody_integrator::step(body_soa& bodies, double dt, int max_substeps) {
+	const size_t n = bodies.size();
+	std::vector<double>* blocks[6] = { &bodies.x, &bodies.y, &bodies.z, &bodies.vx, &bodies.vy, &bodies.vz }; // in packing order
+
+	packed.resize(6 * n);
+	for (int b = 0; b < 6; b++) {
+		std::copy(blocks[b]->begin(), blocks[b]->end(), packed.begin() + b * n);
+	}
+	stage.resize(n);
+	if (stage.m != bodies.m) { // the engine notices changed positions or velocities itself, not changed masses
+		engine.invalidate();
+		stage.m = bodies.m;
+	}
+	const std::uint64_t rebuilds_before = list_rebuilds;
+
+	const engine_result result = engine.integrate(packed, dt, [this](const std::vector<double>& s, std::vector<double>& dydt) { derivatives(s, dydt); }, 1.0, max_substeps);
+
+	for (int b = 0; b < 6; b++) {
+		std::copy(packed.begin() + b * n, packed.begin() + (b + 1) * n, blocks[b]->begin());
+	}
+
+	// Accelerations at the new state, the final stage of the last accepted step when there is one
+	if (engine.hasDerivative()) {
+		const std::vector<double>& dydt = engine.getDerivative();
+		std::copy(dydt.begin() + 3 * n, dydt.begin() + 4 * n, bodies.ax.begin());
+		std::copy(dydt.begin() + 4 * n, dydt.begin() + 5 * n, bodies.ay.begin());
+		std::copy(dydt.begin() + 5 * n, dydt.end(), bodies.az.begin());
+	}
+	else if (!result.crash_f) {
+		last_force = force.evaluate(bodies);
+		force_evaluations++;
+		list_rebuilds += last_force.list_rebuilt ? 1 : 0;
+	}
+
+	// Every step at trace level, only a change in which pairs get the PN terms is worth an info line
+	logger::trace(log_category::integrator, "N body step of {} yr: {} substeps ({} rejected), pairs {} PN / {} near / {} far, neighbour list rebuilt {} times",
+		result.covered, result.count, result.rejects, last_force.pn_pairs, last_force.near_pairs, last_force.far_pairs, list_rebuilds - rebuilds_before);
+	if (last_force.pn_pairs != logged_pn_pairs) {
+		logger::info(log_category::integrator, "{} pairs get the PN terms, {} near / {} far", last_force.pn_pairs, last_force.near_pairs, last_force.far_pairs);
+		logged_pn_pairs = last_force.pn_pairs;
+	}
+	return result;
+}
+
+void nbody_integrator::derivatives(const std::vector<double>& s, std::vector<double>& dydt) {
+	const size_t n = stage.size();
+	const size_t bytes = n * sizeof(double);
+	std::memcpy(stage.x.data(), s.data(), bytes);
+	std::memcpy(stage.y.data(), s.data() + n, bytes);
+	std::memcpy(stage.z.data(), s.data() + 2 * n, bytes);
+	std::memcpy(stage.vx.data(), s.data() + 3 * n, bytes);
+	std::memcpy(stage.vy.data(), s.data() + 4 * n, bytes);
+	std::memcpy(stage.vz.data(), s.data() + 5 * n, bytes);
+
+	last_force = force.evaluate(stage);
+	force_evaluations++;
+	list_rebuilds += last_force.list_rebuilt ? 1 : 0;
+
+	std::memcpy(dydt.data(), s.data() + 3 * n, 3 * bytes); // positions change with the velocities
+	std::memcpy(dydt.data() + 3 * n, stage.ax.data(), bytes);
+	std::memcpy(dydt.data() + 4 * n, stage.ay.data(), bytes);
+	std::memcpy(dydt.data() + 5 * n, stage.az.data(), bytes);
+}
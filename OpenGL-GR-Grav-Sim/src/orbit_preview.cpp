@@ -0,0 +1,156 @@
+#include <glm/glm.hpp>
+#include "formulae.h"
+#include "integration.h"
+#include "orbit_preview.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+// Preview Constants
+// -----------------------------------------------------------------------------------------
+static const double max_span = 50.0; // years, longer orbits are only previewed in part
+static const double unbound_crossings = 10.0; // an unbound preview runs until the bodies are this many initial separations further apart
+static const int step_budget = 20000; // substeps of the whole preview, keeps a pathological edit from holding a pool thread
+
+//Constructor
+orbit_preview::orbit_preview(int samples, double tolerance, size_t cache_size)
+	: samples(std::max(samples, 2)), tolerance(tolerance), cache_size(std::max<size_t>(cache_size, 1)), jobs(thread_pool::shared()) {}
+
+orbit_preview::~orbit_preview() {
+	latest.store(0); // no job matches key 0, each stops at its next sample
+	jobs.wait();
+}
+
+void orbit_preview::request(const dmat43& y, double m1, double m2, bool newtonian) {
+	const std::uint64_t key = editKey(y, m1, m2, newtonian);
+	if (key == latest.load()) {
+		delivered = 0; // same edit as the one already predicted or running, poll hands its path out again
+		return;
+	}
+	latest.store(key);
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		has_ready = false;
+		for (size_t i = 0; i < cache.size(); i++) {
+			if (cache[i].key == key) {
+				std::rotate(cache.begin() + i, cache.begin() + i + 1, cache.end()); // most recently used to the back
+				ready = cache.back();
+				has_ready = true;
+				return;
+			}
+		}
+	}
+
+	jobs.run([this, key, y, m1, m2, newtonian] { predict(key, y, m1, m2, newtonian); });
+}
+
+bool orbit_preview::poll(preview_path& out) {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (!has_ready || ready.key == delivered) {
+		return false;
+	}
+	out = ready;
+	delivered = ready.key;
+	return true;
+}
+
+void orbit_preview::clear() {
+	latest.store(0);
+	std::lock_guard<std::mutex> lock(mtx);
+	cache.clear();
+	has_ready = false;
+	delivered = 0;
+}
+
+std::uint64_t orbit_preview::editKey(const dmat43& y, double m1, double m2, bool newtonian) {
+	// FNV-1a over the exact bits, any change to a field is a different edit
+	double fields[15];
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 3; j++) {
+			fields[3 * i + j] = y[i][j];
+		}
+	}
+	fields[12] = m1;
+	fields[13] = m2;
+	fields[14] = newtonian ? 1.0 : 0.0;
+
+	unsigned char bytes[sizeof(fields)];
+	std::memcpy(bytes, fields, sizeof(fields));
+
+	std::uint64_t hash = 14695981039346656037ull;
+	for (unsigned char b : bytes) {
+		hash ^= b;
+		hash *= 1099511628211ull;
+	}
+	return (hash == 0) ? 1 : hash; // 0 is reserved for no request
+}
+
+double orbit_preview::horizon(const dmat43& y, double m1, double m2) {
+	dvec3 sep = y[0] - y[2];
+	dvec3 v_bold = y[1] - y[3];
+	const double r = glm::length(sep);
+	const double v = glm::length(v_bold);
+	const double mu = G * (m1 + m2);
+
+	const double energy = 0.5 * v * v - mu / r;
+	if (energy < 0.0) {
+		const double a = -mu / (2.0 * energy); // semi-major axis
+		return std::min(max_span, 2.0 * PI * std::sqrt((a * a * a) / mu)); // one orbit
+	}
+	return (v > 0.0) ? std::min(max_span, unbound_crossings * r / v) : max_span;
+}
+
+void orbit_preview::predict(std::uint64_t key, dmat43 y, double m1, double m2, bool newtonian) {
+	const double span = horizon(y, m1, m2);
+	const double sample_dt = span / (samples - 1);
+
+	RK45_integration integrator(tolerance, tolerance, sample_dt); // loose tolerances, the path only has to look right
+	integrator.setNewtonian(newtonian);
+
+	preview_path path;
+	path.key = key;
+	path.path1.reserve(3 * samples);
+	path.path2.reserve(3 * samples);
+
+	auto push = [&path](const dmat43& s) {
+		path.path1.insert(path.path1.end(), { static_cast<float>(s[0].x), static_cast<float>(s[0].y), static_cast<float>(s[0].z) });
+		path.path2.insert(path.path2.end(), { static_cast<float>(s[2].x), static_cast<float>(s[2].y), static_cast<float>(s[2].z) });
+	};
+
+	mathState s{ y, m1, m2, 0.0 };
+	push(s.y);
+
+	int substeps = 0;
+	for (int i = 1; i < samples; i++) {
+		if (latest.load(std::memory_order_relaxed) != key) {
+			return; // superseded by a newer edit
+		}
+
+		integrate_result result = integrator.step(s, sample_dt);
+		substeps += result.count;
+		if (result.crash_f || substeps > step_budget) {
+			path.crashed = result.crash_f;
+			break;
+		}
+
+		s.y = result.state_y;
+		s.physics_time += sample_dt;
+		push(s.y);
+	}
+	path.span = s.physics_time;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	cache.push_back(path);
+	if (cache.size() > cache_size) {
+		cache.erase(cache.begin()); // least recently used
+	}
+	if (latest.load() == key) {
+		ready = std::move(path);
+		has_ready = true;
+	}
+}
@@ -0,0 +1,206 @@
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "formulae.h"
+#include "integration.h"
+#include "logger.h"
+#include "pnsim.h"
+
+#include <cmath>
+#include <cstring>
+#include <new>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+static_assert(sizeof(dmat43) == PNSIM_STATE_SIZE * sizeof(double), "the C state layout is the dmat43 columns back to back");
+
+struct pnsim_sim {
+	RK45_integration integrator;
+	mathState s;
+	bool crashed = false;
+
+	pnsim_sim(double atol, double rtol, double initial_dt) : integrator(atol, rtol, initial_dt), s{ dmat43{ 0.0 }, 1.0, 1.0, 0.0 } {}
+};
+
+// Every entry point runs its body through this, so no exception reaches the C caller
+template <typename Fn>
+static int guarded(Fn&& fn) {
+	try {
+		return fn();
+	}
+	catch (...) {
+		return PNSIM_ERR_INTERNAL;
+	}
+}
+
+static bool finite(const double* v, int n) {
+	for (int i = 0; i < n; i++) {
+		if (!std::isfinite(v[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Version
+// -------------------------------------------------------------------------------------------
+uint32_t pnsim_abi_version(void) {
+	return PNSIM_ABI_VERSION;
+}
+
+const char* pnsim_status_string(int status) {
+	switch (status) {
+	case PNSIM_OK: return "ok";
+	case PNSIM_ERR_NULL: return "null pointer";
+	case PNSIM_ERR_ARGUMENT: return "argument out of range";
+	case PNSIM_ERR_CRASHED: return "integration failed";
+	case PNSIM_ERR_INTERNAL: return "internal error";
+	default: return "unknown status";
+	}
+}
+
+// Lifetime
+// -------------------------------------------------------------------------------------------
+pnsim_sim* pnsim_create(double atol, double rtol, double initial_dt) {
+	if (!(atol > 0.0) || !(rtol > 0.0) || !(initial_dt > 0.0)) {
+		return nullptr;
+	}
+	return new (std::nothrow) pnsim_sim(atol, rtol, initial_dt);
+}
+
+void pnsim_destroy(pnsim_sim* sim) {
+	delete sim;
+}
+
+// Settings
+// -------------------------------------------------------------------------------------------
+int pnsim_set_tolerances(pnsim_sim* sim, double atol, double rtol) {
+	if (!sim) {
+		return PNSIM_ERR_NULL;
+	}
+	if (!(atol > 0.0) || !(rtol > 0.0)) {
+		return PNSIM_ERR_ARGUMENT;
+	}
+	sim->integrator.setTolerances(atol, rtol);
+	return PNSIM_OK;
+}
+
+int pnsim_set_newtonian(pnsim_sim* sim, int newtonian) {
+	if (!sim) {
+		return PNSIM_ERR_NULL;
+	}
+	sim->integrator.setNewtonian(newtonian != 0);
+	return PNSIM_OK;
+}
+
+void pnsim_set_log_level(int level) {
+	if (level < static_cast<int>(log_level::trace)) {
+		level = static_cast<int>(log_level::trace);
+	}
+	if (level > static_cast<int>(log_level::off)) {
+		level = static_cast<int>(log_level::off);
+	}
+	logger::setLevel(static_cast<log_level>(level));
+}
+
+// State
+// -------------------------------------------------------------------------------------------
+int pnsim_set_state(pnsim_sim* sim, const double state[PNSIM_STATE_SIZE], double m1, double m2, double time) {
+	if (!sim || !state) {
+		return PNSIM_ERR_NULL;
+	}
+	if (!finite(state, PNSIM_STATE_SIZE) || !(m1 > 0.0) || !(m2 > 0.0) || !std::isfinite(time)) {
+		return PNSIM_ERR_ARGUMENT;
+	}
+	std::memcpy(glm::value_ptr(sim->s.y), state, sizeof(dmat43));
+	sim->s.m1 = m1;
+	sim->s.m2 = m2;
+	sim->s.physics_time = time;
+	sim->crashed = false;
+	return PNSIM_OK;
+}
+
+int pnsim_get_state(const pnsim_sim* sim, double state_out[PNSIM_STATE_SIZE], double* m1_out, double* m2_out, double* time_out) {
+	if (!sim || !state_out) {
+		return PNSIM_ERR_NULL;
+	}
+	std::memcpy(state_out, glm::value_ptr(sim->s.y), sizeof(dmat43));
+	if (m1_out) { *m1_out = sim->s.m1; }
+	if (m2_out) { *m2_out = sim->s.m2; }
+	if (time_out) { *time_out = sim->s.physics_time; }
+	return PNSIM_OK;
+}
+
+int pnsim_get_derivatives(const pnsim_sim* sim, double dydt_out[PNSIM_STATE_SIZE]) {
+	if (!sim || !dydt_out) {
+		return PNSIM_ERR_NULL;
+	}
+	return guarded([&] {
+		const dmat43 dydt = RK45_integration::derivatives(sim->s.y, sim->s.m1, sim->s.m2);
+		std::memcpy(dydt_out, glm::value_ptr(dydt), sizeof(dmat43));
+		return PNSIM_OK;
+	});
+}
+
+int pnsim_get_invariants(const pnsim_sim* sim, double* energy_out, double angular_momentum_out[3]) {
+	if (!sim) {
+		return PNSIM_ERR_NULL;
+	}
+	return guarded([&] {
+		const dmat43& y = sim->s.y;
+		if (energy_out) {
+			*energy_out = orbital_energy(y[0], y[2], y[1], y[3], sim->s.m1, sim->s.m2);
+		}
+		if (angular_momentum_out) {
+			const dvec3 L = orbital_angular_momentum(y[0], y[2], y[1], y[3], sim->s.m1, sim->s.m2);
+			angular_momentum_out[0] = L.x;
+			angular_momentum_out[1] = L.y;
+			angular_momentum_out[2] = L.z;
+		}
+		return PNSIM_OK;
+	});
+}
+
+// Stepping
+// -------------------------------------------------------------------------------------------
+int pnsim_step(pnsim_sim* sim, double dt, int64_t steps, double* trajectory_out, double* times_out, pnsim_step_stats* stats_out) {
+	if (!sim) {
+		return PNSIM_ERR_NULL;
+	}
+	if (!(dt > 0.0) || !std::isfinite(dt) || steps < 0) {
+		return PNSIM_ERR_ARGUMENT;
+	}
+	if (stats_out) {
+		*stats_out = pnsim_step_stats{ 0, 0, 0.0 };
+	}
+	if (sim->crashed) {
+		return PNSIM_ERR_CRASHED;
+	}
+
+	return guarded([&] {
+		for (int64_t i = 0; i < steps; i++) {
+			const integrate_result result = sim->integrator.step(sim->s, dt);
+			if (stats_out) {
+				stats_out->substeps += result.count;
+				stats_out->rejects += result.rejects;
+			}
+			if (result.crash_f) {
+				sim->crashed = true; // the state is left at the start of the failed interval
+				return PNSIM_ERR_CRASHED;
+			}
+
+			sim->s.y = result.state_y;
+			sim->s.physics_time += result.covered;
+			if (stats_out) {
+				stats_out->covered += result.covered;
+			}
+			if (trajectory_out) {
+				std::memcpy(trajectory_out + i * PNSIM_STATE_SIZE, glm::value_ptr(sim->s.y), sizeof(dmat43));
+			}
+			if (times_out) {
+				times_out[i] = sim->s.physics_time;
+			}
+		}
+		return PNSIM_OK;
+	});
+}
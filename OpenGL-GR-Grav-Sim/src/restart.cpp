@@ -0,0 +1,150 @@
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "restart.h"
+#include "crc32.h"
+#include "byte_io.h"
+#include "mapped_file.h"
+#include "logger.h"
+
+#include <filesystem>
+#include <cstdio>
+#include <cstring>
+
+namespace fs = std::filesystem;
+using namespace byte_io;
+
+static const unsigned char restart_magic[8] = { 'P', 'N', 'S', 'N', 'A', 'P', 0x1a, '\n' }; // the last two catch a file mangled by a text mode transfer
+
+enum restart_flags : std::uint32_t {
+	flag_dydt_valid = 1u << 0,
+	flag_newtonian = 1u << 1,
+	flag_auto_tune = 1u << 2
+};
+
+// Encoding
+// -------------------------------------------------------------------------------------------
+void encodeRestart(const restart_state& rs, unsigned char* out) {
+	unsigned char* p = out + restart_header_size;
+
+	const double* y = glm::value_ptr(rs.s.y);
+	for (int i = 0; i < 12; i++) {
+		p = putF64(p, y[i]);
+	}
+	const double* dydt = glm::value_ptr(rs.dydt);
+	for (int i = 0; i < 12; i++) {
+		p = putF64(p, dydt[i]);
+	}
+	p = putF64(p, rs.s.m1);
+	p = putF64(p, rs.s.m2);
+	p = putF64(p, rs.s.physics_time);
+	p = putF64(p, rs.atol);
+	p = putF64(p, rs.rtol);
+	p = putF64(p, rs.timestep);
+	p = putF64(p, rs.drift_target);
+	p = putF64(p, rs.energy0);
+	p = putF64(p, rs.momentum0);
+	p = putU64(p, rs.steps);
+	p = putU64(p, rs.tracer_count);
+	p = putU32(p, rs.tracer_seed);
+	p = putU32(p, (rs.dydt_valid ? flag_dydt_valid : 0u) | (rs.newtonian ? flag_newtonian : 0u) | (rs.auto_tune ? flag_auto_tune : 0u));
+
+	// Header, last so the checksum covers the finished payload
+	unsigned char* h = out;
+	std::memcpy(h, restart_magic, sizeof(restart_magic));
+	h += sizeof(restart_magic);
+	h = putU32(h, restart_version);
+	h = putU32(h, static_cast<std::uint32_t>(restart_header_size));
+	h = putU32(h, static_cast<std::uint32_t>(restart_payload_size));
+	h = putU32(h, crc32(out + restart_header_size, restart_payload_size));
+	putU64(h, 0); // reserved
+}
+
+bool decodeRestart(const unsigned char* data, size_t size, restart_state& rs, const char* name) {
+	if (size < restart_header_size || std::memcmp(data, restart_magic, sizeof(restart_magic)) != 0) {
+		logger::error(log_category::io, "{}: not a restart snapshot", name);
+		return false;
+	}
+	const unsigned char* h = data + sizeof(restart_magic);
+	const std::uint32_t version = getU32(h);
+	const std::uint32_t header_size = getU32(h);
+	const std::uint32_t payload_size = getU32(h);
+	const std::uint32_t crc = getU32(h);
+
+	if (version == 0 || version > restart_version) {
+		logger::error(log_category::io, "{}: snapshot version {} (this build reads up to {})", name, version, restart_version);
+		return false;
+	}
+	if (header_size < restart_header_size || payload_size < restart_payload_size || size < header_size || size - header_size < payload_size) {
+		logger::error(log_category::io, "{}: truncated snapshot ({} bytes)", name, size);
+		return false;
+	}
+	const unsigned char* payload = data + header_size;
+	if (crc32(payload, payload_size) != crc) {
+		logger::error(log_category::io, "{}: snapshot checksum mismatch", name);
+		return false;
+	}
+
+	const unsigned char* p = payload;
+	double* y = glm::value_ptr(rs.s.y);
+	for (int i = 0; i < 12; i++) {
+		y[i] = getF64(p);
+	}
+	double* dydt = glm::value_ptr(rs.dydt);
+	for (int i = 0; i < 12; i++) {
+		dydt[i] = getF64(p);
+	}
+	rs.s.m1 = getF64(p);
+	rs.s.m2 = getF64(p);
+	rs.s.physics_time = getF64(p);
+	rs.atol = getF64(p);
+	rs.rtol = getF64(p);
+	rs.timestep = getF64(p);
+	rs.drift_target = getF64(p);
+	rs.energy0 = getF64(p);
+	rs.momentum0 = getF64(p);
+	rs.steps = getU64(p);
+	rs.tracer_count = getU64(p);
+	rs.tracer_seed = getU32(p);
+	const std::uint32_t flags = getU32(p);
+	rs.dydt_valid = (flags & flag_dydt_valid) != 0;
+	rs.newtonian = (flags & flag_newtonian) != 0;
+	rs.auto_tune = (flags & flag_auto_tune) != 0;
+	return true;
+}
+
+// Files
+// -------------------------------------------------------------------------------------------
+bool writeRestart(const std::string& path, const restart_state& rs) {
+	unsigned char buffer[restart_file_size];
+	encodeRestart(rs, buffer);
+
+	const std::string tmp = path + ".tmp";
+	FILE* f = std::fopen(tmp.c_str(), "wb");
+	if (!f) {
+		logger::error(log_category::io, "Could not create {}", tmp);
+		return false;
+	}
+	const bool written = std::fwrite(buffer, 1, sizeof(buffer), f) == sizeof(buffer); // the whole file in one write
+	if (std::fclose(f) != 0 || !written) {
+		logger::error(log_category::io, "Could not write {}", tmp);
+		return false;
+	}
+
+	// The old snapshot is only replaced by a complete new one, an interrupted write leaves it intact
+	std::error_code ec;
+	fs::rename(tmp, path, ec);
+	if (ec) {
+		logger::error(log_category::io, "Could not replace {}: {}", path, ec.message());
+		return false;
+	}
+	return true;
+}
+
+bool readRestart(const std::string& path, restart_state& rs) {
+	mapped_file file;
+	if (!file.open(path)) {
+		logger::error(log_category::io, "Could not open {}", path);
+		return false;
+	}
+	return decodeRestart(file.data(), file.size(), rs, path.c_str());
+}
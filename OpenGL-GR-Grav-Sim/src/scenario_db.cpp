@@ -0,0 +1,747 @@
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "scenario_db.h"
+#include "byte_io.h"
+#include "crc32.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+using namespace byte_io;
+
+static const unsigned char data_magic[8] = { 'P', 'N', 'S', 'C', 'E', 'N', 0x1a, '\n' };
+static const unsigned char index_magic[8] = { 'P', 'N', 'S', 'C', 'I', 'D', 'X', '\n' };
+static const std::uint32_t record_magic = 0x4E454353; // "SCEN"
+static const std::uint32_t flag_removed = 1u << 0;
+
+static const size_t data_header_size = 32;
+static const size_t record_header_size = 16;
+static const size_t body_fixed_size = 12 * 8 + 2 * 8 + 4 * 4; // state, masses, three lengths and padding
+static const size_t index_header_size = 48;
+static const size_t entry_size = 24;
+static const size_t tag_entry_size = 12;
+static const size_t min_compact = 16; // journal records a compaction waits for at least, a sixteenth of the index past that
+
+static size_t padded(size_t n) {
+	return (n + 7) & ~size_t{ 7 };
+}
+
+static char lower(char c) {
+	return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+}
+
+std::string normaliseTags(const std::string& tags) {
+	std::vector<std::string> list;
+	size_t start = 0;
+	while (start <= tags.size()) {
+		size_t end = tags.find(',', start);
+		if (end == std::string::npos) {
+			end = tags.size();
+		}
+		size_t a = start, b = end;
+		while (a < b && std::isspace(static_cast<unsigned char>(tags[a]))) {
+			a++;
+		}
+		while (b > a && std::isspace(static_cast<unsigned char>(tags[b - 1]))) {
+			b--;
+		}
+		std::string tag = tags.substr(a, b - a);
+		std::transform(tag.begin(), tag.end(), tag.begin(), lower);
+		if (!tag.empty() && std::find(list.begin(), list.end(), tag) == list.end()) {
+			list.push_back(tag);
+		}
+		start = end + 1;
+	}
+
+	std::string joined;
+	for (const std::string& tag : list) {
+		joined += (joined.empty() ? "" : ",") + tag;
+	}
+	return joined;
+}
+
+// Records
+// -------------------------------------------------------------------------------------------
+static void encodeRecord(const scenario& s, bool removed, std::vector<unsigned char>& out) {
+	const std::string tags = removed ? std::string{} : normaliseTags(s.tags);
+	const std::string& description = removed ? std::string{} : s.description;
+	const size_t body = padded(body_fixed_size + s.name.size() + tags.size() + description.size());
+
+	const size_t at = out.size();
+	out.resize(at + record_header_size + body, 0);
+	unsigned char* p = out.data() + at + record_header_size;
+	const double* y = glm::value_ptr(s.y);
+	for (int i = 0; i < 12; i++) {
+		p = putF64(p, removed ? 0.0 : y[i]);
+	}
+	p = putF64(p, removed ? 0.0 : s.m1);
+	p = putF64(p, removed ? 0.0 : s.m2);
+	p = putU32(p, static_cast<std::uint32_t>(s.name.size()));
+	p = putU32(p, static_cast<std::uint32_t>(tags.size()));
+	p = putU32(p, static_cast<std::uint32_t>(description.size()));
+	p = putU32(p, 0);
+	std::memcpy(p, s.name.data(), s.name.size());
+	p += s.name.size();
+	std::memcpy(p, tags.data(), tags.size());
+	p += tags.size();
+	std::memcpy(p, description.data(), description.size());
+
+	unsigned char* h = out.data() + at;
+	h = putU32(h, record_magic);
+	h = putU32(h, static_cast<std::uint32_t>(body));
+	h = putU32(h, crc32(out.data() + at + record_header_size, body));
+	putU32(h, removed ? flag_removed : 0u);
+}
+
+// The record at offset if it is whole and intact, its size (header and body) in size
+static bool recordAt(const mapped_file& file, std::uint64_t offset, size_t& size, std::uint32_t& flags) {
+	if (offset < data_header_size || offset > file.size() || file.size() - offset < record_header_size) {
+		return false;
+	}
+	const unsigned char* h = file.data() + offset;
+	const std::uint32_t magic = getU32(h);
+	const std::uint32_t body = getU32(h);
+	const std::uint32_t crc = getU32(h);
+	flags = getU32(h);
+	if (magic != record_magic || body < body_fixed_size || file.size() - offset - record_header_size < body) {
+		return false;
+	}
+	if (crc32(file.data() + offset + record_header_size, body) != crc) {
+		return false;
+	}
+	size = record_header_size + body;
+	return true;
+}
+
+bool scenario_db::decode(std::uint64_t offset, scenario& out, bool* removed) const {
+	size_t size = 0;
+	std::uint32_t flags = 0;
+	if (!recordAt(data, offset, size, flags)) {
+		logger::error(log_category::io, "{}: damaged scenario record at byte {}", data_path, offset);
+		return false;
+	}
+	const unsigned char* p = data.data() + offset + record_header_size;
+	double* y = glm::value_ptr(out.y);
+	for (int i = 0; i < 12; i++) {
+		y[i] = getF64(p);
+	}
+	out.m1 = getF64(p);
+	out.m2 = getF64(p);
+	const std::uint32_t name_len = getU32(p);
+	const std::uint32_t tags_len = getU32(p);
+	const std::uint32_t description_len = getU32(p);
+	p += 4;
+	if (static_cast<std::uint64_t>(name_len) + tags_len + description_len > size - record_header_size - body_fixed_size) {
+		logger::error(log_category::io, "{}: damaged scenario record at byte {}", data_path, offset);
+		return false;
+	}
+	const char* text = reinterpret_cast<const char*>(p);
+	out.name.assign(text, name_len);
+	out.tags.assign(text + name_len, tags_len);
+	out.description.assign(text + name_len + tags_len, description_len);
+	if (removed) {
+		*removed = (flags & flag_removed) != 0;
+	}
+	return true;
+}
+
+// Files
+// -------------------------------------------------------------------------------------------
+bool scenario_db::open(const std::string& path) {
+	std::unique_lock<std::shared_mutex> lock(mtx);
+	data.close();
+	index.close();
+	data_path = path;
+	index_path = path + ".idx";
+
+	std::error_code ec;
+	const bool created = !fs::exists(data_path, ec);
+	if (created) {
+		unsigned char header[data_header_size] = {};
+		std::memcpy(header, data_magic, sizeof(data_magic));
+		putU32(header + sizeof(data_magic), scenario_version);
+		FILE* f = std::fopen(data_path.c_str(), "wb");
+		const bool written = f && std::fwrite(header, 1, sizeof(header), f) == sizeof(header);
+		if (!f || std::fclose(f) != 0 || !written) {
+			logger::error(log_category::io, "Could not create the scenario store {}", data_path);
+			return false;
+		}
+	}
+
+	if (!data.open(data_path) || data.size() < data_header_size || std::memcmp(data.data(), data_magic, sizeof(data_magic)) != 0) {
+		logger::error(log_category::io, "{} is not a scenario store", data_path);
+		data.close();
+		return false;
+	}
+	const unsigned char* h = data.data() + sizeof(data_magic);
+	const std::uint32_t version = getU32(h);
+	if (version == 0 || version > scenario_version) {
+		logger::error(log_category::io, "{}: scenario store version {} (this build reads up to {})", data_path, version, scenario_version);
+		data.close();
+		return false;
+	}
+
+	if (!mapIndex()) {
+		if (!created) {
+			logger::warn(log_category::io, "The index of {} is missing or out of date, rebuilding it", data_path);
+		}
+		if (!rebuildIndex()) {
+			data.close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void scenario_db::close() {
+	std::unique_lock<std::shared_mutex> lock(mtx);
+	data.close();
+	index.close();
+	entries = tag_entries = nullptr;
+	strings = nullptr;
+	entry_count = tag_count = strings_size = 0;
+	journal.clear();
+	journal_at.clear();
+	journal_records = live_count = 0;
+}
+
+bool scenario_db::mapIndex() {
+	entries = tag_entries = nullptr;
+	strings = nullptr;
+	entry_count = tag_count = strings_size = 0;
+	journal.clear();
+	journal_at.clear();
+	journal_records = live_count = 0;
+
+	if (!index.open(index_path) || index.size() < index_header_size || std::memcmp(index.data(), index_magic, sizeof(index_magic)) != 0) {
+		index.close();
+		return false;
+	}
+	const unsigned char* h = index.data() + sizeof(index_magic);
+	const std::uint32_t version = getU32(h);
+	const std::uint32_t count = getU32(h);
+	const std::uint32_t tags = getU32(h);
+	const std::uint32_t crc = getU32(h);
+	const std::uint64_t covered = getU64(h);
+
+	const std::uint64_t tables = static_cast<std::uint64_t>(count) * entry_size + static_cast<std::uint64_t>(tags) * tag_entry_size;
+	if (version == 0 || version > scenario_version || index.size() - index_header_size < tables
+		|| covered < data_header_size || covered > data.size() || crc32(index.data() + index_header_size, index.size() - index_header_size) != crc) {
+		index.close();
+		return false;
+	}
+
+	entries = index.data() + index_header_size;
+	tag_entries = entries + static_cast<size_t>(count) * entry_size;
+	strings = reinterpret_cast<const char*>(tag_entries + static_cast<size_t>(tags) * tag_entry_size);
+	entry_count = count;
+	tag_count = tags;
+	strings_size = index.size() - index_header_size - static_cast<size_t>(tables);
+
+	// The checksum vouches for the contents, the string ranges are still checked once so a lookup never has to
+	for (size_t i = 0; i < entry_count; i++) {
+		const unsigned char* e = entries + i * entry_size + 8;
+		const std::uint64_t name_end = static_cast<std::uint64_t>(getU32(e)) + getU32(e);
+		const std::uint64_t tags_end = static_cast<std::uint64_t>(getU32(e)) + getU32(e);
+		if (name_end > strings_size || tags_end > strings_size) {
+			index.close();
+			entry_count = tag_count = 0;
+			return false;
+		}
+	}
+	live_count = entry_count;
+
+	// The journal, every record past what the index covers
+	std::uint64_t offset = covered;
+	size_t size = 0;
+	std::uint32_t flags = 0;
+	scenario s;
+	while (recordAt(data, offset, size, flags)) {
+		bool removed = false;
+		decode(offset, s, &removed);
+		note(entry{ offset, s.name, s.tags, removed });
+		offset += size;
+	}
+	return offset == data.size(); // a record cut short, the rebuild drops it
+}
+
+bool scenario_db::rebuildIndex() {
+	std::unordered_map<std::string, size_t> by_name;
+	std::vector<entry> list;
+	std::vector<bool> live;
+
+	std::uint64_t offset = data_header_size;
+	size_t size = 0;
+	std::uint32_t flags = 0;
+	scenario s;
+	while (recordAt(data, offset, size, flags)) {
+		bool removed = false;
+		decode(offset, s, &removed);
+		const auto it = by_name.find(s.name);
+		if (it != by_name.end()) {
+			list[it->second] = entry{ offset, s.name, s.tags };
+			live[it->second] = !removed;
+		}
+		else {
+			by_name.emplace(s.name, list.size());
+			list.push_back(entry{ offset, s.name, s.tags });
+			live.push_back(!removed);
+		}
+		offset += size;
+	}
+
+	if (offset < data.size()) { // a record cut short, later appends have to follow the last whole one
+		logger::warn(log_category::io, "{}: dropping {} bytes after the last complete scenario record", data_path, data.size() - offset);
+		data.close();
+		std::error_code ec;
+		fs::resize_file(data_path, offset, ec);
+		if (ec || !data.open(data_path)) {
+			logger::error(log_category::io, "Could not truncate {}: {}", data_path, ec.message());
+			return false;
+		}
+	}
+
+	std::vector<entry> kept;
+	kept.reserve(list.size());
+	for (size_t i = 0; i < list.size(); i++) {
+		if (live[i]) {
+			kept.push_back(std::move(list[i]));
+		}
+	}
+	return writeIndex(kept);
+}
+
+bool scenario_db::writeIndex(std::vector<entry>& list, size_t sorted) {
+	// A save only adds a few entries to a list that is already in order, so those are sorted and merged in rather than sorting everything
+	auto by_name = [](const entry& a, const entry& b) { return a.name < b.name; };
+	sorted = std::min(sorted, list.size());
+	std::sort(list.begin() + sorted, list.end(), by_name);
+	std::inplace_merge(list.begin(), list.begin() + sorted, list.end(), by_name);
+
+	// Strings, and where every tag of every entry starts in them
+	size_t pool_size = 0;
+	for (const entry& e : list) {
+		pool_size += e.name.size() + e.tags.size();
+	}
+	std::string pool;
+	pool.reserve(pool_size);
+	struct tag_ref {
+		std::uint32_t offset, length, entry;
+	};
+	std::vector<tag_ref> tag_refs;
+	std::vector<std::uint32_t> tag_ids; // the distinct tag each reference is
+	std::vector<tag_ref> distinct; // one reference per distinct tag
+	std::unordered_map<std::string_view, std::uint32_t> ids;
+	std::vector<std::uint32_t> name_at(list.size()), tags_at(list.size());
+	for (size_t i = 0; i < list.size(); i++) {
+		name_at[i] = static_cast<std::uint32_t>(pool.size());
+		pool += list[i].name;
+		tags_at[i] = static_cast<std::uint32_t>(pool.size());
+		pool += list[i].tags;
+
+		size_t start = 0;
+		while (start < list[i].tags.size()) {
+			size_t end = list[i].tags.find(',', start);
+			if (end == std::string::npos) {
+				end = list[i].tags.size();
+			}
+			if (end > start) {
+				const tag_ref ref{ static_cast<std::uint32_t>(tags_at[i] + start), static_cast<std::uint32_t>(end - start), static_cast<std::uint32_t>(i) };
+				const auto id = ids.emplace(std::string_view(pool.data() + ref.offset, ref.length), static_cast<std::uint32_t>(distinct.size())); // pool has its final capacity, the views stay valid
+				if (id.second) {
+					distinct.push_back(ref);
+				}
+				tag_refs.push_back(ref);
+				tag_ids.push_back(id.first->second);
+			}
+			start = end + 1;
+		}
+	}
+
+	// There are far fewer tags than references to them: sort the distinct ones, then place the references by counting,
+	// which keeps them in entry order within a tag
+	std::vector<std::uint32_t> order(distinct.size());
+	for (std::uint32_t i = 0; i < order.size(); i++) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&](std::uint32_t a, std::uint32_t b) {
+		return std::string_view(pool.data() + distinct[a].offset, distinct[a].length) < std::string_view(pool.data() + distinct[b].offset, distinct[b].length);
+	});
+	std::vector<size_t> first(distinct.size() + 1, 0); // where each distinct tag's references start, by id
+	for (std::uint32_t id : tag_ids) {
+		first[id]++;
+	}
+	size_t at = 0;
+	for (std::uint32_t id : order) {
+		const size_t n = first[id];
+		first[id] = at;
+		at += n;
+	}
+	std::vector<tag_ref> by_tag(tag_refs.size());
+	for (size_t i = 0; i < tag_refs.size(); i++) {
+		by_tag[first[tag_ids[i]]++] = tag_refs[i];
+	}
+	tag_refs.swap(by_tag);
+
+	std::vector<unsigned char> buffer(index_header_size + list.size() * entry_size + tag_refs.size() * tag_entry_size + pool.size());
+	unsigned char* p = buffer.data() + index_header_size;
+	for (size_t i = 0; i < list.size(); i++) {
+		p = putU64(p, list[i].offset);
+		p = putU32(p, name_at[i]);
+		p = putU32(p, static_cast<std::uint32_t>(list[i].name.size()));
+		p = putU32(p, tags_at[i]);
+		p = putU32(p, static_cast<std::uint32_t>(list[i].tags.size()));
+	}
+	for (const tag_ref& t : tag_refs) {
+		p = putU32(p, t.offset);
+		p = putU32(p, t.length);
+		p = putU32(p, t.entry);
+	}
+	std::memcpy(p, pool.data(), pool.size());
+
+	unsigned char* h = buffer.data();
+	std::memcpy(h, index_magic, sizeof(index_magic));
+	h += sizeof(index_magic);
+	h = putU32(h, scenario_version);
+	h = putU32(h, static_cast<std::uint32_t>(list.size()));
+	h = putU32(h, static_cast<std::uint32_t>(tag_refs.size()));
+	h = putU32(h, crc32(buffer.data() + index_header_size, buffer.size() - index_header_size));
+	putU64(h, data.size());
+
+	const std::string tmp = index_path + ".tmp";
+	FILE* f = std::fopen(tmp.c_str(), "wb");
+	const bool written = f && std::fwrite(buffer.data(), 1, buffer.size(), f) == buffer.size();
+	if (!f || std::fclose(f) != 0 || !written) {
+		logger::error(log_category::io, "Could not write {}", tmp);
+		return false;
+	}
+	index.close(); // a mapped file cannot be replaced on every platform
+	std::error_code ec;
+	fs::rename(tmp, index_path, ec);
+	if (ec) {
+		logger::error(log_category::io, "Could not replace {}: {}", index_path, ec.message());
+	}
+	return mapIndex() && !ec;
+}
+
+bool scenario_db::append(const std::vector<unsigned char>& records) {
+	FILE* f = std::fopen(data_path.c_str(), "ab");
+	const bool written = f && std::fwrite(records.data(), 1, records.size(), f) == records.size(); // every record of the batch in one write
+	const bool closed = f && std::fclose(f) == 0;
+	if (!written || !closed) {
+		logger::error(log_category::io, "Could not append to {}", data_path);
+	}
+	if (!data.open(data_path)) { // the mapping does not grow with the file
+		logger::error(log_category::io, "Could not map {}", data_path);
+		return false;
+	}
+	return written && closed;
+}
+
+// Index lookups (the caller holds the lock)
+// -------------------------------------------------------------------------------------------
+std::uint64_t scenario_db::offsetAt(size_t i) const {
+	const unsigned char* e = entries + i * entry_size;
+	return getU64(e);
+}
+
+std::string scenario_db::nameAt(size_t i) const {
+	const unsigned char* e = entries + i * entry_size + 8;
+	const std::uint32_t at = getU32(e);
+	const std::uint32_t length = getU32(e);
+	return std::string(strings + at, length);
+}
+
+std::string scenario_db::tagsAt(size_t i) const {
+	const unsigned char* e = entries + i * entry_size + 16;
+	const std::uint32_t at = getU32(e);
+	const std::uint32_t length = getU32(e);
+	return std::string(strings + at, length);
+}
+
+size_t scenario_db::lowerBound(const std::string& name) const {
+	size_t lo = 0, hi = entry_count;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		const unsigned char* e = entries + mid * entry_size + 8;
+		const std::uint32_t at = getU32(e);
+		const std::uint32_t length = getU32(e);
+		if (std::string_view(strings + at, length) < name) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+bool scenario_db::current(const std::string& name, std::uint64_t& offset) const {
+	const auto it = journal_at.find(name);
+	if (it != journal_at.end()) {
+		offset = journal[it->second].offset;
+		return !journal[it->second].removed;
+	}
+	const size_t i = lowerBound(name);
+	if (i < entry_count && nameAt(i) == name) {
+		offset = offsetAt(i);
+		return true;
+	}
+	return false;
+}
+
+std::vector<size_t> scenario_db::shadowed() const {
+	std::vector<size_t> found;
+	for (const entry& e : journal) {
+		const size_t i = lowerBound(e.name);
+		if (i < entry_count && nameAt(i) == e.name) {
+			found.push_back(i);
+		}
+	}
+	std::sort(found.begin(), found.end());
+	return found;
+}
+
+std::vector<scenario_id> scenario_db::merge(const std::vector<size_t>& hits, std::vector<const entry*>& journal_hits) const {
+	std::sort(journal_hits.begin(), journal_hits.end(), [](const entry* a, const entry* b) { return a->name < b->name; });
+	std::vector<scenario_id> found;
+	found.reserve(hits.size() + journal_hits.size());
+	size_t j = 0;
+	for (size_t i : hits) {
+		const unsigned char* e = entries + i * entry_size + 8;
+		const std::uint32_t at = getU32(e);
+		const std::uint32_t length = getU32(e);
+		const std::string_view name(strings + at, length);
+		for (; j < journal_hits.size() && journal_hits[j]->name < name; j++) {
+			found.push_back(journal_hits[j]->offset);
+		}
+		found.push_back(offsetAt(i));
+	}
+	for (; j < journal_hits.size(); j++) {
+		found.push_back(journal_hits[j]->offset);
+	}
+	return found;
+}
+
+// Reading
+// -------------------------------------------------------------------------------------------
+size_t scenario_db::size() const {
+	std::shared_lock<std::shared_mutex> lock(mtx);
+	return live_count;
+}
+
+std::string scenario_db::name(scenario_id id) const {
+	std::shared_lock<std::shared_mutex> lock(mtx);
+	scenario s;
+	return decode(id, s) ? s.name : std::string{};
+}
+
+std::string scenario_db::tags(scenario_id id) const {
+	std::shared_lock<std::shared_mutex> lock(mtx);
+	scenario s;
+	return decode(id, s) ? s.tags : std::string{};
+}
+
+bool scenario_db::load(scenario_id id, scenario& out) const {
+	std::shared_lock<std::shared_mutex> lock(mtx);
+	return data.isOpen() && decode(id, out);
+}
+
+bool scenario_db::load(const std::string& name, scenario& out) const {
+	std::shared_lock<std::shared_mutex> lock(mtx);
+	std::uint64_t offset = 0;
+	return current(name, offset) && decode(offset, out);
+}
+
+bool scenario_db::contains(const std::string& name) const {
+	std::shared_lock<std::shared_mutex> lock(mtx);
+	std::uint64_t offset = 0;
+	return current(name, offset);
+}
+
+std::vector<scenario_id> scenario_db::withTag(const std::string& tag) const {
+	std::shared_lock<std::shared_mutex> lock(mtx);
+	const std::string wanted = normaliseTags(tag);
+	auto tagAt = [this](size_t i) {
+		const unsigned char* t = tag_entries + i * tag_entry_size;
+		const std::uint32_t at = getU32(t);
+		const std::uint32_t length = getU32(t);
+		return std::string_view(strings + at, length);
+	};
+
+	size_t lo = 0, hi = tag_count;
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		if (tagAt(mid) < wanted) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	const std::vector<size_t> skip = shadowed();
+	std::vector<size_t> hits;
+	for (size_t i = lo; i < tag_count && tagAt(i) == wanted; i++) {
+		const unsigned char* t = tag_entries + i * tag_entry_size + 8;
+		const size_t e = getU32(t);
+		if (!std::binary_search(skip.begin(), skip.end(), e)) {
+			hits.push_back(e);
+		}
+	}
+	std::vector<const entry*> journal_hits;
+	for (const entry& e : journal) {
+		if (!e.removed && ("," + e.tags + ",").find("," + wanted + ",") != std::string::npos) {
+			journal_hits.push_back(&e);
+		}
+	}
+	return merge(hits, journal_hits);
+}
+
+std::vector<scenario_id> scenario_db::search(const std::string& text) const {
+	std::shared_lock<std::shared_mutex> lock(mtx);
+	auto same = [](char a, char b) { return lower(a) == lower(b); };
+	auto contains = [&](const char* s, size_t n) {
+		return std::search(s, s + n, text.begin(), text.end(), same) != s + n;
+	};
+
+	const std::vector<size_t> skip = shadowed();
+	size_t next_skip = 0;
+	std::vector<size_t> hits;
+	for (size_t i = 0; i < entry_count; i++) { // names and tags sit next to each other in the mapping, so this is one pass over a few bytes per entry
+		if (next_skip < skip.size() && skip[next_skip] == i) {
+			next_skip++;
+			continue;
+		}
+		const unsigned char* e = entries + i * entry_size + 8;
+		const std::uint32_t name_at = getU32(e);
+		const std::uint32_t name_len = getU32(e);
+		const std::uint32_t tags_at = getU32(e);
+		const std::uint32_t tags_len = getU32(e);
+		if (text.empty() || contains(strings + name_at, name_len) || contains(strings + tags_at, tags_len)) {
+			hits.push_back(i);
+		}
+	}
+	std::vector<const entry*> journal_hits;
+	for (const entry& e : journal) {
+		if (!e.removed && (text.empty() || contains(e.name.data(), e.name.size()) || contains(e.tags.data(), e.tags.size()))) {
+			journal_hits.push_back(&e);
+		}
+	}
+	return merge(hits, journal_hits);
+}
+
+// Writing
+// -------------------------------------------------------------------------------------------
+bool scenario_db::put(const std::vector<scenario>& batch) {
+	std::unique_lock<std::shared_mutex> lock(mtx);
+	if (!data.isOpen()) {
+		return false;
+	}
+	for (const scenario& s : batch) {
+		if (s.name.empty()) {
+			logger::error(log_category::io, "A scenario needs a name");
+			return false;
+		}
+	}
+
+	std::vector<unsigned char> records;
+	std::vector<entry> added;
+	std::uint64_t offset = data.size();
+	for (const scenario& s : batch) {
+		const size_t before = records.size();
+		encodeRecord(s, false, records);
+		added.push_back(entry{ offset, s.name, normaliseTags(s.tags) });
+		offset += records.size() - before;
+	}
+
+	if (!append(records)) {
+		rebuildIndex(); // keeps whatever part of the batch made it to the file
+		return false;
+	}
+	for (entry& e : added) {
+		note(std::move(e));
+	}
+	compact(); // the batch is already stored, a failed compaction only leaves the journal longer
+	return true;
+}
+
+bool scenario_db::remove(const std::string& name) {
+	std::unique_lock<std::shared_mutex> lock(mtx);
+	std::uint64_t offset = 0;
+	if (!data.isOpen() || !current(name, offset)) {
+		return false;
+	}
+
+	scenario removed;
+	removed.name = name;
+	std::vector<unsigned char> records;
+	encodeRecord(removed, true, records);
+	offset = data.size();
+	if (!append(records)) {
+		rebuildIndex();
+		return false;
+	}
+	note(entry{ offset, name, std::string{}, true });
+	compact();
+	return true;
+}
+
+bool scenario_db::compactionFailed() const {
+	std::shared_lock<std::shared_mutex> lock(mtx);
+	return compact_failed;
+}
+
+void scenario_db::note(entry e) {
+	std::uint64_t offset = 0;
+	const bool was_live = current(e.name, offset);
+	live_count += (e.removed ? 0 : 1);
+	live_count -= (was_live ? 1 : 0);
+	journal_records++;
+
+	const auto it = journal_at.find(e.name);
+	if (it != journal_at.end()) {
+		journal[it->second] = std::move(e);
+	}
+	else {
+		journal_at.emplace(e.name, journal.size());
+		journal.push_back(std::move(e));
+	}
+}
+
+// Only once the journal holds a sixteenth as many records as the index has entries, so on average a save writes a bounded share of
+// the index rather than all of it, and the journal read back on open stays short
+bool scenario_db::compact() {
+	if (journal_records < std::max(min_compact, entry_count / 16)) {
+		return true;
+	}
+	const std::vector<size_t> skip = shadowed();
+	std::vector<entry> list;
+	list.reserve(live_count);
+	size_t next_skip = 0;
+	for (size_t i = 0; i < entry_count; i++) {
+		if (next_skip < skip.size() && skip[next_skip] == i) {
+			next_skip++;
+			continue;
+		}
+		list.push_back(entry{ offsetAt(i), nameAt(i), tagsAt(i) });
+	}
+	const size_t sorted = list.size();
+	for (const entry& e : journal) {
+		if (!e.removed) {
+			list.push_back(e); // copied, writeIndex can fail before the new index replaces the journal
+		}
+	}
+	compact_failed = !writeIndex(list, sorted); // maps the new index, which covers the whole data file, so the journal starts empty
+	if (compact_failed) {
+		logger::warn(log_category::io, "{}: could not compact the index, {} records stay in the journal until the next change", data_path, journal_records);
+	}
+	return !compact_failed;
+}
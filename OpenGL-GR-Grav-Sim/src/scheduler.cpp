@@ -0,0 +1,110 @@
+#include "scheduler.h"
+
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <cerrno>
+
+#ifndef _WIN32
+	#include <time.h>
+#endif
+
+//Constructor
+fixed_step_scheduler::fixed_step_scheduler(double rate_hz, int max_catchup, clock_mode mode)
+	: mode(mode), max_catchup((max_catchup > 0) ? max_catchup : 1), period_ns(1) {
+	setRate(rate_hz);
+	reset();
+}
+
+int fixed_step_scheduler::begin() {
+	const std::int64_t now_ns = clockNs();
+	stats.ticks++;
+
+	if (now_ns < next_deadline_ns) {
+		return 0; // woken early (spurious wake up, or called without sleeping)
+	}
+
+	// Lateness of this wake up past the deadline it slept for
+	const double late = static_cast<double>(now_ns - next_deadline_ns) * 1e-9;
+	late_sum += late;
+	stats.max_late = std::max(stats.max_late, late);
+	stats.mean_late = late_sum / static_cast<double>(stats.ticks);
+
+	std::int64_t due = (now_ns - next_deadline_ns) / period_ns + 1; // every grid point passed since the last one handed out
+	if (due > 1) {
+		stats.overruns++;
+	}
+
+	if (due > max_catchup) {
+		// Spiral of death guard, the work cannot keep up so the backlog is given up instead of growing without end
+		const std::int64_t dropped = due - max_catchup;
+		stats.dropped += static_cast<std::uint64_t>(dropped);
+		stats.drift += static_cast<double>(dropped * period_ns) * 1e-9;
+		next_deadline_ns += dropped * period_ns;
+		due = max_catchup;
+	}
+
+	next_deadline_ns += due * period_ns;
+	stats.steps += static_cast<std::uint64_t>(due);
+	return static_cast<int>(due);
+}
+
+void fixed_step_scheduler::sleepUntilNext() {
+	sleepUntil(next_deadline_ns);
+}
+
+void fixed_step_scheduler::reset() {
+	next_deadline_ns = clockNs() + period_ns;
+}
+
+void fixed_step_scheduler::advance(double seconds) {
+	if (mode == clock_mode::virtual_clock && seconds > 0.0) {
+		virtual_ns += static_cast<std::int64_t>(seconds * 1e9);
+	}
+}
+
+void fixed_step_scheduler::setRate(double rate_hz) {
+	const double rate = std::clamp(rate_hz, 1.0, 10000.0);
+	period_ns = std::max<std::int64_t>(1, static_cast<std::int64_t>(1e9 / rate + 0.5));
+}
+
+double fixed_step_scheduler::now() const {
+	return static_cast<double>(clockNs()) * 1e-9;
+}
+
+std::int64_t fixed_step_scheduler::clockNs() const {
+	if (mode == clock_mode::virtual_clock) {
+		return virtual_ns;
+	}
+	// steady_clock is CLOCK_MONOTONIC on POSIX and QueryPerformanceCounter on Windows, the same clocks the sleeps below are measured against
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void fixed_step_scheduler::sleepUntil(std::int64_t deadline_ns) {
+	if (mode == clock_mode::virtual_clock) {
+		virtual_ns = std::max(virtual_ns, deadline_ns); // sleeping is instant, the clock jumps to the deadline
+		return;
+	}
+
+	if (clockNs() >= deadline_ns) {
+		return;
+	}
+
+#ifdef _WIN32
+	// No absolute monotonic sleep, so the bulk is slept with the (millisecond granular) system sleep and the last stretch is yielded away
+	const std::int64_t coarse_margin_ns = 2000000;
+	std::int64_t remaining = deadline_ns - clockNs();
+	if (remaining > coarse_margin_ns) {
+		std::this_thread::sleep_for(std::chrono::nanoseconds(remaining - coarse_margin_ns));
+	}
+	while (clockNs() < deadline_ns) {
+		std::this_thread::yield();
+	}
+#else
+	// Absolute deadline, so neither the time spent getting here nor an interruption can stretch the sleep
+	timespec ts;
+	ts.tv_sec = static_cast<time_t>(deadline_ns / 1000000000);
+	ts.tv_nsec = static_cast<long>(deadline_ns % 1000000000);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+#endif
+}
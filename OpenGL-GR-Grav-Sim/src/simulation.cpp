@@ -0,0 +1,477 @@
+#include <glm/glm.hpp>
+#include "formulae.h"
+#include "simulation.h"
+
+#include "logger.h"
+
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+static std::atomic<int> instances{ 0 }; // Simulations constructed so far
+
+// The first simulation keeps the plain name, so a snapshot saved by one run still loads in the next, later ones are numbered
+static std::string instancePath(const char* stem, const char* extension, int instance) {
+	return (instance <= 1) ? std::string(stem) + extension : std::string(stem) + "-" + std::to_string(instance) + extension;
+}
+
+//Constructor
+Simulation::Simulation(const state& initial, double atol, double rtol, double initial_dt)
+	: integrator(atol, rtol, initial_dt), fixed_atol(atol), fixed_rtol(rtol), tuner(1e-8), tracers(0.002, 0.01) { // 0.002 yr tracer substeps, 0.01 AU softening
+	const int instance = ++instances;
+	snapshot_path = instancePath("pnsim", ".snap", instance);
+	flight_path = instancePath("pnsim", ".flight", instance);
+	backBuffer.physics_time = 0.0;
+	applyEdits(initial);
+	integrator.setDebug(false);
+}
+
+Simulation::~Simulation() {
+	stop();
+}
+
+void Simulation::start(double warp) {
+	if (physics.joinable()) {
+		return;
+	}
+	sim_speed = warp;
+	stopping = false;
+	if (!flight_path.empty() && recorder.open(flight_path)) { // a simulation that cannot record still runs
+		integrator.setRecorder(&recorder);
+	}
+	if (!export_prefix.empty()) {
+		exporter = std::make_unique<vtk_writer>(vtk_options{ export_every }); // drops frames rather than hold up a step
+		if (!exporter->open(export_prefix, { "energy", "achieved_warp" })) {
+			exporter.reset();
+		}
+	}
+	physics = std::thread(&Simulation::run, this);
+}
+
+void Simulation::stop() {
+	if (!physics.joinable()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mtx); // the paused physics thread checks stopping under the lock
+		stopping = true;
+	}
+	P_cv.notify_one();
+	physics.join();
+	tuner.cancel(); // nothing would apply its result, and it must not outlive the shared pool
+	integrator.setRecorder(nullptr);
+	recorder.close();
+	if (exporter) {
+		exporter->close();
+		if (exporter->dropped() > 0) {
+			logger::warn(log_category::io, "{} ParaView frames were dropped, the disk could not keep up", exporter->dropped());
+		}
+		exporter.reset();
+	}
+}
+
+std::uint64_t Simulation::send(const sim_command& cmd) {
+	const std::uint64_t ticket = commands.push(cmd);
+	if (ticket == 0) {
+		logger::warn(log_category::physics, "The physics thread is not taking commands, one was dropped ({} so far)", commands.dropped());
+	}
+	{
+		std::lock_guard<std::mutex> lock(mtx); // orders the push before the physics thread's predicate check, so the wake up cannot be lost
+	}
+	P_cv.notify_one();
+	return ticket;
+}
+
+tolerance_choice Simulation::getTunedChoice() const {
+	std::lock_guard<std::mutex> lock(mtx);
+	return tuned_choice;
+}
+
+void Simulation::debugBackBuffer() const {
+	dmat43 y = backBuffer.y;
+
+	for (int i = 0; i < 4; i = i + 2) {
+		logger::debug(log_category::physics, "bckbuf pos = {}, {}, {}", y[i][0], y[i][1], y[i][2]);
+		logger::debug(log_category::physics, "bckbuf vel = {}, {}, {}", y[i + 1][0], y[i + 1][1], y[i + 1][2]);
+	}
+	logger::debug(log_category::physics, "bckbuf m1 = {}", backBuffer.m1);
+	logger::debug(log_category::physics, "bckbuf m2 = {}", backBuffer.m2);
+}
+
+// Edits
+// -------------------------------------------------------------------------------------------
+void Simulation::edit(const state& edit_state) { // Changes the values within the back buffer, readers follow with the next published frame
+	backBuffer.y = edit_state.vectors;
+	backBuffer.m1 = edit_state.m1;
+	backBuffer.m2 = edit_state.m2;
+	dydt_valid = false;
+}
+
+void Simulation::applyEdits(const state& edit_state) { // Update the back buffer with a completely new state / simulation
+	edit(edit_state);
+	editStack.push(edit_state);
+}
+
+void Simulation::setMass(int body, double mass) { // Replaces the mass of one body, keeping everything else
+	if (body == 1) {
+		backBuffer.m1 = mass;
+	}
+	else {
+		backBuffer.m2 = mass;
+	}
+	dydt_valid = false;
+	state val(backBuffer.y, backBuffer.m1, backBuffer.m2);
+	editStack.push(val);
+}
+
+void Simulation::undoState(bool running_flag) {
+	if (!running_flag) {
+		editStack.undo();
+	}
+	edit(editStack.read());
+}
+
+void Simulation::redoState() {
+	editStack.redo();
+	edit(editStack.read());
+}
+
+// Snapshots
+// -------------------------------------------------------------------------------------------
+void Simulation::seedTracers(size_t count, std::uint32_t seed) {
+	// Circumbinary disk from twice to six times the current separation
+	double sep = glm::length(backBuffer.y[0] - backBuffer.y[2]);
+	tracers.seedDisk(count, 2.0 * sep, 6.0 * sep, backBuffer.y, backBuffer.m1, backBuffer.m2, seed);
+}
+
+bool Simulation::saveSnapshot() {
+	restart_state rs;
+	rs.s = backBuffer;
+	rs.dydt = backDydt;
+	rs.dydt_valid = dydt_valid;
+	rs.atol = integrator.getAtol(); // the tuned ones while tuning, the run carries on from the same settings
+	rs.rtol = integrator.getRtol();
+	rs.timestep = integrator.getTimestep();
+	rs.newtonian = newtonian;
+	rs.auto_tune = auto_tune;
+	rs.drift_target = drift_target;
+	rs.steps = sequence;
+	rs.energy0 = orbital_energy(backBuffer.y[0], backBuffer.y[2], backBuffer.y[1], backBuffer.y[3], backBuffer.m1, backBuffer.m2);
+	rs.momentum0 = glm::length(orbital_angular_momentum(backBuffer.y[0], backBuffer.y[2], backBuffer.y[1], backBuffer.y[3], backBuffer.m1, backBuffer.m2));
+	rs.tracer_seed = tracers.getSeed();
+	rs.tracer_count = tracers.size();
+
+	if (!writeRestart(snapshot_path, rs)) {
+		return false;
+	}
+	logger::info(log_category::io, "Snapshot saved to {} at t = {} yr", snapshot_path, backBuffer.physics_time);
+	return true;
+}
+
+bool Simulation::loadSnapshot() { // Like an edit, so it can be undone, but it also restores the integrator where it left off
+	restart_state rs;
+	if (!readRestart(snapshot_path, rs)) {
+		return false;
+	}
+	applyEdits(state(rs.s.y, rs.s.m1, rs.s.m2));
+	backBuffer.physics_time = rs.s.physics_time;
+	backDydt = rs.dydt;
+	dydt_valid = rs.dydt_valid;
+
+	fixed_atol = rs.atol;
+	fixed_rtol = rs.rtol;
+	integrator.setTolerances(rs.atol, rs.rtol);
+	integrator.setTimestep(rs.timestep);
+	if (rs.dydt_valid) {
+		integrator.seedDerivative(rs.s, rs.dydt); // the restored step carries on with its first same as last stage
+	}
+	newtonian = rs.newtonian;
+	auto_tune = rs.auto_tune;
+	drift_target = rs.drift_target;
+
+	if (rs.tracer_count > 0) {
+		seedTracers(static_cast<size_t>(rs.tracer_count), rs.tracer_seed); // the same disk, seeded around the restored binary
+	}
+	else {
+		tracers.clear();
+	}
+	logger::info(log_category::io, "Snapshot loaded from {} at t = {} yr", snapshot_path, rs.s.physics_time);
+	return true;
+}
+
+bool Simulation::saveScenario(const std::string& name, const std::string& tags) { // The current edit, like the old preset slots, not wherever the run has got to
+	if (scenarios == nullptr) {
+		logger::warn(log_category::io, "No scenario store to save {} to", name);
+		return false;
+	}
+	const state current = editStack.read();
+	scenario s;
+	s.name = name;
+	s.tags = tags;
+	s.y = current.vectors;
+	s.m1 = current.m1;
+	s.m2 = current.m2;
+	if (!scenarios->put(s)) {
+		return false;
+	}
+	logger::info(log_category::io, "Scenario {} saved", name);
+	return true;
+}
+
+bool Simulation::drainCommands() {
+	sim_command cmd;
+	bool changed = false;
+
+	while (commands.pop(cmd)) {
+		switch (cmd.type) {
+		case command_type::SetState: {
+			pause = true;
+			if (cmd.flag) {
+				state checkpoint(backBuffer.y, backBuffer.m1, backBuffer.m2); // so the edit can be undone back to where the simulation was
+				applyEdits(checkpoint);
+			}
+			applyEdits(state(cmd.y, cmd.m1, cmd.m2));
+			changed = true;
+			break;
+		}
+		case command_type::SetMass:
+			pause = true;
+			setMass(cmd.body, cmd.mass);
+			changed = true;
+			break;
+		case command_type::Undo:
+			pause = true;
+			undoState(cmd.flag);
+			changed = true;
+			break;
+		case command_type::Redo:
+			pause = true;
+			redoState();
+			changed = true;
+			break;
+		case command_type::SaveScenario:
+			saveScenario(cmd.name, cmd.tags);
+			break;
+		case command_type::SaveSnapshot:
+			backDerivatives(); // so the snapshot carries them
+			saveSnapshot();
+			break;
+		case command_type::LoadSnapshot:
+			if (loadSnapshot()) {
+				pause = true;
+				changed = true;
+			}
+			break;
+		case command_type::Pause:
+			pause = cmd.flag;
+			break;
+		case command_type::SetSpeed:
+			sim_speed = cmd.speed;
+			break;
+		}
+		applied_ticket = std::max(applied_ticket, cmd.ticket); // max, two senders may queue their tickets out of order
+	}
+
+	return changed;
+}
+
+// Publishing
+// -------------------------------------------------------------------------------------------
+const dmat43& Simulation::backDerivatives() {
+	if (!dydt_valid) {
+		backDydt = RK45_integration::derivatives(backBuffer.y, backBuffer.m1, backBuffer.m2);
+		dydt_valid = true;
+	}
+	return backDydt;
+}
+
+void Simulation::publishBackBuffer(const fixed_step_scheduler& scheduler, double achieved_warp, bool lagging) {
+	// Copies the Backbuffer into a new immutable frame for the reader, never blocks
+	sim_snapshot& frame = published.back();
+	frame.y = backBuffer.y;
+	frame.dydt = backDerivatives();
+	frame.m1 = backBuffer.m1;
+	frame.m2 = backBuffer.m2;
+	frame.physics_time = backBuffer.physics_time;
+
+	// Derived quantities, so the reader never has to evaluate any physics
+	// The jerk is the Newtonian one, differentiating the PN terms would cost more than the step's whole derivative for a relative ~1e-8 change
+	dvec3 j_rel = newtonian_jerk(backBuffer.y[0], backBuffer.y[2], backBuffer.y[1], backBuffer.y[3], backBuffer.m1, backBuffer.m2);
+	resolve_rel_accel(j_rel, frame.jerk1, frame.jerk2, backBuffer.m1, backBuffer.m2);
+	frame.energy = orbital_energy(backBuffer.y[0], backBuffer.y[2], backBuffer.y[1], backBuffer.y[3], backBuffer.m1, backBuffer.m2);
+	frame.sequence = ++sequence;
+	frame.ticket = applied_ticket;
+	frame.published = std::chrono::steady_clock::now();
+	if (tracers_enabled) {
+		tracers.copyPositions(frame.tracer_xyz); // reuses the slot's capacity, no allocation once the three slots have grown
+	}
+	else {
+		frame.tracer_xyz.clear();
+	}
+	frame.timing = scheduler.getStats();
+	frame.achieved_warp = achieved_warp;
+	frame.lagging = lagging;
+	published.publish();
+}
+
+void Simulation::queueState(double display_time, bool discontinuity) { // Queues the Backbuffer for the interpolated display, never blocks
+	timed_state s{ backBuffer.y, backDerivatives(), backBuffer.physics_time, display_time, discontinuity };
+	lookahead.try_push(s); // a full queue means the reader has stalled, it catches up from the states already queued
+}
+
+// Physics Thread
+// -------------------------------------------------------------------------------------------
+void Simulation::run() {
+	logger::nameThread("physics");
+	fixed_step_scheduler scheduler(physics_rate, 4); // catches up at most 4 steps per wake up, a longer backlog is dropped
+	dmat43 mat{ dvec3{ 0.0 }, dvec3{ 0.0 }, dvec3{ 0.0 }, dvec3{ 0.0 } };
+	integrate_result result(mat, 0, 0, 0, 0.0, false);
+
+	int count = 0, accepts = 0, rejects = 0;
+
+	const int slice_substeps = 64; // substeps integrated between two looks at the clock
+	double achieved_warp = 1.0;
+	bool lagging = false;
+
+	bool tuning = false;
+
+	publishBackBuffer(scheduler, achieved_warp, lagging); // the reader has a frame from the start
+
+	while (!stopping) {
+		if (drainCommands()) {
+			publishBackBuffer(scheduler, achieved_warp, lagging); // edits show up straight away, even while paused
+			queueState(scheduler.now(), true);
+		}
+
+		if (pause) {
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				P_cv.wait(lock, [this] { return !pause || stopping || !commands.empty(); });
+			} // Sleeps until a command arrives, only taken while paused so a running simulation never touches the mutex
+			scheduler.reset(); // time spent paused is not caught up
+			queueState(scheduler.now(), true); // the display restarts from where it was paused
+			continue;
+		}
+
+		if (scheduler.getRate() != physics_rate) {
+			scheduler.setRate(physics_rate);
+		}
+
+		mathState BackBuffer = backBuffer; // Working copy of the backbuffer
+
+		if (auto_tune != tuning) {
+			tuning = auto_tune;
+			if (!tuning) {
+				tuner.cancel();
+				integrator.setTolerances(fixed_atol, fixed_rtol);
+			}
+		}
+		if (tuning && tuner.getTarget() != drift_target) {
+			tuner.setTarget(drift_target); // recalibrates on the next step
+		}
+
+		integrator.setNewtonian(newtonian || (tuning && tuner.getChoice().kepler));
+
+		int request = tracer_request.exchange(0);
+		if (request > 0) {
+			seedTracers(static_cast<size_t>(request), std::random_device{}());
+		}
+		else if (request < 0) {
+			tracers.clear();
+		}
+
+		// One year of simulated time per second of wall time at a warp of 1
+		const double warp = sim_speed;
+		const double physics_dt = scheduler.getDt() * warp;
+		const int steps = scheduler.begin();
+		const double lookahead_s = scheduler.getDt() + frame_budget_ms * 1e-3; // a state is computed at most a budget after its grid time, and has to be queued before the display reaches it
+
+		// Every step gets as many adaptive substeps as fit in the compute budget, so a large warp takes large steps where the orbit allows instead of more ticks
+		const auto tick_start = std::chrono::steady_clock::now();
+		const auto deadline = tick_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(frame_budget_ms.load()));
+		double simulated = 0.0;
+		bool over_budget = false;
+
+		for (int step_i = 0; step_i < steps && !over_budget; step_i++) {
+			if (drainCommands()) { // edits land between two steps
+				BackBuffer = backBuffer;
+				publishBackBuffer(scheduler, achieved_warp, lagging);
+				queueState(scheduler.now(), true);
+				if (pause) {
+					break;
+				}
+			}
+
+			if (tuning && tuner.update(BackBuffer, physics_dt, integrator)) { // never waits, the measuring runs on the pool
+				integrator.setNewtonian(newtonian || tuner.getChoice().kepler);
+				std::lock_guard<std::mutex> lock(mtx);
+				tuned_choice = tuner.getChoice();
+			}
+
+			integrator.setDenseOutput(tracers_enabled); // only the tracers read it
+
+			// Above the limit a tick would take the tracers more substeps than the binary, they keep the limit's count per tick instead
+			const double tracer_tick_substeps = tracer_warp_limit * scheduler.getDt() / tracers.getMaxDt();
+
+			double done = 0.0;
+			while (done < physics_dt) {
+				result = integrator.step(BackBuffer, physics_dt - done, slice_substeps); // Steps through the physics given the current state within the backbuffer
+				if (result.crash_f) {
+					break;
+				}
+
+				if (tracers_enabled) { // Follows the binary along the slice it has just taken
+					const int tracer_substeps = (warp > tracer_warp_limit) ? static_cast<int>(std::ceil(tracer_tick_substeps * result.covered / physics_dt)) : 0;
+					tracers.advance(integrator, BackBuffer.y, result.state_y, BackBuffer.m1, BackBuffer.m2, result.covered, tracer_substeps);
+				}
+
+				BackBuffer.y = result.state_y; // the next slice carries on from here rather than repeating this one
+				BackBuffer.physics_time += result.covered;
+				done += result.covered;
+
+				count += result.count;
+				accepts += result.accepts;
+				rejects += result.rejects;
+
+				if (done < physics_dt && std::chrono::steady_clock::now() >= deadline) {
+					over_budget = true; // the rest of this step and any further due steps are given up
+					break;
+				}
+			}
+			simulated += done;
+
+			if (result.crash_f) {
+				backBuffer.y = result.state_y;
+				backBuffer.physics_time = BackBuffer.physics_time;
+				dydt_valid = false;
+				crash_flag = true;
+				pause = true;
+				break;
+			}
+
+			backBuffer.y = BackBuffer.y;
+			backBuffer.physics_time = BackBuffer.physics_time;
+			backDydt = result.dydt; // first same as last, no extra evaluation
+			dydt_valid = true;
+
+			if (over_budget || step_i + 1 == steps) {
+				achieved_warp = simulated / (steps * scheduler.getDt());
+				lagging = over_budget;
+			}
+
+			publishBackBuffer(scheduler, achieved_warp, lagging);
+			queueState(scheduler.lastDeadline() - (steps - 1 - step_i) * scheduler.getDt() + lookahead_s, false); // stamped with its own grid time, so caught up steps keep their spacing
+			if (exporter) {
+				const double fields[] = { orbital_energy(backBuffer.y[0], backBuffer.y[2], backBuffer.y[1], backBuffer.y[3], backBuffer.m1, backBuffer.m2), achieved_warp };
+				exporter->push(backBuffer.physics_time, backBuffer.y, backDerivatives(), backBuffer.m1, backBuffer.m2, fields); // a copy into a pooled frame, never waits
+			}
+		}
+
+		if (!pause) {
+			scheduler.sleepUntilNext(); // precise sleep to the next deadline, rather than a fixed 33ms after however long the work took
+		}
+	}
+}
@@ -0,0 +1,500 @@
+#include <glm/glm.hpp>
+#include "snapshot_import.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string_view>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static const double kpc_au = 2.0626480624709636e8; // AU per kpc
+static const double kms_auyr = 0.21094502112788454; // AU/yr per km/s
+
+static const size_t import_grain = 16384; // bodies per task, a few hundred kB of input
+
+const char* formatName(snapshot_format format) {
+	switch (format) {
+	case snapshot_format::automatic: return "automatic";
+	case snapshot_format::gadget1: return "Gadget-2 format 1";
+	case snapshot_format::gadget2: return "Gadget-2 format 2";
+	case snapshot_format::csv: return "CSV";
+	case snapshot_format::table: return "binary table";
+	}
+	return "unknown";
+}
+
+// Raw values in the file's byte order
+// -------------------------------------------------------------------------------------------
+static std::uint32_t swapped(std::uint32_t v) {
+	return (v >> 24) | ((v >> 8) & 0xFF00u) | ((v << 8) & 0xFF0000u) | (v << 24);
+}
+
+static std::uint64_t swapped(std::uint64_t v) {
+	return (static_cast<std::uint64_t>(swapped(static_cast<std::uint32_t>(v))) << 32) | swapped(static_cast<std::uint32_t>(v >> 32));
+}
+
+static std::uint32_t readU32(const unsigned char* p, bool swap) {
+	std::uint32_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return swap ? swapped(v) : v;
+}
+
+static double readF64(const unsigned char* p, bool swap) {
+	std::uint64_t bits;
+	std::memcpy(&bits, p, sizeof(bits));
+	if (swap) {
+		bits = swapped(bits);
+	}
+	double v;
+	std::memcpy(&v, &bits, sizeof(v));
+	return v;
+}
+
+static double readReal(const unsigned char* p, bool f64, bool swap) { // a value of a block that is either precision
+	if (f64) {
+		return readF64(p, swap);
+	}
+	std::uint32_t bits = readU32(p, swap);
+	float v;
+	std::memcpy(&v, &bits, sizeof(v));
+	return v;
+}
+
+// Gadget-2
+// -------------------------------------------------------------------------------------------
+static const size_t gadget_header_size = 256;
+
+struct gadget_part { // One file of a (possibly split) snapshot, pointers into its mapping
+	mapped_file file;
+	bool swap = false;
+	bool format2 = false;
+	std::uint32_t npart[6] = {};
+	double massarr[6] = {};
+	double time = 0.0;
+	double hubble = 1.0;
+	std::uint32_t num_files = 1;
+	size_t n = 0; // bodies in this file
+	size_t first = 0; // index of its first body in the whole snapshot
+	const unsigned char* pos = nullptr;
+	const unsigned char* vel = nullptr;
+	const unsigned char* mass = nullptr; // only the types without a fixed mass
+	bool pos_f64 = false, vel_f64 = false, mass_f64 = false;
+};
+
+// Format 1 or 2 and the byte order, from the length of the first record, false if it is neither
+static bool gadgetMarker(const mapped_file& file, bool& format2, bool& swap) {
+	if (file.size() < 4) {
+		return false;
+	}
+	const std::uint32_t first = readU32(file.data(), false);
+	for (const std::uint32_t length : { std::uint32_t{ 256 }, std::uint32_t{ 8 } }) {
+		if (first == length || first == swapped(length)) {
+			format2 = (length == 8);
+			swap = (first != length);
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool readGadgetPart(const std::string& path, gadget_part& part) {
+	if (!part.file.open(path) || !gadgetMarker(part.file, part.format2, part.swap)) {
+		logger::error(log_category::io, "{} is not a Gadget-2 snapshot", path);
+		return false;
+	}
+	const unsigned char* data = part.file.data();
+	const size_t size = part.file.size();
+
+	size_t at = 0;
+	int unnamed = 0; // format 1 blocks are known only by their order
+	bool header = false;
+	size_t variable = 0; // bodies of types whose mass is in the MASS block
+	while (at < size) {
+		std::string name;
+		if (part.format2) { // 8 byte record: the name and the size of the block record after it
+			if (size - at < 16 || readU32(data + at, part.swap) != 8 || readU32(data + at + 12, part.swap) != 8) {
+				break;
+			}
+			name.assign(reinterpret_cast<const char*>(data + at + 4), 4);
+			name.erase(name.find_last_not_of(' ') + 1);
+			at += 16;
+		}
+		else {
+			const char* order[] = { "HEAD", "POS", "VEL", "ID", "MASS" };
+			name = (unnamed < 5) ? order[unnamed] : "";
+			unnamed++;
+		}
+
+		if (size - at < 4) {
+			break;
+		}
+		const std::uint32_t length = readU32(data + at, part.swap);
+		if (size - at - 4 < static_cast<size_t>(length) + 4 || readU32(data + at + 4 + length, part.swap) != length) {
+			logger::error(log_category::io, "{}: damaged record at byte {}", path, at);
+			return false;
+		}
+		const unsigned char* block = data + at + 4;
+		at += static_cast<size_t>(length) + 8;
+
+		if (name == "HEAD") {
+			if (length < gadget_header_size) {
+				break;
+			}
+			for (int t = 0; t < 6; t++) {
+				part.npart[t] = readU32(block + 4 * t, part.swap);
+				part.massarr[t] = readF64(block + 24 + 8 * t, part.swap);
+				part.n += part.npart[t];
+				variable += (part.massarr[t] == 0.0) ? part.npart[t] : 0;
+			}
+			part.time = readF64(block + 72, part.swap);
+			part.num_files = std::max<std::uint32_t>(1, readU32(block + 124, part.swap));
+			part.hubble = readF64(block + 152, part.swap);
+			header = true;
+			continue;
+		}
+		if (!header) {
+			break;
+		}
+
+		// Single or double precision, from the block length
+		auto claim = [&](const unsigned char*& out, bool& f64, size_t values) {
+			if (length == values * 4 || length == values * 8) {
+				out = block;
+				f64 = (length == values * 8);
+				return true;
+			}
+			logger::error(log_category::io, "{}: the {} block holds {} bytes, not {} values", path, name, length, values);
+			return false;
+		};
+		if (name == "POS" && !claim(part.pos, part.pos_f64, 3 * part.n)) {
+			return false;
+		}
+		if (name == "VEL" && !claim(part.vel, part.vel_f64, 3 * part.n)) {
+			return false;
+		}
+		if (name == "MASS" && variable > 0 && !claim(part.mass, part.mass_f64, variable)) {
+			return false;
+		}
+	}
+
+	if (!header || (part.n > 0 && (!part.pos || !part.vel)) || (variable > 0 && !part.mass)) {
+		logger::error(log_category::io, "{}: the header, positions, velocities or masses are missing", path);
+		return false;
+	}
+	if (!(part.hubble > 0.0)) { // runs without cosmology may leave it at 0
+		part.hubble = 1.0;
+	}
+	return true;
+}
+
+static bool importGadget(const std::string& path, body_soa& out, const import_options& options, import_report& report) {
+	// A split snapshot is <path>.0 .. <path>.<num_files - 1>, named by the path without the number
+	std::error_code ec;
+	const bool split = !fs::exists(path, ec) && fs::exists(path + ".0", ec);
+	std::vector<gadget_part> parts(1);
+	if (!readGadgetPart(split ? path + ".0" : path, parts[0])) {
+		return false;
+	}
+	if (split) {
+		parts.resize(parts[0].num_files);
+		for (size_t i = 1; i < parts.size(); i++) {
+			if (!readGadgetPart(path + "." + std::to_string(i), parts[i])) {
+				return false;
+			}
+		}
+	}
+
+	size_t total = 0;
+	for (gadget_part& part : parts) {
+		part.first = total;
+		total += part.n;
+	}
+	out.resize(total);
+
+	thread_pool& pool = thread_pool::shared();
+	for (const gadget_part& part : parts) {
+		const double length = kpc_au / part.hubble * options.length_scale;
+		const double velocity = kms_auyr * options.velocity_scale;
+		const double mass = 1e10 / part.hubble * options.mass_scale;
+		const size_t pos_size = part.pos_f64 ? 8 : 4, vel_size = part.vel_f64 ? 8 : 4, mass_size = part.mass_f64 ? 8 : 4;
+
+		pool.parallel_for(0, part.n, import_grain, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				const size_t o = part.first + i;
+				const unsigned char* p = part.pos + 3 * i * pos_size;
+				const unsigned char* v = part.vel + 3 * i * vel_size;
+				out.x[o] = readReal(p, part.pos_f64, part.swap) * length;
+				out.y[o] = readReal(p + pos_size, part.pos_f64, part.swap) * length;
+				out.z[o] = readReal(p + 2 * pos_size, part.pos_f64, part.swap) * length;
+				out.vx[o] = readReal(v, part.vel_f64, part.swap) * velocity;
+				out.vy[o] = readReal(v + vel_size, part.vel_f64, part.swap) * velocity;
+				out.vz[o] = readReal(v + 2 * vel_size, part.vel_f64, part.swap) * velocity;
+			}
+
+			// Masses type by type, the MASS block skips the types given one mass in the header
+			size_t type_first = 0, block_first = 0;
+			for (int t = 0; t < 6; t++) {
+				const size_t type_end = type_first + part.npart[t];
+				const size_t b = std::max(begin, type_first), e = std::min(end, type_end);
+				for (size_t i = b; i < e; i++) {
+					const double m = (part.massarr[t] != 0.0) ? part.massarr[t] : readReal(part.mass + (block_first + i - type_first) * mass_size, part.mass_f64, part.swap);
+					out.m[part.first + i] = m * mass;
+				}
+				block_first += (part.massarr[t] == 0.0) ? part.npart[t] : 0;
+				type_first = type_end;
+			}
+		});
+	}
+
+	report.format = parts[0].format2 ? snapshot_format::gadget2 : snapshot_format::gadget1;
+	report.files = parts.size();
+	report.time = parts[0].time;
+	return true;
+}
+
+// Binary table
+// -------------------------------------------------------------------------------------------
+static bool importTable(const std::string& path, body_soa& out, const import_options& options) {
+	mapped_file file;
+	const size_t value_size = options.table_f32 ? 4 : 8;
+	const size_t record = 7 * value_size;
+	if (!file.open(path) || file.size() % record != 0) {
+		logger::error(log_category::io, "{} is not a table of {} byte records", path, record);
+		return false;
+	}
+	const size_t n = file.size() / record;
+	out.resize(n);
+
+	thread_pool::shared().parallel_for(0, n, import_grain, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const unsigned char* r = file.data() + i * record;
+			auto value = [&](int k) { return readReal(r + k * value_size, !options.table_f32, false); };
+			out.x[i] = value(0) * options.length_scale;
+			out.y[i] = value(1) * options.length_scale;
+			out.z[i] = value(2) * options.length_scale;
+			out.vx[i] = value(3) * options.velocity_scale;
+			out.vy[i] = value(4) * options.velocity_scale;
+			out.vz[i] = value(5) * options.velocity_scale;
+			out.m[i] = value(6) * options.mass_scale;
+		}
+	});
+	return true;
+}
+
+// CSV
+// -------------------------------------------------------------------------------------------
+static bool separator(char c) {
+	return c == ',' || c == ' ' || c == '\t' || c == '\r';
+}
+
+// Where the fields start on the line [p, end), up to max_fields
+static size_t splitFields(const char* p, const char* end, std::string_view* fields, size_t max_fields) {
+	size_t count = 0;
+	while (p < end && count < max_fields) {
+		while (p < end && separator(*p)) {
+			p++;
+		}
+		if (p == end || *p == '#') {
+			break;
+		}
+		const char* start = p;
+		while (p < end && !separator(*p) && *p != '#') {
+			p++;
+		}
+		fields[count++] = std::string_view(start, static_cast<size_t>(p - start));
+	}
+	return count;
+}
+
+static bool blankLine(const char* p, const char* end) { // nothing but separators and a comment
+	while (p < end && separator(*p)) {
+		p++;
+	}
+	return p == end || *p == '#';
+}
+
+static bool importCsv(const std::string& path, body_soa& out, const import_options& options) {
+	mapped_file file;
+	if (!file.open(path)) {
+		logger::error(log_category::io, "Could not open {}", path);
+		return false;
+	}
+	const char* const text = reinterpret_cast<const char*>(file.data());
+	const char* const text_end = text + file.size();
+	auto lineEnd = [text_end](const char* p) {
+		const void* nl = std::memchr(p, '\n', static_cast<size_t>(text_end - p));
+		return nl ? static_cast<const char*>(nl) : text_end;
+	};
+	auto nextLine = [text_end](const char* line_end) { return (line_end == text_end) ? text_end : line_end + 1; };
+
+	// The first line that is not blank either names the columns or is the first body
+	int column[7] = { 0, 1, 2, 3, 4, 5, 6 }; // field of x y z vx vy vz m
+	const char* body_start = text;
+	while (body_start < text_end && blankLine(body_start, lineEnd(body_start))) {
+		body_start = nextLine(lineEnd(body_start));
+	}
+	if (body_start < text_end) {
+		const char* end = lineEnd(body_start);
+		std::string_view fields[64];
+		const size_t count = splitFields(body_start, end, fields, 64);
+		double first = 0.0;
+		if (std::from_chars(fields[0].data(), fields[0].data() + fields[0].size(), first).ec != std::errc{}) {
+			const char* names[7] = { "x", "y", "z", "vx", "vy", "vz", "m" };
+			for (int k = 0; k < 7; k++) {
+				column[k] = -1;
+				for (size_t f = 0; f < count; f++) {
+					std::string name(fields[f]);
+					std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+					if (name == names[k] || (k == 6 && name == "mass")) {
+						column[k] = static_cast<int>(f);
+					}
+				}
+				if (column[k] < 0) {
+					logger::error(log_category::io, "{}: no {} column", path, names[k]);
+					return false;
+				}
+			}
+			body_start = nextLine(end);
+		}
+	}
+	const size_t fields_needed = static_cast<size_t>(*std::max_element(column, column + 7)) + 1;
+	if (fields_needed > 64) {
+		logger::error(log_category::io, "{}: the columns are too far apart", path);
+		return false;
+	}
+
+	// Chunks of whole lines, counted in parallel, then parsed in parallel straight into their rows
+	thread_pool& pool = thread_pool::shared();
+	const size_t bytes = static_cast<size_t>(text_end - body_start);
+	const size_t chunks = std::max<size_t>(1, std::min<size_t>(bytes / (1 << 20) + 1, 8 * pool.concurrency()));
+	std::vector<const char*> bounds(chunks + 1, text_end);
+	bounds[0] = body_start;
+	for (size_t c = 1; c < chunks; c++) {
+		const char* guess = std::max(bounds[c - 1], body_start + bytes / chunks * c);
+		bounds[c] = (guess == text_end) ? text_end : nextLine(lineEnd(guess));
+	}
+
+	std::vector<size_t> rows(chunks + 1, 0);
+	pool.parallel_for(0, chunks, 1, [&](size_t begin, size_t end) {
+		for (size_t c = begin; c < end; c++) {
+			for (const char* p = bounds[c]; p < bounds[c + 1];) {
+				const char* e = lineEnd(p);
+				rows[c + 1] += blankLine(p, e) ? 0 : 1;
+				p = nextLine(e);
+			}
+		}
+	});
+	for (size_t c = 0; c < chunks; c++) {
+		rows[c + 1] += rows[c];
+	}
+	out.resize(rows[chunks]);
+
+	std::vector<const char*> bad(chunks, nullptr); // the first line of each chunk that could not be read
+	pool.parallel_for(0, chunks, 1, [&](size_t begin, size_t end) {
+		std::string_view fields[64];
+		for (size_t c = begin; c < end; c++) {
+			size_t i = rows[c];
+			for (const char* p = bounds[c]; p < bounds[c + 1] && !bad[c];) {
+				const char* e = lineEnd(p);
+				if (!blankLine(p, e)) {
+					double v[7];
+					bool ok = splitFields(p, e, fields, fields_needed) == fields_needed;
+					for (int k = 0; k < 7 && ok; k++) {
+						const std::string_view f = fields[column[k]];
+						const auto parsed = std::from_chars(f.data(), f.data() + f.size(), v[k]);
+						ok = parsed.ec == std::errc{} && parsed.ptr == f.data() + f.size();
+					}
+					if (!ok) {
+						bad[c] = p;
+						break;
+					}
+					out.x[i] = v[0] * options.length_scale;
+					out.y[i] = v[1] * options.length_scale;
+					out.z[i] = v[2] * options.length_scale;
+					out.vx[i] = v[3] * options.velocity_scale;
+					out.vy[i] = v[4] * options.velocity_scale;
+					out.vz[i] = v[5] * options.velocity_scale;
+					out.m[i] = v[6] * options.mass_scale;
+					i++;
+				}
+				p = nextLine(e);
+			}
+		}
+	});
+
+	for (const char* line : bad) {
+		if (line) { // the line number is only worth counting for the message
+			const size_t number = static_cast<size_t>(std::count(text, line, '\n')) + 1;
+			logger::error(log_category::io, "{}: could not read line {}: \"{}\"", path, number, std::string(line, lineEnd(line)));
+			return false;
+		}
+	}
+	return true;
+}
+
+// Import
+// -------------------------------------------------------------------------------------------
+static snapshot_format detectFormat(const std::string& path) {
+	std::string extension = fs::path(path).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	if (extension == ".csv" || extension == ".txt") {
+		return snapshot_format::csv;
+	}
+
+	std::error_code ec;
+	mapped_file file(fs::exists(path, ec) ? path : path + ".0");
+	bool format2 = false, swap = false;
+	if (gadgetMarker(file, format2, swap)) {
+		return format2 ? snapshot_format::gadget2 : snapshot_format::gadget1;
+	}
+	if (extension == ".bin" || extension == ".dat") {
+		return snapshot_format::table;
+	}
+	return snapshot_format::automatic;
+}
+
+bool importSnapshot(const std::string& path, body_soa& out, const import_options& options, import_report* report) {
+	const auto started = std::chrono::steady_clock::now();
+	out = body_soa{}; // resized by the importer, which zeroes the accelerations
+	import_report r;
+	r.format = (options.format == snapshot_format::automatic) ? detectFormat(path) : options.format;
+	r.files = 1;
+
+	bool ok = false;
+	switch (r.format) {
+	case snapshot_format::gadget1:
+	case snapshot_format::gadget2:
+		ok = importGadget(path, out, options, r);
+		break;
+	case snapshot_format::csv:
+		ok = importCsv(path, out, options);
+		break;
+	case snapshot_format::table:
+		ok = importTable(path, out, options);
+		break;
+	case snapshot_format::automatic:
+		logger::error(log_category::io, "Could not tell the format of {}, name it explicitly", path);
+		break;
+	}
+	if (!ok) {
+		out = body_soa{};
+		return false;
+	}
+
+	r.bodies = out.size();
+	r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+	logger::info(log_category::io, "Imported {} bodies from {} ({}) in {} s", r.bodies, path, formatName(r.format), r.seconds);
+	if (report) {
+		*report = r;
+	}
+	return true;
+}
@@ -0,0 +1,197 @@
+#include "text_export.h"
+#include "logger.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static const std::chrono::milliseconds writer_period{ 50 }; // the writer drains this often when nobody schedules it
+static const size_t slice_rows = 1024; // rows one pool task formats
+
+// Formatting
+// -------------------------------------------------------------------------------------------
+char* text_export::appendNumber(char* out, double value) {
+	return std::to_chars(out, out + max_number, value).ptr; // shortest round trip, never longer than max_number
+}
+
+char* text_export::appendRow(char* out, const double* values, size_t count) {
+	for (size_t c = 0; c < count; c++) {
+		out = appendNumber(out, values[c]);
+		*out++ = ',';
+	}
+	if (count > 0) {
+		out--; // the last separator becomes the newline
+	}
+	*out++ = '\n';
+	return out;
+}
+
+// Writer
+// -------------------------------------------------------------------------------------------
+csv_writer::csv_writer(const csv_options& options)
+	: options(options), free_blocks(std::make_unique<spsc_queue<std::uint32_t, max_blocks>>()), ready_blocks(std::make_unique<spsc_queue<std::uint32_t, max_blocks>>()) {
+	this->options.block_rows = std::max<size_t>(this->options.block_rows, 1);
+	this->options.blocks = std::clamp<size_t>(this->options.blocks, 2, max_blocks);
+	pool.resize(this->options.blocks);
+}
+
+csv_writer::~csv_writer() {
+	close();
+}
+
+bool csv_writer::open(const std::string& file_path, const std::string& header, bool append) {
+	close();
+	path = file_path;
+	column_count = header.empty() ? 0 : static_cast<size_t>(std::count(header.begin(), header.end(), ',')) + 1;
+	current = nullptr;
+	rows_pushed = 0;
+	failed = false;
+	rows_done = rows_written = bytes_written = push_stalls = 0;
+
+	std::uint32_t index = 0;
+	while (ready_blocks->try_pop(index)) {
+	}
+	while (free_blocks->try_pop(index)) {
+	}
+	for (std::uint32_t i = 0; i < pool.size(); i++) { // kept between opens, these only allocate when the columns grow
+		pool[i].rows = 0;
+		pool[i].values.resize(options.block_rows * column_count);
+		free_blocks->try_push(i);
+	}
+	text.resize(options.block_rows * text_export::rowBytes(column_count));
+	slice_ends.resize((options.block_rows + slice_rows - 1) / slice_rows);
+
+	std::error_code ec;
+	const bool continuing = append && fs::file_size(path, ec) > 0 && !ec;
+	file = std::fopen(path.c_str(), append ? "ab" : "wb");
+	if (!file) {
+		logger::error(log_category::io, "Could not open {}", path);
+		return false;
+	}
+	std::setvbuf(file, nullptr, _IONBF, 0); // the blocks are already large, each fwrite goes straight to one write
+	if (!continuing) {
+		const std::string line = header + "\n";
+		if (std::fwrite(line.data(), 1, line.size(), file) != line.size()) {
+			logger::error(log_category::io, "Could not write {}", path);
+			std::fclose(file);
+			file = nullptr;
+			return false;
+		}
+		bytes_written = line.size();
+	}
+
+	writer = std::make_unique<io_drain>([this] { run(); }, writer_period);
+	return true;
+}
+
+bool csv_writer::close() {
+	if (!writer) {
+		return !failed;
+	}
+	if (current && current->rows > 0) {
+		handOver();
+	}
+	current = nullptr;
+	writer->wait(); // a pass started now takes every block handed over
+	writer.reset();
+	if (std::fclose(file) != 0) {
+		failed = true;
+	}
+	file = nullptr;
+	return !failed;
+}
+
+// Producer
+// -------------------------------------------------------------------------------------------
+void csv_writer::push(const double* row) {
+	if (!writer) {
+		return;
+	}
+	if (!current) {
+		if (!free_blocks->try_pop(current_index)) { // the writer is the whole pool behind
+			push_stalls.fetch_add(1, std::memory_order_relaxed);
+			std::unique_lock<std::mutex> lock(done_mtx);
+			done_cv.wait(lock, [this] { return free_blocks->try_pop(current_index); });
+		}
+		current = &pool[current_index];
+		current->rows = 0;
+	}
+	std::memcpy(current->values.data() + current->rows * column_count, row, column_count * sizeof(double));
+	rows_pushed++;
+	if (++current->rows == options.block_rows) {
+		handOver();
+	}
+}
+
+void csv_writer::handOver() {
+	ready_blocks->try_push(current_index); // cannot fail, there are never more blocks than slots
+	current = nullptr;
+	writer->schedule();
+}
+
+bool csv_writer::flush() {
+	if (!writer) {
+		return !failed;
+	}
+	if (current && current->rows > 0) {
+		handOver(); // a part filled block goes as it is, the next push starts a new one
+	}
+	std::unique_lock<std::mutex> lock(done_mtx);
+	done_cv.wait(lock, [this] { return rows_done.load(std::memory_order_acquire) == rows_pushed; });
+	return !failed;
+}
+
+// Writer
+// -------------------------------------------------------------------------------------------
+void csv_writer::run() {
+	std::uint32_t index = 0;
+	while (ready_blocks->try_pop(index)) {
+		const size_t rows = pool[index].rows;
+		writeBlock(pool[index]);
+		free_blocks->try_push(index);
+		{
+			std::lock_guard<std::mutex> lock(done_mtx); // under the lock, so a producer about to wait cannot miss it
+			rows_done.fetch_add(rows, std::memory_order_release);
+		}
+		done_cv.notify_one();
+	}
+}
+
+void csv_writer::writeBlock(const block& b) {
+	if (failed) {
+		return; // the rows are still counted done, a flush after a failed write must not wait forever
+	}
+	// Every slice formats into room for its longest possible text, then the slices are moved up against each other
+	const size_t row_bytes = text_export::rowBytes(column_count);
+	const size_t slices = (b.rows + slice_rows - 1) / slice_rows;
+	thread_pool::shared().parallel_for(0, slices, 1, [&](size_t first, size_t last) {
+		for (size_t s = first; s < last; s++) {
+			const size_t end_row = std::min(b.rows, (s + 1) * slice_rows);
+			char* out = text.data() + s * slice_rows * row_bytes;
+			for (size_t r = s * slice_rows; r < end_row; r++) {
+				out = text_export::appendRow(out, b.values.data() + r * column_count, column_count);
+			}
+			slice_ends[s] = static_cast<size_t>(out - text.data());
+		}
+	});
+	size_t size = 0;
+	for (size_t s = 0; s < slices; s++) {
+		const size_t start = s * slice_rows * row_bytes;
+		if (start != size) {
+			std::memmove(text.data() + size, text.data() + start, slice_ends[s] - start);
+		}
+		size += slice_ends[s] - start;
+	}
+	if (std::fwrite(text.data(), 1, size, file) != size) {
+		logger::error(log_category::io, "Could not write {}", path);
+		failed = true;
+		return;
+	}
+	rows_written.fetch_add(b.rows, std::memory_order_relaxed);
+	bytes_written.fetch_add(size, std::memory_order_relaxed);
+}
@@ -0,0 +1,413 @@
+#include "thread_pool.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <iterator>
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
+static thread_local thread_pool* current_pool = nullptr; // Pool the calling thread is a worker of
+static thread_local int current_index = -1; // Its deque in that pool
+
+static std::mutex shared_mtx;
+static pool_options shared_options;
+static std::unique_ptr<thread_pool> shared_pool;
+
+// Task Group
+// -------------------------------------------------------------------------------------------
+task_group::~task_group() {
+	try {
+		wait();
+	}
+	catch (...) {}
+}
+
+void task_group::wait() {
+	while (pending.load(std::memory_order_acquire) > 0 && pool.runOne(this)) {
+	}
+	{
+		std::unique_lock<std::mutex> lock(done_mtx); // taken even if nothing is left, the last finish may still hold it
+		done_cv.wait(lock, [this] { return pending.load(std::memory_order_acquire) == 0; }); // the rest of the group is running on other threads
+	}
+
+	std::exception_ptr failure;
+	{
+		std::lock_guard<std::mutex> lock(error_mtx);
+		failure = error;
+		error = nullptr;
+	}
+	if (failure) {
+		std::rethrow_exception(failure);
+	}
+}
+
+void task_group::finish(std::exception_ptr failure) {
+	if (failure) {
+		std::lock_guard<std::mutex> lock(error_mtx);
+		if (!error) {
+			error = failure;
+		}
+	}
+	std::lock_guard<std::mutex> lock(done_mtx);
+	if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		done_cv.notify_all();
+	}
+}
+
+// Thread Pool
+// -------------------------------------------------------------------------------------------
+//Constructor
+thread_pool::thread_pool(const pool_options& options) : options(options) {
+	unsigned int count = options.workers;
+	if (count == 0) {
+		const unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+		count = (hardware > 1) ? hardware - 1 : 1;
+	}
+
+	queues.reserve(count);
+	for (unsigned int i = 0; i < count; i++) {
+		queues.push_back(std::make_unique<worker_queue>());
+	}
+
+	workers.reserve(count);
+	for (unsigned int i = 0; i < count; i++) {
+		workers.emplace_back(&thread_pool::workerLoop, this, i);
+		if (options.pin_threads) {
+			pinThread(workers.back(), i + 1);
+		}
+	}
+}
+
+thread_pool::~thread_pool() {
+	{
+		std::lock_guard<std::mutex> lock(sleep_mtx);
+		stopping.store(true);
+	}
+	sleep_cv.notify_all();
+	for (std::thread& w : workers) {
+		w.join();
+	}
+}
+
+thread_pool& thread_pool::shared() {
+	std::lock_guard<std::mutex> lock(shared_mtx);
+	if (!shared_pool) {
+		shared_pool = std::make_unique<thread_pool>(shared_options);
+	}
+	return *shared_pool;
+}
+
+bool thread_pool::configure(const pool_options& options) {
+	std::lock_guard<std::mutex> lock(shared_mtx);
+	if (shared_pool) {
+		return false;
+	}
+	shared_options = options;
+	return true;
+}
+
+void thread_pool::submit(std::function<void()> fn, task_group* group) {
+	task t{ std::move(fn), group };
+
+	if (current_pool == this) {
+		worker_queue& own = *queues[current_index];
+		std::lock_guard<std::mutex> lock(own.mtx); // only contended by a thief
+		own.tasks.push_back(std::move(t));
+	}
+	else {
+		std::lock_guard<std::mutex> lock(inject_mtx);
+		injected.push_back(std::move(t));
+	}
+
+	queued.fetch_add(1);
+	wake();
+}
+
+bool thread_pool::runOne(const task_group* group) {
+	task t;
+	if (!findTask((current_pool == this) ? current_index : -1, t, group)) {
+		return false;
+	}
+	execute(t);
+	return true;
+}
+
+void thread_pool::workerLoop(unsigned int index) {
+	current_pool = this;
+	current_index = static_cast<int>(index);
+
+	char name[16];
+	std::snprintf(name, sizeof(name), "pool%u", index);
+	logger::nameThread(name);
+
+	int spins = 0;
+	task t;
+	while (!stopping.load(std::memory_order_relaxed)) {
+		if (findTask(current_index, t)) {
+			execute(t);
+			spins = 0;
+			continue;
+		}
+
+		if (++spins < options.spin_limit) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		// Nothing to steal for a while, sleep until a submit
+		std::unique_lock<std::mutex> lock(sleep_mtx);
+		sleeping.fetch_add(1);
+		sleep_cv.wait(lock, [this] { return stopping.load() || queued.load() > 0; });
+		sleeping.fetch_sub(1);
+		spins = 0;
+	}
+}
+
+bool thread_pool::findTask(int index, task& out, const task_group* group) {
+	if (queued.load(std::memory_order_relaxed) == 0) {
+		return false;
+	}
+
+	// Takes the newest or oldest task of a deque, or the first of group's from that end
+	auto take = [this, group](std::deque<task>& tasks, bool newest, task& into) {
+		if (tasks.empty()) {
+			return false;
+		}
+		auto match = [group](const task& t) { return !group || t.group == group; };
+		std::deque<task>::iterator it;
+		if (newest) {
+			auto found = std::find_if(tasks.rbegin(), tasks.rend(), match);
+			if (found == tasks.rend()) {
+				return false;
+			}
+			it = std::prev(found.base());
+		}
+		else {
+			it = std::find_if(tasks.begin(), tasks.end(), match);
+			if (it == tasks.end()) {
+				return false;
+			}
+		}
+		into = std::move(*it);
+		tasks.erase(it);
+		queued.fetch_sub(1);
+		return true;
+	};
+
+	// Own deque, newest first
+	if (index >= 0) {
+		worker_queue& own = *queues[index];
+		std::lock_guard<std::mutex> lock(own.mtx);
+		if (take(own.tasks, true, out)) {
+			return true;
+		}
+	}
+
+	// Work handed in from outside the pool
+	{
+		std::lock_guard<std::mutex> lock(inject_mtx);
+		if (take(injected, false, out)) {
+			return true;
+		}
+	}
+
+	// Steal the oldest task of another worker, starting from the next one along so thieves spread out
+	const size_t n = queues.size();
+	const size_t start = (index >= 0) ? static_cast<size_t>(index) + 1 : 0;
+	for (size_t k = 0; k < n; k++) {
+		worker_queue& victim = *queues[(start + k) % n];
+		std::unique_lock<std::mutex> lock(victim.mtx, std::defer_lock);
+		if (group) {
+			lock.lock(); // a waiter only sleeps once none of its tasks is queued anywhere, else it could sleep on one nobody runs
+		}
+		else if (!lock.try_lock()) {
+			continue; // a busy victim is skipped rather than waited on
+		}
+		if (take(victim.tasks, false, out)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void thread_pool::execute(task& t) {
+	task_group* group = t.group;
+	std::exception_ptr failure;
+
+	if (!group || !group->isCancelled()) {
+		try {
+			t.fn();
+		}
+		catch (...) {
+			failure = std::current_exception();
+		}
+	}
+	t.fn = nullptr; // releases the captures before the group is told, they may reference the waiter's stack
+
+	if (group) {
+		group->finish(failure);
+	}
+}
+
+void thread_pool::wake() {
+	// sleeping is raised under sleep_mtx before a worker checks queued, so either it sees the new task or it is counted here and waits on the lock
+	if (sleeping.load() > 0) {
+		std::lock_guard<std::mutex> lock(sleep_mtx);
+		sleep_cv.notify_one();
+	}
+}
+
+size_t thread_pool::chunkCount(size_t items, size_t grain) const {
+	const size_t max_chunks = 4 * static_cast<size_t>(concurrency()); // a few per thread so stealing can even out uneven chunks
+	const size_t by_grain = items / std::max<size_t>(grain, 1);
+	return std::clamp<size_t>(by_grain, 1, max_chunks);
+}
+
+void thread_pool::pinThread(std::thread& thread, unsigned int cpu) {
+	const unsigned int hardware = std::max(1u, std::thread::hardware_concurrency());
+	cpu %= hardware;
+#ifdef _WIN32
+	SetThreadAffinityMask(static_cast<HANDLE>(thread.native_handle()), DWORD_PTR(1) << cpu);
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &set);
+#endif
+}
+
+// I/O lane
+// -------------------------------------------------------------------------------------------
+static thread_local bool on_io_lane = false;
+
+class io_lane {
+public:
+	static io_lane& get() {
+		static io_lane* lane = new io_lane; // never destroyed, like the logger, drains may still run while the process exits
+		return *lane;
+	}
+
+	void add(io_drain* d) {
+		std::lock_guard<std::mutex> lock(mtx);
+		d->due = std::chrono::steady_clock::now() + d->period;
+		drains.push_back(d);
+		if (!thread.joinable()) {
+			thread = std::thread(&io_lane::run, this);
+		}
+	}
+
+	void request() {
+		{
+			std::lock_guard<std::mutex> lock(mtx); // orders the request before the lane's look at the drains, so it cannot be missed
+		}
+		wake_cv.notify_one();
+	}
+
+	void wait(io_drain* d) {
+		std::unique_lock<std::mutex> lock(mtx);
+		if (d->stopped) {
+			return;
+		}
+		if (on_io_lane) {
+			lock.unlock();
+			d->fn(); // the lane cannot wait on itself, and nothing else runs on it meanwhile
+			return;
+		}
+		const std::uint64_t target = d->started + 1;
+		d->requested.store(true);
+		wake_cv.notify_one();
+		done_cv.wait(lock, [d, target] { return d->finished >= target || d->stopped; });
+	}
+
+	void remove(io_drain* d) {
+		std::unique_lock<std::mutex> lock(mtx);
+		if (d->stopped) {
+			return;
+		}
+		d->stopped = true; // not picked again
+		drains.erase(std::find(drains.begin(), drains.end(), d));
+		done_cv.notify_all(); // waiters return
+		if (!on_io_lane) {
+			done_cv.wait(lock, [d] { return d->finished == d->started; });
+		}
+	}
+
+private:
+	std::mutex mtx;
+	std::condition_variable wake_cv, done_cv;
+	std::vector<io_drain*> drains;
+	std::thread thread;
+	size_t next = 0; // where the search for a due drain starts, so a busy writer cannot starve the others
+
+	void run() {
+		logger::nameThread("io");
+		on_io_lane = true;
+		std::unique_lock<std::mutex> lock(mtx);
+		for (;;) {
+			const auto now = std::chrono::steady_clock::now();
+			auto wake_at = std::chrono::steady_clock::time_point::max();
+			io_drain* pick = nullptr;
+			for (size_t k = 0; k < drains.size(); k++) {
+				io_drain* d = drains[(next + k) % drains.size()];
+				const bool timed = d->period.count() > 0;
+				if (d->requested.load() || (timed && now >= d->due)) {
+					pick = d;
+					next = (next + k + 1) % drains.size();
+					break;
+				}
+				if (timed) {
+					wake_at = std::min(wake_at, d->due);
+				}
+			}
+
+			if (!pick) {
+				if (wake_at == std::chrono::steady_clock::time_point::max()) {
+					wake_cv.wait(lock);
+				}
+				else {
+					wake_cv.wait_until(lock, wake_at);
+				}
+				continue;
+			}
+
+			pick->requested.store(false); // cleared before the run, a schedule during it asks for another
+			pick->started++;
+			lock.unlock();
+			pick->fn();
+			lock.lock();
+			pick->finished++;
+			pick->due = std::chrono::steady_clock::now() + pick->period;
+			done_cv.notify_all();
+		}
+	}
+};
+
+//Constructor
+io_drain::io_drain(std::function<void()> fn, std::chrono::milliseconds period) : fn(std::move(fn)), period(period) {
+	io_lane::get().add(this);
+}
+
+io_drain::~io_drain() {
+	stop();
+}
+
+void io_drain::schedule() {
+	if (!requested.exchange(true)) {
+		io_lane::get().request();
+	}
+}
+
+void io_drain::wait() {
+	io_lane::get().wait(this);
+}
+
+void io_drain::stop() {
+	io_lane::get().remove(this);
+}
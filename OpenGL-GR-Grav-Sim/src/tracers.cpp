@@ -0,0 +1,166 @@
+#include <glm/glm.hpp>
+#include "formulae.h"
+#include "integration.h"
+#include "tracers.h"
+#include "thread_pool.h"
+
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+//Constructor
+tracer_system::tracer_system(double max_dt, double softening, unsigned int threads)
+	: max_dt(max_dt), softening(softening), threads(threads) {
+}
+
+void tracer_system::seedDisk(size_t count, double r_inner, double r_outer, const dmat43& binary, double m1, double m2, std::uint32_t seed) {
+	const double m = m1 + m2;
+	const double mu = G * m;
+
+	tracer_system::seed = seed;
+	std::mt19937 gen(seed);
+	std::uniform_real_distribution<double> area_dist(r_inner * r_inner, r_outer * r_outer); // uniform in area so the disk has an even surface density
+	std::uniform_real_distribution<double> angle_dist(0.0, 2.0 * PI);
+
+	// Centre of mass frame of the binary
+	dvec3 com_pos = (m1 * binary[0] + m2 * binary[2]) / m;
+	dvec3 com_vel = (m1 * binary[1] + m2 * binary[3]) / m;
+
+	// Orbital plane of the binary, falls back onto the xy plane for a radial or resting binary
+	dvec3 normal = glm::cross(binary[0] - binary[2], binary[1] - binary[3]);
+	if (glm::dot(normal, normal) > 0.0) {
+		normal = glm::normalize(normal);
+	}
+	else {
+		normal = dvec3{ 0.0, 0.0, 1.0 };
+	}
+	dvec3 e1 = (std::abs(normal.x) < 0.9) ? glm::normalize(glm::cross(normal, dvec3{ 1.0, 0.0, 0.0 })) : glm::normalize(glm::cross(normal, dvec3{ 0.0, 1.0, 0.0 }));
+	dvec3 e2 = glm::cross(normal, e1);
+
+	clear();
+	x.reserve(count); y.reserve(count); z.reserve(count);
+	vx.reserve(count); vy.reserve(count); vz.reserve(count);
+
+	for (size_t i = 0; i < count; i++) {
+		const double r = std::sqrt(area_dist(gen));
+		const double phi = angle_dist(gen);
+
+		dvec3 r_hat = std::cos(phi) * e1 + std::sin(phi) * e2;
+		dvec3 pos = com_pos + r * r_hat;
+		dvec3 vel = com_vel + std::sqrt(mu / r) * glm::cross(normal, r_hat); // circular velocity around the total mass
+
+		x.push_back(pos.x); y.push_back(pos.y); z.push_back(pos.z);
+		vx.push_back(vel.x); vy.push_back(vel.y); vz.push_back(vel.z);
+	}
+}
+
+void tracer_system::clear() {
+	x.clear(); y.clear(); z.clear();
+	vx.clear(); vy.clear(); vz.clear();
+}
+
+void tracer_system::advance(const RK45_integration& binary, const dmat43& y0, const dmat43& y1, double m1, double m2, double dt, int max_substeps) {
+	if (x.empty() || dt <= 0.0) {
+		return;
+	}
+
+	// Binary positions at every substep boundary, read back from the already integrated step
+	// -------------------------------------------------------------------------------------
+	double wanted = std::ceil(dt / max_dt); // in double, a high warp's step can need more than an int holds
+	if (max_substeps > 0) {
+		wanted = std::min(wanted, static_cast<double>(max_substeps));
+	}
+	const int substeps = static_cast<int>(std::min(std::max(wanted, 1.0), 1e9));
+	const double h = dt / substeps;
+
+	p1.resize(substeps + 1); // capacity is kept, these only allocate when a step needs more substeps than any before
+	p2.resize(substeps + 1);
+	dmat43 yk;
+	if (binary.denseState(0.0, yk)) { // the stepper's own continuous extension, fourth order and no derivative evaluations
+		for (int k = 0; k <= substeps; k++) {
+			binary.denseState(k * h, yk);
+			p1[k] = yk[0];
+			p2[k] = yk[2];
+		}
+	}
+	else {
+		const dmat43 dydt0 = RK45_integration::derivatives(y0, m1, m2);
+		const dmat43 dydt1 = RK45_integration::derivatives(y1, m1, m2);
+		for (int k = 0; k <= substeps; k++) {
+			yk = RK45_integration::interpolate(y0, dydt0, y1, dydt1, dt, static_cast<double>(k) / substeps);
+			p1[k] = yk[0];
+			p2[k] = yk[2];
+		}
+	}
+
+	const double gm1 = G * m1;
+	const double gm2 = G * m2;
+
+	// Kick-drift-kick leapfrog, each chunk of particles runs every substep on its own so the threads only meet once per step
+	// -------------------------------------------------------------------------------------
+	parallelChunks([&](size_t begin, size_t end) {
+		kick(begin, end, p1[0], p2[0], gm1, gm2, 0.5 * h);
+		for (int k = 1; k <= substeps; k++) {
+			drift(begin, end, h);
+			kick(begin, end, p1[k], p2[k], gm1, gm2, (k == substeps) ? 0.5 * h : h); // the closing half kick is merged with the next opening one
+		}
+	});
+}
+
+void tracer_system::copyPositions(std::vector<float>& out) const {
+	const size_t n = x.size();
+	out.resize(3 * n);
+	for (size_t i = 0; i < n; i++) {
+		out[3 * i] = static_cast<float>(x[i]);
+		out[3 * i + 1] = static_cast<float>(y[i]);
+		out[3 * i + 2] = static_cast<float>(z[i]);
+	}
+}
+
+void tracer_system::kick(size_t begin, size_t end, const dvec3& p1, const dvec3& p2, double gm1, double gm2, double dt) {
+	const double eps2 = softening * softening;
+
+	double* px = x.data(); double* py = y.data(); double* pz = z.data();
+	double* pvx = vx.data(); double* pvy = vy.data(); double* pvz = vz.data();
+
+	// Branch free so the compiler vectorises it
+	for (size_t i = begin; i < end; i++) {
+		const double dx1 = p1.x - px[i], dy1 = p1.y - py[i], dz1 = p1.z - pz[i];
+		const double dx2 = p2.x - px[i], dy2 = p2.y - py[i], dz2 = p2.z - pz[i];
+
+		const double r2_1 = dx1 * dx1 + dy1 * dy1 + dz1 * dz1 + eps2;
+		const double r2_2 = dx2 * dx2 + dy2 * dy2 + dz2 * dz2 + eps2;
+
+		const double s1 = gm1 / (r2_1 * std::sqrt(r2_1));
+		const double s2 = gm2 / (r2_2 * std::sqrt(r2_2));
+
+		pvx[i] += dt * (s1 * dx1 + s2 * dx2);
+		pvy[i] += dt * (s1 * dy1 + s2 * dy2);
+		pvz[i] += dt * (s1 * dz1 + s2 * dz2);
+	}
+}
+
+void tracer_system::drift(size_t begin, size_t end, double dt) {
+	double* px = x.data(); double* py = y.data(); double* pz = z.data();
+	const double* pvx = vx.data(); const double* pvy = vy.data(); const double* pvz = vz.data();
+
+	for (size_t i = begin; i < end; i++) {
+		px[i] += dt * pvx[i];
+		py[i] += dt * pvy[i];
+		pz[i] += dt * pvz[i];
+	}
+}
+
+template <typename Fn>
+void tracer_system::parallelChunks(Fn&& fn) {
+	const size_t n = x.size();
+	const size_t min_chunk = 4096; // below this handing the chunk to another thread costs more than the particles
+	thread_pool& pool = thread_pool::shared();
+	const size_t chunks = (threads > 0) ? threads : pool.concurrency();
+	const size_t grain = std::max(min_chunk, (n + chunks - 1) / chunks); // at most one chunk per thread, each runs every substep of the step on its own
+
+	pool.parallel_for(0, n, grain, fn);
+}
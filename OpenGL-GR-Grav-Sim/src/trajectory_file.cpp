@@ -0,0 +1,594 @@
+#include <glm/glm.hpp>
+#include "trajectory_file.h"
+#include "byte_io.h"
+#include "crc32.h"
+#include "logger.h"
+#include "text_export.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <type_traits>
+
+namespace fs = std::filesystem;
+using namespace byte_io;
+
+// A sample is read and written as its 15 doubles in column order
+static_assert(std::is_standard_layout<trajectory_sample>::value && sizeof(trajectory_sample) == trajectory_columns * sizeof(double), "trajectory_sample must be its columns back to back");
+
+static const unsigned char file_magic[8] = { 'P', 'N', 'T', 'R', 'A', 'J', 0x1a, '\n' };
+static const std::uint32_t chunk_magic = 0x4B4E4843; // "CHNK"
+static const std::uint32_t index_magic = 0x58444954; // "TIDX"
+
+static const size_t file_header_size = 32;
+static const size_t chunk_header_size = 40;
+static const size_t offsets_size = trajectory_columns * 4;
+static const size_t index_entry_size = 40;
+static const size_t trailer_size = 16;
+
+static const std::chrono::milliseconds writer_period{ 50 }; // the writer drains this often when nobody schedules it
+
+// Bit streams
+// -------------------------------------------------------------------------------------------
+static int leadingZeros(std::uint64_t x) { // x != 0
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_clzll(x);
+#else
+	int n = 0;
+	while (!(x & (std::uint64_t{ 1 } << 63))) {
+		x <<= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+static int trailingZeros(std::uint64_t x) { // x != 0
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(x);
+#else
+	int n = 0;
+	while (!(x & 1)) {
+		x >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+class bit_writer { // Appends most significant bit first
+public:
+	explicit bit_writer(std::vector<unsigned char>& out) : out(out) {}
+
+	void put(std::uint64_t value, int bits) { // 1 to 64 bits
+		if (bits > 32) {
+			put(value >> 32, bits - 32);
+			put(value & 0xFFFFFFFFu, 32);
+			return;
+		}
+		acc = (acc << bits) | (value & ((std::uint64_t{ 1 } << bits) - 1));
+		used += bits;
+		while (used >= 8) {
+			used -= 8;
+			out.push_back(static_cast<unsigned char>(acc >> used));
+		}
+	}
+
+	void align() { // pads to the next byte, every column starts on one
+		if (used > 0) {
+			out.push_back(static_cast<unsigned char>(acc << (8 - used)));
+		}
+		acc = 0;
+		used = 0;
+	}
+
+private:
+	std::vector<unsigned char>& out;
+	std::uint64_t acc = 0; // only the low used bits are pending
+	int used = 0;
+};
+
+class bit_reader {
+public:
+	bit_reader(const unsigned char* data, size_t size) : data(data), bit_size(size * 8) {}
+
+	std::uint64_t get(int bits) { // 1 to 64 bits, zeros past the end (and overrun set)
+		std::uint64_t v = 0;
+		while (bits > 0) {
+			if (pos >= bit_size) {
+				overrun = true;
+				return 0;
+			}
+			const int offset = static_cast<int>(pos & 7);
+			const int avail = 8 - offset;
+			const int take = std::min(avail, bits);
+			const unsigned int byte = data[pos >> 3];
+			v = (v << take) | ((byte >> (avail - take)) & ((1u << take) - 1));
+			pos += take;
+			bits -= take;
+		}
+		return v;
+	}
+
+	bool overrun = false;
+
+private:
+	const unsigned char* data;
+	size_t bit_size;
+	size_t pos = 0;
+};
+
+// Gorilla XOR coding
+// -------------------------------------------------------------------------------------------
+static std::uint64_t bitsOf(double v) {
+	std::uint64_t b;
+	std::memcpy(&b, &v, sizeof(b));
+	return b;
+}
+
+static double doubleOf(std::uint64_t b) {
+	double v;
+	std::memcpy(&v, &b, sizeof(v));
+	return v;
+}
+
+static void encodeColumn(const double* values, size_t count, bit_writer& w) {
+	std::uint64_t prev = bitsOf(values[0]);
+	w.put(prev, 64);
+	int prev_lz = -1, prev_tz = 0; // window of the last meaningful bits, none yet
+
+	for (size_t i = 1; i < count; i++) {
+		const std::uint64_t cur = bitsOf(values[i]);
+		const std::uint64_t x = cur ^ prev;
+		prev = cur;
+		if (x == 0) {
+			w.put(0, 1); // unchanged
+			continue;
+		}
+		w.put(1, 1);
+		const int lz = std::min(leadingZeros(x), 31); // 5 bits
+		const int tz = trailingZeros(x);
+		if (prev_lz >= 0 && lz >= prev_lz && tz >= prev_tz) {
+			w.put(0, 1); // fits the previous window
+			w.put(x >> prev_tz, 64 - prev_lz - prev_tz);
+		}
+		else {
+			const int length = 64 - lz - tz;
+			w.put(1, 1);
+			w.put(static_cast<std::uint64_t>(lz), 5);
+			w.put(static_cast<std::uint64_t>(length - 1), 6);
+			w.put(x >> tz, length);
+			prev_lz = lz;
+			prev_tz = tz;
+		}
+	}
+	w.align();
+}
+
+// Decodes count values into out, stride doubles apart
+static bool decodeColumn(const unsigned char* data, size_t size, size_t count, double* out, size_t stride) {
+	bit_reader r(data, size);
+	std::uint64_t prev = r.get(64);
+	out[0] = doubleOf(prev);
+	int lz = 0, tz = 0;
+
+	for (size_t i = 1; i < count; i++) {
+		if (r.get(1)) {
+			if (r.get(1)) {
+				lz = static_cast<int>(r.get(5));
+				const int length = static_cast<int>(r.get(6)) + 1;
+				tz = 64 - lz - length;
+				if (tz < 0) {
+					return false;
+				}
+			}
+			prev ^= r.get(64 - lz - tz) << tz;
+		}
+		out[i * stride] = doubleOf(prev);
+	}
+	return !r.overrun;
+}
+
+// Writer
+// -------------------------------------------------------------------------------------------
+trajectory_writer::trajectory_writer(std::uint32_t chunk_rows, bool wait)
+	: chunk_rows(std::max<std::uint32_t>(chunk_rows, 2)), wait(wait), ring(std::make_unique<spsc_queue<trajectory_sample, ring_capacity>>()) {
+	for (std::vector<double>& column : columns) {
+		column.reserve(this->chunk_rows);
+	}
+}
+
+trajectory_writer::~trajectory_writer() {
+	close();
+}
+
+bool trajectory_writer::open(const std::string& path, bool append) {
+	close();
+	index.clear();
+	offset = 0;
+	rows_total = 0;
+	failed = false;
+	rows_written = rows_dropped = bytes_written = push_stalls = 0;
+
+	std::error_code ec;
+	if (append && fs::exists(path, ec)) {
+		trajectory_reader existing;
+		if (!existing.open(path)) {
+			return false;
+		}
+		index = existing.chunkIndex();
+		rows_total = existing.rows();
+		offset = existing.dataEnd();
+		existing.close();
+
+		fs::resize_file(path, offset, ec); // drops the old index and trailer (and a torn chunk), new chunks follow the last complete one
+		if (ec) {
+			logger::error(log_category::io, "Could not reopen {}: {}", path, ec.message());
+			return false;
+		}
+		file = std::fopen(path.c_str(), "ab");
+	}
+	else {
+		file = std::fopen(path.c_str(), "wb");
+		if (file) {
+			unsigned char header[file_header_size] = {};
+			std::memcpy(header, file_magic, sizeof(file_magic));
+			unsigned char* p = header + sizeof(file_magic);
+			p = putU32(p, trajectory_version);
+			p = putU32(p, trajectory_columns);
+			putU32(p, chunk_rows);
+			offset = 0;
+			writeBytes(header, sizeof(header));
+		}
+	}
+	if (!file || failed) {
+		logger::error(log_category::io, "Could not create {}", path);
+		if (file) {
+			std::fclose(file);
+			file = nullptr;
+		}
+		return false;
+	}
+
+	writer = std::make_unique<io_drain>([this] { drain(); }, writer_period);
+	return true;
+}
+
+bool trajectory_writer::close() {
+	if (!writer) {
+		return !failed;
+	}
+	writer.reset(); // waits for a pass in progress, the rest is written here
+	drain();
+	finish();
+	if (std::fclose(file) != 0) {
+		failed = true;
+	}
+	file = nullptr;
+	return !failed;
+}
+
+bool trajectory_writer::push(const trajectory_sample& sample) {
+	if (!writer) {
+		return false;
+	}
+	if (!ring->try_push(sample)) {
+		if (!wait) {
+			rows_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		push_stalls.fetch_add(1, std::memory_order_relaxed);
+		since_wake = 0;
+		writer->schedule(); // the whole ring is the writer's, it has to start on it now
+		std::unique_lock<std::mutex> lock(done_mtx);
+		done_cv.wait(lock, [this, &sample] { return ring->try_push(sample); });
+	}
+	if (++since_wake >= wake_interval) {
+		since_wake = 0;
+		writer->schedule();
+	}
+	return true;
+}
+
+void trajectory_writer::drain() {
+	trajectory_sample sample;
+	unsigned int popped = 0;
+	while (ring->try_pop(sample)) {
+		append(sample);
+		if (++popped % wake_interval == 0) {
+			notifyRoom();
+		}
+	}
+	notifyRoom();
+}
+
+void trajectory_writer::notifyRoom() {
+	{
+		std::lock_guard<std::mutex> lock(done_mtx); // after the pops, so a producer about to wait either sees the room or is woken
+	}
+	done_cv.notify_one();
+}
+
+void trajectory_writer::finish() {
+	flushChunk();
+
+	// Index and trailer
+	const std::uint64_t index_offset = offset;
+	unsigned char entry[index_entry_size];
+	for (const trajectory_chunk_info& c : index) {
+		unsigned char* p = entry;
+		p = putU64(p, c.offset);
+		p = putU64(p, c.first_row);
+		p = putU32(p, c.rows);
+		p = putU32(p, c.bytes);
+		p = putF64(p, c.t_first);
+		putF64(p, c.t_last);
+		writeBytes(entry, sizeof(entry));
+	}
+	unsigned char trailer[trailer_size];
+	unsigned char* p = putU64(trailer, index_offset);
+	p = putU32(p, static_cast<std::uint32_t>(index.size()));
+	putU32(p, index_magic);
+	writeBytes(trailer, sizeof(trailer));
+	if (std::fflush(file) != 0) {
+		failed = true;
+	}
+}
+
+void trajectory_writer::append(const trajectory_sample& sample) {
+	const double* values = reinterpret_cast<const double*>(&sample);
+	for (int c = 0; c < trajectory_columns; c++) {
+		columns[c].push_back(values[c]);
+	}
+	if (columns[0].size() >= chunk_rows) {
+		flushChunk();
+	}
+}
+
+void trajectory_writer::flushChunk() {
+	const size_t rows = columns[0].size();
+	if (rows == 0) {
+		return;
+	}
+
+	payload.clear();
+	std::uint32_t column_offsets[trajectory_columns];
+	bit_writer w(payload);
+	for (int c = 0; c < trajectory_columns; c++) {
+		column_offsets[c] = static_cast<std::uint32_t>(payload.size());
+		encodeColumn(columns[c].data(), rows, w);
+	}
+
+	unsigned char header[chunk_header_size + offsets_size];
+	unsigned char* p = putU32(header, chunk_magic);
+	p = putU32(p, static_cast<std::uint32_t>(rows));
+	p = putU32(p, static_cast<std::uint32_t>(payload.size()));
+	p = putU32(p, crc32(payload.data(), payload.size()));
+	p = putF64(p, columns[0].front());
+	p = putF64(p, columns[0].back());
+	p = putU64(p, rows_total);
+	for (int c = 0; c < trajectory_columns; c++) {
+		p = putU32(p, column_offsets[c]);
+	}
+
+	trajectory_chunk_info info;
+	info.offset = offset;
+	info.first_row = rows_total;
+	info.rows = static_cast<std::uint32_t>(rows);
+	info.bytes = static_cast<std::uint32_t>(sizeof(header) + payload.size());
+	info.t_first = columns[0].front();
+	info.t_last = columns[0].back();
+	index.push_back(info);
+
+	writeBytes(header, sizeof(header));
+	writeBytes(payload.data(), payload.size());
+
+	rows_total += rows;
+	rows_written.store(rows_total, std::memory_order_relaxed);
+	for (std::vector<double>& column : columns) {
+		column.clear();
+	}
+}
+
+void trajectory_writer::writeBytes(const void* data, size_t size) {
+	if (std::fwrite(data, 1, size, file) != size) {
+		failed = true;
+	}
+	offset += size;
+	bytes_written.fetch_add(size, std::memory_order_relaxed);
+}
+
+// Reader
+// -------------------------------------------------------------------------------------------
+bool trajectory_reader::open(const std::string& path) {
+	close();
+	if (!file.open(path)) {
+		logger::error(log_category::io, "Could not open {}", path);
+		return false;
+	}
+	const unsigned char* data = file.data();
+	const size_t size = file.size();
+	if (size < file_header_size || std::memcmp(data, file_magic, sizeof(file_magic)) != 0) {
+		logger::error(log_category::io, "{}: not a trajectory file", path);
+		close();
+		return false;
+	}
+	const unsigned char* p = data + sizeof(file_magic);
+	const std::uint32_t version = getU32(p);
+	columns = getU32(p);
+	if (version == 0 || version > trajectory_version || columns != trajectory_columns) {
+		logger::error(log_category::io, "{}: trajectory version {} with {} columns is not supported", path, version, columns);
+		close();
+		return false;
+	}
+
+	// The index, if the file was closed properly
+	bool indexed = false;
+	if (size >= file_header_size + trailer_size) {
+		p = data + size - trailer_size;
+		const std::uint64_t index_offset = getU64(p);
+		const std::uint32_t count = getU32(p);
+		const std::uint32_t magic = getU32(p);
+		if (magic == index_magic && index_offset >= file_header_size && index_offset + std::uint64_t{ count } * index_entry_size + trailer_size == size) {
+			p = data + index_offset;
+			index.resize(count);
+			indexed = true;
+			for (trajectory_chunk_info& c : index) {
+				c.offset = getU64(p);
+				c.first_row = getU64(p);
+				c.rows = getU32(p);
+				c.bytes = getU32(p);
+				c.t_first = getF64(p);
+				c.t_last = getF64(p);
+				indexed = indexed && c.offset + c.bytes <= index_offset;
+				total_rows += c.rows;
+			}
+		}
+	}
+	if (!indexed) {
+		index.clear();
+		total_rows = 0;
+		rebuilt = true;
+		rebuildIndex();
+		logger::warn(log_category::io, "{} was not closed properly, recovered {} chunks ({} rows)", path, index.size(), total_rows);
+	}
+	return true;
+}
+
+void trajectory_reader::close() {
+	file.close();
+	index.clear();
+	total_rows = 0;
+	columns = 0;
+	rebuilt = false;
+}
+
+std::uint64_t trajectory_reader::dataEnd() const {
+	return index.empty() ? file_header_size : index.back().offset + index.back().bytes;
+}
+
+bool trajectory_reader::rebuildIndex() { // Walks the chunks from the header, stopping at the first incomplete or damaged one
+	const unsigned char* data = file.data();
+	const size_t size = file.size();
+	size_t pos = file_header_size;
+	while (pos + chunk_header_size + offsets_size <= size) {
+		const unsigned char* p = data + pos;
+		if (getU32(p) != chunk_magic) {
+			break;
+		}
+		trajectory_chunk_info c;
+		c.offset = pos;
+		c.rows = getU32(p);
+		const std::uint32_t payload_size = getU32(p);
+		const std::uint32_t crc = getU32(p);
+		c.t_first = getF64(p);
+		c.t_last = getF64(p);
+		c.first_row = getU64(p);
+		c.bytes = static_cast<std::uint32_t>(chunk_header_size + offsets_size + payload_size);
+		if (pos + c.bytes > size || crc32(data + pos + chunk_header_size + offsets_size, payload_size) != crc) {
+			break;
+		}
+		index.push_back(c);
+		total_rows += c.rows;
+		pos += c.bytes;
+	}
+	return !index.empty();
+}
+
+bool trajectory_reader::view(size_t chunk, chunk_view& out) const {
+	if (chunk >= index.size()) {
+		return false;
+	}
+	const trajectory_chunk_info& c = index[chunk];
+	const unsigned char* p = file.data() + c.offset;
+	const std::uint32_t magic = getU32(p);
+	out.rows = getU32(p);
+	out.size = getU32(p);
+	const std::uint32_t crc = getU32(p);
+	p += 24; // times and first row, the index has them
+	for (int i = 0; i < trajectory_columns; i++) {
+		out.offsets[i] = getU32(p);
+	}
+	out.offsets[trajectory_columns] = out.size;
+	out.payload = p;
+
+	bool ok = magic == chunk_magic && out.rows == c.rows && chunk_header_size + offsets_size + out.size == c.bytes && out.rows > 0;
+	for (int i = 0; i < trajectory_columns && ok; i++) {
+		ok = out.offsets[i] < out.offsets[i + 1];
+	}
+	if (!ok || crc32(out.payload, out.size) != crc) {
+		logger::error(log_category::io, "Trajectory chunk {} is damaged", chunk);
+		return false;
+	}
+	return true;
+}
+
+bool trajectory_reader::readChunk(size_t chunk, std::vector<trajectory_sample>& out) const {
+	chunk_view v;
+	if (!view(chunk, v)) {
+		return false;
+	}
+	out.resize(v.rows);
+	double* base = reinterpret_cast<double*>(out.data());
+	for (int c = 0; c < trajectory_columns; c++) {
+		if (!decodeColumn(v.payload + v.offsets[c], v.offsets[c + 1] - v.offsets[c], v.rows, base + c, trajectory_columns)) {
+			logger::error(log_category::io, "Trajectory chunk {} column {} does not decode", chunk, c);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool trajectory_reader::readColumn(size_t chunk, int column, std::vector<double>& out) const {
+	chunk_view v;
+	if (column < 0 || column >= trajectory_columns || !view(chunk, v)) {
+		return false;
+	}
+	out.resize(v.rows);
+	return decodeColumn(v.payload + v.offsets[column], v.offsets[column + 1] - v.offsets[column], v.rows, out.data(), 1);
+}
+
+size_t trajectory_reader::findChunk(double t) const {
+	const auto it = std::upper_bound(index.begin(), index.end(), t, [](double value, const trajectory_chunk_info& c) { return value < c.t_first; });
+	return (it == index.begin()) ? 0 : static_cast<size_t>(it - index.begin()) - 1;
+}
+
+bool trajectory_reader::sampleAt(double t, trajectory_sample& out) const {
+	if (index.empty()) {
+		return false;
+	}
+	std::vector<trajectory_sample> rows;
+	if (!readChunk(findChunk(t), rows)) {
+		return false;
+	}
+	const auto it = std::upper_bound(rows.begin(), rows.end(), t, [](double value, const trajectory_sample& s) { return value < s.t; });
+	out = (it == rows.begin()) ? rows.front() : *(it - 1);
+	return true;
+}
+
+// CSV
+// -------------------------------------------------------------------------------------------
+bool trajectoryToCsv(const std::string& path, std::ostream& out) {
+	trajectory_reader reader;
+	if (!reader.open(path)) {
+		return false;
+	}
+	out << "t,x1,y1,z1,vx1,vy1,vz1,x2,y2,z2,vx2,vy2,vz2,m1,m2\n";
+
+	std::vector<trajectory_sample> rows;
+	std::vector<char> text;
+	for (size_t chunk = 0; chunk < reader.chunks(); chunk++) {
+		if (!reader.readChunk(chunk, rows)) {
+			return false;
+		}
+		text.resize(rows.size() * text_export::rowBytes(trajectory_columns)); // a chunk's text goes out in one write
+		char* end = text.data();
+		for (const trajectory_sample& s : rows) {
+			end = text_export::appendRow(end, reinterpret_cast<const double*>(&s), trajectory_columns);
+		}
+		out.write(text.data(), end - text.data());
+	}
+	return static_cast<bool>(out);
+}
@@ -0,0 +1,310 @@
+#include <glm/glm.hpp>
+#include "formulae.h"
+#include "integration.h"
+#include "kepler.h"
+#include "tuning.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <iterator>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+// Calibration Constants
+// -----------------------------------------------------------------------------------------
+static const double ladder[] = { 1e-4, 1e-5, 1e-6, 1e-7, 1e-8, 1e-9, 1e-10, 1e-11, 1e-12 }; // Candidate tolerances, loosest first
+static const double reference_tol = 1e-13; // Tolerance of the run every candidate is compared against
+static const int max_window_steps = 512; // Longer orbits are only sampled over part of the orbit, the drift is scaled up to a full one
+static const int unbound_window_steps = 64; // Window of an orbit without a period
+
+//Constructor
+tolerance_tuner::tolerance_tuner(double target_drift, double recheck_orbits, int step_budget)
+	: target_drift(target_drift), recheck_orbits(recheck_orbits), step_budget(step_budget) {}
+
+tolerance_tuner::~tolerance_tuner() {
+	cancel();
+}
+
+bool tolerance_tuner::update(const mathState& s, double physics_dt, RK45_integration& integrator) {
+	bool changed = false;
+	if (job_running) {
+		if (!job_done.load(std::memory_order_acquire)) {
+			return false; // one at a time, the current settings stand until it is in
+		}
+		changed = apply(integrator);
+	}
+
+	const std::uint64_t key = scenarioKey(s, physics_dt);
+
+	// New scenario (loaded, edited or evolved far enough to fall into another bucket)
+	// -------------------------------------------------------------------------------------
+	if (!has_choice || key != current_key) {
+		auto found = cache.find(key);
+		if (found == cache.end()) {
+			launch(s, physics_dt, key, false);
+			return changed;
+		}
+
+		choice = found->second;
+		current_key = key;
+		has_choice = true;
+		since_check = 0.0;
+		check_interval = recheck_orbits * std::max(orbitalPeriod(s), windowSteps(s, physics_dt) * physics_dt);
+
+		integrator.setTolerances(choice.atol, choice.rtol);
+		return true;
+	}
+
+	// Periodic verification
+	// -------------------------------------------------------------------------------------
+	since_check += physics_dt;
+	if (since_check >= check_interval) {
+		since_check = 0.0;
+		launch(s, physics_dt, key, true);
+	}
+	return changed;
+}
+
+void tolerance_tuner::launch(const mathState& s, double physics_dt, std::uint64_t key, bool verification) {
+	if (!job) {
+		job = std::make_unique<task_group>(thread_pool::shared());
+	}
+	job_running = true;
+	job_done.store(false, std::memory_order_relaxed);
+
+	const tolerance_choice current = choice;
+	job->run([this, s, physics_dt, key, verification, current] { // s is a copy, the physics thread carries on stepping its own
+		job_result r;
+		if (verification) {
+			r = verify(s, physics_dt, current);
+		}
+		else {
+			r.choice = calibrate(s, physics_dt);
+			r.changed = r.measured = true;
+		}
+		r.key = key;
+		r.verification = verification;
+		r.check_interval = recheck_orbits * std::max(orbitalPeriod(s), windowSteps(s, physics_dt) * physics_dt);
+		job_out = r;
+		job_done.store(true, std::memory_order_release);
+	});
+}
+
+bool tolerance_tuner::apply(RK45_integration& integrator) {
+	job->wait(); // already finished, only collects it
+	job_running = false;
+	const job_result& r = job_out;
+
+	if (r.changed && r.choice.calibrated) {
+		cache[r.key] = r.choice; // an unfinished calibration is retried at the next verification instead
+	}
+	if (!r.measured) {
+		return false; // too expensive to check right now, the current choice stands
+	}
+	if (!r.changed) {
+		if (r.key == current_key) {
+			choice.drift = r.choice.drift;
+		}
+		return false;
+	}
+
+	// Applied even if the scenario has moved on since, update looks the new one up straight after
+	choice = r.choice;
+	current_key = r.key;
+	has_choice = true;
+	since_check = 0.0;
+	check_interval = r.check_interval;
+
+	integrator.setTolerances(choice.atol, choice.rtol);
+	return true;
+}
+
+tolerance_tuner::job_result tolerance_tuner::verify(const mathState& s, double physics_dt, const tolerance_choice& current) const {
+	job_result r;
+	r.choice = current;
+
+	const int steps = windowSteps(s, physics_dt);
+	dmat43 reference;
+	tolerance_choice reference_settings{ reference_tol, reference_tol };
+	if (!run(s, steps, physics_dt, reference_settings, reference)) {
+		return r;
+	}
+	r.measured = true;
+
+	const double drift = measure(s, steps, physics_dt, current, reference);
+	const bool too_loose = !(drift <= target_drift);
+	const bool too_tight = !current.kepler && drift < 1e-3 * target_drift && current.rtol < ladder[0]; // paying for far more accuracy than asked for
+
+	if (!too_loose && !too_tight) {
+		r.choice.drift = drift;
+		return r;
+	}
+
+	r.choice = calibrate(s, physics_dt);
+	r.changed = true;
+	return r;
+}
+
+void tolerance_tuner::cancel() {
+	if (!job) {
+		return;
+	}
+	job->cancel(); // the trial runs notice within a step
+	try {
+		job->wait();
+	}
+	catch (...) {}
+	job.reset(); // a cancelled group stays cancelled, the next launch makes a new one
+	job_running = false;
+}
+
+tolerance_choice tolerance_tuner::calibrate(const mathState& s, double physics_dt) const {
+	const int steps = windowSteps(s, physics_dt);
+
+	tolerance_choice fallback; // Tightest candidate, used when nothing can be measured
+	fallback.atol = fallback.rtol = ladder[std::size(ladder) - 1];
+
+	dmat43 reference;
+	tolerance_choice reference_settings{ reference_tol, reference_tol };
+	if (!run(s, steps, physics_dt, reference_settings, reference)) {
+		return fallback;
+	}
+
+	// The Kepler propagation is the cheapest of all, but only exists for a bound orbit and drops the PN terms altogether, so they have to be below the target as well
+	if (orbitalPeriod(s) > 0.0 && PN_strength_bound(s.y, s.m1, s.m2) < target_drift) {
+		tolerance_choice candidate;
+		candidate.atol = candidate.rtol = ladder[0];
+		candidate.kepler = true;
+		candidate.drift = measure(s, steps, physics_dt, candidate, reference);
+		if (candidate.drift <= target_drift) {
+			candidate.calibrated = true;
+			return candidate;
+		}
+	}
+
+	tolerance_choice candidate;
+	for (double tol : ladder) {
+		candidate.atol = candidate.rtol = tol;
+		candidate.drift = measure(s, steps, physics_dt, candidate, reference);
+		if (candidate.drift <= target_drift) {
+			break;
+		}
+	}
+
+	candidate.calibrated = true; // the tightest candidate is kept even if it misses the target, it is the best on offer
+	return candidate;
+}
+
+void tolerance_tuner::setTarget(double drift) {
+	target_drift = drift;
+	reset();
+}
+
+void tolerance_tuner::reset() {
+	cancel(); // it was measuring against the old target
+	cache.clear();
+	has_choice = false;
+}
+
+std::uint64_t tolerance_tuner::scenarioKey(const mathState& s, double physics_dt) {
+	// Relative orbit invariants, these stay (nearly) constant along an orbit so every phase of the same orbit shares a key
+	dvec3 sep = s.y[0] - s.y[2];
+	dvec3 v_bold = s.y[1] - s.y[3];
+	const double mu = G * (s.m1 + s.m2);
+
+	const double energy = 0.5 * glm::dot(v_bold, v_bold) - mu / glm::length(sep); // specific orbital energy
+	const double h = glm::length(glm::cross(sep, v_bold)); // specific angular momentum
+
+	// Quantised to ~2% buckets on a log scale
+	auto quantise = [](double x) -> std::int64_t {
+		if (x == 0.0 || !std::isfinite(x)) {
+			return 0;
+		}
+		std::int64_t q = std::llround(std::log10(std::abs(x)) * 100.0);
+		return (x < 0.0) ? -(q + (1 << 20)) : (q + (1 << 20));
+	};
+
+	const std::int64_t values[] = { quantise(s.m1), quantise(s.m2), quantise(energy), quantise(h), quantise(physics_dt) };
+
+	// FNV-1a
+	std::uint64_t hash = 14695981039346656037ull;
+	for (std::int64_t v : values) {
+		for (int b = 0; b < 8; b++) {
+			hash ^= static_cast<std::uint64_t>((v >> (8 * b)) & 0xff);
+			hash *= 1099511628211ull;
+		}
+	}
+	return hash;
+}
+
+double tolerance_tuner::orbitalPeriod(const mathState& s) {
+	dvec3 sep = s.y[0] - s.y[2];
+	dvec3 v_bold = s.y[1] - s.y[3];
+	const double mu = G * (s.m1 + s.m2);
+
+	const double energy = 0.5 * glm::dot(v_bold, v_bold) - mu / glm::length(sep);
+	if (!(energy < 0.0)) {
+		return 0.0;
+	}
+
+	const double a = -mu / (2.0 * energy); // semi-major axis
+	return 2.0 * PI * std::sqrt((a * a * a) / mu);
+}
+
+int tolerance_tuner::windowSteps(const mathState& s, double physics_dt) const {
+	const double period = orbitalPeriod(s);
+	if (period <= 0.0) {
+		return unbound_window_steps;
+	}
+	return std::clamp(static_cast<int>(std::ceil(period / physics_dt)), 1, max_window_steps);
+}
+
+bool tolerance_tuner::run(const mathState& s, int steps, double physics_dt, const tolerance_choice& settings, dmat43& out) const {
+	RK45_integration trial(settings.atol, settings.rtol, physics_dt); // A fresh integrator, the live one keeps its timestep
+	trial.setNewtonian(settings.kepler);
+
+	mathState current = s;
+	int substeps = 0;
+
+	for (int i = 0; i < steps; i++) {
+		integrate_result result = trial.step(current, physics_dt);
+		substeps += result.count;
+		if (result.crash_f || substeps > step_budget || abandoned()) {
+			return false;
+		}
+		current.y = result.state_y;
+	}
+
+	out = current.y;
+	return true;
+}
+
+double tolerance_tuner::measure(const mathState& s, int steps, double physics_dt, const tolerance_choice& settings, const dmat43& reference) const {
+	dmat43 y;
+	if (!run(s, steps, physics_dt, settings, y)) {
+		return std::numeric_limits<double>::infinity();
+	}
+
+	const double E_ref = orbital_energy(reference[0], reference[2], reference[1], reference[3], s.m1, s.m2);
+	const dvec3 L_ref = orbital_angular_momentum(reference[0], reference[2], reference[1], reference[3], s.m1, s.m2);
+	const double E = orbital_energy(y[0], y[2], y[1], y[3], s.m1, s.m2);
+	const dvec3 L = orbital_angular_momentum(y[0], y[2], y[1], y[3], s.m1, s.m2);
+
+	double drift = 0.0;
+	if (E_ref != 0.0) {
+		drift = std::max(drift, std::abs(E - E_ref) / std::abs(E_ref));
+	}
+	if (glm::length(L_ref) > 0.0) {
+		drift = std::max(drift, glm::length(L - L_ref) / glm::length(L_ref)); // a radial orbit has no angular momentum to drift
+	}
+
+	// Per orbit, the drift of a partial (or multiple) orbit window is scaled linearly
+	const double period = orbitalPeriod(s);
+	if (period > 0.0) {
+		drift *= period / (steps * physics_dt);
+	}
+
+	return std::isfinite(drift) ? drift : std::numeric_limits<double>::infinity();
+}
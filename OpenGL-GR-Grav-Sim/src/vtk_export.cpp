@@ -0,0 +1,313 @@
+#include <glm/glm.hpp>
+#include "vtk_export.h"
+#include "byte_io.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+static const std::chrono::milliseconds writer_period{ 50 }; // the writer drains this often when nobody schedules it
+
+static const char* byte_order = BYTE_IO_LITTLE_ENDIAN ? "LittleEndian" : "BigEndian";
+static const char pvd_trailer[] = "  </Collection>\n</VTKFile>\n";
+
+// Appends printf style text to out
+template <typename... Args>
+static void appendf(std::string& out, const char* format, Args... args) {
+	char line[512];
+	const int n = std::snprintf(line, sizeof(line), format, args...);
+	out.append(line, static_cast<size_t>(std::clamp(n, 0, static_cast<int>(sizeof(line)) - 1)));
+}
+
+// Writer
+// -------------------------------------------------------------------------------------------
+vtk_writer::vtk_writer(const vtk_options& options)
+	: options(options), free_frames(std::make_unique<spsc_queue<std::uint32_t, max_frames>>()), ready_frames(std::make_unique<spsc_queue<std::uint32_t, max_frames>>()) {
+	this->options.every = std::max(this->options.every, 1);
+	this->options.frames = std::clamp<size_t>(this->options.frames, 2, max_frames);
+	pool.resize(this->options.frames);
+	for (frame& f : pool) { // the two body case never grows them
+		f.points.reserve(6);
+		f.velocity.reserve(6);
+		f.acceleration.reserve(6);
+		f.mass.reserve(2);
+	}
+}
+
+vtk_writer::~vtk_writer() {
+	close();
+}
+
+bool vtk_writer::open(const std::string& path_prefix, const std::vector<std::string>& fields, bool append) {
+	close();
+	prefix = path_prefix;
+	pvd_path = prefix + ".pvd";
+	base_name = fs::path(prefix).filename().string();
+	field_names = fields;
+	next_index = 0;
+	failed = false;
+	since_export = 0;
+	ready_since_wake = 0;
+	frames_written = frames_dropped = bytes_written = 0;
+
+	std::uint32_t index = 0;
+	while (ready_frames->try_pop(index)) {
+	}
+	while (free_frames->try_pop(index)) {
+	}
+	for (std::uint32_t i = 0; i < pool.size(); i++) {
+		pool[i].fields.assign(field_names.size(), 0.0);
+		free_frames->try_push(i);
+	}
+
+	std::error_code ec;
+	if (append && fs::exists(pvd_path, ec)) { // carries on after the last entry, numbering the frames on from it
+		std::ifstream in(pvd_path, std::ios::binary);
+		std::stringstream text;
+		text << in.rdbuf();
+		const std::string existing = text.str();
+		const size_t end = existing.rfind("</Collection>");
+		if (end == std::string::npos) {
+			logger::error(log_category::io, "{} is not a ParaView series", pvd_path);
+			return false;
+		}
+		for (size_t at = existing.find("<DataSet"); at != std::string::npos && at < end; at = existing.find("<DataSet", at + 1)) {
+			next_index++;
+		}
+		const size_t line_start = existing.find_last_not_of(' ', end - 1) + 1;
+		fs::resize_file(pvd_path, line_start, ec);
+		pvd = ec ? nullptr : std::fopen(pvd_path.c_str(), "r+b");
+		if (pvd && std::fseek(pvd, 0, SEEK_END) != 0) {
+			std::fclose(pvd);
+			pvd = nullptr;
+		}
+	}
+	else {
+		pvd = std::fopen(pvd_path.c_str(), "wb");
+		if (pvd) {
+			std::fprintf(pvd, "<?xml version=\"1.0\"?>\n<VTKFile type=\"Collection\" version=\"0.1\" byte_order=\"%s\">\n  <Collection>\n", byte_order);
+		}
+	}
+	if (!pvd || !appendToSeries(0.0, std::string{})) { // writes the trailer, so the file is complete before the first frame
+		logger::error(log_category::io, "Could not create {}", pvd_path);
+		if (pvd) {
+			std::fclose(pvd);
+			pvd = nullptr;
+		}
+		return false;
+	}
+
+	writer = std::make_unique<io_drain>([this] { run(); }, writer_period);
+	return true;
+}
+
+bool vtk_writer::close() {
+	if (!writer) {
+		return !failed;
+	}
+	writer->wait(); // a pass started now takes everything pushed before the close
+	writer.reset();
+	if (std::fclose(pvd) != 0) {
+		failed = true;
+	}
+	pvd = nullptr;
+	return !failed;
+}
+
+// Producer
+// -------------------------------------------------------------------------------------------
+vtk_writer::frame* vtk_writer::claim(double t, size_t n, const double* fields, std::uint32_t& index) {
+	if (!writer) {
+		return nullptr;
+	}
+	if (since_export++ % options.every != 0) {
+		return nullptr;
+	}
+	if (!free_frames->try_pop(index)) {
+		if (!options.wait) {
+			frames_dropped.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		writer->schedule(); // every ready frame is the writer's, it has to start on them now
+		std::unique_lock<std::mutex> lock(done_mtx);
+		done_cv.wait(lock, [this, &index] { return free_frames->try_pop(index); });
+	}
+	frame& f = pool[index];
+	f.t = t;
+	f.n = n;
+	f.points.resize(3 * n); // capacity is kept, these only allocate the first time a frame sees more bodies
+	f.velocity.resize(3 * n);
+	f.acceleration.resize(3 * n);
+	f.mass.resize(n);
+	for (size_t k = 0; k < f.fields.size(); k++) {
+		f.fields[k] = fields ? fields[k] : 0.0;
+	}
+	return &f;
+}
+
+void vtk_writer::commit(std::uint32_t index) {
+	ready_frames->try_push(index); // cannot fail, there are never more frames than slots
+	if (++ready_since_wake >= pool.size() / 2) { // the writer polls, it is only scheduled early when half the pool is waiting
+		ready_since_wake = 0;
+		writer->schedule();
+	}
+}
+
+bool vtk_writer::push(double t, const dmat43& y, const dmat43& dydt, double m1, double m2, const double* fields) {
+	std::uint32_t index = 0;
+	frame* f = claim(t, 2, fields, index);
+	if (!f) {
+		return false;
+	}
+	for (int body = 0; body < 2; body++) { // rows: position, velocity of body 1, then body 2; dydt holds velocity, acceleration
+		for (int k = 0; k < 3; k++) {
+			f->points[3 * body + k] = y[2 * body][k];
+			f->velocity[3 * body + k] = y[2 * body + 1][k];
+			f->acceleration[3 * body + k] = dydt[2 * body + 1][k];
+		}
+	}
+	f->mass[0] = m1;
+	f->mass[1] = m2;
+	commit(index);
+	return true;
+}
+
+bool vtk_writer::push(double t, const body_soa& bodies, const double* fields) {
+	std::uint32_t index = 0;
+	const size_t n = bodies.size();
+	frame* f = claim(t, n, fields, index);
+	if (!f) {
+		return false;
+	}
+	for (size_t i = 0; i < n; i++) {
+		f->points[3 * i] = bodies.x[i];
+		f->points[3 * i + 1] = bodies.y[i];
+		f->points[3 * i + 2] = bodies.z[i];
+		f->velocity[3 * i] = bodies.vx[i];
+		f->velocity[3 * i + 1] = bodies.vy[i];
+		f->velocity[3 * i + 2] = bodies.vz[i];
+		f->acceleration[3 * i] = bodies.ax[i];
+		f->acceleration[3 * i + 1] = bodies.ay[i];
+		f->acceleration[3 * i + 2] = bodies.az[i];
+	}
+	std::copy(bodies.m.begin(), bodies.m.end(), f->mass.begin());
+	commit(index);
+	return true;
+}
+
+// Writer
+// -------------------------------------------------------------------------------------------
+void vtk_writer::run() {
+	std::uint32_t index = 0;
+	while (ready_frames->try_pop(index)) {
+		writeFrame(pool[index]);
+		{
+			std::lock_guard<std::mutex> lock(done_mtx); // under the lock, so a producer about to wait cannot miss it
+			free_frames->try_push(index);
+		}
+		done_cv.notify_one();
+	}
+}
+
+void vtk_writer::writeFrame(const frame& f) {
+	char number[32];
+	std::snprintf(number, sizeof(number), "_%06llu.vtp", static_cast<unsigned long long>(next_index));
+	const std::string file_name = base_name + number;
+	const std::string path = prefix + number;
+
+	const std::uint64_t n = f.n;
+	if (vertex_ids.size() < n + 1) {
+		const size_t old = vertex_ids.size();
+		vertex_ids.resize(n + 1);
+		for (size_t i = old; i < vertex_ids.size(); i++) {
+			vertex_ids[i] = static_cast<std::int64_t>(i);
+		}
+	}
+
+	// Appended blocks in order: points, velocity, acceleration, mass, connectivity, offsets, each a u64 byte count then the values
+	struct block {
+		const void* data;
+		std::uint64_t bytes;
+	};
+	const block blocks[] = {
+		{ f.points.data(), 24 * n }, { f.velocity.data(), 24 * n }, { f.acceleration.data(), 24 * n },
+		{ f.mass.data(), 8 * n }, { vertex_ids.data(), 8 * n }, { vertex_ids.data() + 1, 8 * n }
+	};
+	std::uint64_t offsets[6];
+	std::uint64_t at = 0;
+	for (int b = 0; b < 6; b++) {
+		offsets[b] = at;
+		at += 8 + blocks[b].bytes;
+	}
+
+	xml.clear();
+	appendf(xml, "<?xml version=\"1.0\"?>\n<VTKFile type=\"PolyData\" version=\"1.0\" byte_order=\"%s\" header_type=\"UInt64\">\n  <PolyData>\n", byte_order);
+	xml += "    <FieldData>\n";
+	appendf(xml, "      <DataArray type=\"Float64\" Name=\"TimeValue\" NumberOfTuples=\"1\" format=\"ascii\">%.17g</DataArray>\n", f.t);
+	for (size_t k = 0; k < field_names.size(); k++) {
+		appendf(xml, "      <DataArray type=\"Float64\" Name=\"%s\" NumberOfTuples=\"1\" format=\"ascii\">%.17g</DataArray>\n", field_names[k].c_str(), f.fields[k]);
+	}
+	xml += "    </FieldData>\n";
+	appendf(xml, "    <Piece NumberOfPoints=\"%llu\" NumberOfVerts=\"%llu\" NumberOfLines=\"0\" NumberOfStrips=\"0\" NumberOfPolys=\"0\">\n",
+		static_cast<unsigned long long>(n), static_cast<unsigned long long>(n));
+	xml += "      <PointData Vectors=\"velocity\" Scalars=\"mass\">\n";
+	const char* point_arrays[] = { "velocity", "acceleration" };
+	for (int b = 0; b < 2; b++) {
+		appendf(xml, "        <DataArray type=\"Float64\" Name=\"%s\" NumberOfComponents=\"3\" format=\"appended\" offset=\"%llu\"/>\n",
+			point_arrays[b], static_cast<unsigned long long>(offsets[b + 1]));
+	}
+	appendf(xml, "        <DataArray type=\"Float64\" Name=\"mass\" format=\"appended\" offset=\"%llu\"/>\n", static_cast<unsigned long long>(offsets[3]));
+	xml += "      </PointData>\n      <Points>\n";
+	appendf(xml, "        <DataArray type=\"Float64\" Name=\"position\" NumberOfComponents=\"3\" format=\"appended\" offset=\"%llu\"/>\n", static_cast<unsigned long long>(offsets[0]));
+	xml += "      </Points>\n      <Verts>\n"; // one vertex cell per body, so ParaView draws the points without a glyph filter
+	appendf(xml, "        <DataArray type=\"Int64\" Name=\"connectivity\" format=\"appended\" offset=\"%llu\"/>\n", static_cast<unsigned long long>(offsets[4]));
+	appendf(xml, "        <DataArray type=\"Int64\" Name=\"offsets\" format=\"appended\" offset=\"%llu\"/>\n", static_cast<unsigned long long>(offsets[5]));
+	xml += "      </Verts>\n    </Piece>\n  </PolyData>\n  <AppendedData encoding=\"raw\">\n   _";
+
+	std::FILE* file = std::fopen(path.c_str(), "wb");
+	bool ok = file && std::fwrite(xml.data(), 1, xml.size(), file) == xml.size();
+	for (const block& b : blocks) {
+		ok = ok && std::fwrite(&b.bytes, sizeof(b.bytes), 1, file) == 1; // host order, as the header says
+		ok = ok && (b.bytes == 0 || std::fwrite(b.data, 1, static_cast<size_t>(b.bytes), file) == b.bytes);
+	}
+	static const char tail[] = "\n  </AppendedData>\n</VTKFile>\n";
+	ok = ok && std::fwrite(tail, 1, sizeof(tail) - 1, file) == sizeof(tail) - 1;
+	if (file && std::fclose(file) != 0) {
+		ok = false;
+	}
+	if (!ok) {
+		if (!failed) {
+			logger::error(log_category::io, "Could not write {}", path);
+		}
+		failed = true;
+		return;
+	}
+
+	if (!appendToSeries(f.t, file_name)) {
+		failed = true;
+		return;
+	}
+	next_index++;
+	bytes_written.fetch_add(xml.size() + at + sizeof(tail) - 1, std::memory_order_relaxed);
+	frames_written.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Adds an entry (none for an empty file_name) where the trailer starts and writes the trailer after it
+bool vtk_writer::appendToSeries(double t, const std::string& file_name) {
+	if (!file_name.empty()) {
+		std::fprintf(pvd, "    <DataSet timestep=\"%.17g\" part=\"0\" file=\"%s\"/>\n", t, file_name.c_str());
+	}
+	const long entries_end = std::ftell(pvd);
+	const bool ok = entries_end >= 0 && std::fwrite(pvd_trailer, 1, sizeof(pvd_trailer) - 1, pvd) == sizeof(pvd_trailer) - 1
+		&& std::fflush(pvd) == 0 && std::fseek(pvd, entries_end, SEEK_SET) == 0; // the next entry overwrites the trailer
+	if (!ok) {
+		logger::error(log_category::io, "Could not write {}", pvd_path);
+	}
+	return ok;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#ifndef HEADLESS_RUNNER_H_INCLUDED
+#define HEADLESS_RUNNER_H_INCLUDED
+
+#include <glm/glm.hpp>
+#include "integration.h"
+#include "restart.h"
+#include "trajectory_file.h"
+#include "ephemeris.h"
+#include "flight_recorder.h"
+#include "scenario_db.h"
+#include "vtk_export.h"
+#include "text_export.h"
+#include "nbody.h"
+#include "snapshot_import.h"
+
+#include <atomic>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <limits>
+
+using dvec3 = glm::dvec3;
+using dmat43 = glm::mat<4, 3, double>;
+
+struct run_config {
+	std::string scenario = "earth_sun"; // built in name, a scenario file or a name in the scenario store
+	std::string scenarios; // scenario store names are looked up in, empty for none
+	bool newtonian = false; // integrator: false for the adaptive RK45 PN integrator, true for the exact Kepler propagator
+	double atol = 1e-8;
+	double rtol = 1e-10;
+	double initial_dt = 0.05;
+
+	double until = std::numeric_limits<double>::infinity(); // simulated years to stop at, runs until a signal otherwise
+	double sample_dt = 0.01; // simulated years between samples
+	int output_every = 1; // samples between rows written to the output files
+	double max_wall = std::numeric_limits<double>::infinity(); // seconds of wall time to stop after
+
+	std::string output; // prefix of <output>_states.csv and <output>_diagnostics.csv (only the diagnostics for an N body run), empty for none
+	std::string trajectory; // compressed trajectory file every sample is recorded to, empty for none
+	std::string ephemeris; // Chebyshev ephemeris of this run written at the end, empty for none
+	std::string vtk; // prefix of a ParaView series (<vtk>.pvd and its .vtp frames), empty for none
+	int vtk_every = 1; // samples between frames, the run waits for the disk rather than drop one
+	double ephemeris_tol = 1e-8; // largest position error of the ephemeris (AU)
+	std::string flight; // flight recorder ring of the last substeps, dumped if the run crashes, empty for none
+	size_t flight_records = 65536; // substeps the ring holds
+	std::string checkpoint; // file the checkpoints are written to, empty for none
+	double checkpoint_every = 600.0; // seconds of wall time between periodic checkpoints
+	std::string resume; // checkpoint to carry on from, empty to start from the scenario
+
+	std::string bodies; // N body snapshot integrated instead of the two body scenario, from t = 0, empty for none
+	import_options bodies_import; // its format and units
+	double pn_threshold = 1e-9; // Gm/(rc^2) above which a pair of the bodies gets the PN terms
+};
+
+struct run_report {
+	double wall_s = 0.0;
+	double simulated = 0.0; // years integrated by this run (not counting what a resumed checkpoint had done)
+	std::uint64_t samples = 0;
+	std::uint64_t substeps = 0;
+	std::uint64_t rejects = 0;
+	std::uint64_t checkpoints = 0;
+	std::uint64_t trajectory_bytes = 0; // size of the trajectory file
+	std::uint64_t trajectory_dropped = 0; // samples the trajectory writer could not keep up with
+	std::uint64_t vtk_frames = 0;
+	std::uint64_t vtk_dropped = 0; // frames the VTK writer could not keep up with
+	std::uint64_t ephemeris_segments = 0;
+	std::uint64_t ephemeris_bytes = 0;
+	double ephemeris_error = 0.0; // largest position error of the fit (AU)
+	double energy_drift = 0.0; // relative, end of the run against its start
+	double momentum_drift = 0.0;
+	bool crashed = false;
+	bool interrupted = false; // stopped by a signal or the wall time limit before reaching until
+};
+
+// Runs one simulation without a window, as fast as the integrator goes
+// The only state shared with signal handlers is the two request flags, so a handler never does more than store to an atomic
+class headless_runner {
+public:
+	explicit headless_runner(const run_config& config);
+
+	bool setup(); // Loads the scenario, the checkpoint or the N body snapshot and opens the outputs, false (logged) if either failed
+	run_report run();
+
+	// Signal safe, from a handler or another thread
+	static void requestStop() { stop_request.store(true, std::memory_order_relaxed); } // checkpoints and finishes after the current sample
+	static void requestCheckpoint() { checkpoint_request.store(true, std::memory_order_relaxed); } // checkpoints after the current sample and carries on
+
+	// Built in name, a file of "key = values" lines, or failing both a name in the scenario store at store
+	static bool loadScenario(const std::string& name, mathState& out, const std::string& store = "");
+
+private:
+	run_config config;
+	RK45_integration integrator;
+	restart_state current; // checkpoints are restart snapshots, steps counts the samples taken
+	csv_writer states, diagnostics;
+	trajectory_writer trajectory;
+	vtk_writer vtk;
+	ephemeris_builder ephemeris_fit;
+	flight_recorder recorder;
+	body_soa bodies; // an N body run's bodies, current.s is unused then
+	nbody_integrator nbody;
+
+	static std::atomic<bool> stop_request;
+	static std::atomic<bool> checkpoint_request;
+
+	run_report runBodies();
+	integrate_result stepFitting(double dt); // One sample a substep at a time, every substep is an ephemeris knot
+	bool saveCheckpoint(run_report& report);
+	void writeBodiesSample(const engine_result& result, double wall);
+	void writeSample(double energy, double momentum, double avg_h, std::uint64_t substeps, std::uint64_t rejects, double wall);
+};
+
+#endif
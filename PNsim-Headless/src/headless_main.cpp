@@ -0,0 +1,280 @@
+#include "logger.h"
+#include "headless_runner.h"
+#include "snapshot_import.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+// PNsim headless runner
+// -------------------------------------------------------------------------------------------
+// The simulation without a window, OpenGL or ImGui, for machines with no GPU
+//
+//   pnsim-headless --scenario earth_sun --until 1000 --output run1 --checkpoint run1.ckpt
+//
+// SIGINT / SIGTERM checkpoint and stop after the current sample, SIGUSR1 (where there is one) checkpoints and carries on
+// Exits 0 when the run finished, 1 if it could not start, 2 on a crash, 3 when stopped early and 4 if samples or frames were lost on the way to disk
+// A run is carried on with --resume run1.ckpt, which appends to the outputs of the run it came from
+// pnsim-headless --convert run1.traj run1.csv writes a recorded trajectory out as CSV, --convert-flight does the same for a flight recorder dump
+// --add-scenario and --list-scenarios fill and search the scenario store the window's Presets menu shows
+// --import reads an N-body snapshot and reports what it holds, to check a file (and the units it is read in) before running it with --bodies
+
+extern "C" void onStopSignal(int) {
+	headless_runner::requestStop(); // a lock free atomic store, nothing else is safe in here
+}
+
+#ifdef SIGUSR1
+extern "C" void onCheckpointSignal(int) {
+	headless_runner::requestCheckpoint();
+	flight_recorder::dumpActive(flight_status::requested); // raw writes of the mapped ring, also signal safe
+}
+#endif
+
+static void printUsage() {
+	std::printf(
+		"usage: pnsim-headless [options]\n"
+		"  --scenario <name|file>   earth_sun (default), a scenario file or a name in the --scenarios store\n"
+		"  --scenarios <store>      scenario store to look names up in (pnsim.scenarios is the window's)\n"
+		"  --resume <file>          carries on from a checkpoint instead, with its tolerances and integrator\n"
+		"  --integrator <rk45|kepler>\n"
+		"  --atol <x> --rtol <x>    RK45 tolerances (1e-8, 1e-10)\n"
+		"  --until <years>          simulated time to stop at (runs until a signal otherwise)\n"
+		"  --sample <years>         simulated time between samples (0.01)\n"
+		"  --every <n>              samples between output rows (1)\n"
+		"  --max-wall <seconds>     wall time limit\n"
+		"  --output <prefix>        writes <prefix>_states.csv and <prefix>_diagnostics.csv\n"
+		"  --trajectory <file>      records every sample to a compressed trajectory file\n"
+		"  --ephemeris <file>       fits a Chebyshev ephemeris of the run\n"
+		"  --ephemeris-tol <AU>     its largest position error (1e-8)\n"
+		"  --vtk <prefix>           ParaView series <prefix>.pvd with a .vtp frame per --vtk-every samples\n"
+		"  --vtk-every <n>          samples between frames (1)\n"
+		"  --flight <file>          flight recorder of the last substeps, dumped to <file>.dump on a crash or SIGUSR1\n"
+		"  --flight-records <n>     substeps it holds (65536)\n"
+		"  --checkpoint <file>      binary restart snapshot written at checkpoints\n"
+		"  --checkpoint-every <s>   wall seconds between checkpoints (600)\n"
+		"  --bodies <snapshot>      integrates the bodies of an N-body snapshot instead of a scenario, from t = 0\n"
+		"                           (--output writes only <prefix>_diagnostics.csv, --vtk a frame of every body)\n"
+		"  --bodies-format <fmt>    gadget1, gadget2, csv, table or table32 (from the file otherwise)\n"
+		"  --pn-threshold <x>       Gm/(rc^2) above which a pair of bodies gets the PN terms (1e-9)\n"
+		"  --log <file>             also writes the log to a file\n"
+		"  --verbose                debug logging\n"
+		"       pnsim-headless --convert <trajectory> <csv>\n"
+		"       pnsim-headless --convert-flight <flight recording> <csv>\n"
+		"       pnsim-headless --add-scenario <store> <name> <scenario file> [tags]\n"
+		"       pnsim-headless --list-scenarios <store> [search]\n"
+		"       pnsim-headless --import <snapshot> [gadget1|gadget2|csv|table|table32]\n");
+}
+
+static bool parseFormat(const std::string& format, import_options& options) {
+	if (format == "gadget1") { options.format = snapshot_format::gadget1; }
+	else if (format == "gadget2") { options.format = snapshot_format::gadget2; }
+	else if (format == "csv") { options.format = snapshot_format::csv; }
+	else if (format == "table" || format == "table32") { options.format = snapshot_format::table; options.table_f32 = (format == "table32"); }
+	else if (!format.empty()) {
+		return false;
+	}
+	return true;
+}
+
+static bool parseArgs(int argc, char** argv, run_config& config, logger_options& log) {
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		auto value = [&]() -> const char* {
+			if (i + 1 >= argc) {
+				std::fprintf(stderr, "%s needs a value\n", arg.c_str());
+				return nullptr;
+			}
+			return argv[++i];
+		};
+		auto number = [&](double& out) {
+			const char* v = value();
+			char* end = nullptr;
+			if (v) {
+				out = std::strtod(v, &end);
+			}
+			return v && end && *end == '\0';
+		};
+
+		bool ok = true;
+		if (arg == "--scenario") { const char* v = value(); ok = v; if (v) config.scenario = v; }
+		else if (arg == "--scenarios") { const char* v = value(); ok = v; if (v) config.scenarios = v; }
+		else if (arg == "--resume") { const char* v = value(); ok = v; if (v) config.resume = v; }
+		else if (arg == "--integrator") {
+			const char* v = value();
+			ok = v && (std::strcmp(v, "rk45") == 0 || std::strcmp(v, "kepler") == 0);
+			config.newtonian = ok && std::strcmp(v, "kepler") == 0;
+		}
+		else if (arg == "--atol") { ok = number(config.atol); }
+		else if (arg == "--rtol") { ok = number(config.rtol); }
+		else if (arg == "--until") { ok = number(config.until); }
+		else if (arg == "--sample") { ok = number(config.sample_dt) && config.sample_dt > 0.0; }
+		else if (arg == "--every") { double n = 1; ok = number(n) && n >= 1; config.output_every = static_cast<int>(n); }
+		else if (arg == "--max-wall") { ok = number(config.max_wall); }
+		else if (arg == "--output") { const char* v = value(); ok = v; if (v) config.output = v; }
+		else if (arg == "--trajectory") { const char* v = value(); ok = v; if (v) config.trajectory = v; }
+		else if (arg == "--ephemeris") { const char* v = value(); ok = v; if (v) config.ephemeris = v; }
+		else if (arg == "--ephemeris-tol") { ok = number(config.ephemeris_tol) && config.ephemeris_tol > 0.0; }
+		else if (arg == "--vtk") { const char* v = value(); ok = v; if (v) config.vtk = v; }
+		else if (arg == "--vtk-every") { double n = 1; ok = number(n) && n >= 1; config.vtk_every = static_cast<int>(n); }
+		else if (arg == "--flight") { const char* v = value(); ok = v; if (v) config.flight = v; }
+		else if (arg == "--flight-records") { double n = 0; ok = number(n) && n >= 1; config.flight_records = static_cast<size_t>(n); }
+		else if (arg == "--checkpoint") { const char* v = value(); ok = v; if (v) config.checkpoint = v; }
+		else if (arg == "--checkpoint-every") { ok = number(config.checkpoint_every); }
+		else if (arg == "--bodies") { const char* v = value(); ok = v; if (v) config.bodies = v; }
+		else if (arg == "--bodies-format") { const char* v = value(); ok = v && parseFormat(v, config.bodies_import); }
+		else if (arg == "--pn-threshold") { ok = number(config.pn_threshold) && config.pn_threshold > 0.0; }
+		else if (arg == "--log") { const char* v = value(); ok = v; if (v) log.text_path = v; }
+		else if (arg == "--verbose") { log.level = log_level::debug; }
+		else { ok = false; }
+
+		if (!ok) {
+			std::fprintf(stderr, "bad argument %s\n", arg.c_str());
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	run_config config;
+	logger_options log;
+	if (argc > 1 && (std::strcmp(argv[1], "--help") == 0 || std::strcmp(argv[1], "-h") == 0)) {
+		printUsage();
+		return 0;
+	}
+	if (argc == 4 && std::strcmp(argv[1], "--convert") == 0) {
+		std::ofstream csv(argv[3]);
+		const bool ok = csv && trajectoryToCsv(argv[2], csv);
+		logger::shutdown();
+		if (!ok) {
+			std::fprintf(stderr, "could not convert %s to %s\n", argv[2], argv[3]);
+		}
+		return ok ? 0 : 1;
+	}
+	if (argc == 4 && std::strcmp(argv[1], "--convert-flight") == 0) {
+		std::ofstream csv(argv[3]);
+		const bool ok = csv && flightRecordingToCsv(argv[2], csv);
+		logger::shutdown();
+		if (!ok) {
+			std::fprintf(stderr, "could not convert %s to %s\n", argv[2], argv[3]);
+		}
+		return ok ? 0 : 1;
+	}
+	if ((argc == 5 || argc == 6) && std::strcmp(argv[1], "--add-scenario") == 0) {
+		scenario s;
+		mathState loaded;
+		bool ok = headless_runner::loadScenario(argv[4], loaded);
+		s.name = argv[3];
+		s.tags = (argc == 6) ? argv[5] : "";
+		s.y = loaded.y;
+		s.m1 = loaded.m1;
+		s.m2 = loaded.m2;
+		scenario_db db;
+		ok = ok && db.open(argv[2]) && db.put(s);
+		logger::shutdown();
+		if (!ok) {
+			std::fprintf(stderr, "could not add %s to %s\n", argv[4], argv[2]);
+		}
+		return ok ? 0 : 1;
+	}
+	if ((argc == 3 || argc == 4) && std::strcmp(argv[1], "--list-scenarios") == 0) {
+		scenario_db db;
+		const bool ok = db.open(argv[2]);
+		if (ok) {
+			for (scenario_id i : db.search((argc == 4) ? argv[3] : "")) {
+				std::printf("%s\t%s\n", db.name(i).c_str(), db.tags(i).c_str());
+			}
+		}
+		logger::shutdown();
+		return ok ? 0 : 1;
+	}
+	if ((argc == 3 || argc == 4) && std::strcmp(argv[1], "--import") == 0) {
+		import_options options;
+		if (!parseFormat((argc == 4) ? argv[3] : "", options)) {
+			printUsage();
+			return 1;
+		}
+
+		body_soa bodies;
+		import_report report;
+		const bool ok = importSnapshot(argv[2], bodies, options, &report);
+		if (ok) {
+			double mass = 0.0;
+			dvec3 centre{ 0.0 }, momentum{ 0.0 }, low{ std::numeric_limits<double>::infinity() }, high{ -std::numeric_limits<double>::infinity() };
+			for (size_t i = 0; i < bodies.size(); i++) {
+				mass += bodies.m[i];
+				centre += bodies.m[i] * bodies.getPos(i);
+				momentum += bodies.m[i] * bodies.getVel(i);
+				low = glm::min(low, bodies.getPos(i));
+				high = glm::max(high, bodies.getPos(i));
+			}
+			if (mass > 0.0) {
+				centre /= mass;
+			}
+			std::printf("%s, %zu bodies in %zu file(s), t = %.17g, read in %.3f s\n", formatName(report.format), report.bodies, report.files, report.time, report.seconds);
+			std::printf("total mass %.17g Msun\ncentre of mass %.17g %.17g %.17g AU\nmomentum %.17g %.17g %.17g Msun AU/yr\n",
+				mass, centre.x, centre.y, centre.z, momentum.x, momentum.y, momentum.z);
+			std::printf("bounds %.17g %.17g %.17g .. %.17g %.17g %.17g AU\n", low.x, low.y, low.z, high.x, high.y, high.z);
+		}
+		logger::shutdown();
+		return ok ? 0 : 1;
+	}
+	if (!parseArgs(argc, argv, config, log)) {
+		printUsage();
+		return 1;
+	}
+	logger::configure(log);
+	logger::nameThread("runner");
+
+	flight_recorder::installSignalHandlers(); // first, so the runner's own SIGUSR1 handler below replaces the recorder's
+	std::signal(SIGINT, onStopSignal);
+	std::signal(SIGTERM, onStopSignal);
+#ifdef SIGUSR1
+	std::signal(SIGUSR1, onCheckpointSignal);
+#endif
+
+	headless_runner runner(config);
+	if (!runner.setup()) {
+		logger::shutdown();
+		return 1;
+	}
+
+	const run_report report = runner.run();
+
+	// Throughput report
+	const double wall = (report.wall_s > 0.0) ? report.wall_s : 1e-9;
+	logger::info(log_category::general, "{} yr simulated in {} s of wall time, {} yr/s", report.simulated, report.wall_s, report.simulated / wall);
+	logger::info(log_category::general, "{} samples, {} substeps ({} per second, {} ns each), {} rejected",
+		report.samples, report.substeps, report.substeps / wall, 1e9 * wall / std::max<std::uint64_t>(report.substeps, 1), report.rejects);
+	logger::info(log_category::general, "relative drift: energy {} angular momentum {}", report.energy_drift, report.momentum_drift);
+	logger::info(log_category::general, "{} checkpoints written{}", report.checkpoints, report.interrupted ? ", stopped early" : "");
+	if (!config.trajectory.empty()) {
+		logger::info(log_category::general, "trajectory: {} bytes ({} per sample), {} samples dropped", report.trajectory_bytes,
+			static_cast<double>(report.trajectory_bytes) / std::max<std::uint64_t>(report.samples, 1), report.trajectory_dropped);
+	}
+	if (!config.vtk.empty()) {
+		logger::info(log_category::general, "ParaView series: {} frames, {} dropped", report.vtk_frames, report.vtk_dropped);
+	}
+	if (!config.ephemeris.empty()) {
+		const double raw = static_cast<double>(report.samples) * 6 * sizeof(double); // both positions at every sample
+		logger::info(log_category::general, "ephemeris: {} segments, {} bytes ({}x smaller than the sampled positions), largest error {} AU",
+			report.ephemeris_segments, report.ephemeris_bytes, raw / std::max<std::uint64_t>(report.ephemeris_bytes, 1), report.ephemeris_error);
+	}
+	const bool lost = report.trajectory_dropped > 0 || report.vtk_dropped > 0; // the writers wait in a headless run, so this is a bug rather than a slow disk
+	if (lost) {
+		logger::error(log_category::io, "{} trajectory samples and {} ParaView frames were lost", report.trajectory_dropped, report.vtk_dropped);
+	}
+	logger::shutdown();
+
+	if (report.crashed) {
+		return 2;
+	}
+	if (report.interrupted) {
+		return 3;
+	}
+	return lost ? 4 : 0;
+}
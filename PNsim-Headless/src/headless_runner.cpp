@@ -0,0 +1,462 @@
+#include <glm/glm.hpp>
+#include "formulae.h"
+#include "logger.h"
+#include "headless_runner.h"
+
+#include <chrono>
+#include <sstream>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+static_assert(std::atomic<bool>::is_always_lock_free, "the signal flags must be lock free to be set from a handler");
+
+std::atomic<bool> headless_runner::stop_request{ false };
+std::atomic<bool> headless_runner::checkpoint_request{ false };
+
+static double momentumOf(const mathState& s) {
+	return glm::length(orbital_angular_momentum(s.y[0], s.y[2], s.y[1], s.y[3], s.m1, s.m2));
+}
+
+static double energyOf(const mathState& s) {
+	return orbital_energy(s.y[0], s.y[2], s.y[1], s.y[3], s.m1, s.m2);
+}
+
+static double energyOf(const body_soa& b) { // Newtonian, every pair once
+	double energy = 0.0;
+	for (size_t i = 0; i < b.size(); i++) {
+		energy += 0.5 * b.m[i] * glm::dot(b.getVel(i), b.getVel(i));
+		for (size_t j = i + 1; j < b.size(); j++) {
+			energy -= G * b.m[i] * b.m[j] / glm::distance(b.getPos(i), b.getPos(j));
+		}
+	}
+	return energy;
+}
+
+static double momentumOf(const body_soa& b) {
+	dvec3 l{ 0.0 };
+	for (size_t i = 0; i < b.size(); i++) {
+		l += b.m[i] * glm::cross(b.getPos(i), b.getVel(i));
+	}
+	return glm::length(l);
+}
+
+// Time of the kth sample after t0, worked out afresh every sample rather than summed, so rounding cannot build up into a sample just short
+// of the next one. A time within a millionth of a sample of until is until
+static double sampleTime(const run_config& config, double t0, std::uint64_t k) {
+	const double t = t0 + static_cast<double>(k) * config.sample_dt;
+	return (config.until - t <= 1e-6 * config.sample_dt) ? config.until : t;
+}
+
+static double relativeDrift(double now, double start) {
+	return (start != 0.0) ? std::abs((now - start) / start) : std::abs(now - start);
+}
+
+//Constructor
+headless_runner::headless_runner(const run_config& config)
+	: config(config), integrator(config.atol, config.rtol, config.initial_dt), trajectory(4096, true), vtk(vtk_options{ config.vtk_every, 8, true }), ephemeris_fit(ephemeris_options{ config.ephemeris_tol }),
+	recorder(config.flight_records),
+	nbody(config.atol, config.rtol, config.initial_dt, hybrid_force(config.pn_threshold, 1.5, std::numeric_limits<double>::infinity(), 10)) {
+	integrator.setNewtonian(config.newtonian);
+}
+
+// Setup
+// -------------------------------------------------------------------------------------------
+bool headless_runner::setup() {
+	if (!config.bodies.empty()) {
+		if (!config.resume.empty() || !config.checkpoint.empty() || !config.trajectory.empty() || !config.ephemeris.empty() || !config.flight.empty()) {
+			logger::error(log_category::io, "An N body run (--bodies) has no checkpoints, trajectory, ephemeris or flight recorder, only --output and --vtk");
+			return false;
+		}
+		if (!importSnapshot(config.bodies, bodies, config.bodies_import)) {
+			return false;
+		}
+		if (bodies.size() < 2) {
+			logger::error(log_category::io, "{} holds {} bodies, an N body run needs at least 2", config.bodies, bodies.size());
+			return false;
+		}
+		current.s.physics_time = 0.0;
+		current.energy0 = energyOf(bodies);
+		current.momentum0 = momentumOf(bodies);
+		logger::info(log_category::io, "{} bodies from {}, PN threshold {}", bodies.size(), config.bodies, config.pn_threshold);
+
+		if (!config.output.empty() && !diagnostics.open(config.output + "_diagnostics.csv",
+			"t,energy,energy_drift,momentum_drift,avg_h,substeps,rejects,pn_pairs,near_pairs,far_pairs,wall_s")) {
+			return false;
+		}
+		if (!config.vtk.empty() && !vtk.open(config.vtk, { "energy", "energy_drift", "momentum_drift", "substeps", "rejects", "pn_pairs" })) {
+			return false;
+		}
+		return true;
+	}
+
+	if (!config.resume.empty()) {
+		if (!readRestart(config.resume, current)) {
+			return false;
+		}
+		integrator.setTolerances(current.atol, current.rtol); // the run carries on with the settings it was started with
+		integrator.setNewtonian(current.newtonian);
+		integrator.setTimestep(current.timestep);
+		if (current.dydt_valid) {
+			integrator.seedDerivative(current.s, current.dydt); // the first step carries on exactly as it would have without the restart
+		}
+		logger::info(log_category::io, "Resuming {} at t = {} yr", config.resume, current.s.physics_time);
+	}
+	else {
+		if (!loadScenario(config.scenario, current.s, config.scenarios)) {
+			logger::error(log_category::io, "Unknown scenario {}", config.scenario);
+			return false;
+		}
+		current.atol = config.atol;
+		current.rtol = config.rtol;
+		current.timestep = config.initial_dt;
+		current.newtonian = config.newtonian;
+		current.energy0 = energyOf(current.s);
+		current.momentum0 = momentumOf(current.s);
+	}
+
+	if (!config.output.empty()) {
+		const bool append = !config.resume.empty(); // a resumed run carries on the files of the run it came from
+		if (!states.open(config.output + "_states.csv", "t,x1,y1,z1,vx1,vy1,vz1,x2,y2,z2,vx2,vy2,vz2,m1,m2", append)
+			|| !diagnostics.open(config.output + "_diagnostics.csv", "t,energy,energy_drift,momentum_drift,avg_h,substeps,rejects,wall_s", append)) {
+			logger::error(log_category::io, "Could not open the outputs {}_*.csv", config.output);
+			return false;
+		}
+	}
+	if (!config.trajectory.empty() && !trajectory.open(config.trajectory, !config.resume.empty())) {
+		return false;
+	}
+	if (!config.vtk.empty() && !vtk.open(config.vtk, { "energy", "energy_drift", "momentum_drift", "substeps", "rejects" }, !config.resume.empty())) {
+		return false;
+	}
+	if (!config.flight.empty()) {
+		if (!recorder.open(config.flight)) {
+			return false;
+		}
+		integrator.setRecorder(&recorder);
+	}
+	return true;
+}
+
+// Run
+// -------------------------------------------------------------------------------------------
+// The ephemeris is fitted to the quintic Hermite through its knots, which only holds its tolerance with knots about a substep apart
+// (a quarter orbit between samples needed 70 times the file size of the positions themselves), so a fitted sample is taken in slices
+// of at most the integrator's next substep, the same steps the whole sample would have taken, and each slice adds its state
+integrate_result headless_runner::stepFitting(double dt) {
+	mathState s = current.s;
+	integrate_result total(s.y, 0, 0, 0, 0.0, false);
+	double h_sum = 0.0;
+	double remaining = dt;
+	while (remaining > 0.0) {
+		const integrate_result slice = integrator.step(s, std::min(remaining, integrator.getTimestep()), 1); // the Kepler path ignores the substep limit, the slice length bounds it
+		total.count += slice.count;
+		total.accepts += slice.accepts;
+		total.rejects += slice.rejects;
+		h_sum += slice.avg_h * slice.accepts;
+		total.state_y = slice.state_y;
+		total.dydt = slice.dydt;
+		if (slice.crash_f) {
+			total.crash_f = true;
+			break;
+		}
+
+		s.y = slice.state_y;
+		s.physics_time += slice.covered;
+		if (slice.covered >= remaining) { // the last slice, its state is added by the caller with the sample
+			total.covered = dt;
+			break;
+		}
+		total.covered += slice.covered;
+		remaining -= slice.covered;
+		ephemeris_fit.add(s.physics_time, s.y, slice.dydt, s.m1, s.m2);
+	}
+	total.avg_h = (total.accepts > 0) ? h_sum / total.accepts : 0.0;
+	return total;
+}
+
+run_report headless_runner::run() {
+	if (!config.bodies.empty()) {
+		return runBodies();
+	}
+
+	using clock = std::chrono::steady_clock;
+	run_report report;
+
+	const clock::time_point start = clock::now();
+	clock::time_point last_checkpoint = start;
+	const double t0 = current.s.physics_time;
+
+	const bool fitting = !config.ephemeris.empty();
+	if (fitting) { // the ephemeris covers this run, from the state it started at
+		ephemeris_fit.add(current.s.physics_time, current.s.y, RK45_integration::derivatives(current.s.y, current.s.m1, current.s.m2), current.s.m1, current.s.m2);
+	}
+
+	std::uint64_t window_substeps = 0, window_rejects = 0; // since the last row written
+	double window_h = 0.0;
+	int window_steps = 0;
+
+	for (std::uint64_t k = 1; current.s.physics_time < config.until; k++) {
+		const double target = sampleTime(config, t0, k);
+		const double dt = target - current.s.physics_time;
+		integrate_result result = fitting ? stepFitting(dt) : integrator.step(current.s, dt);
+
+		report.substeps += result.count;
+		report.rejects += result.rejects;
+		window_substeps += result.count;
+		window_rejects += result.rejects;
+		window_h += result.avg_h;
+		window_steps++;
+
+		if (result.crash_f) {
+			report.crashed = true;
+			logger::error(log_category::integrator, "Integration failed at t = {} yr, the last good state is kept", current.s.physics_time);
+			break;
+		}
+
+		current.s.y = result.state_y;
+		current.s.physics_time = target; // the step covers all of dt, the grid's time rather than the sum of the substeps
+		current.dydt = result.dydt;
+		current.dydt_valid = true;
+		current.steps++;
+		report.samples++;
+		trajectory.push(current.s.physics_time, current.s.y, current.s.m1, current.s.m2); // waits for the disk rather than lose a sample
+		if (vtk.isOpen()) {
+			const double energy = energyOf(current.s);
+			const double fields[] = { energy, relativeDrift(energy, current.energy0), relativeDrift(momentumOf(current.s), current.momentum0),
+				static_cast<double>(result.count), static_cast<double>(result.rejects) };
+			vtk.push(current.s.physics_time, current.s.y, result.dydt, current.s.m1, current.s.m2, fields); // as does this
+		}
+		if (fitting) {
+			ephemeris_fit.add(current.s.physics_time, current.s.y, result.dydt, current.s.m1, current.s.m2);
+		}
+
+		const double wall = std::chrono::duration<double>(clock::now() - start).count();
+		if (current.steps % config.output_every == 0 && states.isOpen()) {
+			writeSample(energyOf(current.s), momentumOf(current.s), window_h / window_steps, window_substeps, window_rejects, wall);
+			window_substeps = window_rejects = 0;
+			window_h = 0.0;
+			window_steps = 0;
+		}
+
+		const bool stopping = stop_request.load(std::memory_order_relaxed) || wall >= config.max_wall;
+		const bool periodic = std::chrono::duration<double>(clock::now() - last_checkpoint).count() >= config.checkpoint_every;
+		if (checkpoint_request.exchange(false, std::memory_order_relaxed) || periodic || stopping) {
+			saveCheckpoint(report);
+			last_checkpoint = clock::now();
+		}
+		if (stopping) {
+			report.interrupted = true;
+			break;
+		}
+	}
+
+	report.wall_s = std::chrono::duration<double>(clock::now() - start).count();
+	report.simulated = current.s.physics_time - t0;
+	report.energy_drift = relativeDrift(energyOf(current.s), current.energy0);
+	report.momentum_drift = relativeDrift(momentumOf(current.s), current.momentum0);
+
+	if (!report.interrupted && !report.crashed && !config.checkpoint.empty()) {
+		saveCheckpoint(report); // the finished state, so a longer run can carry on from it
+	}
+	const bool outputs_written = states.close() & diagnostics.close(); // both, even after a failure
+	if (!outputs_written) {
+		logger::error(log_category::io, "Could not write the outputs {}_*.csv", config.output);
+	}
+	if (trajectory.isOpen()) {
+		if (!trajectory.close()) {
+			logger::error(log_category::io, "Could not write the trajectory {}", config.trajectory);
+		}
+		report.trajectory_bytes = trajectory.bytes();
+		report.trajectory_dropped = trajectory.dropped();
+	}
+	if (vtk.isOpen()) {
+		if (!vtk.close()) {
+			logger::error(log_category::io, "Could not write the ParaView series {}", config.vtk);
+		}
+		report.vtk_frames = vtk.written();
+		report.vtk_dropped = vtk.dropped();
+	}
+	if (fitting) {
+		ephemeris_fit.finish();
+		if (ephemeris_fit.write(config.ephemeris)) {
+			report.ephemeris_segments = ephemeris_fit.segments();
+			report.ephemeris_bytes = ephemeris_fit.fileSize();
+			report.ephemeris_error = ephemeris_fit.maxError();
+		}
+		if (ephemeris_fit.forced() > 0) {
+			logger::warn(log_category::io, "{} ephemeris segments could not meet the tolerance at the shortest span", ephemeris_fit.forced());
+		}
+	}
+	return report;
+}
+
+// Each sample is one nbody_integrator step, which logs its substeps and how many pairs it treated at each level
+run_report headless_runner::runBodies() {
+	using clock = std::chrono::steady_clock;
+	run_report report;
+	const clock::time_point start = clock::now();
+	const double t0 = current.s.physics_time;
+
+	for (std::uint64_t k = 1; current.s.physics_time < config.until; k++) {
+		const double target = sampleTime(config, t0, k);
+		const engine_result result = nbody.step(bodies, target - current.s.physics_time);
+		report.substeps += result.count;
+		report.rejects += result.rejects;
+		if (result.crash_f) {
+			report.crashed = true;
+			logger::error(log_category::integrator, "Integration failed at t = {} yr, the last good state is kept", current.s.physics_time);
+			break;
+		}
+		current.s.physics_time = target;
+		current.steps++;
+		report.samples++;
+
+		const double wall = std::chrono::duration<double>(clock::now() - start).count();
+		writeBodiesSample(result, wall);
+		if (stop_request.load(std::memory_order_relaxed) || wall >= config.max_wall) {
+			report.interrupted = true;
+			break;
+		}
+	}
+
+	report.wall_s = std::chrono::duration<double>(clock::now() - start).count();
+	report.simulated = current.s.physics_time;
+	report.energy_drift = relativeDrift(energyOf(bodies), current.energy0);
+	report.momentum_drift = relativeDrift(momentumOf(bodies), current.momentum0);
+	logger::info(log_category::integrator, "{} force evaluations, neighbour list rebuilt {} times", nbody.evaluations(), nbody.rebuilds());
+
+	if (!diagnostics.close()) {
+		logger::error(log_category::io, "Could not write the output {}_diagnostics.csv", config.output);
+	}
+	if (vtk.isOpen()) {
+		if (!vtk.close()) {
+			logger::error(log_category::io, "Could not write the ParaView series {}", config.vtk);
+		}
+		report.vtk_frames = vtk.written();
+		report.vtk_dropped = vtk.dropped();
+	}
+	return report;
+}
+
+// The energy is a sum over every pair, so it is only worked out for a sample that is written
+void headless_runner::writeBodiesSample(const engine_result& result, double wall) {
+	const bool row = diagnostics.isOpen() && current.steps % config.output_every == 0;
+	const bool frame = vtk.isOpen() && (current.steps - 1) % config.vtk_every == 0; // the push the writer keeps, it skips the others itself
+	if (!row && !frame) {
+		if (vtk.isOpen()) {
+			vtk.push(current.s.physics_time, bodies); // counted towards vtk_every, not exported
+		}
+		return;
+	}
+	const force_stats& pairs = nbody.lastForce();
+	const double energy = energyOf(bodies);
+	const double energy_drift = relativeDrift(energy, current.energy0);
+	const double momentum_drift = relativeDrift(momentumOf(bodies), current.momentum0);
+	if (row) {
+		const double values[11] = { current.s.physics_time, energy, energy_drift, momentum_drift, result.avg_h, static_cast<double>(result.count),
+			static_cast<double>(result.rejects), static_cast<double>(pairs.pn_pairs), static_cast<double>(pairs.near_pairs), static_cast<double>(pairs.far_pairs), wall };
+		diagnostics.push(values);
+	}
+	if (vtk.isOpen()) {
+		const double fields[] = { energy, energy_drift, momentum_drift, static_cast<double>(result.count), static_cast<double>(result.rejects),
+			static_cast<double>(pairs.pn_pairs) };
+		vtk.push(current.s.physics_time, bodies, fields);
+	}
+}
+
+bool headless_runner::saveCheckpoint(run_report& report) {
+	if (config.checkpoint.empty()) {
+		return false;
+	}
+	current.timestep = integrator.getTimestep();
+	if (!writeRestart(config.checkpoint, current)) {
+		return false;
+	}
+	if (states.isOpen()) { // the outputs are complete up to the checkpoint, so a resume appends to them seamlessly
+		states.flush();
+		diagnostics.flush();
+	}
+	report.checkpoints++;
+	logger::info(log_category::io, "Checkpoint at t = {} yr", current.s.physics_time);
+	return true;
+}
+
+void headless_runner::writeSample(double energy, double momentum, double avg_h, std::uint64_t substeps, std::uint64_t rejects, double wall) {
+	const mathState& s = current.s;
+	double row[15];
+	row[0] = s.physics_time;
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 3; j++) {
+			row[1 + 3 * i + j] = s.y[i][j];
+		}
+	}
+	row[13] = s.m1;
+	row[14] = s.m2;
+	states.push(row);
+
+	const double diagnostic[8] = { s.physics_time, energy, relativeDrift(energy, current.energy0), relativeDrift(momentum, current.momentum0),
+		avg_h, static_cast<double>(substeps), static_cast<double>(rejects), wall };
+	diagnostics.push(diagnostic);
+}
+
+// Scenarios
+// -------------------------------------------------------------------------------------------
+bool headless_runner::loadScenario(const std::string& name, mathState& out, const std::string& store) {
+	out = mathState{ dmat43{ 0.0 }, 0.0, 0.0, 0.0 };
+
+	if (name == "earth_sun") { // the window's default state
+		out.y[2] = dvec3{ 1.0, 0.0, 0.0 };
+		out.y[3] = dvec3{ 0.0, 2.0 * PI, 0.0 };
+		out.m1 = 1.0;
+		out.m2 = 3.003e-6;
+		return true;
+	}
+
+	// A scenario file: one "key = values" line per field, keys pos1 vel1 pos2 vel2 (three values) and m1 m2 t (one), # starts a comment
+	std::ifstream file(name);
+	if (!file) {
+		scenario_db db;
+		scenario s;
+		if (store.empty() || !db.open(store) || !db.load(name, s)) { // one lookup through the index, the rest of the store is never read
+			return false;
+		}
+		out.y = s.y;
+		out.m1 = s.m1;
+		out.m2 = s.m2;
+		logger::info(log_category::io, "Scenario {} from {}", name, store);
+		return out.m1 > 0.0 && out.m2 > 0.0;
+	}
+	std::string line;
+	int found = 0;
+	while (std::getline(file, line)) {
+		line = line.substr(0, line.find('#'));
+		const size_t eq = line.find('=');
+		if (eq == std::string::npos) {
+			continue;
+		}
+		std::istringstream key_in(line.substr(0, eq)), values(line.substr(eq + 1));
+		std::string key;
+		key_in >> key;
+
+		const char* vectors[] = { "pos1", "vel1", "pos2", "vel2" };
+		bool known = false;
+		for (int i = 0; i < 4; i++) {
+			if (key == vectors[i]) {
+				values >> out.y[i].x >> out.y[i].y >> out.y[i].z;
+				known = true;
+				found++;
+			}
+		}
+		if (key == "m1") { values >> out.m1; known = true; found++; }
+		else if (key == "m2") { values >> out.m2; known = true; found++; }
+		else if (key == "t") { values >> out.physics_time; known = true; }
+
+		if (!known || values.fail()) {
+			logger::error(log_category::io, "{}: could not read the line \"{}\"", name, line);
+			return false;
+		}
+	}
+	return found == 6 && out.m1 > 0.0 && out.m2 > 0.0;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#ifndef TEST_HARNESS_H_INCLUDED
+#define TEST_HARNESS_H_INCLUDED
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Test harness
+// -------------------------------------------------------------------------------------------
+// Each test file registers its cases with PNSIM_TEST, test_main runs them all (or the ones whose name holds its argument)
+// A failed check is printed with its file and line and the case carries on, so one run reports every failure
+//
+//   PNSIM_TEST(kepler_matches_rk45) {
+//       CHECK(kepler_propagate(y, m1, m2, dt));
+//       CHECK_NEAR(x, expected, 1e-9);
+//   }
+
+namespace tests {
+	using test_fn = void (*)();
+
+	struct test_case {
+		const char* name;
+		test_fn fn;
+	};
+
+	std::vector<test_case>& registry();
+	void fail(const char* file, int line, const std::string& what); // counts a failed check against the running case
+
+	struct registrar {
+		registrar(const char* name, test_fn fn) { registry().push_back(test_case{ name, fn }); }
+	};
+
+	std::string tempPath(const std::string& name); // a fresh path in the system's temporary directory, removed first if it exists
+}
+
+#define PNSIM_TEST(name) \
+	static void name(); \
+	static const tests::registrar name##_registrar(#name, name); \
+	static void name()
+
+#define CHECK(cond) \
+	do { if (!(cond)) { tests::fail(__FILE__, __LINE__, #cond); } } while (0)
+
+#define CHECK_NEAR(a, b, tol) \
+	do { \
+		const double check_a = (a), check_b = (b); \
+		if (!(std::abs(check_a - check_b) <= (tol))) { \
+			tests::fail(__FILE__, __LINE__, std::string(#a " ~ " #b ": ") + std::to_string(check_a) + " vs " + std::to_string(check_b)); \
+		} \
+	} while (0)
+
+#endif
@@ -0,0 +1,90 @@
+#include "test_harness.h"
+#include "kepler.h"
+#include "formulae.h"
+#include "integration.h"
+#include "rk45_engine.h"
+
+#include <glm/glm.hpp>
+
+// The analytic Kepler propagation against the RK45 engine integrating the same Newtonian system at tight tolerances
+
+static dmat43 eccentricOrbit(double m1, double m2) {
+	// Relative orbit with a = 1 AU and e = 0.5, started at pericentre, about the centre of mass
+	const double a = 1.0, e = 0.5;
+	const double rp = a * (1.0 - e);
+	const double vp = std::sqrt(G * (m1 + m2) * (1.0 + e) / rp);
+	const double m = m1 + m2;
+	dmat43 y{ 0.0 };
+	y[0] = dvec3(rp * m2 / m, 0.0, 0.0);
+	y[1] = dvec3(0.0, vp * m2 / m, 0.1 * vp * m2 / m);
+	y[2] = dvec3(-rp * m1 / m, 0.0, 0.0);
+	y[3] = dvec3(0.0, -vp * m1 / m, -0.1 * vp * m1 / m);
+	return y;
+}
+
+static void newtonian(const dmat43& y, dmat43& dydt, double m1, double m2) {
+	const dvec3 sep = y[0] - y[2];
+	const double r = glm::length(sep);
+	dvec3 a_rel = -G * (m1 + m2) / (r * r * r) * sep;
+	dvec3 a1, a2;
+	resolve_rel_accel(a_rel, a1, a2, m1, m2);
+	dydt[0] = y[1];
+	dydt[1] = a1;
+	dydt[2] = y[3];
+	dydt[3] = a2;
+}
+
+static double largestDifference(const dmat43& a, const dmat43& b) {
+	double worst = 0.0;
+	for (int col = 0; col < 4; col++) {
+		for (int row = 0; row < 3; row++) {
+			worst = std::max(worst, std::abs(a[col][row] - b[col][row]));
+		}
+	}
+	return worst;
+}
+
+PNSIM_TEST(kepler_matches_rk45) {
+	const double m1 = 1.0, m2 = 0.3;
+	const double dts[] = { 0.013, 0.37, 1.0, 2.71 }; // within an orbit, about one, several
+	for (double dt : dts) {
+		dmat43 kepler = eccentricOrbit(m1, m2);
+		CHECK(kepler_propagate(kepler, m1, m2, dt));
+
+		dmat43 rk = eccentricOrbit(m1, m2);
+		dormand_prince<dmat43> engine(1e-13, 1e-13, 1e-4);
+		const engine_result r = engine.integrate(rk, dt, [m1, m2](const dmat43& y, dmat43& dydt) { newtonian(y, dydt, m1, m2); });
+		CHECK(!r.crash_f);
+		CHECK_NEAR(r.covered, dt, 1e-12);
+		CHECK(largestDifference(kepler, rk) < 1e-8);
+	}
+}
+
+PNSIM_TEST(kepler_round_trip) {
+	const double m1 = 1.0, m2 = 3e-6;
+	const dmat43 start = eccentricOrbit(m1, m2);
+	dmat43 y = start;
+	CHECK(kepler_propagate(y, m1, m2, 12.345));
+	CHECK(largestDifference(y, start) > 1e-3); // it did move
+	CHECK(kepler_propagate(y, m1, m2, -12.345));
+	CHECK(largestDifference(y, start) < 1e-10);
+}
+
+PNSIM_TEST(kepler_path_of_the_integrator) {
+	// A light, wide pair has negligible PN terms, so the integrator takes the Kepler path, which must land where the propagation does
+	const double m1 = 1e-4, m2 = 1e-6;
+	mathState s{ eccentricOrbit(m1, m2), m1, m2, 0.0 };
+	s.y *= 100.0; // a hundred times wider at a tenth of the speed, the same orbit scaled
+	s.y[1] /= 1000.0;
+	s.y[3] /= 1000.0;
+	CHECK(PN_strength_bound(s.y, m1, m2) < pn_negligible);
+
+	dmat43 expected = s.y;
+	CHECK(kepler_propagate(expected, m1, m2, 50.0));
+
+	RK45_integration integrator(1e-10, 1e-10, 0.01);
+	const integrate_result r = integrator.step(s, 50.0);
+	CHECK(!r.crash_f);
+	CHECK(r.covered == 50.0);
+	CHECK(largestDifference(r.state_y, expected) == 0.0);
+}
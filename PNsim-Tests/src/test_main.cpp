@@ -0,0 +1,60 @@
+#include "test_harness.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+// PNsim tests
+// -------------------------------------------------------------------------------------------
+//   pnsim-tests [filter]    runs every case whose name contains filter (all of them without one)
+// Exits 0 when every check passed, 1 otherwise
+
+namespace fs = std::filesystem;
+
+static const char* running = nullptr;
+static int failed_checks = 0;
+
+std::vector<tests::test_case>& tests::registry() {
+	static std::vector<test_case> cases; // filled by the static registrars, before main
+	return cases;
+}
+
+void tests::fail(const char* file, int line, const std::string& what) {
+	failed_checks++;
+	std::printf("  %s:%d: %s failed: %s\n", fs::path(file).filename().string().c_str(), line, running ? running : "?", what.c_str());
+}
+
+std::string tests::tempPath(const std::string& name) {
+	const fs::path path = fs::temp_directory_path() / ("pnsim_test_" + name);
+	std::error_code ec;
+	fs::remove_all(path, ec);
+	return path.string();
+}
+
+int main(int argc, char** argv) {
+	logger_options log;
+	log.console = false; // the cases provoke errors on purpose (damaged files), they would drown the report
+	log.text_path = tests::tempPath("log.txt");
+	logger::configure(log);
+
+	const char* filter = (argc > 1) ? argv[1] : "";
+	int run = 0, failed = 0;
+	for (const tests::test_case& t : tests::registry()) {
+		if (std::strstr(t.name, filter) == nullptr) {
+			continue;
+		}
+		running = t.name;
+		const int before = failed_checks;
+		t.fn();
+		run++;
+		if (failed_checks != before) {
+			failed++;
+		}
+		std::printf("%s %s\n", (failed_checks == before) ? "ok  " : "FAIL", t.name);
+	}
+	logger::shutdown();
+
+	std::printf("%d of %d passed\n", run - failed, run);
+	return (failed == 0 && run > 0) ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+#include "test_harness.h"
+#include "restart.h"
+#include "integration.h"
+#include "constants.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+// Restart snapshots read back exactly, a resumed run carries on bit for bit, and a damaged file is refused
+
+static mathState closeBinary() {
+	// Tight enough that the PN terms are not negligible, so the steps go through the RK45 engine
+	const double m1 = 10.0, m2 = 8.0, r = 0.002;
+	const double v = std::sqrt(G * (m1 + m2) / r);
+	mathState s{ dmat43{ 0.0 }, m1, m2, 0.0 };
+	s.y[0] = dvec3(r * m2 / (m1 + m2), 0.0, 0.0);
+	s.y[1] = dvec3(0.0, 0.9 * v * m2 / (m1 + m2), 0.0);
+	s.y[2] = dvec3(-r * m1 / (m1 + m2), 0.0, 0.0);
+	s.y[3] = dvec3(0.0, -0.9 * v * m1 / (m1 + m2), 0.0);
+	return s;
+}
+
+static bool sameState(const dmat43& a, const dmat43& b) {
+	return std::memcmp(&a, &b, sizeof(dmat43)) == 0;
+}
+
+PNSIM_TEST(restart_round_trip) {
+	const std::string path = tests::tempPath("round_trip.snap");
+	restart_state rs;
+	rs.s = closeBinary();
+	rs.s.physics_time = 12.5;
+	rs.dydt = RK45_integration::derivatives(rs.s.y, rs.s.m1, rs.s.m2);
+	rs.dydt_valid = true;
+	rs.atol = 1e-9;
+	rs.rtol = 1e-11;
+	rs.timestep = 3.25e-5;
+	rs.newtonian = false;
+	rs.auto_tune = true;
+	rs.drift_target = 2e-8;
+	rs.steps = 123456789;
+	rs.energy0 = -1234.5;
+	rs.momentum0 = 0.75;
+	rs.tracer_seed = 42;
+	rs.tracer_count = 5000;
+	CHECK(writeRestart(path, rs));
+	CHECK(std::filesystem::file_size(path) == restart_file_size);
+
+	restart_state back;
+	CHECK(readRestart(path, back));
+	CHECK(sameState(back.s.y, rs.s.y) && sameState(back.dydt, rs.dydt));
+	CHECK(back.s.m1 == rs.s.m1 && back.s.m2 == rs.s.m2 && back.s.physics_time == rs.s.physics_time);
+	CHECK(back.dydt_valid && !back.newtonian && back.auto_tune);
+	CHECK(back.atol == rs.atol && back.rtol == rs.rtol && back.timestep == rs.timestep && back.drift_target == rs.drift_target);
+	CHECK(back.steps == rs.steps && back.energy0 == rs.energy0 && back.momentum0 == rs.momentum0);
+	CHECK(back.tracer_seed == rs.tracer_seed && back.tracer_count == rs.tracer_count);
+}
+
+PNSIM_TEST(restart_resumes_exactly) {
+	const double dt = 1e-4;
+	const int before = 20, after = 20;
+
+	// Uninterrupted
+	RK45_integration straight(1e-10, 1e-12, 1e-6);
+	mathState a = closeBinary();
+	for (int i = 0; i < before + after; i++) {
+		const integrate_result r = straight.step(a, dt);
+		CHECK(!r.crash_f);
+		a.y = r.state_y;
+		a.physics_time += r.covered;
+	}
+
+	// Stopped half way, through a snapshot file, into a new integrator
+	RK45_integration first(1e-10, 1e-12, 1e-6);
+	mathState b = closeBinary();
+	restart_state rs;
+	for (int i = 0; i < before; i++) {
+		const integrate_result r = first.step(b, dt);
+		b.y = r.state_y;
+		b.physics_time += r.covered;
+		rs.dydt = r.dydt;
+	}
+	rs.s = b;
+	rs.dydt_valid = true;
+	rs.atol = first.getAtol();
+	rs.rtol = first.getRtol();
+	rs.timestep = first.getTimestep();
+	const std::string path = tests::tempPath("resume.snap");
+	CHECK(writeRestart(path, rs));
+
+	restart_state back;
+	CHECK(readRestart(path, back));
+	RK45_integration second(back.atol, back.rtol, back.timestep);
+	mathState c = back.s;
+	second.seedDerivative(c, back.dydt);
+	for (int i = 0; i < after; i++) {
+		const integrate_result r = second.step(c, dt);
+		c.y = r.state_y;
+		c.physics_time += r.covered;
+	}
+	CHECK(sameState(a.y, c.y));
+	CHECK(a.physics_time == c.physics_time);
+}
+
+PNSIM_TEST(restart_rejects_damage) {
+	restart_state rs;
+	rs.s = closeBinary();
+	rs.steps = 99;
+	std::vector<unsigned char> file(restart_file_size);
+	encodeRestart(rs, file.data());
+
+	restart_state back;
+	CHECK(decodeRestart(file.data(), file.size(), back));
+	CHECK(back.steps == 99);
+
+	int accepted = 0;
+	for (size_t i = restart_header_size; i < file.size(); i++) { // any single flipped bit of the payload fails the checksum
+		std::vector<unsigned char> damaged = file;
+		damaged[i] ^= static_cast<unsigned char>(1u << (i % 8));
+		accepted += decodeRestart(damaged.data(), damaged.size(), back) ? 1 : 0;
+	}
+	CHECK(accepted == 0);
+	CHECK(!decodeRestart(file.data(), file.size() - 1, back)); // truncated
+	std::vector<unsigned char> not_snapshot = file;
+	not_snapshot[0] = 'X';
+	CHECK(!decodeRestart(not_snapshot.data(), not_snapshot.size(), back));
+
+	// And through a file, where a damaged snapshot must not be taken for a good one
+	const std::string path = tests::tempPath("damaged.snap");
+	CHECK(writeRestart(path, rs));
+	std::FILE* f = std::fopen(path.c_str(), "r+b");
+	CHECK(f != nullptr);
+	if (f) {
+		std::fseek(f, static_cast<long>(restart_header_size + 40), SEEK_SET);
+		const int byte = std::fgetc(f);
+		std::fseek(f, static_cast<long>(restart_header_size + 40), SEEK_SET);
+		std::fputc(byte ^ 0xff, f);
+		std::fclose(f);
+	}
+	CHECK(!readRestart(path, back));
+}
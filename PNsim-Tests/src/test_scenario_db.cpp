@@ -0,0 +1,93 @@
+#include "test_harness.h"
+#include "scenario_db.h"
+
+#include <filesystem>
+#include <string>
+
+// The scenario store through its journal and compactions, and back from disk
+
+static scenario named(const std::string& name, double m1, const std::string& tags = "") {
+	scenario s;
+	s.name = name;
+	s.tags = tags;
+	s.m1 = m1;
+	s.m2 = 1e-6;
+	s.y[0] = glm::dvec3(m1, 0.0, 0.0);
+	return s;
+}
+
+PNSIM_TEST(scenario_db_journal_and_compact) {
+	const std::string path = tests::tempPath("store.scen");
+	tests::tempPath("store.scen.idx");
+	scenario_db db;
+	CHECK(db.open(path));
+
+	// Fewer saves than a compaction waits for stay in the journal, no index file yet
+	for (int i = 0; i < 10; i++) {
+		CHECK(db.put(named("s" + std::to_string(100 + i), i, (i % 2) ? "odd" : "even")));
+	}
+	CHECK(db.size() == 10);
+	CHECK(db.withTag("odd").size() == 5);
+
+	// Enough to compact several times over
+	for (int i = 10; i < 200; i++) {
+		CHECK(db.put(named("s" + std::to_string(100 + i), i, (i % 2) ? "odd" : "even")));
+	}
+	CHECK(!db.compactionFailed());
+	CHECK(db.size() == 200);
+
+	// Replacing and removing, the old id still reads the version it was saved as
+	const std::vector<scenario_id> hits = db.search("s150");
+	CHECK(hits.size() == 1);
+	CHECK(db.put(named("s150", -1.0, "changed")));
+	CHECK(db.remove("s151"));
+	CHECK(!db.remove("s151"));
+	CHECK(db.size() == 199);
+	scenario s;
+	CHECK(!hits.empty() && db.load(hits.front(), s) && s.m1 == 50.0);
+	CHECK(db.load("s150", s) && s.m1 == -1.0);
+	CHECK(!db.contains("s151"));
+	CHECK(db.withTag("changed").size() == 1);
+
+	// Everything comes back from disk, journal included
+	db.close();
+	scenario_db again;
+	CHECK(again.open(path));
+	CHECK(again.size() == 199);
+	CHECK(again.load("s150", s) && s.m1 == -1.0 && s.y[0].x == -1.0);
+	CHECK(again.load("s299", s) && s.m1 == 199.0);
+	CHECK(!again.contains("s151"));
+	const std::vector<scenario_id> all = again.search("");
+	bool ordered = all.size() == 199;
+	for (size_t i = 1; i < all.size(); i++) {
+		ordered = ordered && again.name(all[i - 1]) < again.name(all[i]);
+	}
+	CHECK(ordered);
+}
+
+PNSIM_TEST(scenario_db_failed_compaction_keeps_the_journal) {
+	const std::string path = tests::tempPath("blocked.scen");
+	tests::tempPath("blocked.scen.idx");
+	const std::string tmp = tests::tempPath("blocked.scen.idx.tmp");
+	scenario_db db;
+	CHECK(db.open(path));
+	std::filesystem::create_directory(tmp); // the new index cannot be written
+
+	for (int i = 0; i < 40; i++) {
+		CHECK(db.put(named("n" + std::to_string(i), i))); // stored, even though the compaction fails
+	}
+	CHECK(db.compactionFailed());
+	CHECK(db.size() == 40);
+	scenario s;
+	CHECK(db.load("n17", s) && s.m1 == 17.0);
+
+	std::filesystem::remove(tmp);
+	CHECK(db.put(named("last", 40.0)));
+	CHECK(!db.compactionFailed());
+	db.close();
+
+	scenario_db again;
+	CHECK(again.open(path));
+	CHECK(again.size() == 41);
+	CHECK(again.load("n39", s) && s.m1 == 39.0);
+}
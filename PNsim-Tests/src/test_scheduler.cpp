@@ -0,0 +1,74 @@
+#include "test_harness.h"
+#include "scheduler.h"
+
+// Fixed step scheduler on the virtual clock, where sleeping jumps straight to the deadline, so every count below is exact
+
+PNSIM_TEST(scheduler_fixed_step_count) {
+	fixed_step_scheduler s(100.0, 5, clock_mode::virtual_clock);
+	CHECK(s.begin() == 0); // the first deadline is a period away
+
+	int steps = 0;
+	for (int i = 0; i < 1000; i++) {
+		s.sleepUntilNext();
+		steps += s.begin();
+	}
+	const scheduler_stats stats = s.getStats();
+	CHECK(steps == 1000);
+	CHECK(stats.steps == 1000);
+	CHECK(stats.overruns == 0);
+	CHECK(stats.dropped == 0);
+	CHECK(stats.max_late == 0.0);
+	CHECK_NEAR(s.now(), 10.0, 1e-12);
+	CHECK_NEAR(s.lastDeadline(), s.now(), 1e-12); // on the grid, nothing accumulated
+}
+
+PNSIM_TEST(scheduler_catches_up) {
+	fixed_step_scheduler s(100.0, 5, clock_mode::virtual_clock);
+	s.sleepUntilNext();
+	CHECK(s.begin() == 1);
+
+	s.advance(0.035); // the step ran three and a half periods long
+	CHECK(s.begin() == 3); // the two deadlines it missed and the one it woke for
+	CHECK(s.getStats().overruns == 1);
+	CHECK_NEAR(s.getStats().max_late, 0.025, 1e-9);
+
+	s.sleepUntilNext(); // back on the grid, half a period later
+	CHECK(s.begin() == 1);
+	CHECK_NEAR(s.now(), 0.05, 1e-12);
+	CHECK(s.getStats().steps == 5);
+	CHECK(s.getStats().dropped == 0);
+}
+
+PNSIM_TEST(scheduler_caps_the_spiral) {
+	fixed_step_scheduler s(100.0, 5, clock_mode::virtual_clock);
+	s.sleepUntilNext();
+	CHECK(s.begin() == 1);
+
+	s.advance(1.0); // a hundred periods behind
+	CHECK(s.begin() == 5); // only the catch-up budget is handed out
+	scheduler_stats stats = s.getStats();
+	CHECK(stats.dropped == 95);
+	CHECK_NEAR(stats.drift, 0.95, 1e-9);
+
+	for (int i = 0; i < 10; i++) { // and the rate is back to one step a period, not paying the backlog off
+		s.sleepUntilNext();
+		CHECK(s.begin() == 1);
+	}
+	stats = s.getStats();
+	CHECK(stats.steps == 16);
+	CHECK(stats.dropped == 95);
+	CHECK(stats.overruns == 1);
+}
+
+PNSIM_TEST(scheduler_reset_skips_a_pause) {
+	fixed_step_scheduler s(60.0, 4, clock_mode::virtual_clock);
+	s.sleepUntilNext();
+	CHECK(s.begin() == 1);
+
+	s.advance(5.0); // paused
+	s.reset();
+	CHECK(s.begin() == 0);
+	s.sleepUntilNext();
+	CHECK(s.begin() == 1);
+	CHECK(s.getStats().dropped == 0);
+}
@@ -0,0 +1,83 @@
+#include "test_harness.h"
+#include "text_export.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+
+// Numbers printed by text_export read back bit for bit, one at a time and through a whole CSV file
+
+static bool sameBits(double a, double b) {
+	return std::memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+PNSIM_TEST(csv_numbers_round_trip) {
+	std::mt19937_64 rng(12345);
+	std::uniform_int_distribution<std::uint64_t> bits;
+	char text[text_export::max_number + 1];
+	int checked = 0;
+	for (int i = 0; i < 100000; i++) {
+		const std::uint64_t b = bits(rng);
+		double value;
+		std::memcpy(&value, &b, sizeof(double));
+		if (!std::isfinite(value)) {
+			continue;
+		}
+		char* end = text_export::appendNumber(text, value);
+		CHECK(end - text <= static_cast<std::ptrdiff_t>(text_export::max_number));
+		*end = '\0';
+		CHECK(sameBits(std::strtod(text, nullptr), value));
+		checked++;
+	}
+	CHECK(checked > 90000);
+
+	const double edges[] = { 0.0, -0.0, 1.0, -2.5, 1e300, 5e-324, std::numeric_limits<double>::max(), -std::numeric_limits<double>::min(), 0.1, 1.0 / 3.0 };
+	for (double value : edges) {
+		*text_export::appendNumber(text, value) = '\0';
+		CHECK(sameBits(std::strtod(text, nullptr), value));
+	}
+	*text_export::appendNumber(text, 42.0) = '\0';
+	CHECK(std::strcmp(text, "42") == 0); // integral values without a fraction
+}
+
+PNSIM_TEST(csv_file_round_trip) {
+	const std::string path = tests::tempPath("round_trip.csv");
+	const size_t columns = 4, rows = 20000; // several blocks, the last one partly filled
+	std::vector<double> values(columns * rows);
+	std::mt19937_64 rng(777);
+	std::normal_distribution<double> normal(0.0, 1e3);
+	for (double& v : values) {
+		v = normal(rng);
+	}
+
+	csv_options options;
+	options.block_rows = 1024;
+	csv_writer writer(options);
+	CHECK(writer.open(path, "a,b,c,d"));
+	for (size_t r = 0; r < rows; r++) {
+		writer.push(&values[r * columns]);
+	}
+	CHECK(writer.close());
+	CHECK(writer.rows() == rows);
+
+	std::ifstream in(path);
+	std::string line;
+	CHECK(std::getline(in, line) && line == "a,b,c,d");
+	size_t r = 0, mismatches = 0;
+	while (std::getline(in, line) && r < rows) {
+		const char* p = line.c_str();
+		for (size_t c = 0; c < columns; c++) {
+			char* end = nullptr;
+			mismatches += sameBits(std::strtod(p, &end), values[r * columns + c]) ? 0 : 1;
+			p = (*end == ',') ? end + 1 : end;
+		}
+		r++;
+	}
+	CHECK(r == rows);
+	CHECK(mismatches == 0);
+}
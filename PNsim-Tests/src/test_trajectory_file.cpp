@@ -0,0 +1,95 @@
+#include "test_harness.h"
+#include "trajectory_file.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+// Trajectory files decode to exactly the samples that were written, and a file cut short keeps its complete chunks
+
+static trajectory_sample sampleAt(std::uint64_t i) {
+	const double t = 0.01 * static_cast<double>(i);
+	trajectory_sample s;
+	s.t = t;
+	s.y[0] = dvec3(std::cos(t), std::sin(t), 1e-3 * std::sin(3.0 * t));
+	s.y[1] = dvec3(-std::sin(t), std::cos(t), 3e-3 * std::cos(3.0 * t));
+	s.y[2] = -3e-6 * s.y[0];
+	s.y[3] = -3e-6 * s.y[1];
+	s.m1 = 1.0;
+	s.m2 = (i < 700) ? 3e-6 : 4e-6; // a mass edit half way through
+	return s;
+}
+
+static bool sameSample(const trajectory_sample& a, const trajectory_sample& b) {
+	return a.t == b.t && a.m1 == b.m1 && a.m2 == b.m2 && std::memcmp(&a.y, &b.y, sizeof(dmat43)) == 0;
+}
+
+PNSIM_TEST(trajectory_round_trip) {
+	const std::string path = tests::tempPath("round_trip.traj");
+	const std::uint64_t rows = 1500; // five full chunks and a partial one
+	trajectory_writer writer(256, true);
+	CHECK(writer.open(path));
+	for (std::uint64_t i = 0; i < rows; i++) {
+		CHECK(writer.push(sampleAt(i)));
+	}
+	CHECK(writer.close());
+	CHECK(writer.dropped() == 0);
+	CHECK(writer.written() == rows);
+	CHECK(writer.bytes() < rows * trajectory_columns * sizeof(double)); // it did compress
+
+	trajectory_reader reader;
+	CHECK(reader.open(path));
+	CHECK(!reader.recovered());
+	CHECK(reader.rows() == rows);
+	CHECK(reader.chunks() == 6);
+
+	std::uint64_t row = 0, mismatches = 0;
+	std::vector<trajectory_sample> chunk;
+	for (size_t c = 0; c < reader.chunks(); c++) {
+		CHECK(reader.readChunk(c, chunk));
+		for (const trajectory_sample& s : chunk) {
+			mismatches += sameSample(s, sampleAt(row)) ? 0 : 1;
+			row++;
+		}
+	}
+	CHECK(row == rows);
+	CHECK(mismatches == 0);
+
+	trajectory_sample s;
+	CHECK(reader.sampleAt(7.005, s)); // between rows 700 and 701
+	CHECK(sameSample(s, sampleAt(700)));
+
+	std::vector<double> column;
+	CHECK(reader.readColumn(2, 14, column)); // m2 alone
+	CHECK(column.size() == 256 && column.front() == 3e-6 && column.back() == 4e-6);
+	reader.close();
+}
+
+PNSIM_TEST(trajectory_cut_short) {
+	const std::string path = tests::tempPath("cut.traj");
+	trajectory_writer writer(256, true);
+	CHECK(writer.open(path));
+	for (std::uint64_t i = 0; i < 1024; i++) {
+		writer.push(sampleAt(i));
+	}
+	CHECK(writer.close());
+
+	std::uint64_t chunk_end = 0;
+	{
+		trajectory_reader reader;
+		CHECK(reader.open(path));
+		CHECK(reader.chunks() == 4);
+		chunk_end = reader.chunkIndex()[2].offset + reader.chunkIndex()[2].bytes;
+	}
+	std::filesystem::resize_file(path, chunk_end + 100); // a crash part way through the fourth chunk, no index
+	trajectory_reader reader;
+	CHECK(reader.open(path));
+	CHECK(reader.recovered());
+	CHECK(reader.chunks() == 3);
+	CHECK(reader.rows() == 768);
+	std::vector<trajectory_sample> chunk;
+	CHECK(reader.readChunk(2, chunk));
+	CHECK(!chunk.empty() && sameSample(chunk.back(), sampleAt(767)));
+}